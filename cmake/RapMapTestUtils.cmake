@@ -0,0 +1,103 @@
+# Helpers shared by the quasi-mapping tests, which are run with
+# "cmake -P" from the build directory (where rapmap is), with TOPLEVEL_DIR
+# set to the top of the source tree.  The sample transcripts and reads are
+# read from ${TOPLEVEL_DIR}/sample_data, but every index and SAM file a
+# test writes goes to a directory of its own (named after its script)
+# under ${CMAKE_BINARY_DIR}/quasi_tests, so that tests run in parallel
+# (ctest -j) never touch each other's files.
+
+set(RAPMAP_SAMPLE_DIR ${TOPLEVEL_DIR}/sample_data)
+set(RAPMAP_TEST_ROOT ${CMAKE_BINARY_DIR}/quasi_tests)
+get_filename_component(RAPMAP_TEST_NAME ${CMAKE_SCRIPT_MODE_FILE} NAME_WE)
+set(RAPMAP_TEST_DIR ${RAPMAP_TEST_ROOT}/${RAPMAP_TEST_NAME})
+# Don't let the output of an earlier run stand in for this one
+file(REMOVE_RECURSE ${RAPMAP_TEST_DIR})
+file(MAKE_DIRECTORY ${RAPMAP_TEST_DIR})
+
+# The plain index, and its mapping, that the other tests compare with;
+# they are made once, by TestQuasiMapPlain.cmake (the setup test of the
+# rapmap_plain fixture), and only ever read by the other tests.
+set(RAPMAP_PLAIN_DIR ${RAPMAP_TEST_ROOT}/TestQuasiMapPlain)
+set(RAPMAP_PLAIN_INDEX ${RAPMAP_PLAIN_DIR}/sample_quasi_index_plain)
+set(RAPMAP_PLAIN_SAM ${RAPMAP_PLAIN_DIR}/sample_quasi_map_plain.sam)
+
+# Build sample_quasi_index_<NAME> from the sample transcripts, passing the
+# remaining arguments to quasiindex.
+function(rapmap_build_index NAME)
+    set(QUASI_INDEX_CMD ${CMAKE_BINARY_DIR}/rapmap quasiindex ${ARGN} -t ${RAPMAP_SAMPLE_DIR}/transcripts.fasta -i sample_quasi_index_${NAME})
+    execute_process(COMMAND ${QUASI_INDEX_CMD}
+                    WORKING_DIRECTORY ${RAPMAP_TEST_DIR}
+                    RESULT_VARIABLE QUASI_INDEX_RESULT
+                    )
+    if (QUASI_INDEX_RESULT)
+        message(FATAL_ERROR "Error running ${QUASI_INDEX_CMD}")
+    endif()
+endfunction()
+
+# Set OUT_VAR to the records of the SAM file SAM_FILE (not its header,
+# which records the command line).
+function(rapmap_read_records SAM_FILE OUT_VAR)
+    file(STRINGS ${SAM_FILE} SAM_LINES REGEX "^[^@]")
+    set(${OUT_VAR} "${SAM_LINES}" PARENT_SCOPE)
+endfunction()
+
+# Map the sample read pairs (with one thread, so that the records come out
+# in a fixed order) against sample_quasi_index_<INDEX_NAME> into
+# sample_quasi_map_<NAME>.sam, passing the remaining arguments to
+# quasimap, and set OUT_VAR to the records of the SAM file.
+function(rapmap_map_reads INDEX_NAME NAME OUT_VAR)
+    set(SAM_FILE ${RAPMAP_TEST_DIR}/sample_quasi_map_${NAME}.sam)
+    set(MAP_COMMAND ${CMAKE_BINARY_DIR}/rapmap quasimap -t 1 -i sample_quasi_index_${INDEX_NAME} ${ARGN} -1 ${RAPMAP_SAMPLE_DIR}/reads_1.fastq -2 ${RAPMAP_SAMPLE_DIR}/reads_2.fastq -o ${SAM_FILE})
+    execute_process(COMMAND ${MAP_COMMAND}
+                    WORKING_DIRECTORY ${RAPMAP_TEST_DIR}
+                    RESULT_VARIABLE QUASI_MAP_RESULT
+                    )
+    if (QUASI_MAP_RESULT)
+        message(FATAL_ERROR "Error running ${MAP_COMMAND}")
+    endif()
+    if (NOT EXISTS ${SAM_FILE})
+        message(FATAL_ERROR "${MAP_COMMAND} produced no output")
+    endif()
+
+    rapmap_read_records(${SAM_FILE} SAM_RECORDS)
+    set(${OUT_VAR} "${SAM_RECORDS}" PARENT_SCOPE)
+endfunction()
+
+# Build sample_quasi_index_<NAME> with the quasiindex flags given as the
+# remaining arguments, map the sample reads against it, and set OUT_VAR to
+# the records of the mapping.
+function(rapmap_map_variant NAME OUT_VAR)
+    rapmap_build_index(${NAME} ${ARGN})
+    rapmap_map_reads(${NAME} ${NAME} SAM_RECORDS)
+    set(${OUT_VAR} "${SAM_RECORDS}" PARENT_SCOPE)
+endfunction()
+
+# Fail, naming DESCRIPTION, unless the mapping records in the variables
+# named EXPECTED_VAR and ACTUAL_VAR are identical (and not empty; every
+# sample read is drawn from the transcripts).
+function(rapmap_expect_same_records EXPECTED_VAR ACTUAL_VAR DESCRIPTION)
+    if ("${${EXPECTED_VAR}}" STREQUAL "")
+        message(FATAL_ERROR "RapMap (quasi) produced no mappings to compare ${DESCRIPTION} against")
+    endif()
+    if (NOT "${${EXPECTED_VAR}}" STREQUAL "${${ACTUAL_VAR}}")
+        message(FATAL_ERROR "RapMap (quasi, ${DESCRIPTION}) produced different mappings than the index it is compared with")
+    endif()
+endfunction()
+
+# Set OUT_VAR to the records of the mapping against the plain index
+function(rapmap_plain_records OUT_VAR)
+    if (NOT EXISTS ${RAPMAP_PLAIN_SAM})
+        message(FATAL_ERROR "${RAPMAP_PLAIN_SAM} is missing; it is made by the quasi_map_test_plain test")
+    endif()
+    rapmap_read_records(${RAPMAP_PLAIN_SAM} SAM_RECORDS)
+    set(${OUT_VAR} "${SAM_RECORDS}" PARENT_SCOPE)
+endfunction()
+
+# Build sample_quasi_index_<NAME> with the quasiindex flags given as the
+# remaining arguments, map the sample reads against it, and fail, naming
+# DESCRIPTION, unless the mappings are those of the plain index.
+function(rapmap_expect_same_as_plain NAME DESCRIPTION)
+    rapmap_plain_records(SAM_RECORDS_plain)
+    rapmap_map_variant(${NAME} SAM_RECORDS_variant ${ARGN})
+    rapmap_expect_same_records(SAM_RECORDS_plain SAM_RECORDS_variant "${DESCRIPTION}")
+endfunction()
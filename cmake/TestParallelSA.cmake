@@ -0,0 +1,17 @@
+# Build the suffix array of the sample transcripts with divsufsort (the
+# default, whatever -x is) and with the parallel sort (--parallelSA);
+# sa.bin must be byte-for-byte identical.
+include(${CMAKE_CURRENT_LIST_DIR}/RapMapTestUtils.cmake)
+
+rapmap_build_index(sa_divsufsort -x 4)
+rapmap_build_index(sa_parallel -x 4 --parallelSA)
+
+execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files
+                        sample_quasi_index_sa_divsufsort/sa.bin sample_quasi_index_sa_parallel/sa.bin
+                WORKING_DIRECTORY ${RAPMAP_TEST_DIR}
+                RESULT_VARIABLE COMPARE_RESULT
+                )
+if (COMPARE_RESULT)
+    message(FATAL_ERROR "The suffix arrays built by divsufsort and by the parallel sort differ")
+endif()
+message("RapMap (quasi, parallel suffix array) ran successfully")
@@ -0,0 +1,86 @@
+# Build, bucket by bucket, the suffix array of a transcriptome big enough
+# (600,000 bases) that a tight --bucketMemory cap splits it into many
+# chunks.  The suffix array must be that of divsufsort, and the resident
+# memory of the indexer must stay under the cap while it is built (the
+# indexer reports its peak; on Linux that is the peak of the build alone,
+# elsewhere it counts all of indexing, so it isn't checked there).
+include(${CMAKE_CURRENT_LIST_DIR}/RapMapTestUtils.cmake)
+
+# 400 transcripts, each made of 3 of 40 random 500-base genes, so that
+# there are many more suffixes than distinct k-mers (and the hash is
+# small).  No two transcripts start with the same 2 genes: sorting the
+# suffixes of a bucket costs as much as they share, and a long shared
+# sequence would make it very slow (see buildSAAndHashByBuckets).
+string(RANDOM LENGTH 500 ALPHABET ACGT RANDOM_SEED 20180101 GENE_0)
+foreach (GENE RANGE 1 39)
+    string(RANDOM LENGTH 500 ALPHABET ACGT GENE_${GENE})
+endforeach()
+set(TXP_FASTA ${RAPMAP_TEST_DIR}/repeats.fasta)
+set(TXP_RECORDS "")
+foreach (TXP RANGE 399)
+    math(EXPR G0 "${TXP} % 40")
+    math(EXPR G1 "(${G0} + 1 + ${TXP} / 40) % 40")
+    math(EXPR G2 "(${TXP} * 7 + 3) % 40")
+    set(TXP_RECORDS "${TXP_RECORDS}>txp${TXP}\n${GENE_${G0}}${GENE_${G1}}${GENE_${G2}}\n")
+endforeach()
+file(WRITE ${TXP_FASTA} "${TXP_RECORDS}")
+
+# Build repeats_index_<NAME> from the transcripts, bucket by bucket under
+# a cap of CAP_MB megabytes if that isn't empty (and with divsufsort if it
+# is), and set OUT_VAR to what the indexer reports
+function(rapmap_build_repeats_index NAME CAP_MB OUT_VAR)
+    set(QUASI_INDEX_CMD ${CMAKE_BINARY_DIR}/rapmap quasiindex -x 1 -t ${TXP_FASTA} -i repeats_index_${NAME})
+    if (CAP_MB)
+        list(APPEND QUASI_INDEX_CMD --bucketMemory ${CAP_MB})
+    endif()
+    execute_process(COMMAND ${QUASI_INDEX_CMD}
+                    WORKING_DIRECTORY ${RAPMAP_TEST_DIR}
+                    RESULT_VARIABLE QUASI_INDEX_RESULT
+                    OUTPUT_VARIABLE QUASI_INDEX_OUT
+                    ERROR_VARIABLE QUASI_INDEX_ERR
+                    )
+    if (QUASI_INDEX_RESULT)
+        message(FATAL_ERROR "Error running ${QUASI_INDEX_CMD}:\n${QUASI_INDEX_ERR}")
+    endif()
+    set(${OUT_VAR} "${QUASI_INDEX_OUT}${QUASI_INDEX_ERR}" PARENT_SCOPE)
+endfunction()
+
+rapmap_build_repeats_index(divsufsort "" DIVSUFSORT_LOG)
+
+# Learn how much the indexer holds before the bucketed build starts (the
+# binary, the text, the transcript names, ...) under a loose cap, then
+# leave it 3 MB more than that
+rapmap_build_repeats_index(loose 4096 LOOSE_LOG)
+if (NOT LOOSE_LOG MATCHES "resident memory before the bucketed build: ([0-9]+) kB")
+    message(FATAL_ERROR "The indexer didn't report its memory before the bucketed build:\n${LOOSE_LOG}")
+endif()
+math(EXPR CAP_MB "(${CMAKE_MATCH_1} + 1023) / 1024 + 3")
+
+rapmap_build_repeats_index(tight ${CAP_MB} TIGHT_LOG)
+if (NOT TIGHT_LOG MATCHES "in ([0-9]+) chunks")
+    message(FATAL_ERROR "The indexer didn't report how many chunks it sorted:\n${TIGHT_LOG}")
+endif()
+set(NUM_CHUNKS ${CMAKE_MATCH_1})
+if (NUM_CHUNKS LESS 5)
+    message(FATAL_ERROR "--bucketMemory ${CAP_MB} split the suffix array into only ${NUM_CHUNKS} chunks")
+endif()
+if (NOT TIGHT_LOG MATCHES "peak resident memory while building: ([0-9]+) kB")
+    message(FATAL_ERROR "The indexer didn't report its peak memory:\n${TIGHT_LOG}")
+endif()
+set(PEAK_KB ${CMAKE_MATCH_1})
+math(EXPR CAP_KB "${CAP_MB} * 1024")
+if (CMAKE_HOST_SYSTEM_NAME STREQUAL "Linux" AND PEAK_KB GREATER CAP_KB)
+    message(FATAL_ERROR "The indexer took ${PEAK_KB} kB under --bucketMemory ${CAP_MB}")
+endif()
+
+foreach (NAME loose tight)
+    execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files
+                            repeats_index_divsufsort/sa.bin repeats_index_${NAME}/sa.bin
+                    WORKING_DIRECTORY ${RAPMAP_TEST_DIR}
+                    RESULT_VARIABLE COMPARE_RESULT
+                    )
+    if (COMPARE_RESULT)
+        message(FATAL_ERROR "The suffix array built under --bucketMemory (${NAME}) differs from divsufsort's")
+    endif()
+endforeach()
+message("RapMap (quasi, --bucketMemory, ${NUM_CHUNKS} chunks in ${PEAK_KB} kB of ${CAP_KB} kB) ran successfully")
@@ -0,0 +1,46 @@
+# Map every read twice (a file holding two copies of the sample reads, with
+# a single thread), and count the heap allocations made while mapping the
+# second copy: by then the per-thread workspace has grown as large as
+# these reads need, so mapping them must not allocate at all.  The
+# counting is done by rapmap_count_allocs (built just before this test, by
+# quasi_map_build_count_allocs), which counts malloc / calloc / realloc
+# as well as operator new.
+include(${CMAKE_CURRENT_LIST_DIR}/RapMapTestUtils.cmake)
+
+rapmap_build_index(allocs)
+
+foreach(MATE 1 2)
+    file(READ ${RAPMAP_SAMPLE_DIR}/reads_${MATE}.fastq READS)
+    file(WRITE ${RAPMAP_TEST_DIR}/reads_twice_${MATE}.fastq "${READS}${READS}")
+endforeach()
+
+# The number of reads (pairs) in one copy; the first copy is the warm-up
+file(STRINGS ${RAPMAP_SAMPLE_DIR}/reads_1.fastq READ_LINES)
+list(LENGTH READ_LINES NUM_LINES)
+math(EXPR NUM_READS "${NUM_LINES} / 4")
+
+foreach(MODE paired single)
+    if (MODE STREQUAL "paired")
+        set(READ_FLAGS -1 reads_twice_1.fastq -2 reads_twice_2.fastq)
+    else()
+        set(READ_FLAGS -r reads_twice_1.fastq)
+    endif()
+
+    set(MAP_COMMAND ${CMAKE_BINARY_DIR}/rapmap_count_allocs quasimap -t 1 -i sample_quasi_index_allocs ${READ_FLAGS} --countAllocs ${NUM_READS} -o sample_quasi_map_allocs_${MODE}.sam)
+    execute_process(COMMAND ${MAP_COMMAND}
+                    WORKING_DIRECTORY ${RAPMAP_TEST_DIR}
+                    RESULT_VARIABLE QUASI_MAP_RESULT
+                    ERROR_VARIABLE QUASI_MAP_LOG
+                    )
+    if (QUASI_MAP_RESULT)
+        message(FATAL_ERROR "Error running ${MAP_COMMAND}")
+    endif()
+
+    if (NOT QUASI_MAP_LOG MATCHES "heap allocations while mapping reads \\(after the first [0-9]+ reads of each thread\\): ([0-9]+)")
+        message(FATAL_ERROR "RapMap (quasi, ${MODE}) didn't report its heap allocations")
+    endif()
+    if (NOT CMAKE_MATCH_1 EQUAL 0)
+        message(FATAL_ERROR "RapMap (quasi, ${MODE}) made ${CMAKE_MATCH_1} heap allocations while mapping reads it had already seen")
+    endif()
+endforeach()
+message("RapMap (quasi, allocations) ran successfully")
@@ -0,0 +1,16 @@
+# Build the sample index normally and bucket by bucket under a memory cap;
+# the suffix arrays must be byte-for-byte identical, and the mappings the
+# same.
+include(${CMAKE_CURRENT_LIST_DIR}/RapMapTestUtils.cmake)
+
+rapmap_expect_same_as_plain(bucket_memory "--bucketMemory" --bucketMemory 256)
+
+execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files
+                        ${RAPMAP_PLAIN_INDEX}/sa.bin sample_quasi_index_bucket_memory/sa.bin
+                WORKING_DIRECTORY ${RAPMAP_TEST_DIR}
+                RESULT_VARIABLE COMPARE_RESULT
+                )
+if (COMPARE_RESULT)
+    message(FATAL_ERROR "The suffix array built under --bucketMemory differs")
+endif()
+message("RapMap (quasi, --bucketMemory) ran successfully")
@@ -0,0 +1,10 @@
+# Map the same reads against a plain index and against indices whose hash
+# is keyed on canonical k-mers (built in one go, and bucket by bucket
+# under a memory cap); each lookup then answers for both strands, but the
+# mappings must be identical.
+include(${CMAKE_CURRENT_LIST_DIR}/RapMapTestUtils.cmake)
+
+rapmap_expect_same_as_plain(canonical "canonical hash" --canonical)
+rapmap_expect_same_as_plain(canonical_bucket_memory "canonical hash, --bucketMemory"
+                            --canonical --bucketMemory 256)
+message("RapMap (quasi, canonical hash) ran successfully")
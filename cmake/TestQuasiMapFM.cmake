@@ -0,0 +1,8 @@
+# Map the same reads against a plain (suffix array) index and against an
+# FM-index of the sample transcripts; the FM-index plugs into the same
+# collector, and its searcher finds the same matches and extensions, so
+# the mappings must be identical.
+include(${CMAKE_CURRENT_LIST_DIR}/RapMapTestUtils.cmake)
+
+rapmap_expect_same_as_plain(fm "FM-index" --fm)
+message("RapMap (quasi, FM-index) ran successfully")
@@ -0,0 +1,13 @@
+# Map the same reads against a plain index and against indices with a
+# k-mer filter in front of the hash (regular, canonical, built bucket by
+# bucket and perfect); the filter only turns away k-mers that aren't in the hash,
+# so the mappings must be identical.
+include(${CMAKE_CURRENT_LIST_DIR}/RapMapTestUtils.cmake)
+
+rapmap_expect_same_as_plain(filter "k-mer filter" --filterBits 16)
+rapmap_expect_same_as_plain(filter_canonical "k-mer filter, canonical hash"
+                            --filterBits 16 --canonical)
+rapmap_expect_same_as_plain(filter_bucket_memory "k-mer filter, --bucketMemory"
+                            --filterBits 8 --bucketMemory 256)
+rapmap_expect_same_as_plain(filter_perfect "k-mer filter, perfect hash" --filterBits 16 -p)
+message("RapMap (quasi, k-mer filter) ran successfully")
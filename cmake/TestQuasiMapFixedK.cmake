@@ -0,0 +1,14 @@
+# For each k that the mapper has specialized mapping loops for (see
+# mapReadsWithK in RapMapSAMapper.cpp), build an index of the sample
+# transcripts with that k and map the same reads with the specialized
+# loops and with those that take k at run time (--runtimeK); the mappings
+# must be identical.
+include(${CMAKE_CURRENT_LIST_DIR}/RapMapTestUtils.cmake)
+
+foreach(K 19 23 25 31)
+    rapmap_build_index(k${K} -k ${K})
+    rapmap_map_reads(k${K} k${K}_fixed SAM_RECORDS_fixed)
+    rapmap_map_reads(k${K} k${K}_runtime SAM_RECORDS_runtime --runtimeK)
+    rapmap_expect_same_records(SAM_RECORDS_runtime SAM_RECORDS_fixed "k = ${K}, specialized")
+endforeach()
+message("RapMap (quasi, fixed k) ran successfully")
@@ -0,0 +1,7 @@
+# Map the same reads against a plain index and against one stored in the
+# single, page-aligned file that the mapper mmaps (flat.bin); the
+# mappings must be identical.
+include(${CMAKE_CURRENT_LIST_DIR}/RapMapTestUtils.cmake)
+
+rapmap_expect_same_as_plain(flat "flat layout" --flat)
+message("RapMap (quasi, flat layout) ran successfully")
@@ -0,0 +1,18 @@
+# Map the same reads against a plain index and against indices with the
+# LCP-LR arrays and LCP range-minimum structure (with a byte and a 2-bit
+# packed text), with the child table, and with the suffix fingerprints
+# (alone, and along with the child table and a packed text), and with
+# samples of the k-mer intervals (of at least 32 rows, so that the small
+# sample data has some); the searcher takes a different path for both
+# the MMP and the LCE queries with these, but the mappings must be
+# identical.
+include(${CMAKE_CURRENT_LIST_DIR}/RapMapTestUtils.cmake)
+
+rapmap_expect_same_as_plain(lcp "LCP" --lcp)
+rapmap_expect_same_as_plain(lcp_packed "LCP, packed text" --lcp --packedText)
+rapmap_expect_same_as_plain(child_table "child table" --childTable)
+rapmap_expect_same_as_plain(fingerprints "fingerprints" --fingerprints)
+rapmap_expect_same_as_plain(fingerprints_child_table "fingerprints, child table, packed text"
+                            --fingerprints --childTable --packedText)
+rapmap_expect_same_as_plain(sampled_search "sampled search" --sampledSearch 32)
+message("RapMap (quasi, LCP) ran successfully")
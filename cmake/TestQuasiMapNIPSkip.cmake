@@ -0,0 +1,104 @@
+# Map two reads whose mappings depend on how far the collector skips after
+# a maximal match (by the LCE of the suffixes it matched; see getSAHits_ in
+# SACollector.hpp), against small transcriptomes built for them, with each
+# of the searchers that answer LCE queries differently.  The reads must map
+# to exactly the transcripts that they share every k-mer skipped over with.
+include(${CMAKE_CURRENT_LIST_DIR}/RapMapTestUtils.cmake)
+
+# Set OUT_VAR to a base other than the one at POS in SEQ
+function(rapmap_other_base SEQ POS OUT_VAR)
+    string(SUBSTRING "${SEQ}" ${POS} 1 BASE)
+    if (BASE STREQUAL "A")
+        set(${OUT_VAR} C PARENT_SCOPE)
+    else()
+        set(${OUT_VAR} A PARENT_SCOPE)
+    endif()
+endfunction()
+
+string(RANDOM LENGTH 31 ALPHABET ACGT RANDOM_SEED 20180312 PREFIX_1)
+string(RANDOM LENGTH 200 ALPHABET ACGT SEQ_Z)
+string(RANDOM LENGTH 30 ALPHABET ACGT SEQ_Y)
+string(RANDOM LENGTH 31 ALPHABET ACGT PREFIX_2)
+string(RANDOM LENGTH 200 ALPHABET ACGT SEQ_W)
+string(RANDOM LENGTH 100 ALPHABET ACGT SEQ_V)
+string(RANDOM LENGTH 50 ALPHABET ACGT SEQ_U1)
+string(RANDOM LENGTH 50 ALPHABET ACGT SEQ_U2)
+
+# read_lce starts with a k-mer of nip_a and nip_b, which then differ at
+# once but share the 170 bases from their 63rd on.  The LCE of the two
+# must be 31 (so the read is next looked up from its 33rd base, which is
+# in nip_a alone), not 69 (what comparing them only from their 63rd base
+# gives, which would skip every k-mer of the read but the first, as the
+# rest all hold its mismatch with nip_a at base 70).
+set(TXP_A "${PREFIX_1}A${SEQ_Z}")
+string(SUBSTRING "${SEQ_Z}" 30 170 SEQ_Z_TAIL)
+set(TXP_B "${PREFIX_1}C${SEQ_Y}${SEQ_Z_TAIL}")
+string(SUBSTRING "${SEQ_Z}" 0 37 SEQ_Z_HEAD)
+rapmap_other_base("${SEQ_Z}" 37 BASE_Z)
+string(SUBSTRING "${SEQ_Z}" 38 30 SEQ_Z_MID)
+set(READ_LCE "${PREFIX_1}G${SEQ_Z_HEAD}${BASE_Z}${SEQ_Z_MID}")
+
+# read_cap starts with a k-mer of nip_s1 and nip_s2, which share their
+# first 132 bases; the read leaves them at base 32, and has a mismatch
+# with both at base 61.  The LCE of the two may reach the end of the read
+# (so the collector next looks up its last k-mer, which they have), and
+# mustn't stop at the end of the read less the first match (which would
+# next look up the k-mer at base 40, found only in nip_s3, which holds the
+# read's last 61 bases, and leave the read with no transcript in common
+# with all of its matches).
+set(TXP_S1 "${PREFIX_2}T${SEQ_W}")
+string(SUBSTRING "${SEQ_W}" 0 100 SEQ_W_HEAD)
+set(TXP_S2 "${PREFIX_2}T${SEQ_W_HEAD}${SEQ_V}")
+string(SUBSTRING "${SEQ_W}" 0 28 SEQ_W_START)
+rapmap_other_base("${SEQ_W}" 28 BASE_W)
+string(SUBSTRING "${SEQ_W}" 29 39 SEQ_W_MID)
+set(READ_CAP "${PREFIX_2}G${SEQ_W_START}${BASE_W}${SEQ_W_MID}")
+string(SUBSTRING "${READ_CAP}" 39 61 READ_CAP_TAIL)
+set(TXP_S3 "${SEQ_U1}${READ_CAP_TAIL}${SEQ_U2}")
+
+set(TXP_FASTA ${RAPMAP_TEST_DIR}/nip_skip.fasta)
+file(WRITE ${TXP_FASTA} ">nip_a\n${TXP_A}\n>nip_b\n${TXP_B}\n>nip_s1\n${TXP_S1}\n>nip_s2\n${TXP_S2}\n>nip_s3\n${TXP_S3}\n")
+set(READS_FASTQ ${RAPMAP_TEST_DIR}/nip_skip.fastq)
+string(RANDOM LENGTH 100 ALPHABET I QUALS)
+file(WRITE ${READS_FASTQ} "@read_lce\n${READ_LCE}\n+\n${QUALS}\n@read_cap\n${READ_CAP}\n+\n${QUALS}\n")
+
+# The read, transcript and (1-based) position of each expected record
+set(EXPECTED_HITS "read_cap nip_s1 1" "read_cap nip_s2 1" "read_lce nip_a 1")
+
+foreach (VARIANT "plain" "lcp;--lcp" "lcp_packed;--lcp;--packedText" "packed;--packedText" "fm;--fm")
+    list(GET VARIANT 0 NAME)
+    list(REMOVE_AT VARIANT 0)
+    set(QUASI_INDEX_CMD ${CMAKE_BINARY_DIR}/rapmap quasiindex -k 31 ${VARIANT} -t ${TXP_FASTA} -i nip_skip_index_${NAME})
+    execute_process(COMMAND ${QUASI_INDEX_CMD}
+                    WORKING_DIRECTORY ${RAPMAP_TEST_DIR}
+                    RESULT_VARIABLE QUASI_INDEX_RESULT
+                    )
+    if (QUASI_INDEX_RESULT)
+        message(FATAL_ERROR "Error running ${QUASI_INDEX_CMD}")
+    endif()
+
+    set(SAM_FILE ${RAPMAP_TEST_DIR}/nip_skip_map_${NAME}.sam)
+    set(MAP_COMMAND ${CMAKE_BINARY_DIR}/rapmap quasimap -t 1 -i nip_skip_index_${NAME} -r ${READS_FASTQ} -o ${SAM_FILE})
+    execute_process(COMMAND ${MAP_COMMAND}
+                    WORKING_DIRECTORY ${RAPMAP_TEST_DIR}
+                    RESULT_VARIABLE QUASI_MAP_RESULT
+                    )
+    if (QUASI_MAP_RESULT)
+        message(FATAL_ERROR "Error running ${MAP_COMMAND}")
+    endif()
+
+    rapmap_read_records(${SAM_FILE} SAM_RECORDS)
+    set(HITS "")
+    foreach (RECORD ${SAM_RECORDS})
+        string(REPLACE "\t" ";" FIELDS "${RECORD}")
+        list(GET FIELDS 0 QNAME)
+        list(GET FIELDS 2 RNAME)
+        list(GET FIELDS 3 POS)
+        list(APPEND HITS "${QNAME} ${RNAME} ${POS}")
+    endforeach()
+    list(SORT HITS)
+    if (NOT "${HITS}" STREQUAL "${EXPECTED_HITS}")
+        message(FATAL_ERROR "RapMap (quasi, ${NAME} index) mapped the reads to [${HITS}], not [${EXPECTED_HITS}]")
+    endif()
+endforeach()
+message("RapMap (quasi, NIP skipping) ran successfully")
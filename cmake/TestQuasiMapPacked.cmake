@@ -0,0 +1,9 @@
+# Map the same reads against an index with a byte-per-base text and one
+# with a 2-bit packed text (both with the perfect hash); the mappings
+# must be identical.
+include(${CMAKE_CURRENT_LIST_DIR}/RapMapTestUtils.cmake)
+
+rapmap_map_variant(unpacked SAM_RECORDS_unpacked -p)
+rapmap_map_variant(packed SAM_RECORDS_packed --packedText -p)
+rapmap_expect_same_records(SAM_RECORDS_unpacked SAM_RECORDS_packed "packed text")
+message("RapMap (quasi, packed text) ran successfully")
@@ -0,0 +1,6 @@
+# Map the same reads against an index with a plain suffix array and one
+# with a bit-packed suffix array; the mappings must be identical.
+include(${CMAKE_CURRENT_LIST_DIR}/RapMapTestUtils.cmake)
+
+rapmap_expect_same_as_plain(packed_sa "packed SA" --packedSA)
+message("RapMap (quasi, packed SA) ran successfully")
@@ -0,0 +1,7 @@
+# Map the same reads against the plain index, whose k-mer lookups go
+# through the default hash, and against one that uses the perfect hash
+# (with its key fingerprints); the mappings must be identical.
+include(${CMAKE_CURRENT_LIST_DIR}/RapMapTestUtils.cmake)
+
+rapmap_expect_same_as_plain(ph "perfect hash" -p)
+message("RapMap (quasi, perfect-hash equality) ran successfully")
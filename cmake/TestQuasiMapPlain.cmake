@@ -0,0 +1,10 @@
+# Build the plain index of the sample transcripts and map the sample reads
+# against it; this is the setup test of the rapmap_plain fixture, whose
+# mapping the other tests compare theirs with (see RapMapTestUtils.cmake).
+include(${CMAKE_CURRENT_LIST_DIR}/RapMapTestUtils.cmake)
+
+rapmap_map_variant(plain SAM_RECORDS_plain)
+if ("${SAM_RECORDS_plain}" STREQUAL "")
+    message(FATAL_ERROR "RapMap (quasi, plain) mapped none of the sample reads")
+endif()
+message("RapMap (quasi, plain) ran successfully")
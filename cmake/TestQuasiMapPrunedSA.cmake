@@ -0,0 +1,7 @@
+# Map the same reads against an index with a plain suffix array and one
+# without the suffixes that can't begin a k-mer; the mappings must be
+# identical.
+include(${CMAKE_CURRENT_LIST_DIR}/RapMapTestUtils.cmake)
+
+rapmap_expect_same_as_plain(pruned_sa "pruned SA" --pruneSA)
+message("RapMap (quasi, pruned SA) ran successfully")
@@ -0,0 +1,55 @@
+# Map the same reads against an index loaded from disk and against the
+# same index published in shared memory by "rapmap quasiload" (-y); an
+# attach that lost any part of the index would map differently, so the
+# mappings must be identical.  This is done both for the default hash and
+# for the perfect hash, whose values are read from the segment in place.
+include(${CMAKE_CURRENT_LIST_DIR}/RapMapTestUtils.cmake)
+
+function(rapmap_check_shared_mem NAME)
+    set(SHM_NAME rapmap_test_${NAME})
+    set(INDEX_NAME sample_quasi_index_${NAME})
+
+    rapmap_map_variant(${NAME} SAM_RECORDS_disk ${ARGN})
+
+    # Remove any segment left over from an earlier (failed) run
+    execute_process(COMMAND ${CMAKE_BINARY_DIR}/rapmap quasiload -y ${SHM_NAME} --remove
+                    WORKING_DIRECTORY ${RAPMAP_TEST_DIR}
+                    OUTPUT_QUIET ERROR_QUIET
+                    )
+
+    set(QUASI_LOAD_CMD ${CMAKE_BINARY_DIR}/rapmap quasiload -i ${INDEX_NAME} -y ${SHM_NAME})
+    execute_process(COMMAND ${QUASI_LOAD_CMD}
+                    WORKING_DIRECTORY ${RAPMAP_TEST_DIR}
+                    RESULT_VARIABLE QUASI_LOAD_RESULT
+                    )
+    if (QUASI_LOAD_RESULT)
+        message(FATAL_ERROR "Error running ${QUASI_LOAD_CMD}")
+    endif()
+
+    # Map directly (rather than with rapmap_map_reads), so that the segment
+    # is removed even if mapping fails
+    set(SAM_FILE ${RAPMAP_TEST_DIR}/sample_quasi_map_${NAME}_attached.sam)
+    set(MAP_COMMAND ${CMAKE_BINARY_DIR}/rapmap quasimap -t 1 -i ${INDEX_NAME} -y ${SHM_NAME} -1 ${RAPMAP_SAMPLE_DIR}/reads_1.fastq -2 ${RAPMAP_SAMPLE_DIR}/reads_2.fastq -o ${SAM_FILE})
+    execute_process(COMMAND ${MAP_COMMAND}
+                    WORKING_DIRECTORY ${RAPMAP_TEST_DIR}
+                    RESULT_VARIABLE QUASI_MAP_RESULT
+                    )
+
+    execute_process(COMMAND ${CMAKE_BINARY_DIR}/rapmap quasiload -y ${SHM_NAME} --remove
+                    WORKING_DIRECTORY ${RAPMAP_TEST_DIR}
+                    RESULT_VARIABLE QUASI_UNLOAD_RESULT
+                    )
+    if (QUASI_MAP_RESULT)
+        message(FATAL_ERROR "Error running ${MAP_COMMAND}")
+    endif()
+    if (QUASI_UNLOAD_RESULT)
+        message(FATAL_ERROR "Error removing the shared memory segment ${SHM_NAME}")
+    endif()
+
+    rapmap_read_records(${SAM_FILE} SAM_RECORDS_attached)
+    rapmap_expect_same_records(SAM_RECORDS_disk SAM_RECORDS_attached "shared memory (${NAME})")
+endfunction()
+
+rapmap_check_shared_mem(shm)
+rapmap_check_shared_mem(shm_ph -p)
+message("RapMap (quasi, shared memory) ran successfully")
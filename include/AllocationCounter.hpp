@@ -0,0 +1,50 @@
+//
+// RapMap - Rapid and accurate mapping of short reads to transcriptomes using
+// quasi-mapping.
+// Copyright (C) 2015, 2016, 2017 Rob Patro, Avi Srivastava, Hirak Sarkar
+//
+// This file is part of RapMap.
+//
+// RapMap is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RapMap is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RapMap.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef __RAPMAP_ALLOCATION_COUNTER_HPP__
+#define __RAPMAP_ALLOCATION_COUNTER_HPP__
+
+#include <cstdint>
+
+namespace rapmap {
+namespace utils {
+
+/**
+ * The number of heap allocations (calls to malloc, calloc and realloc,
+ * which also back operator new) made so far by the calling thread.  The
+ * mapper takes differences of it around the mapping of a chunk of reads
+ * (see --countAllocs), to check that the per-read scratch is reused
+ * rather than reallocated.  Allocations are only counted in the test
+ * executable rapmap_count_allocs (compiled with RAPMAP_COUNT_ALLOCS
+ * defined, and built by quasi_map_test_allocations); in
+ * rapmap itself this is always 0.
+ */
+#ifdef RAPMAP_COUNT_ALLOCS
+uint64_t threadAllocations();
+#else
+inline uint64_t threadAllocations() { return 0; }
+#endif // RAPMAP_COUNT_ALLOCS
+
+} // namespace utils
+} // namespace rapmap
+
+#endif // __RAPMAP_ALLOCATION_COUNTER_HPP__
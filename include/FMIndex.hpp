@@ -0,0 +1,230 @@
+//
+// RapMap - Rapid and accurate mapping of short reads to transcriptomes using
+// quasi-mapping.
+// Copyright (C) 2015, 2016, 2017 Rob Patro, Avi Srivastava, Hirak Sarkar
+//
+// This file is part of RapMap.
+//
+// RapMap is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RapMap is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RapMap.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RAPMAP_FM_INDEX_HPP__
+#define __RAPMAP_FM_INDEX_HPP__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <cereal/types/vector.hpp>
+
+#include "IndexArray.hpp"
+#include "rank9b.h"
+
+namespace rapmap {
+namespace utils {
+
+/**
+ * An FM-index (BWT, occurrence counts and a sampled suffix array) of
+ * the *reversed* concatenated text R.  Backward search over R extends
+ * a pattern of the forward text T to the right, one base at a time,
+ * which is the direction in which RapMap extends its maximal matches.
+ *
+ * A row of the index names a suffix of R, i.e. a prefix of T ending at
+ * some position; if row i matches the first len bases of a query, the
+ * query starts at position n - SA_R[i] - len of T (see hitPosition()).
+ *
+ * The BWT is stored in blocks of 256 rows: the count of each base
+ * preceding the block, the 2-bit packed BWT (MSB-first, with the same
+ * encoding as my_mer) and a bit per row marking '$' (and the row of R's
+ * first suffix, which has no preceding character).  SA_R is sampled at
+ * every text position that is a multiple of the sample rate, and at
+ * every position that follows a '$', so that locating a row never has
+ * to step across a transcript boundary.
+ */
+template <typename IndexT>
+class FMIndex {
+public:
+  static constexpr uint32_t kBlockRows = 256;
+  static constexpr uint32_t kBaseWords = kBlockRows / 32;
+  static constexpr uint32_t kSentinelWords = kBlockRows / 64;
+  // counts, bases and sentinel bits
+  static constexpr uint32_t kBlockWords = 4 + kBaseWords + kSentinelWords;
+  static constexpr uint8_t kSentinel = 4;
+
+  FMIndex() : len_(0), sampleRate_(0), lfBase_(4, 0) {}
+  FMIndex(const FMIndex&) = delete;
+  FMIndex& operator=(const FMIndex&) = delete;
+
+  // Build the index of rtext (the reversed text) given its suffix array
+  template <typename SAIndexT>
+  void build(const std::string& rtext, const std::vector<SAIndexT>& SA,
+             uint32_t sampleRate) {
+    uint64_t n = rtext.length();
+    len_ = n;
+    sampleRate_ = sampleRate;
+
+    uint64_t numBlocks = n / kBlockRows + 1;
+    std::vector<uint64_t> blocks(numBlocks * kBlockWords, 0);
+    std::vector<uint64_t> sampledBits(n / 64 + 1, 0);
+    std::vector<IndexT> samples;
+
+    uint64_t counts[4] = {0, 0, 0, 0};
+    uint64_t firstChar[5] = {0, 0, 0, 0, 0};
+    for (uint64_t i = 0; i < n; ++i) {
+      uint64_t* block = blocks.data() + (i / kBlockRows) * kBlockWords;
+      uint32_t r = i % kBlockRows;
+      if (r == 0) {
+        for (size_t c = 0; c < 4; ++c) { block[c] = counts[c]; }
+      }
+      uint64_t p = static_cast<uint64_t>(SA[i]);
+      firstChar[code_(rtext[p])]++;
+      uint8_t c = (p == 0) ? kSentinel : code_(rtext[p - 1]);
+      if (c == kSentinel) {
+        block[4 + kBaseWords + r / 64] |= uint64_t(1) << (r % 64);
+      } else {
+        block[4 + r / 32] |= uint64_t(c) << (62 - 2 * (r % 32));
+        ++counts[c];
+      }
+      if (p % sampleRate == 0 or rtext[p - 1] == '$') {
+        sampledBits[i / 64] |= uint64_t(1) << (i % 64);
+        samples.push_back(static_cast<IndexT>(p));
+      }
+    }
+    // The last suffix of R (a single base) sorts first among those
+    // starting with its base, but is preceded by no row of the BWT.
+    uint64_t smaller = firstChar[kSentinel];
+    for (size_t c = 0; c < 4; ++c) {
+      lfBase_[c] = smaller + ((n > 0 and code_(rtext[n - 1]) == c) ? 1 : 0);
+      smaller += firstChar[c];
+    }
+    blocks_.assign(std::move(blocks));
+    sampledBits_.assign(std::move(sampledBits));
+    samples_.assign(std::move(samples));
+    buildRank_();
+  }
+
+  inline uint64_t length() const { return len_; }
+  inline uint32_t sampleRate() const { return sampleRate_; }
+  inline uint64_t bytes() const {
+    return (blocks_.size() + sampledBits_.size()) * sizeof(uint64_t) +
+           samples_.size() * sizeof(IndexT);
+  }
+
+  // The BWT at row i (0-3 for a base, kSentinel otherwise)
+  inline uint8_t bwt(uint64_t i) const {
+    const uint64_t* block = block_(i);
+    uint32_t r = i % kBlockRows;
+    if ((block[4 + kBaseWords + r / 64] >> (r % 64)) & 0x1) { return kSentinel; }
+    return (block[4 + r / 32] >> (62 - 2 * (r % 32))) & 0x3;
+  }
+
+  // The number of occurrences of base c in the BWT before row i
+  inline uint64_t occ(uint8_t c, uint64_t i) const {
+    const uint64_t* block = block_(i);
+    uint32_t r = i % kBlockRows;
+    uint64_t count = block[c];
+    // each pair of bits equal to c becomes 01
+    const uint64_t pattern = uint64_t(c) * 0x5555555555555555ULL;
+    uint32_t w = 0;
+    for (; w < r / 32; ++w) {
+      uint64_t x = block[4 + w] ^ pattern;
+      count += __builtin_popcountll(~(x | (x >> 1)) & 0x5555555555555555ULL);
+    }
+    uint32_t rem = r % 32;
+    if (rem > 0) {
+      uint64_t x = block[4 + w] ^ pattern;
+      uint64_t keep = ~uint64_t(0) << (64 - 2 * rem);
+      count += __builtin_popcountll(~(x | (x >> 1)) & 0x5555555555555555ULL & keep);
+    }
+    // sentinels are packed as 'A'
+    if (c == 0) {
+      for (w = 0; w < r / 64; ++w) {
+        count -= __builtin_popcountll(block[4 + kBaseWords + w]);
+      }
+      rem = r % 64;
+      if (rem > 0) {
+        count -= __builtin_popcountll(block[4 + kBaseWords + w] &
+                                      ((uint64_t(1) << rem) - 1));
+      }
+    }
+    return count;
+  }
+
+  // The row of the suffix one position earlier in R (i.e. one base
+  // further along T); only valid if bwt(i) is a base.
+  inline uint64_t lf(uint64_t i) const {
+    uint8_t c = bwt(i);
+    return lfBase_[c] + occ(c, i);
+  }
+
+  // Extend the rows [lb, ub) by base c (to the right in T)
+  inline void extend(uint8_t c, uint64_t& lb, uint64_t& ub) const {
+    lb = lfBase_[c] + occ(c, lb);
+    ub = lfBase_[c] + occ(c, ub);
+  }
+
+  // SA_R at row i, found by walking to the nearest sampled row
+  inline uint64_t locate(uint64_t i) const {
+    uint64_t steps{0};
+    while (!((sampledBits_[i / 64] >> (i % 64)) & 0x1)) {
+      i = lf(i);
+      ++steps;
+    }
+    return static_cast<uint64_t>(samples_[sampleRank_->rank(i)]) + steps;
+  }
+
+  template <typename Archive> void save(Archive& ar) const {
+    ar(len_, sampleRate_, lfBase_, blocks_, sampledBits_, samples_);
+  }
+
+  template <typename Archive> void load(Archive& ar) {
+    ar(len_, sampleRate_, lfBase_, blocks_, sampledBits_, samples_);
+    buildRank_();
+  }
+
+private:
+  static inline uint8_t code_(char c) {
+    switch (c) {
+    case 'A': return 0;
+    case 'C': return 1;
+    case 'G': return 2;
+    case 'T': return 3;
+    default: return kSentinel;
+    }
+  }
+
+  inline const uint64_t* block_(uint64_t i) const {
+    return blocks_.data() + (i / kBlockRows) * kBlockWords;
+  }
+
+  void buildRank_() {
+    sampleRank_.reset(new rank9b(sampledBits_.data(), len_));
+  }
+
+  uint64_t len_;
+  uint32_t sampleRate_;
+  // The row at which the suffixes starting with each base (and
+  // preceded by a row of the BWT) begin
+  std::vector<uint64_t> lfBase_;
+  IndexArray<uint64_t> blocks_;
+  IndexArray<uint64_t> sampledBits_;
+  IndexArray<IndexT> samples_;
+  std::unique_ptr<rank9b> sampleRank_{nullptr};
+};
+
+} // namespace utils
+} // namespace rapmap
+
+#endif // __RAPMAP_FM_INDEX_HPP__
@@ -0,0 +1,125 @@
+//
+// RapMap - Rapid and accurate mapping of short reads to transcriptomes using
+// quasi-mapping.
+// Copyright (C) 2015, 2016, 2017 Rob Patro, Avi Srivastava, Hirak Sarkar
+//
+// This file is part of RapMap.
+//
+// RapMap is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RapMap is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RapMap.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef FM_SEARCHER_HPP
+#define FM_SEARCHER_HPP
+
+#include <algorithm>
+#include <limits>
+#include <tuple>
+
+#include "RapMapFMIndex.hpp"
+#include "SASearcher.hpp"
+
+/**
+ * The searcher for an FM-index.  Maximal matches are extended by
+ * backward search (over the reversed text), and common extensions are
+ * read directly from the BWT, so the text is never needed.
+ */
+template <typename IndexT, typename HashT, uint32_t K>
+class SASearcher<RapMapFMIndex<IndexT, HashT>, K> {
+    public:
+        using RapMapIndexT = RapMapFMIndex<IndexT, HashT>;
+        using OffsetT = IndexT;
+
+        SASearcher(RapMapIndexT* rmi) : rmi_(rmi) {}
+
+        // Backward search reads the query a character at a time, so an
+        // encoded query (see the suffix array searcher) isn't needed
+        void addEncodedQuery(const char*, size_t, const uint64_t*, const uint64_t*) {}
+        void clearEncodedQueries() {}
+
+        /**
+         * Extend the match of the first startAt characters of the query,
+         * whose rows are [lbIn + 1, ubIn), as far as possible.  As with
+         * the suffix array searcher, lbIn is one *less* than the first
+         * row (a k-mer never occupies row 0, which is a '$' suffix).
+         * Returns the rows of the longest match and its length.
+         */
+        template <typename IteratorT>
+        std::tuple<OffsetT, OffsetT, OffsetT> extendSearchNaive(
+                OffsetT lbIn, // The lower bound for the search
+                OffsetT ubIn, // The upper bound for the search
+                OffsetT startAt, // The offset at which to start looking
+                IteratorT qb, // Iterator to the beginning of the query
+                IteratorT qe, // Iterator to the end of the query
+                bool complementBases=false // True if bases should be complemented
+                                           // before comparison
+                ) {
+            auto& fm = rmi_->fm;
+            uint64_t lb = static_cast<uint64_t>(lbIn) + 1;
+            uint64_t ub = static_cast<uint64_t>(ubIn);
+            int64_t m = std::distance(qb, qe);
+            int64_t i = startAt;
+            while (i < m) {
+                char queryChar = ::toupper(*(qb + i));
+                if (complementBases) {
+                    queryChar = rapmap::utils::my_mer::complement(queryChar);
+                }
+                int code = rapmap::utils::my_mer::code(queryChar);
+                if (rapmap::utils::my_mer::not_dna(code)) { break; }
+                uint64_t nlb{lb}, nub{ub};
+                fm.extend(static_cast<uint8_t>(code), nlb, nub);
+                if (nlb >= nub) { break; }
+                lb = nlb;
+                ub = nub;
+                ++i;
+            }
+            return std::make_tuple(static_cast<OffsetT>(lb), static_cast<OffsetT>(ub),
+                                   static_cast<OffsetT>(i));
+        }
+
+        /**
+         * Compute the longest common extension of all the matches in rows
+         * [p1, p2], which share their first `startAt` characters, going
+         * to at most `stopAt`.  In the suffix array the rows of a match
+         * are ordered by what follows it, so the LCE of the first and the
+         * last row is that of them all; here they are ordered by what
+         * precedes it, so instead the rows are extended (to the right in
+         * the text) for as long as every one of them is followed by the
+         * same base, which gives the same answer.
+         */
+        OffsetT lce(OffsetT p1, OffsetT p2,
+                    OffsetT startAt=0,
+                    OffsetT stopAt=std::numeric_limits<OffsetT>::max(),
+                    bool verbose=false) {
+            auto& fm = rmi_->fm;
+            uint64_t lb = static_cast<uint64_t>(std::min(p1, p2));
+            uint64_t ub = static_cast<uint64_t>(std::max(p1, p2)) + 1;
+            OffsetT len = startAt;
+            while (len < stopAt) {
+                uint8_t c = fm.bwt(lb);
+                if (c == rapmap::utils::FMIndex<IndexT>::kSentinel) { break; }
+                uint64_t nlb{lb}, nub{ub};
+                fm.extend(c, nlb, nub);
+                if (nub - nlb != ub - lb) { break; }
+                lb = nlb;
+                ub = nub;
+                ++len;
+            }
+            return len;
+        }
+
+    private:
+        RapMapIndexT* rmi_;
+};
+
+#endif // FM_SEARCHER_HPP
@@ -4,9 +4,11 @@
 #include "fcntl.h"
 #include "unistd.h"
 #include <atomic>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <iostream>
+#include <string>
 #include <thread>
 #include <vector>
 
@@ -59,9 +61,28 @@ typename _Unique_if<T>::_Known_bound make_unique(Args&&...) = delete;
 #endif //__FASTX_PARSER_PRECXX14_MAKE_UNIQUE__
 
 namespace fastx_parser {
+// A read, 2-bit encoded while it is parsed (see FastxParser::encodeReads).
+// Bases are A=0, C=1, G=2, T=3 (either case), 32 to a word with the first
+// base in the high bits; a base that isn't A, C, G or T is encoded as A and
+// its bit (bit i % 64 of word i / 64) is set in the mask.  The same is kept
+// for the reverse complement, whose bases (rcSeq) are upper-cased, with N
+// for anything that isn't A, C, G, T or U.
+struct EncodedSeq {
+  std::vector<uint64_t> fwd;
+  std::vector<uint64_t> rc;
+  std::vector<uint64_t> nMask;
+  std::vector<uint64_t> rcNMask;
+  std::string rcSeq;
+  // true if this holds the encoding of the read it belongs to
+  bool valid{false};
+
+  void encode(const char* seq, size_t len);
+};
+
 struct ReadSeq {
     std::string seq;
     std::string name;
+    EncodedSeq enc;
     ~ReadSeq() {}
 };
 
@@ -122,6 +143,9 @@ public:
               uint32_t numConsumers, uint32_t numParsers = 1,
               uint32_t chunkSize = 1000);
   ~FastxParser();
+  // Also 2-bit encode each read (into ReadSeq::enc) in the parsing
+  // threads; must be set before start()
+  void encodeReads(bool encode) { encodeReads_ = encode; }
   bool start();
   ReadGroup<T> getReadGroup();
   bool refill(ReadGroup<T>& rg);
@@ -134,6 +158,7 @@ private:
   std::vector<std::string> inputStreams_;
   std::vector<std::string> inputStreams2_;
   uint32_t numParsers_;
+  bool encodeReads_{false};
   std::atomic<uint32_t> numParsing_;
   std::vector<std::unique_ptr<std::thread>> parsingThreads_;
   size_t blockSize_;
@@ -0,0 +1,64 @@
+//
+// RapMap - Rapid and accurate mapping of short reads to transcriptomes using
+// quasi-mapping.
+// Copyright (C) 2015, 2016, 2017 Rob Patro, Avi Srivastava, Hirak Sarkar
+//
+// This file is part of RapMap.
+//
+// RapMap is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RapMap is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RapMap.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RAPMAP_FIXED_KMER_HPP__
+#define __RAPMAP_FIXED_KMER_HPP__
+
+#include <cstdint>
+
+namespace rapmap {
+namespace utils {
+
+/**
+ * Operations on a k-mer held in a single word, encoded as my_mer encodes
+ * it (A=0, C=1, G=2, T=3, the first base in the high bits), for a k (at
+ * most 32) fixed at compile time, so that every mask and shift is a
+ * constant.  K = 0 stands for a k only known at run time, which is then
+ * passed in; the mapper uses it for the k values it doesn't specialize
+ * (see mapReadsWithK in RapMapSAMapper.cpp).
+ */
+template <uint32_t K> struct FixedKmer {
+  static inline uint32_t len(uint32_t k) { return (K > 0) ? K : k; }
+
+  static inline uint64_t mask(uint32_t k) {
+    return (len(k) >= 32) ? ~uint64_t(0) : ((uint64_t(1) << (2 * len(k))) - 1);
+  }
+
+  // Is every base of w the same?
+  static inline bool isHomopolymer(uint64_t w, uint32_t k) {
+    return w == ((w & 0x3) * 0x5555555555555555ULL & mask(k));
+  }
+
+  // Complement every base, reverse the order of the 2-bit bases within the
+  // word, and shift the k-mer back down to the low bits
+  static inline uint64_t reverseComplement(uint64_t w, uint32_t k) {
+    w = ~w;
+    w = ((w >> 2) & 0x3333333333333333ULL) | ((w & 0x3333333333333333ULL) << 2);
+    w = ((w >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((w & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    w = __builtin_bswap64(w);
+    return w >> (64 - 2 * len(k));
+  }
+};
+
+} // namespace utils
+} // namespace rapmap
+
+#endif // __RAPMAP_FIXED_KMER_HPP__
@@ -0,0 +1,160 @@
+//
+// RapMap - Rapid and accurate mapping of short reads to transcriptomes using
+// quasi-mapping.
+// Copyright (C) 2015, 2016, 2017 Rob Patro, Avi Srivastava, Hirak Sarkar
+//
+// This file is part of RapMap.
+//
+// RapMap is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RapMap is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RapMap.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RAPMAP_FLAT_INDEX_HPP__
+#define __RAPMAP_FLAT_INDEX_HPP__
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * The "flat" layout stores the large, fixed-size components of a quasi
+ * index as raw arrays in a single file (flat.bin).  The first page holds
+ * a small preamble describing where each section lives; every section
+ * begins on a page boundary so that the whole file can be mapped
+ * read-only and each array used in place.  Processes mapping the same
+ * index therefore share a single copy through the page cache.
+ */
+namespace rapmap {
+namespace flat {
+
+constexpr char kFlatMagic[8] = {'R', 'M', 'F', 'L', 'A', 'T', '\0', '\0'};
+// Bump this whenever the on-disk layout changes
+constexpr uint32_t kFlatLayoutVersion = 1;
+constexpr uint64_t kFlatPageSize = 4096;
+constexpr uint32_t kMaxFlatSections = 32;
+constexpr char kFlatFileName[] = "flat.bin";
+
+enum class FlatSectionID : uint32_t {
+  NONE = 0,
+  SA,                // suffix array (IndexT)
+  TEXT,              // concatenated text (char)
+  TXP_OFFSETS,       // start of each transcript in the text (IndexT)
+  TXP_LENS,          // length of each transcript (IndexT)
+  TXP_COMPLETE_LENS, // length before clipping (uint32_t)
+  BOUNDARY_BITS,     // words of the bit vector marking '$' (uint64_t)
+  TXP_NAMES,         // '\0'-separated transcript names (char)
+  PACKED_TEXT,       // 2-bit packed text, in place of TEXT (uint64_t)
+  PACKED_SA          // image of a bit-packed SA, in place of SA (uint64_t)
+};
+
+struct FlatSection {
+  uint32_t id;
+  uint32_t elemSize;
+  uint64_t count;
+  uint64_t offset;
+  uint64_t bytes;
+};
+
+struct FlatPreamble {
+  char magic[8];
+  uint32_t version;
+  uint32_t indexWidth; // sizeof(IndexT) for the SA and offsets
+  uint64_t pageSize;
+  uint32_t numSections;
+  uint32_t reserved;
+  FlatSection sections[kMaxFlatSections];
+};
+
+static_assert(sizeof(FlatPreamble) <= kFlatPageSize,
+              "the flat index preamble must fit in a single page");
+
+/**
+ * Collects the sections of a flat index and lays them out
+ * (page-aligned) in a file or in an existing region of memory.  The
+ * writer does not copy the data, so everything added must stay alive
+ * until it has been written.
+ */
+class FlatIndexWriter {
+public:
+  explicit FlatIndexWriter(uint32_t indexWidth);
+
+  void addSection(FlatSectionID id, const void* data, size_t elemSize,
+                  size_t count);
+
+  // The total number of bytes required to hold the flat index
+  uint64_t totalBytes() const;
+
+  bool write(const std::string& fname) const;
+  // dst must point to at least totalBytes() writable bytes
+  void writeTo(char* dst) const;
+
+private:
+  FlatPreamble layout_() const;
+
+  uint32_t indexWidth_;
+  std::vector<FlatSection> sections_;
+  std::vector<const void*> data_;
+};
+
+/**
+ * A read-only view of a flat index, either mapped from a file or
+ * attached to memory that is owned elsewhere.
+ */
+class FlatIndexView {
+public:
+  FlatIndexView();
+  ~FlatIndexView();
+  FlatIndexView(const FlatIndexView&) = delete;
+  FlatIndexView& operator=(const FlatIndexView&) = delete;
+
+  // mmap fname read-only and validate its preamble
+  bool open(const std::string& fname, uint32_t indexWidth, std::string& err);
+  // use (and validate) an image that lives in memory owned elsewhere
+  bool attach(const char* base, uint64_t len, uint32_t indexWidth,
+              std::string& err);
+
+  // Get a pointer to (and the number of elements in) section id.
+  // Returns false if the section is absent or has the wrong element size.
+  template <typename T>
+  bool get(FlatSectionID id, const T*& ptr, size_t& count) const {
+    const FlatSection* s = find_(id);
+    if (s == nullptr or s->elemSize != sizeof(T)) {
+      return false;
+    }
+    ptr = reinterpret_cast<const T*>(base_ + s->offset);
+    count = s->count;
+    return true;
+  }
+
+  bool has(FlatSectionID id) const { return find_(id) != nullptr; }
+  uint64_t mappedBytes() const { return len_; }
+
+private:
+  bool validate_(uint32_t indexWidth, std::string& err);
+  const FlatSection* find_(FlatSectionID id) const;
+
+  const char* base_;
+  uint64_t len_;
+  bool mapped_;
+};
+
+// Pack / unpack transcript names to / from a '\0'-separated buffer
+std::vector<char> packNames(const std::vector<std::string>& names);
+void unpackNames(const char* buf, size_t len, size_t numNames,
+                 std::vector<std::string>& names);
+
+} // namespace flat
+} // namespace rapmap
+
+#endif // __RAPMAP_FLAT_INDEX_HPP__
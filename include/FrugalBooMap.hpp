@@ -3,14 +3,20 @@
 
 #include "BooPHF.hpp"
 #include "RapMapUtils.hpp"
+#include "SharedIndex.hpp"
+#include "PackedText.hpp"
+#include "PackedSA.hpp"
 
 #include "cereal/types/vector.hpp"
 #include "cereal/types/utility.hpp"
 #include "cereal/archives/binary.hpp"
 
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <vector>
 #include <iterator>
+#include <random>
 #include <type_traits>
 
 #include <sys/stat.h>
@@ -83,6 +89,9 @@ private:
 // pointer to the suffix array, and it "spot checks" the index 
 // returned by the perfect hash by ensuring that the suffix at
 // the corresponding offset starts with the query k-mer.
+// A 16-bit fingerprint of each key is kept beside its interval, so that
+// nearly every absent k-mer is rejected without touching the suffix
+// array or the text.
 template <typename KeyT, typename ValueT>
 class FrugalBooMap {
 public:
@@ -90,13 +99,24 @@ public:
     using HasherT = boomphf::SingleHashFunctor<KeyT>;
     using BooPHFT = boomphf::mphf<KeyT, HasherT>;
     typedef typename ValueT::index_type IndexT;
-    using IteratorT = KVProxy<typename std::vector<IndexT>::iterator, ValueT>;
+    using IteratorT = KVProxy<const IndexT*, ValueT>;
 
     //using IteratorT = typename std::vector<std::pair<KeyT, ValueT>>::iterator;
 
     FrugalBooMap() : built_(false) {}
-    void setSAPtr(std::vector<IndexT>* saPtr) { saPtr_ = saPtr; }
-    void setTextPtr(const char* txtPtr, size_t textLen) { txtPtr_ = txtPtr; textLen_ = textLen; }
+    void setSAPtr(const IndexT* saPtr) { saPtr_ = saPtr; packedSA_ = nullptr; }
+    // Use a bit-packed suffix array (instead of the plain one) for lookups
+    void setPackedSA(const rapmap::utils::PackedSA<IndexT>* packedSA) {
+        packedSA_ = packedSA;
+        saPtr_ = nullptr;
+    }
+    void setTextPtr(const char* txtPtr, size_t textLen) { txtPtr_ = txtPtr; textLen_ = textLen; packedTxt_ = nullptr; }
+    // Use a 2-bit packed text (instead of the character text) for spot checks
+    void setPackedText(const rapmap::utils::PackedText* packedTxt) {
+        packedTxt_ = packedTxt;
+        txtPtr_ = nullptr;
+        textLen_ = packedTxt->length();
+    }
 
     void add(KeyT&& k, ValueT&& v) {
         // In the frugal map, we don't even keep the key!
@@ -113,10 +133,10 @@ public:
 
     bool validate_hash(){
         for( auto& e : data_ ) {
-            rapmap::utils::my_mer kmer(txtPtr_ + (*saPtr_)[e]);
+            rapmap::utils::my_mer kmer(txtPtr_ + saPtr_[e]);
             auto ind = boophf_->lookup(kmer.word(0));
             if (ind >= data_.size()) { 
-                rapmap::utils::my_mer km(txtPtr_ + (*saPtr_)[e]);
+                rapmap::utils::my_mer km(txtPtr_ + saPtr_[e]);
                 std::cerr << "index for " << km << " was " << ind << ", outside bounds of data_ (" << data_.size() << ")\n";
                 return false;
             }
@@ -142,30 +162,48 @@ public:
         //validate_hash();
         std::cerr << "done\n";
         std::cerr << "size of overflow table is " << overflow_.size() << '\n';
+        buildFingerprints_();
+        setView_();
         built_ = true;
         return built_;
     }
 
     inline IteratorT find(const KeyT& k) {
         auto intervalIndex = boophf_->lookup(k);
-        if (intervalIndex >= data_.size()) return end();
-        auto ind = data_[intervalIndex];
-        auto textInd = (*saPtr_)[ind];
-        rapmap::utils::my_mer m(txtPtr_ + textInd);
+        if (intervalIndex >= size_) return end();
+        // A differing fingerprint means the slot belongs to another key
+        if (fpsPtr_ != nullptr and fpsPtr_[intervalIndex] != keyFingerprint_(k)) {
+            return end();
+        }
+        auto ind = dataPtr_[intervalIndex];
+        auto textInd = saAt_(ind);
+        KeyT mer = kmerAtText_(textInd);
 
         // If what we find matches the key, return the iterator
         // otherwise we don't have the key (it must have been here if it
         // existed).
-        if (m.word(0) == k) {
-            IndexT l = *(lens_.begin() + intervalIndex);
+        if (mer == k) {
+            IndexT l = lensPtr_[intervalIndex];
             if (l == std::numeric_limits<uint8_t>::max()) {
                 l = overflow_[ind];
             }
-            return IteratorT(m.word(0), data_.begin() + intervalIndex, ind + l);
+            return IteratorT(mer, dataPtr_ + intervalIndex, ind + l);
         }
         return end();
     }
     
+    // Look up the slot of k in the perfect hash and prefetch its entries,
+    // so that a later find(k) doesn't stall on them.  (The suffix array
+    // and text reads of find depend on these, so they can't be issued yet.)
+    inline void prefetch(const KeyT& k) const {
+        auto intervalIndex = boophf_->lookup(k);
+        if (intervalIndex < size_) {
+            __builtin_prefetch(dataPtr_ + intervalIndex);
+            __builtin_prefetch(lensPtr_ + intervalIndex);
+            if (fpsPtr_ != nullptr) { __builtin_prefetch(fpsPtr_ + intervalIndex); }
+        }
+    }
+
     /**
      * NOTE: This function *assumes* that the key is in the hash.
      * If it isn't, you'll get back a random element!
@@ -177,10 +215,10 @@ public:
     }
     */
     
-    inline IteratorT begin() { return IteratorT(0, data_.begin(), lens_.front()); }
-    inline IteratorT end() { return IteratorT(0, data_.end(), 0, true); }
-    inline IteratorT cend() const { return IteratorT(0, data_.cend(), 0, true); }
-    inline IteratorT cbegin() const { return IteratorT(0, data_.cbegin(), lens_.front()); }
+    inline IteratorT begin() { return IteratorT(0, dataPtr_, lensPtr_[0]); }
+    inline IteratorT end() { return IteratorT(0, dataPtr_ + size_, 0, true); }
+    inline IteratorT cend() const { return IteratorT(0, dataPtr_ + size_, 0, true); }
+    inline IteratorT cbegin() const { return IteratorT(0, dataPtr_, lensPtr_[0]); }
     
     void save(const std::string& ofileBase) {
         if (built_) {
@@ -209,6 +247,18 @@ public:
                     outArchive(lens_);
                     overflow_.serialize(typename spp_utils::pod_hash_serializer<IndexT, IndexT>(), &valStream);
                 }
+                // The fingerprints follow the overflow table (indices
+                // written before they existed simply end there), after a
+                // byte of padding if need be so that they start at an
+                // even offset, and can be read in place when the file is
+                // loaded into (page-aligned) memory
+                {
+                    if ((static_cast<uint64_t>(valStream.tellp()) + sizeof(uint64_t)) % sizeof(uint16_t) != 0) {
+                        valStream.put('\0');
+                    }
+                    cereal::BinaryOutputArchive outArchive(valStream);
+                    outArchive(fps_);
+                }
                 valStream.close();
             }
         }
@@ -243,31 +293,118 @@ public:
                 inArchive(lens_);
                 overflow_.unserialize(typename spp_utils::pod_hash_serializer<IndexT, IndexT>(), &dataStream);
             }
+            fps_.clear();
+            skipFingerprintPadding_(dataStream);
+            if (dataStream.peek() != std::ifstream::traits_type::eof()) {
+                cereal::BinaryInputArchive inArchive(dataStream);
+                inArchive(fps_);
+            }
             dataStream.close();
         }
 
+        setView_();
         built_ = true;
     }
 
+    /**
+     * Load the map from the contents of the .bph and .val files held in
+     * memory (e.g. in a shared-memory segment).  The interval starts and
+     * lengths, and the key fingerprints, are used in place, so the memory
+     * must outlive the map.
+     */
+    bool loadFromMemory(const char* hashBuf, size_t hashLen,
+                        const char* valBuf, size_t valLen) {
+        {
+            rapmap::shm::MemoryStreamBuf sb(hashBuf, hashLen);
+            std::istream is(&sb);
+            boophf_.reset(new BooPHFT);
+            boophf_->load(is);
+        }
+        // The values were written by cereal; each vector is its size
+        // followed by the raw elements.
+        const char* it = valBuf;
+        const char* valEnd = valBuf + valLen;
+        uint64_t numData{0}, numLens{0};
+        if (it + sizeof(numData) > valEnd) { return false; }
+        std::memcpy(&numData, it, sizeof(numData));
+        it += sizeof(numData);
+        const IndexT* dataPtr = reinterpret_cast<const IndexT*>(it);
+        it += numData * sizeof(IndexT);
+        if (it + sizeof(numLens) > valEnd) { return false; }
+        std::memcpy(&numLens, it, sizeof(numLens));
+        it += sizeof(numLens);
+        const uint8_t* lensPtr = reinterpret_cast<const uint8_t*>(it);
+        it += numLens;
+        if (it > valEnd or numLens != numData) { return false; }
+        {
+            rapmap::shm::MemoryStreamBuf sb(it, valEnd - it);
+            std::istream is(&sb);
+            overflow_.unserialize(typename spp_utils::pod_hash_serializer<IndexT, IndexT>(), &is);
+            it += sb.consumed();
+        }
+        // Then the fingerprints, if the index has them; what's left is the
+        // padding (see save), their count and the fingerprints themselves
+        const uint16_t* fpsPtr{nullptr};
+        std::vector<uint16_t>().swap(fps_);
+        it += (valEnd - it) % sizeof(uint16_t);
+        if (it + sizeof(uint64_t) <= valEnd) {
+            uint64_t numFps{0};
+            std::memcpy(&numFps, it, sizeof(numFps));
+            it += sizeof(numFps);
+            if (numFps != numData or it + numFps * sizeof(uint16_t) > valEnd) { return false; }
+            if (reinterpret_cast<uintptr_t>(it) % alignof(uint16_t) == 0) {
+                fpsPtr = reinterpret_cast<const uint16_t*>(it);
+            } else {
+                // Written unpadded (before save padded them); copy them
+                // out rather than read them through a misaligned pointer
+                fps_.resize(numFps);
+                std::memcpy(fps_.data(), it, numFps * sizeof(uint16_t));
+                fpsPtr = fps_.data();
+            }
+        }
+        std::vector<IndexT>().swap(data_);
+        std::vector<uint8_t>().swap(lens_);
+        dataPtr_ = dataPtr;
+        lensPtr_ = lensPtr;
+        fpsPtr_ = fpsPtr;
+        size_ = numData;
+        built_ = true;
+        return true;
+    }
+
     inline KeyT getKmerFromInterval_(ValueT& ival) {
         rapmap::utils::my_mer m;// copy the global mer to get k-mer object
-        m.from_chars(txtPtr_ + (*saPtr_)[ival.begin()]);
+        m.from_chars(txtPtr_ + saPtr_[ival.begin()]);
         return m.word(0);
     }
 
     // variant where we provide an existing mer object
     inline KeyT getKmerFromInterval_(ValueT& ival, rapmap::utils::my_mer& m) {
-        m.from_chars(txtPtr_ + (*saPtr_)[ival.begin()]);
+        m.from_chars(txtPtr_ + saPtr_[ival.begin()]);
         return m.word(0);
     }
 
     // variant where we provide an existing mer object
     inline KeyT getKmerFromPos_(IndexT pos, rapmap::utils::my_mer& m) {
-        m.from_chars(txtPtr_ + (*saPtr_)[pos]);
+        m.from_chars(txtPtr_ + saPtr_[pos]);
         return m.word(0);
     }
 
 private:
+    // The suffix array entry at position ind
+    inline IndexT saAt_(IndexT ind) const {
+        return (packedSA_ != nullptr) ? (*packedSA_)[ind] : saPtr_[ind];
+    }
+
+    // The encoded k-mer starting at position textInd of the text
+    inline KeyT kmerAtText_(IndexT textInd) {
+        if (packedTxt_ != nullptr) {
+            return packedTxt_->kmer(textInd, rapmap::utils::my_mer::k());
+        }
+        rapmap::utils::my_mer m(txtPtr_ + textInd);
+        return m.word(0);
+    }
+
     // Taken from http://stackoverflow.com/questions/12774207/fastest-way-to-check-if-a-file-exist-using-standard-c-c11-c
     bool FileExists_(const char *path) {
         struct stat fileStat;
@@ -280,6 +417,70 @@ private:
         return true;
     }
 
+    // Skip the byte of padding that save may have written before the
+    // fingerprints; the count and fingerprints that follow it take an
+    // even number of bytes, so there is one exactly if an odd number is left
+    void skipFingerprintPadding_(std::istream& is) {
+        auto pos = is.tellg();
+        is.seekg(0, std::ios::end);
+        auto end = is.tellg();
+        is.seekg(pos);
+        if ((end - pos) % 2 != 0) { is.ignore(1); }
+    }
+
+    // Lookups go through these, so that the values may live either in
+    // data_ / lens_ or in memory owned by someone else.
+    void setView_() {
+        dataPtr_ = data_.data();
+        lensPtr_ = lens_.data();
+        fpsPtr_ = (fps_.size() == data_.size() and !fps_.empty()) ? fps_.data() : nullptr;
+        size_ = data_.size();
+    }
+
+    // The fingerprint of a key: the high bits of a 64-bit mix of it.  This
+    // must not be correlated with the hash of the BooPHF, since the keys
+    // that land on a slot are exactly those that agree on that hash.
+    static inline uint16_t keyFingerprint_(KeyT k) {
+        uint64_t x = static_cast<uint64_t>(k);
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return static_cast<uint16_t>(x >> 48);
+    }
+
+    // Record the fingerprint of the k-mer of every slot, and report what
+    // they cost and how many random (hence almost surely absent) k-mers
+    // still get past them to the suffix array and text
+    void buildFingerprints_() {
+        rapmap::utils::my_mer mer;
+        fps_.resize(data_.size());
+        for (size_t i = 0; i < data_.size(); ++i) {
+            fps_[i] = keyFingerprint_(getKmerFromPos_(data_[i], mer));
+        }
+        const uint32_t k = rapmap::utils::my_mer::k();
+        const uint64_t merMask = (k >= 32) ? ~uint64_t(0) : ((uint64_t(1) << (2 * k)) - 1);
+        const size_t numProbes{1000000};
+        std::mt19937_64 gen(271828);
+        size_t numAbsent{0}, numPassed{0};
+        for (size_t i = 0; i < numProbes; ++i) {
+            KeyT probe = static_cast<KeyT>(gen() & merMask);
+            auto intervalIndex = boophf_->lookup(probe);
+            // Probes that miss the table entirely never reach the fingerprints
+            if (intervalIndex >= data_.size()) { continue; }
+            if (getKmerFromPos_(data_[intervalIndex], mer) == probe) { continue; }
+            ++numAbsent;
+            numPassed += (fps_[intervalIndex] == keyFingerprint_(probe)) ? 1 : 0;
+        }
+        size_t valBytes = data_.size() * (sizeof(IndexT) + sizeof(uint8_t));
+        size_t fpBytes = fps_.size() * sizeof(uint16_t);
+        std::cerr << "key fingerprints use " << fpBytes << " bytes (+"
+                  << (valBytes ? (100.0 * fpBytes) / valBytes : 0.0)
+                  << "% over the stored intervals); " << numPassed << " of "
+                  << numAbsent << " absent random k-mers that land in the table pass them\n";
+    }
+
     void reorder_fn_()  {
         /* Adapted from code at: http://blog.merovius.de/2014/08/12/applying-permutation-in-constant.html */
         // Note, we can actually do this with out the bitvector by using the high-order bit 
@@ -305,8 +506,10 @@ private:
         }
     }
 
-    std::vector<IndexT>* saPtr_;
+    const IndexT* saPtr_;
+    const rapmap::utils::PackedSA<IndexT>* packedSA_{nullptr};
     const char* txtPtr_; 
+    const rapmap::utils::PackedText* packedTxt_{nullptr};
     size_t textLen_;
     rapmap::utils::my_mer mer_;
     bool built_;
@@ -314,6 +517,12 @@ private:
     std::vector<IndexT> data_;
     // Length of the interval
     std::vector<uint8_t> lens_;
+    const IndexT* dataPtr_{nullptr};
+    const uint8_t* lensPtr_{nullptr};
+    size_t size_{0};
+    // A fingerprint of the key of each slot (empty for older indices)
+    std::vector<uint16_t> fps_;
+    const uint16_t* fpsPtr_{nullptr};
     // Overflow table if interval is >= std::numeric_limits<uint8_t>::max()
     spp::sparse_hash_map<IndexT, IndexT> overflow_;
     std::unique_ptr<BooPHFT> boophf_{nullptr};
@@ -25,6 +25,7 @@
 #include "RapMapUtils.hpp"
 #include "RapMapIndex.hpp"
 #include "RapMapSAIndex.hpp"
+#include "RapMapFMIndex.hpp"
 
 //#include "eytzinger_array.h"
 
@@ -46,9 +47,49 @@ namespace rapmap {
 
         template <typename T>
         using SAIntervalHit = rapmap::utils::SAIntervalHit<T>;
-        using SAHitMap = std::map<int, rapmap::utils::ProcessedSAHit>;
         using ProcessedSAHit = rapmap::utils::ProcessedSAHit;
 
+        /**
+         * The scratch space of intersectSAHits, kept by each mapping
+         * thread and reused (cleared, not freed) from read to read, so
+         * that intersecting the intervals of a read allocates nothing
+         * once the buffers have grown.
+         *
+         * The transcripts hit by the smallest interval are held, sorted,
+         * in a flat array (and found by binary search); the positions hit
+         * in each are appended, in the order they're found, to a single
+         * arena, and then gathered (stably) so that those of each
+         * transcript are contiguous.  After intersectSAHits, transcript i
+         * (in increasing order of id) is txps[i], with hits
+         * [positions.begin() + offsets[i], positions.begin() + offsets[i + 1]).
+         */
+        class SAHitWorkspace {
+            public:
+                // A position in the arena, and the transcript (index) it's in
+                struct PendingPos {
+                    uint32_t txp;
+                    SATxpQueryPos pos;
+                };
+
+                void clear() {
+                    txps.clear();
+                    numActive.clear();
+                    active.clear();
+                    pending.clear();
+                    offsets.clear();
+                    positions.clear();
+                }
+
+                size_t size() const { return txps.size(); }
+
+                std::vector<uint32_t> txps;
+                std::vector<uint32_t> numActive;
+                std::vector<uint8_t> active;
+                std::vector<PendingPos> pending;
+                std::vector<uint32_t> offsets;
+                std::vector<SATxpQueryPos> positions;
+        };
+
         class SAProcessedHitVec {
             public:
                 std::vector<ProcessedSAHit> hits;
@@ -66,9 +107,9 @@ namespace rapmap {
                 std::vector<QuasiAlignment>& hits,
                 MateStatus mateStatus);
 
-        // Return hits from processedHits where position constraints
-        // match maxDist
-        bool collectHitsSimpleSA(SAHitMap& processedHits,
+        // Return the hits of the transcripts left active in ws (see
+        // intersectSAHits)
+        bool collectHitsSimpleSA(SAHitWorkspace& ws,
                 uint32_t readLen,
                 uint32_t maxDist,
                 std::vector<QuasiAlignment>& hits,
@@ -91,13 +132,6 @@ namespace rapmap {
         void intersectWithOutput(HitInfo& h2, RapMapIndex& rmi,
                 std::vector<ProcessedHit>& outHits);
 
-        template <typename RapMapIndexT>
-        void intersectSAIntervalWithOutput(SAIntervalHit<typename RapMapIndexT::IndexType>& h,
-                                           RapMapIndexT& rmi,
-                                           uint32_t intervalCounter,
-                                           SAHitMap& outHits);
-                                           
-
         template <typename RapMapIndexT>
         void intersectSAIntervalWithOutput2(SAIntervalHit<typename RapMapIndexT::IndexType>& h,
                 RapMapIndexT& rmi,
@@ -113,12 +147,16 @@ namespace rapmap {
                 std::vector<HitInfo>& inHits,
                 RapMapIndex& rmi);
 
+        // Intersects the SA intervals in inHits, leaving the transcripts
+        // in which every one of them occurs, and their positions, in ws
+        // (see SAHitWorkspace)
         template <typename RapMapIndexT>
-        SAHitMap intersectSAHits(
-                                 std::vector<SAIntervalHit<typename RapMapIndexT::IndexType>>& inHits,
-                                 RapMapIndexT& rmi, 
-                                 size_t readLen,
-                                 bool strictFilter=false);
+        void intersectSAHits(
+                             std::vector<SAIntervalHit<typename RapMapIndexT::IndexType>>& inHits,
+                             RapMapIndexT& rmi,
+                             size_t readLen,
+                             bool strictFilter,
+                             SAHitWorkspace& ws);
 
         template <typename RapMapIndexT>
         std::vector<ProcessedSAHit> intersectSAHits2(
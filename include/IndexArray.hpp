@@ -0,0 +1,122 @@
+//
+// RapMap - Rapid and accurate mapping of short reads to transcriptomes using
+// quasi-mapping.
+// Copyright (C) 2015, 2016, 2017 Rob Patro, Avi Srivastava, Hirak Sarkar
+//
+// This file is part of RapMap.
+//
+// RapMap is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RapMap is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RapMap.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RAPMAP_INDEX_ARRAY_HPP__
+#define __RAPMAP_INDEX_ARRAY_HPP__
+
+#include <cstddef>
+#include <vector>
+#include <utility>
+
+#include <cereal/types/vector.hpp>
+
+namespace rapmap {
+namespace utils {
+
+/**
+ * A read-only, contiguous array used for the large components of the
+ * index (the suffix array, the text, transcript offsets, ...).  The
+ * array either owns its storage (e.g. when it was deserialized with
+ * cereal) or *borrows* storage that lives somewhere else (e.g. a
+ * memory-mapped flat index).  Either way, it is indexed exactly like
+ * the std::vector it replaces.
+ */
+template <typename T>
+class IndexArray {
+public:
+  using value_type = T;
+  using const_iterator = const T*;
+
+  IndexArray() : data_(nullptr), size_(0), borrowed_(false) {}
+  IndexArray(const IndexArray&) = delete;
+  IndexArray& operator=(const IndexArray&) = delete;
+
+  // Take ownership of the contents of v
+  void assign(std::vector<T>&& v) {
+    owned_ = std::move(v);
+    data_ = owned_.data();
+    size_ = owned_.size();
+    borrowed_ = false;
+  }
+
+  // Refer to n elements starting at d; the caller guarantees that
+  // this memory outlives the array.
+  void borrow(const T* d, size_t n) {
+    std::vector<T>().swap(owned_);
+    data_ = d;
+    size_ = n;
+    borrowed_ = true;
+  }
+
+  // Allocate owned storage for n elements and return a pointer through
+  // which it can be filled in (e.g. by a parallel read).
+  T* allocate(size_t n) {
+    std::vector<T>(n).swap(owned_);
+    data_ = owned_.data();
+    size_ = n;
+    borrowed_ = false;
+    return owned_.data();
+  }
+
+  void clear() {
+    std::vector<T>().swap(owned_);
+    data_ = nullptr;
+    size_ = 0;
+    borrowed_ = false;
+  }
+
+  inline const T& operator[](size_t i) const { return data_[i]; }
+  inline const T* data() const { return data_; }
+  inline size_t size() const { return size_; }
+  inline size_t length() const { return size_; }
+  inline bool empty() const { return size_ == 0; }
+  inline const T& front() const { return data_[0]; }
+  inline const T& back() const { return data_[size_ - 1]; }
+  inline const_iterator begin() const { return data_; }
+  inline const_iterator end() const { return data_ + size_; }
+
+  bool isBorrowed() const { return borrowed_; }
+
+  // The on-disk representation is identical to that of a std::vector<T>
+  // (and, for T = char, to that of a std::string) so that existing
+  // indices load unchanged.
+  template <typename Archive> void save(Archive& ar) const {
+    ar(cereal::make_size_tag(static_cast<cereal::size_type>(size_)));
+    ar(cereal::binary_data(data_, size_ * sizeof(T)));
+  }
+
+  template <typename Archive> void load(Archive& ar) {
+    std::vector<T> v;
+    ar(v);
+    assign(std::move(v));
+  }
+
+private:
+  std::vector<T> owned_;
+  const T* data_;
+  size_t size_;
+  bool borrowed_;
+};
+
+} // namespace utils
+} // namespace rapmap
+
+#endif // __RAPMAP_INDEX_ARRAY_HPP__
@@ -34,13 +34,14 @@ enum class IndexType : uint8_t {
 
 class IndexHeader {
     public:
-        IndexHeader () : type_(IndexType::INVALID), versionString_("invalid"), usesKmers_(false), kmerLen_(0), perfectHash_(false) {}
+        IndexHeader () : type_(IndexType::INVALID), versionString_("invalid"), usesKmers_(false), kmerLen_(0), perfectHash_(false),
+                         flatLayout_(false), flatLayoutVersion_(0), packedText_(false), packedSA_(false), fmIndex_(false), prunedSA_(false), lcp_(false), lcpRMQ_(false), childTable_(false), fingerprints_(false), sampledSearch_(false), canonicalHash_(false), kmerFilter_(false) {}
 
         IndexHeader(IndexType typeIn, const std::string& versionStringIn,
                     bool usesKmersIn, uint32_t kmerLenIn, bool bigSA = false, bool perfectHash = false):
                     type_(typeIn), versionString_(versionStringIn),
                     usesKmers_(usesKmersIn), kmerLen_(kmerLenIn), bigSA_(bigSA),
-                    perfectHash_(perfectHash) {}
+                    perfectHash_(perfectHash), flatLayout_(false), flatLayoutVersion_(0), packedText_(false), packedSA_(false), fmIndex_(false), prunedSA_(false), lcp_(false), lcpRMQ_(false), childTable_(false), fingerprints_(false), sampledSearch_(false), canonicalHash_(false), kmerFilter_(false) {}
 
         template <typename Archive>
             void save(Archive& ar) const {
@@ -52,6 +53,19 @@ class IndexHeader {
                 ar( cereal::make_nvp("PerfectHash", perfectHash_) );
                 ar( cereal::make_nvp("SeqHash", seqHash_) );
                 ar( cereal::make_nvp("NameHash", nameHash_) );
+                ar( cereal::make_nvp("FlatLayout", flatLayout_) );
+                ar( cereal::make_nvp("FlatLayoutVersion", flatLayoutVersion_) );
+                ar( cereal::make_nvp("PackedText", packedText_) );
+                ar( cereal::make_nvp("PackedSA", packedSA_) );
+                ar( cereal::make_nvp("FMIndex", fmIndex_) );
+                ar( cereal::make_nvp("PrunedSA", prunedSA_) );
+                ar( cereal::make_nvp("LCP", lcp_) );
+                ar( cereal::make_nvp("LCPRMQ", lcpRMQ_) );
+                ar( cereal::make_nvp("ChildTable", childTable_) );
+                ar( cereal::make_nvp("Fingerprints", fingerprints_) );
+                ar( cereal::make_nvp("SampledSearch", sampledSearch_) );
+                ar( cereal::make_nvp("CanonicalHash", canonicalHash_) );
+                ar( cereal::make_nvp("KmerFilter", kmerFilter_) );
             }
 
         template <typename Archive>
@@ -73,6 +87,21 @@ class IndexHeader {
                 cerrLog->flush(); 
                 std::exit(1);
             }
+            // Fields added after index version q5 are optional, so that
+            // older indices can still be read.
+            loadOptional_(ar, "FlatLayout", flatLayout_, false);
+            loadOptional_(ar, "FlatLayoutVersion", flatLayoutVersion_, 0u);
+            loadOptional_(ar, "PackedText", packedText_, false);
+            loadOptional_(ar, "PackedSA", packedSA_, false);
+            loadOptional_(ar, "FMIndex", fmIndex_, false);
+            loadOptional_(ar, "PrunedSA", prunedSA_, false);
+            loadOptional_(ar, "LCP", lcp_, false);
+            loadOptional_(ar, "LCPRMQ", lcpRMQ_, false);
+            loadOptional_(ar, "ChildTable", childTable_, false);
+            loadOptional_(ar, "Fingerprints", fingerprints_, false);
+            loadOptional_(ar, "SampledSearch", sampledSearch_, false);
+            loadOptional_(ar, "CanonicalHash", canonicalHash_, false);
+            loadOptional_(ar, "KmerFilter", kmerFilter_, false);
         }
 
         IndexType indexType() const { return type_; }
@@ -87,7 +116,76 @@ class IndexHeader {
         std::string seqHash() const { return seqHash_; }
         std::string nameHash() const { return nameHash_; }
 
+        // Is the index stored in the (mmap-able) flat layout?
+        bool flatLayout() const { return flatLayout_; }
+        uint32_t flatLayoutVersion() const { return flatLayoutVersion_; }
+        void setFlatLayout(bool flat, uint32_t version) {
+            flatLayout_ = flat;
+            flatLayoutVersion_ = flat ? version : 0;
+        }
+
+        // Is the reference text stored 2-bit packed?
+        bool packedText() const { return packedText_; }
+        void setPackedText(bool packed) { packedText_ = packed; }
+
+        // Are the suffix array entries bit-packed (in which case the
+        // index is always loaded with 64-bit offsets)?
+        bool packedSA() const { return packedSA_; }
+        void setPackedSA(bool packed) { packedSA_ = packed; }
+
+        // Is the suffix array (and text) replaced by an FM-index?
+        bool fmIndex() const { return fmIndex_; }
+        void setFMIndex(bool fm) { fmIndex_ = fm; }
+
+        // Does the suffix array hold only suffixes that begin a k-mer?
+        bool prunedSA() const { return prunedSA_; }
+        void setPrunedSA(bool pruned) { prunedSA_ = pruned; }
+
+        // Were the LCP array (lcp.bin) and the LCP-LR arrays used by the
+        // searcher (lcplr.bin) built along with the suffix array?
+        bool lcp() const { return lcp_; }
+        void setLCP(bool lcp) { lcp_ = lcp; }
+
+        // Was the range-minimum structure over the LCP array, with which
+        // the searcher answers LCE queries, written (to lcprmq.bin)?
+        bool lcpRMQ() const { return lcpRMQ_; }
+        void setLCPRMQ(bool rmq) { lcpRMQ_ = rmq; }
+
+        // Was the child table of the enhanced suffix array written (to
+        // cld.bin)?  It is only used along with lcprmq.bin.
+        bool childTable() const { return childTable_; }
+        void setChildTable(bool cld) { childTable_ = cld; }
+
+        // Were the suffix fingerprints (see SuffixFingerprints.hpp)
+        // written (to fp.bin)?
+        bool fingerprints() const { return fingerprints_; }
+        void setFingerprints(bool fp) { fingerprints_ = fp; }
+
+        // Were the samples of the large k-mer intervals (see
+        // SampledSearchTree.hpp) written (to sampled.bin)?
+        bool sampledSearch() const { return sampledSearch_; }
+        void setSampledSearch(bool s) { sampledSearch_ = s; }
+
+        // Is the k-mer hash keyed on canonical k-mers, with the orientation
+        // of each interval in its flags (see rapmap::utils::CanonicalKmer)?
+        bool canonicalHash() const { return canonicalHash_; }
+        void setCanonicalHash(bool c) { canonicalHash_ = c; }
+
+        // Was the filter over the keys of the hash (see KmerFilter.hpp)
+        // written (to filter.bin)?
+        bool kmerFilter() const { return kmerFilter_; }
+        void setKmerFilter(bool f) { kmerFilter_ = f; }
+
     private:
+        template <typename Archive, typename T>
+        void loadOptional_(Archive& ar, const char* name, T& val, const T& defaultVal) {
+            try {
+                ar( cereal::make_nvp(name, val) );
+            } catch (const cereal::Exception& e) {
+                val = defaultVal;
+            }
+        }
+
         // The type of index we have
         IndexType type_;
         // The version string for the index
@@ -105,6 +203,32 @@ class IndexHeader {
         std::string seqHash_;
         // Hash of sequence names in txome
         std::string nameHash_;
+        // Are the SA, text and transcript info stored in flat.bin?
+        bool flatLayout_;
+        // The version of the flat layout (0 if not flat)
+        uint32_t flatLayoutVersion_;
+        // Is the text stored 2-bit packed (with '$' in the boundary bits)?
+        bool packedText_;
+        // Are the suffix array entries stored with ceil(log2 n) bits?
+        bool packedSA_;
+        // Is the index an FM-index (fm.bin) of the reversed text?
+        bool fmIndex_;
+        // Were the suffixes that can't begin a k-mer left out of the SA?
+        bool prunedSA_;
+        // Were lcp.bin and lcplr.bin written?
+        bool lcp_;
+        // Was lcprmq.bin written?
+        bool lcpRMQ_;
+        // Was cld.bin written?
+        bool childTable_;
+        // Was fp.bin written?
+        bool fingerprints_;
+        // Was sampled.bin written?
+        bool sampledSearch_;
+        // Is hash.bin keyed on canonical k-mers?
+        bool canonicalHash_;
+        // Was filter.bin written?
+        bool kmerFilter_;
 };
 
 
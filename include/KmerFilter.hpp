@@ -0,0 +1,135 @@
+//
+// RapMap - Rapid and accurate mapping of short reads to transcriptomes using
+// quasi-mapping.
+// Copyright (C) 2015, 2016, 2017 Rob Patro, Avi Srivastava, Hirak Sarkar
+//
+// This file is part of RapMap.
+//
+// RapMap is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RapMap is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RapMap.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RAPMAP_KMER_FILTER_HPP__
+#define __RAPMAP_KMER_FILTER_HPP__
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "IndexArray.hpp"
+
+namespace rapmap {
+namespace utils {
+
+/**
+ * A blocked Bloom filter over the keys of the k-mer hash, which the
+ * mapper asks before the hash so that most k-mers that aren't in the
+ * index are turned away after reading a single cache line.  The filter
+ * is an array of 64-byte blocks of kWordsPerBlock words, and each key
+ * sets one bit in every word of one block (the "split" blocked Bloom
+ * filter); the block and the bits all come from a single 64-bit mix of
+ * the key.  With 16 bits per key, fewer than 1 in 500 absent keys get
+ * through.  A key that was added is always reported present.
+ */
+class KmerFilter {
+public:
+  static constexpr uint32_t kWordsPerBlock = 8;
+
+  // Size the (empty) filter for numKeys keys at bitsPerKey bits each
+  void init(uint64_t numKeys, uint32_t bitsPerKey) {
+    uint64_t bits = std::max<uint64_t>(numKeys * bitsPerKey, 1);
+    numBlocks_ = (bits + kBlockBits - 1) / kBlockBits;
+    allocate_();
+  }
+
+  inline void add(uint64_t key) {
+    uint64_t h = mix_(key);
+    uint64_t* b = const_cast<uint64_t*>(block_(h));
+    uint32_t x = static_cast<uint32_t>(h);
+    for (uint32_t i = 0; i < kWordsPerBlock; ++i) {
+      b[i] |= uint64_t(1) << bit_(x, i);
+    }
+  }
+
+  // False if key was certainly never added
+  inline bool contains(uint64_t key) const {
+    uint64_t h = mix_(key);
+    const uint64_t* b = block_(h);
+    uint32_t x = static_cast<uint32_t>(h);
+    for (uint32_t i = 0; i < kWordsPerBlock; ++i) {
+      if (!((b[i] >> bit_(x, i)) & 1)) { return false; }
+    }
+    return true;
+  }
+
+  inline void prefetch(uint64_t key) const { __builtin_prefetch(block_(mix_(key))); }
+
+  inline bool empty() const { return numBlocks_ == 0; }
+  inline uint64_t bytes() const { return numBlocks_ * kBlockBits / 8; }
+
+  template <typename Archive> void save(Archive& ar) const {
+    std::vector<uint64_t> words(blocks_, blocks_ + numBlocks_ * kWordsPerBlock);
+    ar(numBlocks_, words);
+  }
+
+  template <typename Archive> void load(Archive& ar) {
+    std::vector<uint64_t> words;
+    ar(numBlocks_, words);
+    allocate_();
+    std::memcpy(blocks_, words.data(),
+                std::min<size_t>(words.size(), numBlocks_ * kWordsPerBlock) * sizeof(uint64_t));
+  }
+
+private:
+  static constexpr uint64_t kBlockBits = 64 * kWordsPerBlock;
+
+  // The bit set in word i of the block, from the low half x of the mix;
+  // each word has its own odd multiplier (as in the Parquet filter)
+  static inline uint32_t bit_(uint32_t x, uint32_t i) {
+    static constexpr uint32_t kSalts[kWordsPerBlock] = {
+        0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+        0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+    return (x * kSalts[i]) >> 26;
+  }
+
+  static inline uint64_t mix_(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+  }
+
+  // The block of a key is chosen by the high half of its mix
+  inline const uint64_t* block_(uint64_t h) const {
+    return blocks_ + ((h >> 32) * numBlocks_ >> 32) * kWordsPerBlock;
+  }
+
+  // The blocks start on a cache line, so a lookup touches only one
+  void allocate_() {
+    uint64_t* words = storage_.allocate(numBlocks_ * kWordsPerBlock + kWordsPerBlock - 1);
+    uintptr_t p = reinterpret_cast<uintptr_t>(words);
+    blocks_ = reinterpret_cast<uint64_t*>((p + 63) & ~static_cast<uintptr_t>(63));
+  }
+
+  uint64_t numBlocks_{0};
+  IndexArray<uint64_t> storage_;
+  uint64_t* blocks_{nullptr};
+};
+
+} // namespace utils
+} // namespace rapmap
+
+#endif // __RAPMAP_KMER_FILTER_HPP__
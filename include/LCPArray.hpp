@@ -0,0 +1,262 @@
+//
+// RapMap - Rapid and accurate mapping of short reads to transcriptomes using
+// quasi-mapping.
+// Copyright (C) 2015, 2016, 2017 Rob Patro, Avi Srivastava, Hirak Sarkar
+//
+// This file is part of RapMap.
+//
+// RapMap is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RapMap is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RapMap.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RAPMAP_LCP_ARRAY_HPP__
+#define __RAPMAP_LCP_ARRAY_HPP__
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "IndexArray.hpp"
+
+namespace rapmap {
+namespace utils {
+
+// LCP-LR entries are stored in 16 bits; this value means "at least this"
+constexpr uint16_t kMaxLCPLR = std::numeric_limits<uint16_t>::max();
+
+/**
+ * Build the LCP array of SA over text: lcp[i] is the length of the
+ * longest common prefix of the suffixes at rows i - 1 and i (and
+ * lcp[0] = 0).  This is Kasai et al.'s algorithm, which visits the
+ * suffixes in text order and uses the fact that the LCP of suffix p + 1
+ * with its predecessor is at least one less than that of suffix p.  SA
+ * may be pruned (see pruneSuffixArray); the bound is then only used when
+ * the suffix that would give it is in SA.
+ */
+template <typename IndexT>
+void buildLCPArray(const std::string& text, const std::vector<IndexT>& SA,
+                   std::vector<IndexT>& lcp) {
+  const int64_t n = static_cast<int64_t>(text.length());
+  const int64_t numRows = static_cast<int64_t>(SA.size());
+  lcp.assign(numRows, 0);
+  // The row of each suffix (-1 if it isn't in SA)
+  std::vector<IndexT> rank(n, static_cast<IndexT>(-1));
+  for (int64_t i = 0; i < numRows; ++i) { rank[SA[i]] = static_cast<IndexT>(i); }
+
+  int64_t h{0};
+  for (int64_t p = 0; p < n; ++p) {
+    int64_t r = static_cast<int64_t>(rank[p]);
+    if (r <= 0) {
+      h = 0;
+      continue;
+    }
+    int64_t q = static_cast<int64_t>(SA[r - 1]);
+    while (p + h < n and q + h < n and text[p + h] == text[q + h]) { ++h; }
+    lcp[r] = static_cast<IndexT>(h);
+    h = (h > 0 and q + 1 < n and rank[q + 1] != static_cast<IndexT>(-1)) ? h - 1 : 0;
+  }
+}
+
+namespace detail {
+// Fill in the LCP-LR entries of the search node (l, r) of the k-mer
+// interval [lb, ub), and return the minimum of lcp over (l, r], i.e. the
+// LCP of the suffixes at rows l and r.  The bounds lb - 1 and ub stand
+// for the k-mer itself (see buildLCPLR), and so share k bases with every
+// suffix of the interval.
+template <typename IndexT>
+uint64_t fillLCPLR(const std::vector<IndexT>& lcp, uint32_t k, int64_t lb,
+                   int64_t ub, int64_t l, int64_t r,
+                   std::vector<uint16_t>& llcp, std::vector<uint16_t>& rlcp) {
+  if (r - l == 1) {
+    return (r == lb or r == ub) ? k : static_cast<uint64_t>(lcp[r]);
+  }
+  int64_t c = (l + r) / 2;
+  uint64_t left = fillLCPLR(lcp, k, lb, ub, l, c, llcp, rlcp);
+  uint64_t right = fillLCPLR(lcp, k, lb, ub, c, r, llcp, rlcp);
+  llcp[c] = static_cast<uint16_t>(std::min<uint64_t>(left, kMaxLCPLR));
+  rlcp[c] = static_cast<uint16_t>(std::min<uint64_t>(right, kMaxLCPLR));
+  return std::min(left, right);
+}
+} // namespace detail
+
+/**
+ * Build the LCP-LR arrays used by SASearcher.  A search for a query
+ * whose first k bases match a k-mer starts from the bounds (lb - 1, ub)
+ * of the k-mer's interval and bisects them at c = (l + r) / 2, so every
+ * row of the interval is the midpoint of exactly one node (l, r) of that
+ * search.  For row c, llcp[c] is the LCP of the suffixes at rows l and c,
+ * and rlcp[c] that of the suffixes at rows c and r, where the outer
+ * bounds are taken to be the k-mer itself (followed by a character
+ * smaller, or larger, than any other).  The k-mer intervals are exactly
+ * the maximal runs of rows whose LCP with their predecessor is >= k.
+ */
+template <typename IndexT>
+void buildLCPLR(const std::vector<IndexT>& lcp, uint32_t k,
+                std::vector<uint16_t>& llcp, std::vector<uint16_t>& rlcp) {
+  const int64_t numRows = static_cast<int64_t>(lcp.size());
+  llcp.assign(numRows, 0);
+  rlcp.assign(numRows, 0);
+  int64_t lb{0};
+  for (int64_t i = 1; i <= numRows; ++i) {
+    if (i == numRows or static_cast<uint64_t>(lcp[i]) < k) {
+      // (an interval of one row is never searched)
+      if (i - lb > 1) { detail::fillLCPLR(lcp, k, lb, i, lb - 1, i, llcp, rlcp); }
+      lb = i;
+    }
+  }
+}
+
+/**
+ * Build the child table of the enhanced suffix array (Abouelhoda, Kurtz
+ * and Ohlebusch, 2004) from the LCP array, in its single-array form.  The
+ * lcp-interval [i..j] (the rows sharing a prefix of length l, the
+ * minimum of lcp over (i, j]) has child intervals delimited by its
+ * l-indices, the rows of (i, j] at which lcp is l.  The first l-index is
+ * up[j + 1] if lcp[i] <= lcp[j + 1], and down[i] otherwise; each
+ * l-index links to the next by nextlIndex.  For every row at most one of
+ * up[i + 1] (stored when lcp[i] > lcp[i + 1]), nextlIndex[i] and down[i]
+ * (needed only when nextlIndex[i] is undefined) is used, so the three
+ * share cld[i].  Here lcp is taken to be -1 at rows 0 and n.
+ */
+template <typename IndexT>
+void buildChildTable(const std::vector<IndexT>& lcp, std::vector<IndexT>& cld) {
+  const int64_t n = static_cast<int64_t>(lcp.size());
+  cld.assign(n, 0);
+  auto L = [&lcp, n](int64_t i) -> int64_t {
+    return (i == 0 or i >= n) ? -1 : static_cast<int64_t>(lcp[i]);
+  };
+  std::vector<int64_t> stack;
+  // up and down
+  stack.push_back(0);
+  int64_t lastIndex{-1};
+  for (int64_t i = 1; i <= n; ++i) {
+    while (L(i) < L(stack.back())) {
+      lastIndex = stack.back();
+      stack.pop_back();
+      int64_t top = stack.back();
+      if (L(i) <= L(top) and L(top) != L(lastIndex)) {
+        cld[top] = static_cast<IndexT>(lastIndex);
+      }
+    }
+    if (lastIndex != -1) {
+      cld[i - 1] = static_cast<IndexT>(lastIndex);
+      lastIndex = -1;
+    }
+    stack.push_back(i);
+  }
+  // nextlIndex (which takes precedence over down)
+  stack.clear();
+  stack.push_back(0);
+  for (int64_t i = 1; i <= n; ++i) {
+    while (L(i) < L(stack.back())) { stack.pop_back(); }
+    if (L(i) == L(stack.back())) {
+      int64_t top = stack.back();
+      stack.pop_back();
+      if (i < n) { cld[top] = static_cast<IndexT>(i); }
+    }
+    stack.push_back(i);
+  }
+}
+
+/**
+ * A range-minimum structure over the LCP array, with which the longest
+ * common extension of the suffixes at any two rows i < j (the minimum of
+ * lcp over (i, j]) is found in constant time.  The LCP values are stored
+ * in 16 bits (saturating at kMaxLCPLR, far longer than any read), and
+ * split into blocks of kBlockRows; a sparse table holds the minimum of
+ * every power-of-two run of blocks.  A query then reads two entries of
+ * the table and scans (at most) the ends of two blocks.
+ */
+class LCPRangeMin {
+public:
+  static constexpr uint64_t kBlockRows = 32;
+
+  template <typename IndexT>
+  void build(const std::vector<IndexT>& lcp) {
+    uint64_t n = lcp.size();
+    std::vector<uint16_t> lcp16(n);
+    for (uint64_t i = 0; i < n; ++i) {
+      lcp16[i] = static_cast<uint16_t>(std::min<uint64_t>(lcp[i], kMaxLCPLR));
+    }
+    numBlocks_ = (n + kBlockRows - 1) / kBlockRows;
+    uint64_t numLevels{1};
+    while ((uint64_t(1) << numLevels) <= numBlocks_) { ++numLevels; }
+    std::vector<uint16_t> table(numLevels * numBlocks_, kMaxLCPLR);
+    for (uint64_t i = 0; i < n; ++i) {
+      auto& m = table[i / kBlockRows];
+      m = std::min(m, lcp16[i]);
+    }
+    for (uint64_t level = 1; level < numLevels; ++level) {
+      uint64_t half = uint64_t(1) << (level - 1);
+      uint16_t* prev = table.data() + (level - 1) * numBlocks_;
+      uint16_t* cur = table.data() + level * numBlocks_;
+      for (uint64_t b = 0; b + 2 * half <= numBlocks_; ++b) {
+        cur[b] = std::min(prev[b], prev[b + half]);
+      }
+    }
+    lcp_.assign(std::move(lcp16));
+    table_.assign(std::move(table));
+  }
+
+  inline bool empty() const { return lcp_.empty(); }
+  inline size_t size() const { return lcp_.size(); }
+  // lcp[i], saturated at kMaxLCPLR
+  inline uint16_t operator[](uint64_t i) const { return lcp_[i]; }
+  inline uint64_t bytes() const {
+    return (lcp_.size() + table_.size()) * sizeof(uint16_t);
+  }
+
+  // The minimum of lcp over [i, j] (i <= j), saturated at kMaxLCPLR
+  inline uint16_t query(uint64_t i, uint64_t j) const {
+    uint64_t bi = i / kBlockRows;
+    uint64_t bj = j / kBlockRows;
+    if (bi == bj) { return scan_(i, j + 1); }
+    uint16_t m = std::min(scan_(i, (bi + 1) * kBlockRows), scan_(bj * kBlockRows, j + 1));
+    if (bj - bi > 1) {
+      uint64_t lo = bi + 1;
+      uint64_t hi = bj - 1;
+      uint64_t level = 63 - __builtin_clzll(hi - lo + 1);
+      const uint16_t* row = table_.data() + level * numBlocks_;
+      m = std::min(m, std::min(row[lo], row[hi + 1 - (uint64_t(1) << level)]));
+    }
+    return m;
+  }
+
+  template <typename Archive> void save(Archive& ar) const {
+    ar(numBlocks_, lcp_, table_);
+  }
+
+  template <typename Archive> void load(Archive& ar) {
+    ar(numBlocks_, lcp_, table_);
+  }
+
+private:
+  inline uint16_t scan_(uint64_t b, uint64_t e) const {
+    uint16_t m = kMaxLCPLR;
+    for (const uint16_t* p = lcp_.data() + b; p < lcp_.data() + e; ++p) {
+      m = std::min(m, *p);
+    }
+    return m;
+  }
+
+  uint64_t numBlocks_{0};
+  IndexArray<uint16_t> lcp_;
+  IndexArray<uint16_t> table_;
+};
+
+} // namespace utils
+} // namespace rapmap
+
+#endif // __RAPMAP_LCP_ARRAY_HPP__
@@ -0,0 +1,63 @@
+//
+// RapMap - Rapid and accurate mapping of short reads to transcriptomes using
+// quasi-mapping.
+// Copyright (C) 2015, 2016, 2017 Rob Patro, Avi Srivastava, Hirak Sarkar
+//
+// This file is part of RapMap.
+//
+// RapMap is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RapMap is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RapMap.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef __RAPMAP_MAPPING_WORKSPACE_HPP__
+#define __RAPMAP_MAPPING_WORKSPACE_HPP__
+
+#include <cstdint>
+#include <vector>
+
+#include "FastxParser.hpp"
+#include "RapMapUtils.hpp"
+#include "SACollector.hpp"
+#include "SASearcher.hpp"
+
+/**
+ * Everything a mapping thread needs per read, owned by the thread and
+ * reused from read to read (and chunk to chunk): the vectors are only
+ * ever cleared, so once they have grown to the largest read / chunk seen,
+ * mapping a read allocates nothing.  The collector keeps its own scratch
+ * (k-mer scores, SA intervals, the hit intersection) the same way.
+ */
+template <typename RapMapIndexT, uint32_t K = 0> struct MappingWorkspace {
+  using CollectorT = SACollector<RapMapIndexT, K>;
+  using SearcherT = SASearcher<RapMapIndexT, K>;
+
+  MappingWorkspace(RapMapIndexT* rmi) : collector(rmi), searcher(rmi) {}
+
+  CollectorT collector;
+  SearcherT searcher;
+
+  // The reads of the current chunk (for paired-end reads, the left then
+  // the right mate of each pair), and the first hit of each
+  std::vector<const fastx_parser::ReadSeq*> readSeqs;
+  std::vector<typename CollectorT::FirstHit> firstHits;
+
+  // The hits of a single-end read, or of the mates of a pair and of the
+  // pair itself
+  std::vector<rapmap::utils::QuasiAlignment> hits;
+  std::vector<rapmap::utils::QuasiAlignment> leftHits;
+  std::vector<rapmap::utils::QuasiAlignment> rightHits;
+  std::vector<rapmap::utils::QuasiAlignment> jointHits;
+};
+
+#endif // __RAPMAP_MAPPING_WORKSPACE_HPP__
@@ -0,0 +1,111 @@
+//
+// RapMap - Rapid and accurate mapping of short reads to transcriptomes using
+// quasi-mapping.
+// Copyright (C) 2015, 2016, 2017 Rob Patro, Avi Srivastava, Hirak Sarkar
+//
+// This file is part of RapMap.
+//
+// RapMap is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RapMap is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RapMap.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RAPMAP_MATCH_KERNELS_HPP__
+#define __RAPMAP_MATCH_KERNELS_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define RAPMAP_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+namespace rapmap {
+namespace utils {
+
+/**
+ * Kernels that return the first offset i < len at which a[i] != b[i] (or
+ * len if there is none), comparing many bytes per step.  The SIMD
+ * versions are compiled for their instruction set regardless of the
+ * flags of the build, and mismatchKernel() picks the widest one the CPU
+ * running the program supports, so a binary built for one machine is
+ * still correct (and fast) on another.  None of them read past len.
+ */
+using MismatchFn = size_t (*)(const char* a, const char* b, size_t len);
+
+namespace detail {
+// 8 bytes at a time, with XOR and count-trailing-zeros (the bytes are
+// loaded little-endian, so the first byte is the lowest)
+inline size_t mismatchWords(const char* a, const char* b, size_t len) {
+  size_t i{0};
+  for (; i + 8 <= len; i += 8) {
+    uint64_t wa, wb;
+    std::memcpy(&wa, a + i, 8);
+    std::memcpy(&wb, b + i, 8);
+    uint64_t diff = wa ^ wb;
+    if (diff != 0) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+      return i + (__builtin_clzll(diff) >> 3);
+#else
+      return i + (__builtin_ctzll(diff) >> 3);
+#endif
+    }
+  }
+  while (i < len and a[i] == b[i]) { ++i; }
+  return i;
+}
+
+#ifdef RAPMAP_X86_KERNELS
+// 16 bytes at a time
+__attribute__((target("sse2")))
+inline size_t mismatchSSE2(const char* a, const char* b, size_t len) {
+  size_t i{0};
+  for (; i + 16 <= len; i += 16) {
+    __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+    __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    uint32_t eq = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)));
+    if (eq != 0xFFFF) { return i + __builtin_ctz(~eq); }
+  }
+  return i + mismatchWords(a + i, b + i, len - i);
+}
+
+// 32 bytes at a time
+__attribute__((target("avx2")))
+inline size_t mismatchAVX2(const char* a, const char* b, size_t len) {
+  size_t i{0};
+  for (; i + 32 <= len; i += 32) {
+    __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+    uint32_t eq = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)));
+    if (eq != 0xFFFFFFFFu) { return i + __builtin_ctz(~eq); }
+  }
+  return i + mismatchSSE2(a + i, b + i, len - i);
+}
+#endif // RAPMAP_X86_KERNELS
+} // namespace detail
+
+// The fastest kernel that this CPU supports
+inline MismatchFn mismatchKernel() {
+#ifdef RAPMAP_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) { return detail::mismatchAVX2; }
+  if (__builtin_cpu_supports("sse2")) { return detail::mismatchSSE2; }
+#endif
+  return detail::mismatchWords;
+}
+
+} // namespace utils
+} // namespace rapmap
+
+#endif // __RAPMAP_MATCH_KERNELS_HPP__
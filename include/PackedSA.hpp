@@ -0,0 +1,138 @@
+//
+// RapMap - Rapid and accurate mapping of short reads to transcriptomes using
+// quasi-mapping.
+// Copyright (C) 2015, 2016, 2017 Rob Patro, Avi Srivastava, Hirak Sarkar
+//
+// This file is part of RapMap.
+//
+// RapMap is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RapMap is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RapMap.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RAPMAP_PACKED_SA_HPP__
+#define __RAPMAP_PACKED_SA_HPP__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "IndexArray.hpp"
+
+namespace rapmap {
+namespace utils {
+
+/**
+ * A suffix array whose entries are stored with exactly as many bits as
+ * are required to address the text (ceil(log2 n) bits for a text of
+ * length n), rather than in a 32- or 64-bit integer.  It is indexed
+ * like the IndexArray it replaces, but elements are returned by value.
+ *
+ * The whole array lives in a single vector of words (its "image"): the
+ * number of entries, the width of each entry, and then the entries
+ * themselves, packed LSB-first.  The image ends with a padding word so
+ * that any entry can be read with two (unconditional) word loads.  The
+ * image can be owned or borrowed (e.g. from a flat index) exactly as
+ * with an IndexArray.
+ */
+template <typename IndexT>
+class PackedSA {
+public:
+  using value_type = IndexT;
+  static constexpr size_t kHeaderWords = 2;
+
+  PackedSA() : len_(0), width_(0), mask_(0), words_(nullptr) {}
+  PackedSA(const PackedSA&) = delete;
+  PackedSA& operator=(const PackedSA&) = delete;
+
+  // The number of bits needed to store every value in [0, n)
+  static uint32_t widthFor(uint64_t n) {
+    uint32_t w{1};
+    while (w < 64 and (uint64_t(1) << w) < n) { ++w; }
+    return w;
+  }
+
+  // The number of words in the image of n entries of width w
+  static size_t imageWords(uint64_t n, uint32_t w) {
+    return kHeaderWords + (n * w + 63) / 64 + 1;
+  }
+
+  // Build the image of sa (which, if it has been pruned, may hold fewer
+  // entries than the text it addresses)
+  template <typename SAIndexT>
+  static std::vector<uint64_t> pack(const std::vector<SAIndexT>& sa) {
+    uint64_t n = sa.size();
+    uint64_t maxVal{0};
+    for (auto v : sa) {
+      maxVal = std::max(maxVal, static_cast<uint64_t>(v));
+    }
+    uint32_t w = widthFor(maxVal + 1);
+    std::vector<uint64_t> image(imageWords(n, w), 0);
+    image[0] = n;
+    image[1] = w;
+    uint64_t* words = image.data() + kHeaderWords;
+    for (uint64_t i = 0; i < n; ++i) {
+      uint64_t v = static_cast<uint64_t>(sa[i]);
+      uint64_t p = i * w;
+      uint32_t off = p & 63;
+      words[p >> 6] |= v << off;
+      if (off + w > 64) {
+        words[(p >> 6) + 1] |= v >> (64 - off);
+      }
+    }
+    return image;
+  }
+
+  // The image; once it has been filled in (or borrowed), call init()
+  IndexArray<uint64_t>& image() { return image_; }
+  const IndexArray<uint64_t>& image() const { return image_; }
+
+  // Interpret the image; returns false if it is malformed
+  bool init() {
+    if (image_.size() < kHeaderWords) { return false; }
+    uint64_t n = image_[0];
+    uint64_t w = image_[1];
+    if (w == 0 or w > 64 or image_.size() != imageWords(n, w)) { return false; }
+    len_ = n;
+    width_ = static_cast<uint32_t>(w);
+    mask_ = (w == 64) ? ~uint64_t(0) : ((uint64_t(1) << w) - 1);
+    words_ = image_.data() + kHeaderWords;
+    return true;
+  }
+
+  inline size_t size() const { return len_; }
+  inline bool empty() const { return len_ == 0; }
+  inline uint32_t width() const { return width_; }
+  inline uint64_t bytes() const { return image_.size() * sizeof(uint64_t); }
+
+  inline IndexT operator[](uint64_t i) const {
+    uint64_t p = i * width_;
+    uint32_t off = p & 63;
+    const uint64_t* w = words_ + (p >> 6);
+    // the double shift is 0 (rather than undefined) when off == 0
+    uint64_t v = (w[0] >> off) | ((w[1] << 1) << (63 - off));
+    return static_cast<IndexT>(v & mask_);
+  }
+
+private:
+  IndexArray<uint64_t> image_;
+  uint64_t len_;
+  uint32_t width_;
+  uint64_t mask_;
+  const uint64_t* words_;
+};
+
+} // namespace utils
+} // namespace rapmap
+
+#endif // __RAPMAP_PACKED_SA_HPP__
@@ -0,0 +1,140 @@
+//
+// RapMap - Rapid and accurate mapping of short reads to transcriptomes using
+// quasi-mapping.
+// Copyright (C) 2015, 2016, 2017 Rob Patro, Avi Srivastava, Hirak Sarkar
+//
+// This file is part of RapMap.
+//
+// RapMap is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RapMap is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RapMap.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RAPMAP_PACKED_TEXT_HPP__
+#define __RAPMAP_PACKED_TEXT_HPP__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "IndexArray.hpp"
+
+namespace rapmap {
+namespace utils {
+
+/**
+ * The concatenated reference text stored with 2 bits per base (32
+ * bases per word).  Bases are packed with the first base in the
+ * high-order bits of each word, using the same encoding as my_mer
+ * (A=0, C=1, G=2, T=3), so that a window of the packed text can be
+ * compared directly against an encoded k-mer or query.
+ *
+ * The '$' separators are not representable in 2 bits (they are packed
+ * as 'A'); instead, they are marked in the boundary bit vector that the
+ * index already keeps for rank queries (bit i set iff text[i] == '$').
+ */
+class PackedText {
+public:
+  static constexpr uint32_t kBasesPerWord = 32;
+
+  PackedText() : len_(0), bits_(nullptr), numBitWords_(0) {}
+  PackedText(const PackedText&) = delete;
+  PackedText& operator=(const PackedText&) = delete;
+
+  // Pack text (any character other than C, G or T is packed as 'A')
+  static std::vector<uint64_t> pack(const std::string& text) {
+    std::vector<uint64_t> words((text.length() + kBasesPerWord - 1) / kBasesPerWord, 0);
+    for (size_t i = 0; i < text.length(); ++i) {
+      uint64_t c{0};
+      switch (text[i]) {
+      case 'C': c = 1; break;
+      case 'G': c = 2; break;
+      case 'T': c = 3; break;
+      default: c = 0; break;
+      }
+      words[i / kBasesPerWord] |= c << (62 - 2 * (i % kBasesPerWord));
+    }
+    return words;
+  }
+
+  static size_t numWords(uint64_t len) {
+    return (len + kBasesPerWord - 1) / kBasesPerWord;
+  }
+
+  // The words of the packed text and the number of bases they hold
+  IndexArray<uint64_t>& words() { return words_; }
+  const IndexArray<uint64_t>& words() const { return words_; }
+  void setLength(uint64_t len) { len_ = len; }
+
+  // The '$' bit vector; this is owned by the index
+  void setBoundaries(const uint64_t* bits, size_t numBitWords) {
+    bits_ = bits;
+    numBitWords_ = numBitWords;
+  }
+
+  inline uint64_t length() const { return len_; }
+  inline bool empty() const { return len_ == 0; }
+
+  inline uint64_t code(uint64_t i) const {
+    return (words_[i / kBasesPerWord] >> (62 - 2 * (i % kBasesPerWord))) & 0x3;
+  }
+
+  inline bool isBoundary(uint64_t i) const {
+    return (bits_[i >> 6] >> (i & 63)) & 0x1;
+  }
+
+  // The character at position i, exactly as it appears in the
+  // unpacked text.
+  inline char operator[](uint64_t i) const {
+    return isBoundary(i) ? '$' : "ACGT"[code(i)];
+  }
+
+  // The 32 bases starting at position i, with base i in the high-order
+  // bits (bases past the end of the text are 'A').
+  inline uint64_t window(uint64_t i) const {
+    size_t w = i / kBasesPerWord;
+    uint32_t off = 2 * (i % kBasesPerWord);
+    uint64_t win = words_[w] << off;
+    if (off > 0 and w + 1 < words_.size()) {
+      win |= words_[w + 1] >> (64 - off);
+    }
+    return win;
+  }
+
+  // The encoded k-mer starting at position i (k <= 31)
+  inline uint64_t kmer(uint64_t i, uint32_t k) const {
+    return window(i) >> (64 - 2 * k);
+  }
+
+  // The number of positions, starting at i, that precede the next '$'
+  // (capped at 64).
+  inline uint32_t distToBoundary(uint64_t i) const {
+    size_t w = i >> 6;
+    uint32_t off = i & 63;
+    uint64_t win = bits_[w] >> off;
+    if (off > 0 and w + 1 < numBitWords_) {
+      win |= bits_[w + 1] << (64 - off);
+    }
+    return (win == 0) ? 64 : static_cast<uint32_t>(__builtin_ctzll(win));
+  }
+
+private:
+  IndexArray<uint64_t> words_;
+  uint64_t len_;
+  const uint64_t* bits_;
+  size_t numBitWords_;
+};
+
+} // namespace utils
+} // namespace rapmap
+
+#endif // __RAPMAP_PACKED_TEXT_HPP__
@@ -0,0 +1,212 @@
+//
+// RapMap - Rapid and accurate mapping of short reads to transcriptomes using
+// quasi-mapping.
+// Copyright (C) 2015, 2016, 2017 Rob Patro, Avi Srivastava, Hirak Sarkar
+//
+// This file is part of RapMap.
+//
+// RapMap is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RapMap is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RapMap.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RAPMAP_PARALLEL_SUFFIX_SORT_HPP__
+#define __RAPMAP_PARALLEL_SUFFIX_SORT_HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace rapmap {
+namespace utils {
+
+namespace detail {
+// Call fn(t) for every t in [0, numThreads), each on its own thread (the
+// calling thread runs t = 0).
+template <typename FnT>
+void runOnThreads(uint32_t numThreads, FnT fn) {
+  std::vector<std::thread> threads;
+  for (uint32_t t = 1; t < numThreads; ++t) {
+    threads.emplace_back(fn, t);
+  }
+  fn(0);
+  for (auto& t : threads) { t.join(); }
+}
+
+// Call fn(i, key) for every i in [lo, hi), where key packs the codes of
+// the k characters at i (bits bits each, the first in the high bits).
+template <typename FnT>
+void forEachKey(const unsigned char* text, int64_t n, const uint32_t* code,
+                uint32_t bits, uint32_t k, int64_t lo, int64_t hi, FnT fn) {
+  if (lo >= hi) { return; }
+  const uint64_t keyMask = (uint64_t(1) << (bits * k)) - 1;
+  uint64_t key{0};
+  for (uint32_t j = 0; j < k; ++j) {
+    key = (key << bits) | ((lo + j < n) ? code[text[lo + j]] : 0);
+  }
+  for (int64_t i = lo; i < hi; ++i) {
+    fn(i, key);
+    int64_t nextPos = i + k;
+    key = ((key << bits) & keyMask) | ((nextPos < n) ? code[text[nextPos]] : 0);
+  }
+}
+} // namespace detail
+
+/**
+ * Build the suffix array of text with numThreads threads by prefix
+ * doubling.  The suffixes are first bucketed (with a parallel counting
+ * sort) by their first few characters; then, in each round, every group
+ * of suffixes that share their first h characters is sorted by the rank
+ * of the suffix h characters further along, which orders the group by
+ * its first 2h characters.  Groups are sorted independently, so the work
+ * of a round is spread over the threads, and a round only touches the
+ * suffixes that aren't yet in their final place.
+ *
+ * The suffix array of a text is unique, so the result is identical to
+ * that of divsufsort (bytes are compared as unsigned, and a suffix sorts
+ * before every suffix of which it is a prefix).  This needs an extra
+ * rank array and a byte per suffix beyond the suffix array itself.
+ */
+template <typename IndexT>
+void parallelSuffixSort(const std::string& text, std::vector<IndexT>& SA,
+                        uint32_t numThreads) {
+  using GroupT = std::pair<IndexT, IndexT>;
+  const int64_t n = static_cast<int64_t>(text.length());
+  SA.assign(n, 0);
+  if (n == 0) { return; }
+  numThreads = std::max(numThreads, 1u);
+  const unsigned char* t = reinterpret_cast<const unsigned char*>(text.data());
+
+  // Map the bytes of the text to 1 .. sigma; 0 is "past the end"
+  uint32_t code[256] = {0};
+  for (int64_t i = 0; i < n; ++i) { code[t[i]] = 1; }
+  uint32_t sigma{0};
+  for (uint32_t c = 0; c < 256; ++c) {
+    if (code[c]) { code[c] = ++sigma; }
+  }
+  uint32_t bits{1};
+  while ((1u << bits) < sigma + 1) { ++bits; }
+  // The number of characters in the key of the initial bucketing
+  const uint32_t k0 = std::max(1u, 18 / bits);
+  const uint64_t numBuckets = uint64_t(1) << (bits * k0);
+
+  auto chunkStart = [n, numThreads](uint32_t i) -> int64_t {
+    return (n * static_cast<int64_t>(i)) / numThreads;
+  };
+
+  // Bucket the suffixes by their first k0 characters
+  std::vector<std::vector<IndexT>> counts(numThreads);
+  detail::runOnThreads(numThreads, [&](uint32_t tid) {
+    counts[tid].assign(numBuckets, 0);
+    auto& cnt = counts[tid];
+    detail::forEachKey(t, n, code, bits, k0, chunkStart(tid), chunkStart(tid + 1),
+                       [&cnt](int64_t, uint64_t key) { ++cnt[key]; });
+  });
+  std::vector<IndexT> bucketEnd(numBuckets, 0);
+  std::vector<GroupT> groups;
+  {
+    IndexT offset{0};
+    for (uint64_t b = 0; b < numBuckets; ++b) {
+      IndexT bucketStart = offset;
+      for (uint32_t tid = 0; tid < numThreads; ++tid) {
+        IndexT c = counts[tid][b];
+        counts[tid][b] = offset;
+        offset += c;
+      }
+      bucketEnd[b] = offset;
+      if (offset - bucketStart > 1) { groups.emplace_back(bucketStart, offset); }
+    }
+  }
+  // The rank of a suffix is the last row of its group
+  std::vector<IndexT> rank(n, 0);
+  detail::runOnThreads(numThreads, [&](uint32_t tid) {
+    auto& next = counts[tid];
+    detail::forEachKey(t, n, code, bits, k0, chunkStart(tid), chunkStart(tid + 1),
+                       [&](int64_t i, uint64_t key) {
+      SA[next[key]++] = static_cast<IndexT>(i);
+      rank[i] = bucketEnd[key] - 1;
+    });
+  });
+  counts.clear();
+  counts.shrink_to_fit();
+  bucketEnd.clear();
+  bucketEnd.shrink_to_fit();
+
+  // Groups are handed to the threads in batches
+  const size_t kBatch = 256;
+  // head[j] is set if row j starts a group in the current round
+  std::vector<uint8_t> head(n, 0);
+  int64_t h = k0;
+  while (!groups.empty()) {
+    // Sort each group by the rank of its suffixes h characters on
+    std::atomic<size_t> nextGroup{0};
+    detail::runOnThreads(numThreads, [&](uint32_t) {
+      std::vector<std::pair<IndexT, IndexT>> buf;
+      size_t first;
+      while ((first = nextGroup.fetch_add(kBatch)) < groups.size()) {
+        size_t last = std::min(groups.size(), first + kBatch);
+        for (size_t g = first; g < last; ++g) {
+          IndexT s = groups[g].first, e = groups[g].second;
+          buf.clear();
+          for (IndexT j = s; j < e; ++j) {
+            int64_t p = static_cast<int64_t>(SA[j]) + h;
+            buf.emplace_back((p < n) ? rank[p] : static_cast<IndexT>(-1), SA[j]);
+          }
+          std::sort(buf.begin(), buf.end());
+          for (IndexT j = s; j < e; ++j) {
+            size_t b = j - s;
+            SA[j] = buf[b].second;
+            head[j] = (b == 0 or buf[b].first != buf[b - 1].first);
+          }
+        }
+      }
+    });
+
+    // Then re-rank the suffixes (only once every group has been sorted,
+    // since the sort reads the ranks of other groups), and collect the
+    // groups that still have to be split
+    nextGroup = 0;
+    std::vector<std::vector<GroupT>> nextGroups(numThreads);
+    detail::runOnThreads(numThreads, [&](uint32_t tid) {
+      auto& out = nextGroups[tid];
+      size_t first;
+      while ((first = nextGroup.fetch_add(kBatch)) < groups.size()) {
+        size_t last = std::min(groups.size(), first + kBatch);
+        for (size_t g = first; g < last; ++g) {
+          IndexT s = groups[g].first, e = groups[g].second;
+          IndexT j = s;
+          while (j < e) {
+            IndexT k = j + 1;
+            while (k < e and !head[k]) { ++k; }
+            for (IndexT r = j; r < k; ++r) { rank[SA[r]] = k - 1; }
+            if (k - j > 1) { out.emplace_back(j, k); }
+            j = k;
+          }
+        }
+      }
+    });
+    groups.clear();
+    for (auto& ng : nextGroups) {
+      groups.insert(groups.end(), ng.begin(), ng.end());
+    }
+    h *= 2;
+  }
+}
+
+} // namespace utils
+} // namespace rapmap
+
+#endif // __RAPMAP_PARALLEL_SUFFIX_SORT_HPP__
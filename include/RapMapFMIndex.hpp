@@ -0,0 +1,99 @@
+//
+// RapMap - Rapid and accurate mapping of short reads to transcriptomes using
+// quasi-mapping.
+// Copyright (C) 2015, 2016, 2017 Rob Patro, Avi Srivastava, Hirak Sarkar
+//
+// This file is part of RapMap.
+//
+// RapMap is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RapMap is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RapMap.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RAPMAP_FM_INDEX_RMI_HPP__
+#define __RAPMAP_FM_INDEX_RMI_HPP__
+
+#include "bit_array.h"
+#include "rank9b.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "RapMapUtils.hpp"
+#include "IndexArray.hpp"
+#include "FMIndex.hpp"
+#include "KmerFilter.hpp"
+
+class IndexHeader;
+
+/**
+ * A quasi-index that replaces the suffix array and text with an
+ * FM-index of the reversed text (see FMIndex.hpp).  It exposes the same
+ * interface to SACollector and the hit manager as RapMapSAIndex, except
+ * that the k-mer hash maps to rows of the FM-index, and the position of
+ * a hit is recovered (by walking to a sampled row) only when it is
+ * asked for.  Only the regular (sparse) k-mer hash is supported, since
+ * the perfect hash needs the text to check its lookups.
+ */
+template <typename IndexT, typename HashT>
+class RapMapFMIndex {
+    public:
+    using IndexType = IndexT;
+    using HashType = HashT;
+
+      struct BitArrayDeleter {
+        void operator()(BIT_ARRAY* b) {
+          if(b != nullptr) {
+            bit_array_free(b);
+          }
+        }
+      };
+
+	  using BitArrayPointer = std::unique_ptr<BIT_ARRAY, BitArrayDeleter>;
+
+    RapMapFMIndex();
+
+  	// Given a position, p, in the concatenated text,
+  	// return the corresponding transcript
+  	IndexT transcriptAtPosition(IndexT p);
+
+    // The position in the text at which a match (of length len) found
+    // at row i of the FM-index begins
+    inline IndexT hitPosition(IndexT i, IndexT len) const {
+        return static_cast<IndexT>(fm.length() - fm.locate(i)) - len;
+    }
+
+    bool load(const std::string& indDir, uint32_t numThreads = 4);
+    // FM-indices can't (yet) be published in shared memory
+    bool attach(const std::string& memName, const IndexHeader& h);
+
+    // The length of the (concatenated) text
+    uint64_t textLength() const { return fm.length(); }
+
+    BitArrayPointer bitArray{nullptr};
+    std::unique_ptr<rank9b> rankDict{nullptr};
+
+    rapmap::utils::FMIndex<IndexT> fm;
+    std::vector<std::string> txpNames;
+    rapmap::utils::IndexArray<IndexT> txpOffsets;
+    rapmap::utils::IndexArray<IndexT> txpLens;
+    rapmap::utils::IndexArray<uint32_t> txpCompleteLens;
+    HashT khash;
+    // The hash of an FM-index is never canonical (its keys are reversed)
+    bool canonicalHash{false};
+    // and has no filter in front of it
+    rapmap::utils::KmerFilter kmerFilter;
+};
+
+#endif //__RAPMAP_FM_INDEX_RMI_HPP__
@@ -22,6 +22,8 @@
 #ifndef __RAPMAP_FILESYSTEM_HPP__
 #define __RAPMAP_FILESYSTEM_HPP__
 
+#include <cstdint>
+
 namespace rapmap {
     namespace fs {
         // Taken from http://stackoverflow.com/questions/12774207/fastest-way-to-check-if-a-file-exist-using-standard-c-c11-c
@@ -29,6 +31,12 @@ namespace rapmap {
         // Taken from http://stackoverflow.com/questions/12774207/fastest-way-to-check-if-a-file-exist-using-standard-c-c11-c
         bool DirExists(const char *path);
         void MakeDir(const char* path);
+        // The size of the file at path, in bytes (0 if it can't be stat'ed)
+        uint64_t FileSize(const char* path);
+        // Read bytes bytes starting at offset of the file at path into dst,
+        // splitting the read into numThreads slices that are read concurrently.
+        bool ParallelRead(const char* path, uint64_t offset, char* dst,
+                          uint64_t bytes, uint32_t numThreads);
     }
 }
 
@@ -42,12 +42,28 @@
 
 #include <fstream>
 #include "RapMapUtils.hpp"
-
-template <typename IndexT, typename HashT>
+#include "IndexArray.hpp"
+#include "PackedText.hpp"
+#include "PackedSA.hpp"
+#include "LCPArray.hpp"
+#include "SuffixFingerprints.hpp"
+#include "SampledSearchTree.hpp"
+#include "KmerFilter.hpp"
+#include "FlatIndex.hpp"
+#include "SharedIndex.hpp"
+
+class IndexHeader;
+class IndexLoadReport;
+
+// SAT is the container holding the suffix array; either a plain array
+// of IndexT or a rapmap::utils::PackedSA<IndexT>.
+template <typename IndexT, typename HashT,
+          typename SAT = rapmap::utils::IndexArray<IndexT>>
 class RapMapSAIndex {
     public:
     using IndexType = IndexT;
     using HashType = HashT;
+    using SAType = SAT;
 
       struct BitArrayDeleter {
         void operator()(BIT_ARRAY* b) {
@@ -65,21 +81,83 @@ class RapMapSAIndex {
   	// return the corresponding transcript
   	IndexT transcriptAtPosition(IndexT p);
 
-    bool load(const std::string& indDir);
+    // The position in the text at which a match (of length len) found
+    // at row i of the suffix array begins
+    inline IndexT hitPosition(IndexT i, IndexT len) const { return SA[i]; }
+
+    // Load the index in indDir; the components are loaded concurrently and
+    // large arrays are read using up to numThreads threads each.
+    bool load(const std::string& indDir, uint32_t numThreads = 4);
 
-    std::vector<IndexT> SA;
+    // Attach to an index previously published (by quasiload) into the
+    // shared memory segment memName; h is the header of that index.
+    bool attach(const std::string& memName, const IndexHeader& h);
+    // Publish this (loaded) index, read from indDir, into a new shared
+    // memory segment memName.
+    bool publish(const std::string& memName, const std::string& indDir,
+                 const IndexHeader& h);
+
+    SAT SA;
 
     BitArrayPointer bitArray{nullptr};
     std::unique_ptr<rank9b> rankDict{nullptr};
-
-    std::string seq;
+    // The words of the bit vector marking transcript boundaries
+    rapmap::utils::IndexArray<uint64_t> boundaryBits;
+
+    rapmap::utils::IndexArray<char> seq;
+    // If the index was built with a packed text, seq is empty and the
+    // text is held here instead.
+    bool packedText{false};
+    rapmap::utils::PackedText packedSeq;
+    // The length of the (concatenated) text, however it is stored
+    uint64_t textLength() const { return packedText ? packedSeq.length() : seq.length(); }
     std::vector<std::string> txpNames;
-    std::vector<IndexT> txpOffsets;
-    std::vector<IndexT> txpLens;
+    rapmap::utils::IndexArray<IndexT> txpOffsets;
+    rapmap::utils::IndexArray<IndexT> txpLens;
     std::vector<IndexT> positionIDs;
-    std::vector<uint32_t> txpCompleteLens;
+    rapmap::utils::IndexArray<uint32_t> txpCompleteLens;
     std::vector<rapmap::utils::SAIntervalWithKey<IndexT>> kintervals;
     HashT khash;
+    // If the index was built with --canonical, khash is keyed on canonical
+    // k-mers (see rapmap::utils::CanonicalKmer)
+    bool canonicalHash{false};
+    // If the index was built with --filterBits, the filter over the keys
+    // of khash that the mapper asks first; otherwise it is empty
+    rapmap::utils::KmerFilter kmerFilter;
+
+    // If the index was built with --lcp, the LCP-LR arrays (see
+    // LCPArray.hpp) with which SASearcher skips redundant comparisons;
+    // otherwise these are empty.
+    rapmap::utils::IndexArray<uint16_t> leftLCP;
+    rapmap::utils::IndexArray<uint16_t> rightLCP;
+    // If present, the range-minimum structure over the LCP array with
+    // which SASearcher::lce answers in constant time
+    rapmap::utils::LCPRangeMin lcpRMQ;
+    // If present, the child table of the enhanced suffix array (see
+    // buildChildTable), with which SASearcher descends from a k-mer
+    // interval to the MMP interval
+    rapmap::utils::IndexArray<IndexT> childTable;
+    // If the index was built with --fingerprints, the fingerprint of each
+    // row of SA (see SuffixFingerprints.hpp)
+    rapmap::utils::IndexArray<uint64_t> fingerprints;
+    // If the index was built with --sampledSearch, the samples of its
+    // large k-mer intervals
+    rapmap::utils::SampledSearchTree sampledSearch;
+
+    // If the index uses the flat layout, this is the mapping that
+    // SA, seq, etc. point into.
+    std::unique_ptr<rapmap::flat::FlatIndexView> flatIndex{nullptr};
+    // If the index was attached from shared memory, this is the segment
+    // that flatIndex and the hash point into.
+    std::unique_ptr<rapmap::shm::SharedIndexSegment> sharedSegment{nullptr};
+
+    private:
+    bool loadFlat_(const std::string& indDir, IndexLoadReport& report);
+    bool borrowFlatSections_();
+    bool loadSerialized_(const std::string& indDir, uint32_t numThreads,
+                         IndexLoadReport& report);
+    bool loadSearchTables_(const std::string& indDir, const IndexHeader& h,
+                           IndexLoadReport& report);
 };
 
 #endif //__RAPMAP_SA_INDEX_HPP__
@@ -24,6 +24,7 @@
 
 #include <atomic>
 #include <cmath>
+#include <limits>
 #include <memory>
 #include "xxhash.h"
 #include "sparsepp/spp.h"
@@ -191,6 +192,39 @@ namespace rapmap {
         //void save(Archive& ar) const { ar(begin_, len_); }
     };
 
+    /**
+     * The k-mer hash of an index built with --canonical is keyed on
+     * canonical k-mers (the smaller word of a k-mer and its reverse
+     * complement), so that one lookup answers for both strands.  The
+     * interval under the key c is that of c or, if only its reverse
+     * complement occurs in the text, that of rc(c).  Which of these it is,
+     * and whether both occur, are kept in the sign bits of the interval
+     * (SA rows are never negative).  When both occur, the interval of
+     * rc(c) is stored under rc(c), which is never itself a key.
+     */
+    struct CanonicalKmer {
+        // The key of the k-mer w, whose reverse complement is rcw
+        static inline uint64_t key(uint64_t w, uint64_t rcw) { return (w <= rcw) ? w : rcw; }
+
+        // Record in iv whether it is the interval of rc(c) (rather than
+        // of c), and whether both c and rc(c) occur
+        template <typename IndexT>
+        static inline void setFlags(SAInterval<IndexT>& iv, bool isRC, bool both) {
+            if (isRC) { iv.begin_ |= std::numeric_limits<IndexT>::min(); }
+            if (both) { iv.end_ |= std::numeric_limits<IndexT>::min(); }
+        }
+        template <typename IndexT>
+        static inline bool isRC(const SAInterval<IndexT>& iv) { return iv.begin_ < 0; }
+        template <typename IndexT>
+        static inline bool both(const SAInterval<IndexT>& iv) { return iv.end_ < 0; }
+        // iv without its flags
+        template <typename IndexT>
+        static inline SAInterval<IndexT> bounds(const SAInterval<IndexT>& iv) {
+            return {static_cast<IndexT>(iv.begin_ & std::numeric_limits<IndexT>::max()),
+                    static_cast<IndexT>(iv.end_ & std::numeric_limits<IndexT>::max())};
+        }
+    };
+
 
     struct HitCounters {
         std::atomic<uint64_t> peHits{0};
@@ -200,6 +234,8 @@ namespace rapmap {
         std::atomic<uint64_t> numReads{0};
         std::atomic<uint64_t> tooManyHits{0};
         std::atomic<uint64_t> lastPrint{0};
+        // heap allocations while mapping (see --countAllocs)
+        std::atomic<uint64_t> numAllocs{0};
     };
 
     class JFMerKeyHasher{
@@ -426,6 +462,59 @@ namespace rapmap {
 	bool queryRC, active;
     };
 
+    /**
+     * The check of ProcessedSAHit::checkConsistent on the hits (of one
+     * transcript) in [tqvec, tqend), which it may reorder.
+     */
+    template <typename IteratorT>
+    int32_t checkConsistentHits(IteratorT tqvec, IteratorT tqend,
+                                size_t readLen, int32_t numToCheck) {
+        auto numHits = std::distance(tqvec, tqend);
+
+        // special case for only 1 or two hits (common)
+        if (numHits == 1) {
+            return numToCheck;
+        } else if (numHits == 2) {
+            auto& h1 = (tqvec[0].queryPos < tqvec[1].queryPos) ? tqvec[0] : tqvec[1];
+            auto& h2 = (tqvec[0].queryPos < tqvec[1].queryPos) ? tqvec[1] : tqvec[0];
+            if (h2.pos > h1.pos) {
+                int32_t distortion = (h2.pos - h1.pos) - (h2.queryPos - h1.queryPos);
+                return (distortion > -10 and distortion < 10) ? numToCheck : -1;
+            } else {
+                return -1;
+            }
+            //return (h2.pos > h1.pos) ? (numToCheck) : -1;
+        } else {
+            // first, sort by query position
+            std::sort(tqvec, tqend,
+                      [](const SATxpQueryPos& q1, const SATxpQueryPos& q2) -> bool {
+                          return q1.queryPos < q2.queryPos;
+                      });
+
+            int32_t lastRefPos{std::numeric_limits<int32_t>::min()};
+            int32_t lastQueryPos{std::numeric_limits<int32_t>::min()};
+            bool firstHit{true};
+            //int32_t maxDistortion{0};
+            for (size_t i = 0; i < numToCheck; ++i) {
+                int32_t refPos = static_cast<int32_t>(tqvec[i].pos);
+                int32_t queryPos = static_cast<int32_t>(tqvec[i].queryPos);
+                if (refPos > lastRefPos) {
+                    int32_t distortion = 
+                        firstHit ? 0 : ((refPos - lastRefPos) - (queryPos - lastQueryPos));
+                    firstHit = false;
+                    if (distortion < -10 or distortion > 10) {
+                        return i;
+                    }
+                    lastRefPos = refPos;
+                    lastQueryPos = queryPos;
+                } else {
+                    return i;
+                }
+            }
+            return numToCheck;
+        }
+    }
+
     struct ProcessedSAHit {
 	    ProcessedSAHit() : tid(std::numeric_limits<uint32_t>::max()), active(false), numActive(1) {}
 
@@ -446,50 +535,7 @@ namespace rapmap {
          *         -1 otherwise
          **/
         int32_t checkConsistent(size_t readLen, int32_t numToCheck) {
-            auto numHits = tqvec.size();
-
-            // special case for only 1 or two hits (common)
-            if (numHits == 1) {
-                return numToCheck;
-            } else if (numHits == 2) {
-                auto& h1 = (tqvec[0].queryPos < tqvec[1].queryPos) ? tqvec[0] : tqvec[1];
-                auto& h2 = (tqvec[0].queryPos < tqvec[1].queryPos) ? tqvec[1] : tqvec[0];
-                if (h2.pos > h1.pos) {
-                    int32_t distortion = (h2.pos - h1.pos) - (h2.queryPos - h1.queryPos);
-                    return (distortion > -10 and distortion < 10) ? numToCheck : -1;
-                } else {
-                    return -1;
-                }
-                //return (h2.pos > h1.pos) ? (numToCheck) : -1;
-            } else {
-                // first, sort by query position
-                std::sort(tqvec.begin(), tqvec.end(),
-                          [](const SATxpQueryPos& q1, const SATxpQueryPos& q2) -> bool {
-                              return q1.queryPos < q2.queryPos;
-                          });
-
-                int32_t lastRefPos{std::numeric_limits<int32_t>::min()};
-                int32_t lastQueryPos{std::numeric_limits<int32_t>::min()};
-                bool firstHit{true};
-                //int32_t maxDistortion{0};
-                for (size_t i = 0; i < numToCheck; ++i) {
-                    int32_t refPos = static_cast<int32_t>(tqvec[i].pos);
-                    int32_t queryPos = static_cast<int32_t>(tqvec[i].queryPos);
-                    if (refPos > lastRefPos) {
-                        int32_t distortion = 
-                            firstHit ? 0 : ((refPos - lastRefPos) - (queryPos - lastQueryPos));
-                        firstHit = false;
-                        if (distortion < -10 or distortion > 10) {
-                            return i;
-                        }
-                        lastRefPos = refPos;
-                        lastQueryPos = queryPos;
-                    } else {
-                        return i;
-                    }
-                }
-                return numToCheck;
-            }
+            return checkConsistentHits(tqvec.begin(), tqvec.end(), readLen, numToCheck);
         }
 
 	    uint32_t tid;
@@ -0,0 +1,219 @@
+//
+// RapMap - Rapid and accurate mapping of short reads to transcriptomes using
+// quasi-mapping.
+// Copyright (C) 2015, 2016, 2017 Rob Patro, Avi Srivastava, Hirak Sarkar
+//
+// This file is part of RapMap.
+//
+// RapMap is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RapMap is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RapMap.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RAPMAP_ROLLING_KMER_ENCODER_HPP__
+#define __RAPMAP_ROLLING_KMER_ENCODER_HPP__
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "FixedKmer.hpp"
+
+namespace rapmap {
+namespace utils {
+
+/**
+ * The 2-bit (my_mer) encodings of every k-mer of a read, and of each
+ * k-mer's reverse complement, so that the collectors never rebuild a
+ * k-mer from its characters.  reset() notes where the read has a base
+ * other than A, C, G or T (in a bitmap) and packs the bases two bits
+ * apiece, unless the read comes already encoded (e.g. by the parser, see
+ * fastx_parser::EncodedSeq); the words are then rolled out,
+ * one base at a time and only as far as they are asked for, so each
+ * position costs O(1) whether it is reached by stepping or by jumping.
+ *
+ * The k-mers of the read's reverse complement are those of the read
+ * read backwards: the k-mer at p of the reverse complement is the
+ * reverse complement of the k-mer at len - k - p of the read.  Every
+ * query takes an isRC flag that asks about the reverse complement.
+ *
+ * With K > 0 the k-mer length is fixed at compile time (the k passed to
+ * reset() must then be K); with K = 0 it is the k passed to reset().
+ */
+template <uint32_t K = 0>
+class RollingKmerEncoder {
+public:
+  void reset(const std::string& read, uint32_t k) { reset(read.data(), read.length(), k); }
+
+  void reset(const char* read, size_t len, uint32_t k) {
+    packedBuf_.assign(len / 32 + 1, 0);
+    invalidBuf_.assign((len + 63) / 64, 0);
+    for (size_t i = 0; i < len; ++i) {
+      uint8_t c = code_(read[i]);
+      if (c > 3) {
+        invalidBuf_[i >> 6] |= uint64_t(1) << (i & 63);
+      } else {
+        packedBuf_[i >> 5] |= uint64_t(c) << (62 - 2 * (i & 31));
+      }
+    }
+    reset(packedBuf_.data(), invalidBuf_.data(), len, k);
+  }
+
+  // Use a read that's already encoded: packed holds its bases (A=0 ... T=3,
+  // 32 to a word, the first in the high bits) and bit i of invalid is set
+  // if base i isn't A, C, G or T.  Both must outlive the queries.
+  void reset(const uint64_t* packed, const uint64_t* invalid, size_t len, uint32_t k) {
+    runtimeK_ = k;
+    len_ = len;
+    packed_ = packed;
+    invalid_ = invalid;
+    invalidWords_ = (len + 63) / 64;
+    size_t numKmers = (len >= k_()) ? len - k_() + 1 : 0;
+    if (fwd_.size() < numKmers) {
+      fwd_.resize(numKmers);
+      rc_.resize(numKmers);
+    }
+    nextBase_ = 0;
+    fw_ = 0;
+    rcw_ = 0;
+  }
+
+  size_t length() const { return len_; }
+
+  // The k-mer at p (and its reverse complement); only meaningful if
+  // isValid(p, isRC)
+  inline uint64_t word(size_t p, bool isRC = false) {
+    return isRC ? rcAt_(mirror_(p)) : fwdAt_(p);
+  }
+  inline uint64_t rcWord(size_t p, bool isRC = false) {
+    return isRC ? fwdAt_(mirror_(p)) : rcAt_(p);
+  }
+
+  // Is every base of the k-mer at p one of A, C, G or T?
+  inline bool isValid(size_t p, bool isRC = false) const {
+    return noneInvalid_(isRC ? mirror_(p) : p);
+  }
+
+  inline bool isHomopolymer(size_t p, bool isRC = false) {
+    return Kmer::isHomopolymer(fwdAt_(isRC ? mirror_(p) : p), k_());
+  }
+
+  // The first position at or after p that isn't A, C, G or T (or npos)
+  inline size_t nextInvalid(size_t p, bool isRC = false) const {
+    if (!isRC) { return nextInvalid_(p); }
+    if (p >= len_) { return std::string::npos; }
+    size_t i = lastInvalid_(len_ - 1 - p);
+    return (i == std::string::npos) ? i : len_ - 1 - i;
+  }
+
+  // The last position at or before p (or the end of the read) that
+  // isn't A, C, G or T (or npos)
+  inline size_t lastInvalid(size_t p) const {
+    return (len_ == 0) ? std::string::npos : lastInvalid_(std::min(p, len_ - 1));
+  }
+
+private:
+  using Kmer = FixedKmer<K>;
+
+  // A, C, G, T (either case) are 0-3; anything else is 4
+  static inline uint8_t code_(char c) {
+    switch (c) {
+    case 'A': case 'a': return 0;
+    case 'C': case 'c': return 1;
+    case 'G': case 'g': return 2;
+    case 'T': case 't': return 3;
+    default: return 4;
+    }
+  }
+
+  inline uint32_t k_() const { return Kmer::len(runtimeK_); }
+  inline size_t mirror_(size_t p) const { return len_ - k_() - p; }
+
+  inline uint64_t fwdAt_(size_t p) {
+    if (p + k_() > nextBase_) { rollTo_(p + k_()); }
+    return fwd_[p];
+  }
+  inline uint64_t rcAt_(size_t p) {
+    if (p + k_() > nextBase_) { rollTo_(p + k_()); }
+    return rc_[p];
+  }
+
+  // Shift in the bases before end (an invalid base is shifted in as an
+  // A; the k-mers it's part of aren't valid anyway)
+  void rollTo_(size_t end) {
+    const uint32_t rcShift = 2 * k_() - 2;
+    for (; nextBase_ < end; ++nextBase_) {
+      uint64_t c = (packed_[nextBase_ >> 5] >> (62 - 2 * (nextBase_ & 31))) & 0x3;
+      fw_ = ((fw_ << 2) | c) & Kmer::mask(runtimeK_);
+      rcw_ = (rcw_ >> 2) | ((0x3 - c) << rcShift);
+      if (nextBase_ + 1 >= k_()) {
+        fwd_[nextBase_ + 1 - k_()] = fw_;
+        rc_[nextBase_ + 1 - k_()] = rcw_;
+      }
+    }
+  }
+
+  // Are the k bits of the bitmap from p on all clear (k < 64)?
+  inline bool noneInvalid_(size_t p) const {
+    size_t w = p >> 6;
+    uint32_t off = p & 63;
+    uint64_t bits = invalid_[w] >> off;
+    if (off + k_() > 64 and w + 1 < invalidWords_) { bits |= invalid_[w + 1] << (64 - off); }
+    return (bits & ((uint64_t(1) << k_()) - 1)) == 0;
+  }
+
+  size_t nextInvalid_(size_t p) const {
+    if (p >= len_) { return std::string::npos; }
+    size_t w = p >> 6;
+    uint64_t bits = invalid_[w] & (~uint64_t(0) << (p & 63));
+    while (bits == 0) {
+      if (++w >= invalidWords_) { return std::string::npos; }
+      bits = invalid_[w];
+    }
+    return (w << 6) + __builtin_ctzll(bits);
+  }
+
+  size_t lastInvalid_(size_t p) const {
+    size_t w = p >> 6;
+    uint32_t off = p & 63;
+    uint64_t bits = invalid_[w] & ((off == 63) ? ~uint64_t(0) : ((uint64_t(2) << off) - 1));
+    while (bits == 0) {
+      if (w == 0) { return std::string::npos; }
+      bits = invalid_[--w];
+    }
+    return (w << 6) + 63 - __builtin_clzll(bits);
+  }
+
+  // The k passed to reset() (only used if K is 0)
+  uint32_t runtimeK_{0};
+  size_t len_{0};
+  // The read's bases and invalid bitmap (in packedBuf_ and invalidBuf_
+  // unless the read came encoded)
+  const uint64_t* packed_{nullptr};
+  const uint64_t* invalid_{nullptr};
+  size_t invalidWords_{0};
+  std::vector<uint64_t> packedBuf_;
+  std::vector<uint64_t> invalidBuf_;
+  std::vector<uint64_t> fwd_;
+  std::vector<uint64_t> rc_;
+  // The rolling state: the next base to shift in, and the words ending
+  // just before it
+  size_t nextBase_{0};
+  uint64_t fw_{0};
+  uint64_t rcw_{0};
+};
+
+} // namespace utils
+} // namespace rapmap
+
+#endif // __RAPMAP_ROLLING_KMER_ENCODER_HPP__
@@ -25,14 +25,25 @@
 #include "RapMapSAIndex.hpp"
 #include "RapMapUtils.hpp"
 #include "SASearcher.hpp"
+#include "RollingKmerEncoder.hpp"
+#include "FixedKmer.hpp"
+#include "FastxParser.hpp"
 
 #include <algorithm>
 #include <iostream>
 #include <iterator>
+#include <utility>
 
-template <typename RapMapIndexT> class SACollector {
+// K is the k-mer length, if it is fixed at compile time (see
+// rapmap::utils::FixedKmer), or 0 if it is my_mer::k()
+template <typename RapMapIndexT, uint32_t K = 0> class SACollector {
 public:
   using OffsetT = typename RapMapIndexT::IndexType;
+  using Kmer = rapmap::utils::FixedKmer<K>;
+  using KmerEncoder = rapmap::utils::RollingKmerEncoder<K>;
+
+  // The number of reads whose k-mer lookups findFirstHits keeps in flight
+  static constexpr size_t kBatchWidth = 16;
 
   /** Disable NIP skipping **/
   void disableNIP() { disableNIP_ = true; }
@@ -60,19 +71,20 @@ public:
 
   /** Construct an SACollector given an index **/
   SACollector(RapMapIndexT* rmi)
-      : rmi_(rmi), hashEnd_(rmi->khash.end()), disableNIP_(false), 
-        covReq_(0.0), maxInterval_(1000),
+      : rmi_(rmi), hashEnd_(rmi->khash.end()), canonical_(rmi->canonicalHash),
+        filter_(rmi->kmerFilter.empty() ? nullptr : &rmi->kmerFilter),
+        disableNIP_(false), covReq_(0.0), maxInterval_(1000),
         strictCheck_(false) {}
 
   enum HitStatus { ABSENT = -1, UNTESTED = 0, PRESENT = 1 };
   // Record if k-mers are hits in the
   // fwd direction, rc direction or both
   struct KmerDirScore {
-    KmerDirScore(rapmap::utils::my_mer kmerIn, int32_t kposIn,
+    KmerDirScore(uint64_t kmerIn, int32_t kposIn,
                  HitStatus fwdScoreIn, HitStatus rcScoreIn)
         : kmer(kmerIn), kpos(kposIn), fwdScore(fwdScoreIn), rcScore(rcScoreIn) {
     }
-    KmerDirScore() : kpos(0), fwdScore(UNTESTED), rcScore(UNTESTED) {}
+    KmerDirScore() : kmer(0), kpos(0), fwdScore(UNTESTED), rcScore(UNTESTED) {}
     bool operator==(const KmerDirScore& other) const {
       return kpos == other.kpos;
     }
@@ -80,21 +92,179 @@ public:
       return kpos < other.kpos;
     }
     void print() {
-      std::cerr << "{ " << kmer.to_str() << ", " << kpos << ", "
+      std::cerr << "{ " << merOf_(kmer).to_str() << ", " << kpos << ", "
                 << ((fwdScore) ? "PRESENT" : "ABSENT") << ", "
                 << ((rcScore) ? "PRESENT" : "ABSENT") << "}\t";
     }
-    rapmap::utils::my_mer kmer;
+    uint64_t kmer;
     int32_t kpos;
     HitStatus fwdScore;
     HitStatus rcScore;
   };
 
+  // Whether a k-mer of a read, and its reverse complement, are in the
+  // index (UNTESTED until they are looked up), and the interval of the
+  // k-mer if it is
+  struct KmerLookup {
+    HitStatus mer{UNTESTED};
+    HitStatus rcMer{UNTESTED};
+    rapmap::utils::SAInterval<OffsetT> interval{0, 0};
+  };
+
+  // The first position of a read whose k-mer is in the hash (in either
+  // orientation), and the lookup of the k-mer there
+  struct FirstHit {
+    size_t pos{0};
+    KmerLookup lookup;
+    bool found{false};
+  };
+
+  /**
+   * Find the first hit of each of the reads.  Finding it is a chain of
+   * hash lookups that each depend on the last, and that each miss the
+   * cache, so the lookups of kBatchWidth reads are interleaved: the
+   * buckets of a read's next k-mer are prefetched, and the read is only
+   * returned to (to look the k-mer up) once the other reads in flight
+   * have had their turn.  The results are those of mapping each read on
+   * its own; pass firstHits[i] along with reads[i] to operator().  The
+   * k-mers of a read that the parser encoded are taken from its encoding.
+   */
+  void findFirstHits(const std::vector<const fastx_parser::ReadSeq*>& reads,
+                     std::vector<FirstHit>& firstHits) {
+    struct Slot {
+      size_t read;
+      KmerEncoder* kmers;
+      uint64_t mer;
+      uint64_t rcMer;
+    };
+    auto& khash = rmi_->khash;
+    auto k = kmerLen_();
+    firstHits.assign(reads.size(), FirstHit());
+
+    auto prefetch = [this, &khash](Slot& s) -> void {
+      if (canonical_) {
+        auto key = rapmap::utils::CanonicalKmer::key(s.mer, s.rcMer);
+        if (filter_) { filter_->prefetch(key); }
+        khash.prefetch(key);
+      } else {
+        if (filter_) {
+          filter_->prefetch(s.mer);
+          filter_->prefetch(s.rcMer);
+        }
+        khash.prefetch(s.mer);
+        khash.prefetch(s.rcMer);
+      }
+    };
+    // Put the next read with a k-mer to look up in s
+    size_t nextRead{0};
+    auto startRead = [&](Slot& s) -> bool {
+      while (nextRead < reads.size()) {
+        s.read = nextRead++;
+        resetKmers_(*s.kmers, *reads[s.read], k);
+        if (nextCandidate_(*s.kmers, firstHits[s.read].pos, s.mer, s.rcMer)) {
+          prefetch(s);
+          return true;
+        }
+      }
+      return false;
+    };
+
+    // Each slot rolls out the k-mers of its read with its own encoder
+    Slot slots[kBatchWidth];
+    for (size_t j = 0; j < kBatchWidth; ++j) { slots[j].kmers = &batchKmers_[j]; }
+    size_t numActive{0};
+    while (numActive < kBatchWidth and startRead(slots[numActive])) { ++numActive; }
+    size_t i{0};
+    while (numActive > 0) {
+      Slot& s = slots[i];
+      auto& fh = firstHits[s.read];
+      fh.lookup = KmerLookup();
+      lookup_(s.mer, s.rcMer, fh.lookup);
+      fh.found = (fh.lookup.mer == PRESENT or fh.lookup.rcMer == PRESENT);
+      bool pending{false};
+      if (!fh.found) {
+        ++fh.pos;
+        pending = nextCandidate_(*s.kmers, fh.pos, s.mer, s.rcMer);
+        if (pending) { prefetch(s); }
+      }
+      // If this read is done, start another in its slot (or retire the
+      // slot, by swapping it with the last one in flight, so that no two
+      // slots share an encoder)
+      if (!pending and !startRead(s)) {
+        std::swap(s, slots[--numActive]);
+        if (i >= numActive) { i = 0; }
+        continue;
+      }
+      i = (i + 1 >= numActive) ? 0 : i + 1;
+    }
+  }
+
   bool operator()(std::string& read,
                   std::vector<rapmap::utils::QuasiAlignment>& hits,
-                  SASearcher<RapMapIndexT>& saSearcher,
+                  SASearcher<RapMapIndexT, K>& saSearcher,
+                  rapmap::utils::MateStatus mateStatus,
+                  bool consistentHits = false) {
+    FirstHit firstHit;
+    readKmers_.reset(read, kmerLen_());
+    findFirstHit_(readKmers_, firstHit);
+    return collect_(searchQuery_(read), firstHit, hits, saSearcher, mateStatus,
+                    consistentHits, nullptr);
+  }
+
+  // Map read, whose first hit (see findFirstHits) is already known.  If
+  // the parser encoded the read, its k-mers, its reverse complement and
+  // the queries of the searcher all come from that encoding.
+  bool operator()(fastx_parser::ReadSeq& read, const FirstHit& firstHit,
+                  std::vector<rapmap::utils::QuasiAlignment>& hits,
+                  SASearcher<RapMapIndexT, K>& saSearcher,
                   rapmap::utils::MateStatus mateStatus,
                   bool consistentHits = false) {
+    resetKmers_(readKmers_, read, kmerLen_());
+    auto& query = searchQuery_(read.seq);
+    if (!read.enc.valid) {
+      return collect_(query, firstHit, hits, saSearcher, mateStatus,
+                      consistentHits, nullptr);
+    }
+    auto& enc = read.enc;
+    size_t len = read.seq.length();
+    saSearcher.addEncodedQuery(query.data(), len, enc.fwd.data(), enc.nMask.data());
+    saSearcher.addEncodedQuery(enc.rcSeq.data(), len, enc.rc.data(), enc.rcNMask.data());
+    bool mapped = collect_(query, firstHit, hits, saSearcher, mateStatus,
+                           consistentHits, &enc.rcSeq);
+    saSearcher.clearEncodedQueries();
+    return mapped;
+  }
+
+private:
+  // The read as the searcher compares it, upper-cased once here (into
+  // queryBuffer_, and only if it has lower-case bases) rather than by
+  // every search; its reverse complement is always upper-case
+  std::string& searchQuery_(std::string& read) {
+    auto isLower = [](char c) -> bool { return c >= 'a' and c <= 'z'; };
+    if (std::none_of(read.begin(), read.end(), isLower)) { return read; }
+    queryBuffer_.resize(read.length());
+    std::transform(read.begin(), read.end(), queryBuffer_.begin(),
+                   [](char c) -> char { return ::toupper(c); });
+    return queryBuffer_;
+  }
+
+  static inline void resetKmers_(KmerEncoder& kmers,
+                                 const fastx_parser::ReadSeq& read, uint32_t k) {
+    if (read.enc.valid) {
+      kmers.reset(read.enc.fwd.data(), read.enc.nMask.data(), read.seq.length(), k);
+    } else {
+      kmers.reset(read.seq, k);
+    }
+  }
+
+  // Map read (as the searcher compares it; see searchQuery_), whose
+  // k-mers are in readKmers_, from its first hit (rcRead is its reverse
+  // complement, or nullptr if that isn't known yet)
+  bool collect_(std::string& read, const FirstHit& firstHit,
+                std::vector<rapmap::utils::QuasiAlignment>& hits,
+                SASearcher<RapMapIndexT, K>& saSearcher,
+                rapmap::utils::MateStatus mateStatus,
+                bool consistentHits, std::string* rcRead) {
 
     using QuasiAlignment = rapmap::utils::QuasiAlignment;
     using MateStatus = rapmap::utils::MateStatus;
@@ -102,15 +272,10 @@ public:
 
     auto& rankDict = rmi_->rankDict;
     auto& txpStarts = rmi_->txpOffsets;
-    auto& SA = rmi_->SA;
-    auto& khash = rmi_->khash;
-    auto& text = rmi_->seq;
-    auto salen = SA.size();
-    //auto hashEnd_ = khash.end();
     auto readLen = read.length();
     auto maxDist = 1.5 * readLen;
 
-    auto k = rapmap::utils::my_mer::k();
+    auto k = kmerLen_();
     auto readStartIt = read.begin();
     auto readEndIt = read.end();
 
@@ -123,124 +288,48 @@ public:
     size_t fwdCov{0};
     size_t rcCov{0};
 
-    bool foundHit = false;
-    bool isRev = false;
-
-    rapmap::utils::my_mer mer;
-    rapmap::utils::my_mer rcMer;
-
     bool useCoverageCheck{disableNIP_ and strictCheck_};
 
     // This allows implementing our heurisic for comparing
     // forward and reverse-complement strand matches
-    std::vector<KmerDirScore> kmerScores;
+    auto& kmerScores = kmerScores_;
+    kmerScores.clear();
 
     // Where we store the SA intervals for forward and rc hits
-    std::vector<SAIntervalHit> fwdSAInts;
-    std::vector<SAIntervalHit> rcSAInts;
-
-    // Number of nucleotides to skip when encountering a homopolymer k-mer.
-    OffsetT homoPolymerSkip = 1; // k / 2;
-
-    // Iterator for k-mer and rc k-mer lookups
-    auto merIt = hashEnd_;
-    auto rcMerIt = hashEnd_;
-
-    // The position of the k-mer in the read
-    size_t pos{0};
-    // The position of the next 'N' in the read
-    size_t invalidPos{0};
-
-    // Find a hit within the read
-    // While we haven't fallen off the end
-    while (re <= readEndIt) {
-
-      // Get the k-mer at the current start position.
-      // And make sure that it's valid (contains no Ns).
-      pos = std::distance(readStartIt, rb);
-
-      // See if this k-mer would contain an N
-      // only check if we don't yet know that there are no remaining
-      // Ns
-      if (invalidPos != std::string::npos) {
-        invalidPos = read.find_first_of("nN", pos);
-        if (invalidPos <= pos + k) {
-          rb = read.begin() + invalidPos + 1;
-          re = rb + k;
-          continue;
-        }
-      }
-
-      // If the next k-bases are valid, get the k-mer and
-      // reverse complement k-mer
-      mer = rapmap::utils::my_mer(read.c_str() + pos);
-      if (mer.is_homopolymer()) {
-        rb += homoPolymerSkip;
-        re += homoPolymerSkip;
-        /* Walk base-by-base rather than skipping
-        // If the first N is within k bases, then this k-mer is invalid
-        if (invalidPos < pos + k) {
-            // Skip to the k-mer starting at the next position
-            // (i.e. right past the N)
-            rb = read.begin() + invalidPos + 1;
-            re = rb + k;
-            // Go to the next iteration of the while loop
-            continue;
-        }
-        */
-        continue;
-      }
-      rcMer = mer.get_reverse_complement();
-
-      // See if we can find this k-mer in the hash
-      merIt = khash.find(mer.word(0));//get_bits(0, 2 * k));
-      rcMerIt = khash.find(rcMer.word(0));//rcMer.get_bits(0, 2 * k));
-
-      // If we can find the k-mer in the hash
-      if (merIt != hashEnd_) {
-        if (strictCheck_) {
-          ++fwdHit;
-          // If we also match this k-mer in the rc direction
-          if (rcMerIt != hashEnd_) {
-            ++rcHit;
-            kmerScores.emplace_back(mer, pos, PRESENT, PRESENT);
-          } else { // Otherwise it doesn't match in the rc direction
-            kmerScores.emplace_back(mer, pos, PRESENT, ABSENT);
-          }
-        } else { // no strict check
-          ++fwdHit;
-          if (rcMerIt != hashEnd_) {
-            ++rcHit;
-          }
-        }
-      }
-
-      // See if the reverse complement k-mer is in the hash
-      if (rcMerIt != hashEnd_) {
-        // The original k-mer didn't match in the foward direction
-        if (!fwdHit) {
-          ++rcHit;
-          if (strictCheck_) {
-            kmerScores.emplace_back(mer, pos, ABSENT, PRESENT);
-          }
-        }
-      }
-
-      // If we had a hit with either k-mer then we can
-      // break out of this loop to look for the next informative position
-      if (fwdHit + rcHit > 0) {
-        foundHit = true;
-        break;
-      }
-      ++rb;
-      ++re;
-    }
+    auto& fwdSAInts = fwdSAInts_;
+    auto& rcSAInts = rcSAInts_;
+    fwdSAInts.clear();
+    rcSAInts.clear();
 
     // If we went the entire length of the read without finding a hit
     // then we can bail.
-    if (!foundHit) {
+    if (!firstHit.found) {
       return false;
     }
+    bool foundHit = true;
+
+    // The k-mer at the first hit, and its lookups in the hash
+    size_t pos = firstHit.pos;
+    rb = read.begin() + pos;
+    re = rb + k;
+    auto startInterval = firstHit.lookup.interval;
+
+    // Record if we found the k-mer in the forward direction, the rc
+    // direction, or both
+    if (firstHit.lookup.mer == PRESENT) {
+      ++fwdHit;
+      if (firstHit.lookup.rcMer == PRESENT) { ++rcHit; }
+      if (strictCheck_) {
+        kmerScores.emplace_back(readKmers_.word(pos), pos,
+                                PRESENT, firstHit.lookup.rcMer);
+      }
+    } else {
+      ++rcHit;
+      if (strictCheck_) {
+        kmerScores.emplace_back(readKmers_.word(pos), pos,
+                                ABSENT, PRESENT);
+      }
+    }
 
     bool didCheckFwd{false};
     // If we had a hit on the forward strand
@@ -249,17 +338,20 @@ public:
       getSAHits_(saSearcher,
                  read,             // the read
                  rb,               // where to start the search
-                 &(merIt->second), // pointer to the search interval
+                 &startInterval,   // pointer to the search interval
                  fwdCov, fwdHit, rcHit, fwdSAInts, kmerScores, false);
     }
 
     bool checkRC = useCoverageCheck ? (rcHit > 0) : (rcHit >= fwdHit);
     // If we had a hit on the reverse complement strand
     if (checkRC) {
-      rapmap::utils::reverseRead(read, rcBuffer_);
+      if (!rcRead) {
+        rapmap::utils::reverseRead(read, rcBuffer_);
+        rcRead = &rcBuffer_;
+      }
       getSAHits_(saSearcher,
-                 rcBuffer_,         // the read
-                 rcBuffer_.begin(), // where to start the search
+                 *rcRead,           // the read
+                 rcRead->begin(),   // where to start the search
                  nullptr,           // pointer to the search interval
                  rcCov, rcHit, fwdHit, rcSAInts, kmerScores, true);
     }
@@ -305,21 +397,19 @@ public:
           for (auto kmsIt = kmerScores.begin(); kmsIt != e;
                ++kmsIt) { //: kmerScores) {
             auto& kms = *kmsIt;
-            // If the forward k-mer is untested, then test it
-            if (kms.fwdScore == UNTESTED) {
-              auto merIt = khash.find(kms.kmer.word(0));//get_bits(0, 2 * k));
-              kms.fwdScore = (merIt != hashEnd_) ? PRESENT : ABSENT;
+            // If either orientation of the k-mer is untested, then test it
+            // (with a canonical hash, one lookup tests both)
+            if (kms.fwdScore == UNTESTED or kms.rcScore == UNTESTED) {
+              KmerLookup l;
+              l.mer = kms.fwdScore;
+              l.rcMer = kms.rcScore;
+              lookup_(kms.kmer, Kmer::reverseComplement(kms.kmer, kmerLen_()),
+                      l, false);
+              kms.fwdScore = l.mer;
+              kms.rcScore = l.rcMer;
             }
-            // accumulate the score
+            // accumulate the scores
             fwdScore += kms.fwdScore;
-
-            // If the rc k-mer is untested, then test it
-            if (kms.rcScore == UNTESTED) {
-              rcMer = kms.kmer.get_reverse_complement();
-              auto rcMerIt = khash.find(rcMer.word(0));//get_bits(0, 2 * k));
-              kms.rcScore = (rcMerIt != hashEnd_) ? PRESENT : ABSENT;
-            }
-            // accumulate the score
             rcScore += kms.rcScore;
             // kms.print();
             // std::cerr << "\n";
@@ -360,15 +450,15 @@ public:
     auto fwdHitsStart = hits.size();
     // If we had > 1 forward hit
     if (fwdSAInts.size() > 1) {
-      auto processedHits = rapmap::hit_manager::intersectSAHits(
-          fwdSAInts, *rmi_, readLen, consistentHits);
-      rapmap::hit_manager::collectHitsSimpleSA(processedHits, readLen, maxDist,
+      rapmap::hit_manager::intersectSAHits(fwdSAInts, *rmi_, readLen,
+                                           consistentHits, hitWorkspace_);
+      rapmap::hit_manager::collectHitsSimpleSA(hitWorkspace_, readLen, maxDist,
                                                hits, mateStatus);
     } else if (fwdSAInts.size() == 1) { // only 1 hit!
       auto& saIntervalHit = fwdSAInts.front();
       auto initialSize = hits.size();
       for (OffsetT i = saIntervalHit.begin; i != saIntervalHit.end; ++i) {
-        auto globalPos = SA[i];
+        auto globalPos = rmi_->hitPosition(i, saIntervalHit.len);
         auto txpID = rmi_->transcriptAtPosition(globalPos);
         // the offset into this transcript
         auto pos = globalPos - txpStarts[txpID];
@@ -400,15 +490,15 @@ public:
     auto rcHitsStart = fwdHitsEnd;
     // If we had > 1 rc hit
     if (rcSAInts.size() > 1) {
-      auto processedHits = rapmap::hit_manager::intersectSAHits(
-          rcSAInts, *rmi_, readLen, consistentHits);
-      rapmap::hit_manager::collectHitsSimpleSA(processedHits, readLen, maxDist,
+      rapmap::hit_manager::intersectSAHits(rcSAInts, *rmi_, readLen,
+                                           consistentHits, hitWorkspace_);
+      rapmap::hit_manager::collectHitsSimpleSA(hitWorkspace_, readLen, maxDist,
                                                hits, mateStatus);
     } else if (rcSAInts.size() == 1) { // only 1 hit!
       auto& saIntervalHit = rcSAInts.front();
       auto initialSize = hits.size();
       for (OffsetT i = saIntervalHit.begin; i != saIntervalHit.end; ++i) {
-        auto globalPos = SA[i];
+        auto globalPos = rmi_->hitPosition(i, saIntervalHit.len);
         auto txpID = rmi_->transcriptAtPosition(globalPos);
         // the offset into this transcript
         auto pos = globalPos - txpStarts[txpID];
@@ -439,13 +529,17 @@ public:
 
     // If we had both forward and RC hits, then merge them
     if ((fwdHitsEnd > fwdHitsStart) and (rcHitsEnd > rcHitsStart)) {
-      // Merge the forward and reverse hits
-      std::inplace_merge(
+      // Merge the forward and reverse hits (by way of mergedHits_, as
+      // std::inplace_merge would allocate a buffer)
+      mergedHits_.clear();
+      std::merge(
           hits.begin() + fwdHitsStart, hits.begin() + fwdHitsEnd,
-          hits.begin() + rcHitsEnd,
+          hits.begin() + rcHitsStart, hits.begin() + rcHitsEnd,
+          std::back_inserter(mergedHits_),
           [](const QuasiAlignment& a, const QuasiAlignment& b) -> bool {
             return a.tid < b.tid;
           });
+      std::move(mergedHits_.begin(), mergedHits_.end(), hits.begin() + fwdHitsStart);
       // And get rid of duplicate transcript IDs
       auto newEnd = std::unique(
           hits.begin() + fwdHitsStart, hits.begin() + rcHitsEnd,
@@ -458,58 +552,141 @@ public:
     return foundHit;
   }
 
-private:
+  // Advance pos to the next position (at or after pos) at which the read
+  // (whose k-mers are in kmers) has a k-mer worth looking up, one with no
+  // N that isn't a homopolymer, and fill in that k-mer and its reverse
+  // complement.  Returns false if no such k-mer remains.
+  inline bool nextCandidate_(KmerEncoder& kmers, size_t& pos,
+                             uint64_t& mer, uint64_t& rcMer) const {
+    size_t k = kmerLen_();
+    // Number of nucleotides to skip when encountering a homopolymer k-mer.
+    size_t homoPolymerSkip = 1; // k / 2;
+    while (pos + k <= kmers.length()) {
+      // See if this k-mer (or the base just past it) is an N
+      size_t invalidPos = kmers.nextInvalid(pos);
+      if (invalidPos <= pos + k) {
+        pos = invalidPos + 1;
+        continue;
+      }
+      if (kmers.isHomopolymer(pos)) {
+        pos += homoPolymerSkip;
+        continue;
+      }
+      mer = kmers.word(pos);
+      rcMer = kmers.rcWord(pos);
+      return true;
+    }
+    return false;
+  }
+
+  // Find the first hit of the read whose k-mers are in kmers (as
+  // findFirstHits does, one lookup at a time)
+  void findFirstHit_(KmerEncoder& kmers, FirstHit& firstHit) {
+    uint64_t mer;
+    uint64_t rcMer;
+    while (nextCandidate_(kmers, firstHit.pos, mer, rcMer)) {
+      // See if we can find this k-mer in the hash
+      firstHit.lookup = KmerLookup();
+      lookup_(mer, rcMer, firstHit.lookup);
+      if (firstHit.lookup.mer == PRESENT or firstHit.lookup.rcMer == PRESENT) {
+        firstHit.found = true;
+        return;
+      }
+      ++firstHit.pos;
+    }
+  }
+
+  /**
+   * Look up merWord (whose reverse complement is rcMerWord) in the hash,
+   * filling in whichever of l.mer and l.rcMer are UNTESTED (and, if the
+   * k-mer is present and needInterval is true, l.interval).  With a canonical hash
+   * a single lookup answers for both; a second is only needed for the
+   * interval of a k-mer whose reverse complement also occurs and is the
+   * key of the pair.  A key that the filter (if any) rejects is absent
+   * without a lookup.
+   */
+  inline void lookup_(uint64_t merWord, uint64_t rcMerWord, KmerLookup& l,
+                      bool needInterval = true) {
+    using Canon = rapmap::utils::CanonicalKmer;
+    auto& khash = rmi_->khash;
+    if (!canonical_) {
+      if (l.mer == UNTESTED) {
+        auto merIt = mayContain_(merWord) ? khash.find(merWord) : hashEnd_;
+        l.mer = (merIt != hashEnd_) ? PRESENT : ABSENT;
+        if (merIt != hashEnd_) { l.interval = merIt->second; }
+      }
+      if (l.rcMer == UNTESTED) {
+        l.rcMer = (mayContain_(rcMerWord) and khash.find(rcMerWord) != hashEnd_)
+                      ? PRESENT : ABSENT;
+      }
+      return;
+    }
+    if (l.mer != UNTESTED and l.rcMer != UNTESTED) { return; }
+    bool merIsKey = (merWord <= rcMerWord);
+    auto key = merIsKey ? merWord : rcMerWord;
+    auto keyIt = mayContain_(key) ? khash.find(key) : hashEnd_;
+    if (keyIt == hashEnd_) {
+      l.mer = l.rcMer = ABSENT;
+      return;
+    }
+    // Is the stored interval that of mer (rather than of rcMer)?
+    bool storedIsMer = (merIsKey != Canon::isRC(keyIt->second));
+    bool both = Canon::both(keyIt->second);
+    l.mer = (storedIsMer or both) ? PRESENT : ABSENT;
+    l.rcMer = (!storedIsMer or both) ? PRESENT : ABSENT;
+    if (l.mer == PRESENT and needInterval) {
+      if (storedIsMer) {
+        l.interval = Canon::bounds(keyIt->second);
+      } else {
+        // mer isn't the key, and is stored (without flags) under itself;
+        // a hash that breaks this (e.g. one mismatched with its flags)
+        // gets a miss rather than a read past its end
+        auto merIt = khash.find(merWord);
+        if (merIt != hashEnd_) {
+          l.interval = merIt->second;
+        } else {
+          l.mer = ABSENT;
+        }
+      }
+    }
+  }
+
+  // False if the filter says key isn't in the hash
+  inline bool mayContain_(uint64_t key) const {
+    return filter_ == nullptr or filter_->contains(key);
+  }
+
+  static inline uint32_t kmerLen_() {
+    return Kmer::len(rapmap::utils::my_mer::k());
+  }
+
+  // The my_mer whose encoding is w
+  static inline rapmap::utils::my_mer merOf_(uint64_t w) {
+    rapmap::utils::my_mer mer;
+    mer.polyA();
+    mer.set_bits(0, 2 * kmerLen_(), w);
+    return mer;
+  }
+
   // spot-check k-mers to see if there are forward or rc hits
-  template <typename IteratorT>
   inline void
-  spotCheck_(rapmap::utils::my_mer mer,
+  spotCheck_(uint64_t mer, uint64_t complementMer, // the k-mer and its rc
              size_t pos, // the position of the k-mer on the read
              size_t readLen,
-             IteratorT* merItPtr,           // nullptr if we haven't checked yet
-             IteratorT* complementMerItPtr, // nullptr if we haven't checked yet
+             KmerLookup lookup, // what we already know of mer (if anything)
              bool isRC, // is this being called from the RC of the read
              uint32_t& strandHits, uint32_t& otherStrandHits,
              std::vector<KmerDirScore>& kmerScores
              ) {
-    IteratorT merIt = hashEnd_;
-    IteratorT complementMerIt = hashEnd_;
-    auto& khash = rmi_->khash;
-    //auto hashEnd_ = khash.end();
-    auto k = rapmap::utils::my_mer::k();
+    auto k = kmerLen_();
 
-    auto complementMer = mer.get_reverse_complement();
+    // Test whatever we haven't yet
+    lookup_(mer, complementMer, lookup, false);
 
-    if (merItPtr == nullptr) {
-      // We haven't tested this, so do that here
-      merIt = khash.find(mer.word(0));//get_bits(0, 2 * k));
-    } else {
-      // we already have this
-      merIt = *merItPtr;
-    }
-
-    if (complementMerItPtr == nullptr) {
-      // We haven't tested this, so do that here
-      complementMerIt = khash.find(complementMer.word(0));//get_bits(0, 2 * k));
-    } else {
-      // we already have this
-      complementMerIt = *complementMerItPtr;
-    }
-
-    HitStatus status{UNTESTED};
-    HitStatus complementStatus{UNTESTED};
-
-    if (merIt != hashEnd_) {
-      ++strandHits;
-      status = PRESENT;
-    } else {
-      status = ABSENT;
-    }
-    if (complementMerIt != hashEnd_) {
-      ++otherStrandHits;
-      complementStatus = PRESENT;
-    } else {
-      complementStatus = ABSENT;
-    }
+    HitStatus status = lookup.mer;
+    HitStatus complementStatus = lookup.rcMer;
+    if (status == PRESENT) { ++strandHits; }
+    if (complementStatus == PRESENT) { ++otherStrandHits; }
 
     HitStatus fwdStatus = isRC ? complementStatus : status;
     HitStatus rcStatus = isRC ? status : complementStatus;
@@ -535,8 +712,10 @@ private:
   }
   */
 
+  // Collect the MMPs of read, which is the read whose k-mers are in
+  // readKmers_ or (if isRC) its reverse complement
   inline void getSAHits_(
-      SASearcher<RapMapIndexT>& saSearcher, std::string& read,
+      SASearcher<RapMapIndexT, K>& saSearcher, std::string& read,
       std::string::iterator startIt,
       rapmap::utils::SAInterval<OffsetT>* startInterval, size_t& cov,
       uint32_t& strandHits, uint32_t& otherStrandHits,
@@ -545,17 +724,13 @@ private:
       bool isRC // true if read is the reverse complement, false otherwise
       ) {
     using SAIntervalHit = rapmap::utils::SAIntervalHit<OffsetT>;
-    auto& khash = rmi_->khash;
-
-    //auto hashEnd_ = khash.end();
-    decltype(hashEnd_)* nullItPtr = nullptr;
 
     auto readLen = read.length();
     auto readStartIt = read.begin();
     auto readEndIt = read.end();
     OffsetT matchedLen{0};
 
-    auto k = rapmap::utils::my_mer::k();
+    auto k = kmerLen_();
     auto skipOverlapMMP = k - 1;
     auto skipOverlapNIP = k - 1;
     OffsetT homoPolymerSkip = 1;//k / 2;
@@ -563,16 +738,14 @@ private:
     auto rb = readStartIt;
     auto re = rb + k;
     OffsetT lb, ub;
-    size_t invalidPos{0};
 
-    rapmap::utils::my_mer mer, complementMer;
-    auto merIt = hashEnd_;
-    auto complementMerIt = hashEnd_;
+    auto& kmers = readKmers_;
+    uint64_t mer, complementMer;
+    KmerLookup merLookup;
     size_t pos{0};
     size_t sampFactor{1};
     bool lastSearch{false};
     size_t prevMMPEnd{0};
-    bool validMer{true};
 
     // If we have some place to start that we have already computed
     // then use it.
@@ -582,7 +755,6 @@ private:
       rb = startIt;
       re = rb + k;
       pos = std::distance(readStartIt, rb);
-      invalidPos = pos;
       lb = startInterval->begin();
       ub = startInterval->end();
       goto skipSetup;
@@ -592,29 +764,22 @@ private:
       // The distance from the beginning of the read to the
       // start of the k-mer
       pos = std::distance(readStartIt, rb);
-      validMer = mer.from_chars(read.c_str() + pos);
-      // Get the next valid k-mer at some position >= pos
-      //validMer = getNextValidKmer_(read, pos, mer);
-      //if (!validMer) { return; }
 
       // If this k-mer contains an 'N', then find the position
       // of this character and skip one past it.
-      if (!validMer) {
-        invalidPos = read.find_first_of("nN", pos);
-        // If the first N is within k bases, then this k-mer is invalid
-        if (invalidPos < pos + k) {
-          // Skip to the k-mer starting at the next position
-          // (i.e. right past the N)
-          rb = read.begin() + invalidPos + 1;
-          re = rb + k;
-          // Go to the next iteration of the while loop
-          continue;
-        }
+      if (!kmers.isValid(pos, isRC)) {
+        size_t invalidPos = kmers.nextInvalid(pos, isRC);
+        // Skip to the k-mer starting at the next position
+        // (i.e. right past the N)
+        rb = read.begin() + invalidPos + 1;
+        re = rb + k;
+        // Go to the next iteration of the while loop
+        continue;
       }
       // If we got here, we have a k-mer without an 'N'
 
       // If this is a homopolymer, then skip it
-      if (mer.is_homopolymer()) {
+      if (kmers.isHomopolymer(pos, isRC)) {
         rb += homoPolymerSkip; 
         re += homoPolymerSkip;
         /*
@@ -634,20 +799,22 @@ private:
       
       // If it's not a homopolymer, then get the complement
       // k-mer and query both in the hash.
-      complementMer = mer.get_reverse_complement();
-      merIt = khash.find(mer.word(0));//get_bits(0, 2 * k));
+      mer = kmers.word(pos, isRC);
+      complementMer = kmers.rcWord(pos, isRC);
+      merLookup = KmerLookup();
+      lookup_(mer, complementMer, merLookup);
 
       // If we found the k-mer
-      if (merIt != hashEnd_) {
-        spotCheck_(mer, pos, readLen, &merIt, nullItPtr, isRC, strandHits,
+      if (merLookup.mer == PRESENT) {
+        spotCheck_(mer, complementMer, pos, readLen, merLookup, isRC, strandHits,
                    otherStrandHits, kmerScores);
 
-        lb = merIt->second.begin();
-        ub = merIt->second.end();
+        lb = merLookup.interval.begin();
+        ub = merLookup.interval.end();
       skipSetup:
-        // lb must be 1 *less* then the current lb
-        // We can't move any further in the reverse complement direction
-        lb = std::max(static_cast<OffsetT>(0), lb - 1);
+        // lb must be 1 *less* then the current lb (the searcher never
+        // looks at this row, so it may be -1 in a pruned SA)
+        lb = lb - 1;
         std::tie(lb, ub, matchedLen) =
             saSearcher.extendSearchNaive(lb, ub, k, rb, readEndIt);
 
@@ -676,8 +843,7 @@ private:
           if (rb + matchedLen < readEndIt) {
             uint32_t kmerPos = static_cast<uint32_t>(
                 std::distance(readStartIt, rb + matchedLen - skipOverlapMMP));
-            bool validNucs = mer.from_chars(read.c_str() + kmerPos);
-            if (validNucs) {
+            if (kmers.isValid(kmerPos, isRC)) {
               /*
               // since the MMP *ended* before the end of the read, we assume
               // that the k-mer one past the MMP is a mismatch (i.e is ABSENT)
@@ -688,7 +854,8 @@ private:
               // Even though the MMP *ended* before the end of the read, we're still
               // going to check the mismatching k-mer in both directions to ensure that
               // it doesn't appear somewhere else in the forward direction
-              spotCheck_(mer, kmerPos, readLen, nullItPtr, nullItPtr, isRC,
+              spotCheck_(kmers.word(kmerPos, isRC), kmers.rcWord(kmerPos, isRC),
+                         kmerPos, readLen, KmerLookup(), isRC,
                          strandHits, otherStrandHits, kmerScores);
             }
           } // we didn't end the search by falling off the end
@@ -708,7 +875,9 @@ private:
           return;
         }
 
-        auto remainingDistance = std::distance(mismatchIt, readEndIt);
+        // The LCE (like the MMP) is measured from rb, so it can extend at
+        // most to the end of the read
+        auto remainingDistance = std::distance(rb, readEndIt);
         auto lce = disableNIP_ ? matchedLen
                                : saSearcher.lce(lb, ub - 1, matchedLen,
                                                 remainingDistance);
@@ -743,9 +912,9 @@ private:
 
       } else { // If we couldn't match this k-mer, move on to the next.
           
-        // &merIt should point to the end of the k-mer hash,
-        // complementMerItPtr is null because we want to spot-check the complement k-mer.
-        spotCheck_(mer, pos, readLen, &merIt, nullItPtr, isRC, strandHits,
+        // merLookup already says the k-mer is absent (and whether its
+        // complement is present)
+        spotCheck_(mer, complementMer, pos, readLen, merLookup, isRC, strandHits,
                    otherStrandHits, kmerScores);
         rb += sampFactor;
         re = rb + k;
@@ -755,11 +924,28 @@ private:
 
   RapMapIndexT* rmi_;
   decltype(rmi_->khash.end()) hashEnd_;
+  // Is the hash keyed on canonical k-mers (see rapmap::utils::CanonicalKmer)?
+  bool canonical_;
+  // The filter in front of the hash, or nullptr if the index has none
+  const rapmap::utils::KmerFilter* filter_;
   bool disableNIP_;
   double covReq_;
   OffsetT maxInterval_;
   bool strictCheck_;
   std::string rcBuffer_;
+  std::string queryBuffer_;
+  // The scratch space of operator(), reused (cleared, never freed) from
+  // read to read: the k-mer scores of the strict check, the SA intervals
+  // of either strand, their intersection, and the merged hits
+  std::vector<KmerDirScore> kmerScores_;
+  std::vector<rapmap::utils::SAIntervalHit<OffsetT>> fwdSAInts_;
+  std::vector<rapmap::utils::SAIntervalHit<OffsetT>> rcSAInts_;
+  rapmap::hit_manager::SAHitWorkspace hitWorkspace_;
+  std::vector<rapmap::utils::QuasiAlignment> mergedHits_;
+  // The k-mers of the read being mapped (both strands), and those of the
+  // reads in flight in findFirstHits
+  KmerEncoder readKmers_;
+  KmerEncoder batchKmers_[kBatchWidth];
 };
 
 #endif // SA_COLLECTOR_HPP
@@ -25,40 +25,64 @@
 #include <vector>
 #include <algorithm>
 #include <iterator>
+#include <cstring>
 #include "jellyfish/mer_dna.hpp"
 
 #include "RapMapUtils.hpp"
 #include "RapMapSAIndex.hpp"
+#include "LCPArray.hpp"
+#include "SuffixFingerprints.hpp"
+#include "MatchKernels.hpp"
+#include "SampledSearchTree.hpp"
+#include "FixedKmer.hpp"
 
-template <typename RapMapIndexT>
+// K is the k-mer length, if it is fixed at compile time (see
+// rapmap::utils::FixedKmer), or 0 if it is my_mer::k()
+template <typename RapMapIndexT, uint32_t K = 0>
 class SASearcher {
     public:
         using OffsetT = typename RapMapIndexT::IndexType;
 
         SASearcher(RapMapIndexT* rmi) :
-            rmi_(rmi), seq_(&rmi->seq), sa_(&rmi->SA) {}
+            rmi_(rmi), seq_(&rmi->seq), sa_(&rmi->SA),
+            packed_(rmi->packedText ? &rmi->packedSeq : nullptr),
+            textLen_(static_cast<OffsetT>(rmi->textLength())),
+            llcp_(rmi->leftLCP.empty() ? nullptr : &rmi->leftLCP),
+            rlcp_(rmi->rightLCP.empty() ? nullptr : &rmi->rightLCP),
+            rmq_(rmi->lcpRMQ.empty() ? nullptr : &rmi->lcpRMQ),
+            cld_((rmi->childTable.empty() or rmi->lcpRMQ.empty()) ? nullptr : &rmi->childTable),
+            fp_(rmi->fingerprints.empty() ? nullptr : &rmi->fingerprints),
+            samples_(rmi->sampledSearch.empty() ? nullptr : &rmi->sampledSearch),
+            mismatch_(rapmap::utils::mismatchKernel()) {}
+
+        // Queries that lie within [begin, begin + len) are then taken,
+        // already 2-bit encoded, from packed (laid out as query2bit_, with
+        // a word of slack), rather than re-encoded; bit i of invalid is set
+        // if base i isn't A, C, G or T.  Holds a read and its reverse
+        // complement (see fastx_parser::EncodedSeq) until
+        // clearEncodedQueries().
+        void addEncodedQuery(const char* begin, size_t len,
+                             const uint64_t* packed, const uint64_t* invalid) {
+            if (numEncoded_ < 2) {
+                encoded_[numEncoded_++] = EncodedText_{begin, len, packed, invalid};
+            }
+        }
+        void clearEncodedQueries() { numEncoded_ = 0; }
 
         int cmp(std::string::iterator abeg,
                 std::string::iterator aend,
                 std::string::iterator bbeg,
                 std::string::iterator bend) {
-            auto ait = abeg;
-            auto bit = bbeg;
-            //size_t la = a.length();
-            //size_t lb = b.length();
-            while (ait < aend and bit < bend) {
-                if (*ait < *bit) {
-                    return -1;
-                } else if (*ait > *bit) {
-                    return 1;
+            auto la = std::distance(abeg, aend);
+            auto lb = std::distance(bbeg, bend);
+            auto len = std::min(la, lb);
+            if (len > 0) {
+                auto i = mismatch_(&*abeg, &*bbeg, len);
+                if (static_cast<decltype(len)>(i) < len) {
+                    return (*(abeg + i) < *(bbeg + i)) ? -1 : 1;
                 }
-                ++ait;
-                ++bit;
-            }
-            if (bit == bend and ait < aend) {
-                return 1;
             }
-            return 0;
+            return (la > lb) ? 1 : 0;
         }
 
         enum class SearchDirection : uint8_t {
@@ -83,6 +107,12 @@ class SASearcher {
 	 * The final binary search *is* optimized (it has a lower bound given by the value)
 	 * returned by second search.  However, this method is likely a bit slower than the
 	 * one above (when it can be made to work correctly at all times).
+	 *
+	 * If the index has LCP-LR arrays, and (lbIn, ubIn) are the bounds of a
+	 * k-mer interval (i.e. startAt == k), the three searches are instead
+	 * done by extendSearchLCP_, which finds the same interval.  If it has
+	 * a child table, the interval is instead found by descending from the
+	 * k-mer interval (see extendSearchESA_).
 	 */
         template <typename IteratorT>
         std::tuple<OffsetT, OffsetT, OffsetT> extendSearchNaive(
@@ -95,103 +125,70 @@ class SASearcher {
                                            // before comparison
                 ) {
 
-            std::vector<OffsetT>& SA = *sa_;
-            std::string& seq = *seq_;
-
             int64_t m = std::distance(qb, qe);
-            size_t n = seq.length();
 
-            auto sb = seq.begin();
-            auto se = seq.end();
+            // With a packed text (or fingerprints), runs of matching bases
+            // are skipped a word at a time; the character comparisons then
+            // only have to decide the (first) mismatch.
+            if ((packed_ or fp_ or samples_) and
+                !copyEncodedQuery_(qb, qe, complementBases)) {
+                encodeQuery_(qb, qe, complementBases);
+            }
+            // With a byte text, the query is compared many bytes at a time
+            // by mismatch_, in place (the collector upper-cases each read
+            // once); only a query to be complemented is copied
+            if (!packed_) { setQueryBytes_(qb, qe, complementBases); }
 
+            bool plt{true};
             // If the bounds are already trivial, just figure how long
             // of a prefix we share and return the interval.
             if (ubIn - lbIn == 2) {
                 lbIn += 1;
-                auto i = startAt;
-                while (i < m and SA[lbIn] + i < n) {
-                    char queryChar = ::toupper(*(qb + i));
-                    // If we're reverse complementing
-                    if (complementBases) {
-                        queryChar = rapmap::utils::my_mer::complement(queryChar);
-                    }
-                    if ( queryChar < *(sb + SA[lbIn] + i) ) {
-                        break;
-                    } else if ( queryChar > *(sb + SA[lbIn] + i)) {
-                        break;
-                    }
-                    ++i;
-                }
+                int64_t i = compareSuffix_(lbIn, startAt, qb, m, '\0', complementBases, plt);
                 return std::make_tuple(lbIn, ubIn, static_cast<OffsetT>(i));
             }
 
+            if (cld_ and startAt == k_() and m < rapmap::utils::kMaxLCPLR) {
+                return extendSearchESA_(lbIn, ubIn, startAt, qb, qe, complementBases);
+            }
+            if (llcp_ and startAt == k_()) {
+                return extendSearchLCP_(lbIn, ubIn, startAt, qb, qe, complementBases);
+            }
+
             BoundSearchResult<OffsetT> res1, res2;
 
-            char smallest = '#';
-            char largest = '}';
-            char sentinel = smallest;
+            // If the interval was sampled, the searches start from the
+            // samples that bound the query (see narrowBySamples_)
+            rapmap::utils::SampledSearchTree::Interval samples;
+            bool sampled = samples_ and startAt == k_() and
+                           samples_->find(lbIn + 1, ubIn, samples);
 
             // FIX: these have to be large enough to hold the *sum* of the boundaries!
             int64_t l = lbIn, r = ubIn;
             int64_t lcpLP = startAt, lcpRP = startAt;
             int64_t c{0};
             int64_t i{0};
+            if (sampled) { narrowBySamples_(samples, m, l, r, lcpLP, lcpRP); }
 
             int64_t maxI{startAt};
-            int64_t prevI = startAt;
-            int64_t prevILow = startAt;
-            int64_t prevIHigh = startAt;
-            int64_t validBoundLow = ubIn;
-            int64_t validBoundHigh = lbIn;
-            int64_t validBound = 0;
-            bool plt{true};
+            int64_t prevILow = lcpLP;
+            int64_t prevIHigh = lcpRP;
+            res1.maxLen = std::max(lcpLP, lcpRP);
             // Reduce the search interval until we hit a border
             // i.e. until c == r - 1 or c == l + 1
-            while (true) {
+            while (r - l > 1) {
                 c = (l + r) / 2;
-                plt = true;
-                i = std::min(lcpLP, lcpRP);
-                while (i < m and SA[c] + i < n) {
-                    char queryChar = ::toupper(*(qb + i));
-                    // If we're reverse complementing
-                    if (complementBases) {
-                        queryChar = rapmap::utils::my_mer::complement(queryChar);
-                    }
-
-                    if ( queryChar < *(sb + SA[c] + i) ) {
-                        if (i > prevIHigh) {
-                            prevIHigh = i;
-                            validBoundHigh = c;
-                        } else if (i == prevIHigh) {
-                            validBoundHigh = c < validBoundHigh ? c : validBoundHigh;
-                        }
-
-                        break;
-                    } else if ( queryChar > *(sb + SA[c] + i)) {
-                        if (i > prevILow) {
-                            prevILow = i;
-                            validBoundLow = c;
-                        } else if (i == prevILow) {
-                            validBoundLow = c > validBoundLow ? c : validBoundLow;
-                        }
-                        plt = false;
-                        break;
-                    }
-
-                    ++i;
-                }
-                if (i == m or SA[c] + i == n) {
-                    if (i > prevIHigh) {
-                        prevIHigh = i;
-                        validBoundHigh = c;
-                    } else if (i == prevIHigh) {
-                        validBoundHigh = c < validBoundHigh ? c : validBoundHigh;
-                    }
+                i = compareSuffix_(c, std::min(lcpLP, lcpRP), qb, m, '\0',
+                                   complementBases, plt);
+                if (plt) {
+                    prevIHigh = std::max(prevIHigh, i);
+                } else {
+                    prevILow = std::max(prevILow, i);
                 }
 
                 if (plt) {
                     if (c == l + 1) {
-                        auto maxI = std::max(std::max(i, prevILow), prevIHigh);
+                        maxI = std::max(std::max(i, prevILow), prevIHigh);
                         res1.maxLen = maxI;
                         break;
                     }
@@ -208,38 +205,19 @@ class SASearcher {
                 }
             }
 
-            bool knownValid{true};
-            m = res1.maxLen + 1;
-
-            // first search for the lower bound
-            sentinel = '#';
+            // first search for the lower bound (the prefix of length maxLen
+            // followed by a sentinel smaller than any character)
+            m = res1.maxLen;
             l = lbIn;
             r = ubIn;
-
             lcpLP = startAt;
             lcpRP = startAt;
-            c = 0;
-            plt = true;
-            i = startAt;
-            while (true) {
+            if (sampled) { narrowBySamples_(samples, m, l, r, lcpLP, lcpRP); }
+            res1.bound = r;
+            while (r - l > 1) {
                 c = (l + r) / 2;
-                plt = true;
-                i = std::min(lcpLP, lcpRP);
-                while (i < m and SA[c] + i < n) {
-                    char queryChar = (i < m - 1) ? ::toupper(*(qb + i)) : sentinel;
-                    // If we're reverse complementing
-                    if (queryChar != sentinel and complementBases) {
-                        queryChar = rapmap::utils::my_mer::complement(queryChar);
-                    }
-
-                    if ( queryChar < *(sb + SA[c] + i) ) {
-                     	break;
-                    } else if ( queryChar > *(sb + SA[c] + i)) {
-                        plt = false;
-                        break;
-                    }
-                    ++i;
-                }
+                i = compareSuffix_(c, std::min(lcpLP, lcpRP), qb, m, '#',
+                                   complementBases, plt);
                 if (plt) {
                     if (c == l + 1) {
                         res1.bound = c;
@@ -257,35 +235,21 @@ class SASearcher {
                 }
             }
 
-            // then search for the upper bound
-            sentinel = '{';
+            // then search for the upper bound (with a sentinel larger than
+            // any character)
             l = res1.bound - 1;
             r = ubIn;
-
             lcpLP = startAt;
             lcpRP = startAt;
-            c = 0;
-            plt = true;
-            i = startAt;
-            while (true) {
+            if (sampled) {
+                int64_t sl{l}, slcp{startAt};
+                narrowBySamples_(samples, m, sl, r, slcp, lcpRP);
+            }
+            res2.bound = r;
+            while (r - l > 1) {
                 c = (l + r) / 2;
-                plt = true;
-                i = std::min(lcpLP, lcpRP);
-                while (i < m and SA[c] + i < n) {
-                    char queryChar = (i < m - 1) ? ::toupper(*(qb + i)) : sentinel;
-                    // If we're reverse complementing
-                    if (queryChar != sentinel and complementBases) {
-                        queryChar = rapmap::utils::my_mer::complement(queryChar);
-                    }
-
-                    if ( queryChar < *(sb + SA[c] + i) ) {
-                     	break;
-                    } else if ( queryChar > *(sb + SA[c] + i)) {
-                        plt = false;
-                        break;
-                    }
-                    ++i;
-                }
+                i = compareSuffix_(c, std::min(lcpLP, lcpRP), qb, m, '{',
+                                   complementBases, plt);
                 if (plt) {
                     if (c == l + 1) {
                         res2.bound = c;
@@ -311,33 +275,501 @@ class SASearcher {
 
         /**
          * Compute the longest common extension between the suffixes
-         * at T[SA[p1]] and T[SA[p2]].  Start the comparison at `startAt`
-         * positions into the suffix, and only consider an extension
-         * going to at most position `stopAt`.
+         * at T[SA[p1]] and T[SA[p2]], which share their first `startAt`
+         * characters (so the comparison starts there), going no further
+         * than a '$' or position `stopAt` of the suffixes.  If the index
+         * has a range-minimum structure over its LCP array, this is the
+         * minimum LCP between rows p1 and p2, found in constant time.
          */
         OffsetT lce(OffsetT p1, OffsetT p2,
                     OffsetT startAt=0,
                     OffsetT stopAt=std::numeric_limits<OffsetT>::max(),
                     bool verbose=false) {
-            std::string& seq = *seq_;
-            std::vector<OffsetT>& SA = *sa_;
+            auto& seq = *seq_;
+            auto& SA = *sa_;
+            if (rmq_) {
+                // The LCP array counts matching '$'s, so also stop at the
+                // end of the transcript
+                int64_t pos = SA[p1];
+                auto txp = rmi_->transcriptAtPosition(static_cast<OffsetT>(pos));
+                int64_t limit = std::min<int64_t>(
+                    rmi_->txpOffsets[txp] + rmi_->txpLens[txp] - pos, stopAt);
+                int64_t shared = (p1 == p2) ? limit
+                    : rmq_->query(std::min(p1, p2) + 1, std::max(p1, p2));
+                // (a saturated LCP is only a lower bound)
+                if (shared < rapmap::utils::kMaxLCPLR or limit <= rapmap::utils::kMaxLCPLR) {
+                    return static_cast<OffsetT>(
+                        std::max<int64_t>(startAt, std::min(shared, limit)));
+                }
+            }
             OffsetT len = static_cast<OffsetT>(startAt);
-            auto o1 = SA[p1] + startAt;
-            auto o2 = SA[p2] + startAt;
+            auto o1 = SA[p1];
+            auto o2 = SA[p2];
             auto maxIndex = std::max(o1, o2);
-            while (maxIndex + len < textLen_ and seq[o1+len] == seq[o2+len]) {
-                if (seq[o1+len] == '$') { break; }
-                if (len >= stopAt) { break; }
-                ++len;
+            if (packed_) {
+                // Compare 32 bases at a time, stopping at the first
+                // mismatch or '$' (or the end of the text / stopAt).
+                while (maxIndex + len < textLen_ and len < stopAt) {
+                    uint64_t a = static_cast<uint64_t>(o1 + len);
+                    uint64_t b = static_cast<uint64_t>(o2 + len);
+                    uint64_t diff = packed_->window(a) ^ packed_->window(b);
+                    int64_t same = (diff == 0) ? 32 : (__builtin_clzll(diff) >> 1);
+                    same = std::min<int64_t>(same, packed_->distToBoundary(a));
+                    same = std::min<int64_t>(same, packed_->distToBoundary(b));
+                    same = std::min<int64_t>(same, textLen_ - (maxIndex + len));
+                    same = std::min<int64_t>(same, stopAt - len);
+                    len += static_cast<OffsetT>(same);
+                    if (same < 32) { break; }
+                }
+                return len;
             }
-            return len;
+            if (maxIndex + len >= textLen_ or len >= stopAt) { return len; }
+            // The extension stops at the first mismatch, or at a '$'
+            // shared by both suffixes
+            int64_t maxLen = std::min<int64_t>(textLen_ - maxIndex, stopAt);
+            const char* a = seq.data() + o1 + len;
+            int64_t run = mismatch_(a, seq.data() + o2 + len, maxLen - len);
+            auto sep = static_cast<const char*>(std::memchr(a, '$', run));
+            if (sep != nullptr) { run = sep - a; }
+            return len + static_cast<OffsetT>(run);
         }
 
     private:
+        /**
+         * The three searches of extendSearchNaive, each done as in Manber
+         * and Myers' algorithm: along with the LCP of the query with the
+         * suffixes at the current bounds l and r, we know (from the
+         * LCP-LR arrays) the LCP of each bound with the midpoint c.  When
+         * the query shares more with the bound than c does, or less, the
+         * side of c on which the query lies follows without reading the
+         * text; otherwise the comparison resumes where the query's match
+         * with the bound ends.  No base of the query is compared more than
+         * once per search, so each takes O(m + log n) time.
+         */
+        template <typename IteratorT>
+        std::tuple<OffsetT, OffsetT, OffsetT> extendSearchLCP_(
+                OffsetT lbIn, OffsetT ubIn, OffsetT startAt,
+                IteratorT qb, IteratorT qe, bool complementBases) {
+            int64_t m = std::distance(qb, qe);
+            // The length of the maximum mappable prefix
+            int64_t maxLen{startAt};
+            boundSearchLCP_(lbIn, ubIn, startAt, qb, m, '\0', complementBases, maxLen);
+            int64_t unused{0};
+            // The bounds of the rows matching that prefix
+            int64_t lb = boundSearchLCP_(lbIn, ubIn, startAt, qb, maxLen, '#',
+                                         complementBases, unused);
+            int64_t ub = boundSearchLCP_(lbIn, ubIn, startAt, qb, maxLen, '{',
+                                         complementBases, unused);
+            // Must occur at least once!
+            if (lb == ub) { ub += 1; }
+            return std::make_tuple(static_cast<OffsetT>(lb), static_cast<OffsetT>(ub),
+                                   static_cast<OffsetT>(maxLen));
+        }
+
+        /**
+         * Find the MMP by walking down the lcp-interval tree of the
+         * enhanced suffix array, starting at the k-mer interval.  At each
+         * interval [i..j] (whose suffixes share l characters) the query is
+         * compared to the suffix at i up to l, and then the child interval
+         * whose suffixes continue with the query's next character is found
+         * among the (at most 5) children, using the child table.  This takes
+         * time proportional to the length of the match, however large the
+         * k-mer interval.  The LCP values are those of the range-minimum
+         * structure; they saturate, so the query must be shorter than
+         * kMaxLCPLR.
+         */
+        template <typename IteratorT>
+        std::tuple<OffsetT, OffsetT, OffsetT> extendSearchESA_(
+                OffsetT lbIn, OffsetT ubIn, OffsetT startAt,
+                IteratorT qb, IteratorT qe, bool complementBases) {
+            auto& cld = *cld_;
+            auto& lcp = *rmq_;
+            const int64_t m = std::distance(qb, qe);
+            const int64_t numRows = static_cast<int64_t>(cld.size());
+            // lcp, taken to be -1 at the first row and past the last
+            auto L = [&lcp, numRows](int64_t r) -> int64_t {
+                return (r == 0 or r >= numRows) ? -1 : static_cast<int64_t>(lcp[r]);
+            };
+            bool queryLess{true};
+
+            int64_t i = lbIn + 1, j = ubIn - 1;
+            int64_t matched = startAt;
+            while (true) {
+                if (i == j) {
+                    matched = compareSuffix_(i, matched, qb, m, '\0', complementBases, queryLess);
+                    break;
+                }
+                int64_t first = (L(i) <= L(j + 1)) ? cld[j] : cld[i];
+                int64_t ell = L(first);
+                int64_t end = std::min(ell, m);
+                matched = compareSuffix_(i, matched, qb, end, '\0', complementBases, queryLess);
+                if (matched < end or matched == m) { break; }
+
+                // Find the child interval [lo..hi] that continues with c
+                char c = queryChar_(qb, ell, complementBases);
+                int64_t lo = i;
+                int64_t next = first;
+                bool found{false};
+                while (true) {
+                    int64_t hi = (next < 0) ? j : next - 1;
+                    if (suffixChar_(lo, ell) == c) {
+                        i = lo;
+                        j = hi;
+                        found = true;
+                        break;
+                    }
+                    if (next < 0) { break; }
+                    lo = next;
+                    int64_t nextL = cld[next];
+                    next = (nextL > next and nextL <= j and L(nextL) == ell) ? nextL : -1;
+                }
+                if (!found) { break; }
+            }
+            return std::make_tuple(static_cast<OffsetT>(i), static_cast<OffsetT>(j + 1),
+                                   static_cast<OffsetT>(matched));
+        }
+
+        // Find the row before which the first m characters of the query,
+        // followed by sentinel (unless it is '\0'), would be inserted
+        // between the k-mer bounds lbIn and ubIn.  maxLen is set to the
+        // longest match of the query with a suffix between those bounds.
+        template <typename IteratorT>
+        int64_t boundSearchLCP_(int64_t lbIn, int64_t ubIn, int64_t startAt,
+                                IteratorT qb, int64_t m, char sentinel,
+                                bool complementBases, int64_t& maxLen) {
+            auto& llcp = *llcp_;
+            auto& rlcp = *rlcp_;
+            int64_t l = lbIn, r = ubIn;
+            int64_t lcpLP = startAt, lcpRP = startAt;
+            while (r - l > 1) {
+                int64_t c = (l + r) / 2;
+                int64_t i{0};
+                if (lcpLP >= lcpRP) {
+                    int64_t lcpLC = llcp[c];
+                    // The query is past c
+                    if (lcpLC > lcpLP) { l = c; continue; }
+                    // The query is before c (unless lcpLC is saturated)
+                    if (lcpLC < lcpLP and lcpLC != rapmap::utils::kMaxLCPLR) {
+                        r = c;
+                        lcpRP = lcpLC;
+                        continue;
+                    }
+                    i = std::min(lcpLP, lcpLC);
+                } else {
+                    int64_t lcpCR = rlcp[c];
+                    if (lcpCR > lcpRP) { r = c; continue; }
+                    if (lcpCR < lcpRP and lcpCR != rapmap::utils::kMaxLCPLR) {
+                        l = c;
+                        lcpLP = lcpCR;
+                        continue;
+                    }
+                    i = std::min(lcpRP, lcpCR);
+                }
+
+                // Compare the query to the suffix at c, starting at i
+                bool queryLess{true};
+                i = compareSuffix_(c, i, qb, m, sentinel, complementBases, queryLess);
+                if (queryLess) {
+                    r = c;
+                    lcpRP = i;
+                } else {
+                    l = c;
+                    lcpLP = i;
+                }
+            }
+            maxLen = std::min(std::max(lcpLP, lcpRP), m);
+            return r;
+        }
+
+        // The character at position pos of the text
+        inline char textChar_(uint64_t pos) const {
+            return packed_ ? (*packed_)[pos] : (*seq_)[pos];
+        }
+
+        // Character i of the query, as it is compared (upper-cased and,
+        // if requested, complemented)
+        template <typename IteratorT>
+        inline char queryChar_(IteratorT qb, int64_t i, bool complementBases) const {
+            char c = ::toupper(*(qb + i));
+            return complementBases ? rapmap::utils::my_mer::complement(c) : c;
+        }
+
+        // The character at position i of the suffix at row `row` ('\0' past
+        // the end of the text), read from the row's fingerprint if that
+        // covers position i.
+        inline char suffixChar_(int64_t row, int64_t i) const {
+            if (fp_ and i >= k_()) {
+                using FP = rapmap::utils::SuffixFingerprints;
+                int64_t off = i - k_();
+                uint64_t f = (*fp_)[row];
+                int64_t valid = FP::validBases(f);
+                if (off < valid) { return "ACGT"[FP::base(f, off)]; }
+                if (off == valid and valid < FP::kBases) { return '$'; }
+            }
+            int64_t pos = static_cast<int64_t>((*sa_)[row]) + i;
+            return (pos < static_cast<int64_t>(textLen_)) ? textChar_(pos) : '\0';
+        }
+
+        /**
+         * Compare the query (its first m characters, followed by sentinel
+         * unless that is '\0') with the suffix at row `row`, starting at
+         * position i (the two are known to share the first i characters).
+         * Returns the length of the match, and sets queryLess to false
+         * only if the query sorts after the suffix (if the query ends
+         * first, it is taken to be smaller).  If the row has a fingerprint
+         * covering the mismatch, neither the suffix array nor the text is
+         * read.
+         */
+        template <typename IteratorT>
+        int64_t compareSuffix_(int64_t row, int64_t i, IteratorT qb, int64_t m,
+                               char sentinel, bool complementBases, bool& queryLess) {
+            const int64_t qlen = (sentinel == '\0') ? m : m + 1;
+            auto queryChar = [&](int64_t j) -> char {
+                return (j == m) ? sentinel : queryChar_(qb, j, complementBases);
+            };
+            queryLess = true;
+
+            if (fp_ and i >= k_() and i < qlen) {
+                using FP = rapmap::utils::SuffixFingerprints;
+                uint64_t f = (*fp_)[row];
+                int64_t valid = FP::validBases(f);
+                int64_t off = i - k_();
+                int64_t limit = std::min(m, queryValidLen_) - i;
+                if (off < valid and limit > 0) {
+                    uint64_t diff = FP::window(f, off) ^ queryWindow_(i);
+                    int64_t same = (diff == 0) ? 32 : (__builtin_clzll(diff) >> 1);
+                    same = std::min(same, std::min(valid - off, limit));
+                    i += same;
+                    off += same;
+                }
+                // The fingerprint holds the mismatching character (a base,
+                // or the '$' that ends it); it can't match the query's
+                // character, which is the sentinel, not a base, or differs
+                if (i < qlen and (off < valid or (off == valid and valid < FP::kBases))) {
+                    queryLess = queryChar(i) < suffixChar_(row, i);
+                    return i;
+                }
+                if (i == qlen) { return i; }
+            }
+
+            const int64_t n = textLen_;
+            int64_t pos = (*sa_)[row];
+            if (packed_) {
+                i += matchRun_(pos + i, i, m);
+            } else if (i < m and pos + i < n) {
+                i += mismatch_(queryBytes_ + i, seq_->data() + pos + i,
+                               std::min(m, n - pos) - i);
+            }
+            while (i < qlen and pos + i < n) {
+                char qc = queryChar(i);
+                char tc = textChar_(pos + i);
+                if (qc != tc) {
+                    queryLess = qc < tc;
+                    break;
+                }
+                ++i;
+            }
+            return i;
+        }
+
+        /**
+         * Narrow the search for the query's first qlen characters over a
+         * sampled k-mer interval: l becomes the last sampled row known
+         * (from its fingerprint alone) to sort before them, and r the
+         * first known to sort after them, with lcpL and lcpR their
+         * exact LCPs with the query; l and r are left alone if there is
+         * no such sample.  The rows between hold the boundaries of all
+         * three searches of extendSearchNaive.
+         */
+        void narrowBySamples_(const rapmap::utils::SampledSearchTree::Interval& samples,
+                              int64_t qlen, int64_t& l, int64_t& r,
+                              int64_t& lcpL, int64_t& lcpR) const {
+            using Tree = rapmap::utils::SampledSearchTree;
+            using FP = rapmap::utils::SuffixFingerprints;
+            const int64_t limit = std::min(qlen, queryValidLen_) - k_();
+            if (limit <= 0) { return; }
+            const uint64_t qwin = queryWindow_(k_());
+            // The order of a sampled suffix relative to the query (-1 if
+            // it sorts before, 1 if after, 0 if the fingerprint can't
+            // tell), and their LCP if it can
+            auto order = [&](uint64_t f, int64_t& lcp) -> int {
+                int64_t valid = FP::validBases(f);
+                uint64_t diff = FP::window(f, 0) ^ qwin;
+                int64_t same = (diff == 0) ? 32 : (__builtin_clzll(diff) >> 1);
+                same = std::min(same, valid);
+                if (same >= limit) { return 0; }
+                lcp = k_() + same;
+                if (same < valid) {
+                    return (FP::base(f, same) < ((qwin >> (62 - 2 * same)) & 0x3)) ? -1 : 1;
+                }
+                // the suffix has a '$' here (sorting before any base)
+                return (valid < FP::kBases) ? -1 : 0;
+            };
+            int64_t lcp{0};
+            const uint64_t* before{nullptr};
+            const uint64_t* after{nullptr};
+            uint64_t numBefore = Tree::partitionPoint(samples, [&](uint64_t f) {
+                return order(f, lcp) < 0;
+            }, before, after);
+            if (before) {
+                l = Tree::row(samples, numBefore - 1);
+                order(*before, lcpL);
+            }
+            uint64_t firstAfter = Tree::partitionPoint(samples, [&](uint64_t f) {
+                return order(f, lcp) <= 0;
+            }, before, after);
+            if (after) {
+                r = Tree::row(samples, firstAfter);
+                order(*after, lcpR);
+            }
+        }
+
+        // 2-bit encode the query (as it will be compared: upper-cased and,
+        // if requested, complemented) into query2bit_.  Encoding stops at
+        // the first character that isn't A, C, G or T.
+        template <typename IteratorT>
+        void encodeQuery_(IteratorT qb, IteratorT qe, bool complementBases) {
+            int64_t m = std::distance(qb, qe);
+            // one extra word so that windows never read past the end
+            query2bit_.assign(m / 32 + 2, 0);
+            queryValidLen_ = m;
+            for (int64_t i = 0; i < m; ++i) {
+                char c = ::toupper(*(qb + i));
+                if (complementBases) { c = rapmap::utils::my_mer::complement(c); }
+                uint64_t code{0};
+                switch (c) {
+                    case 'A': code = 0; break;
+                    case 'C': code = 1; break;
+                    case 'G': code = 2; break;
+                    case 'T': code = 3; break;
+                    default: queryValidLen_ = i; return;
+                }
+                query2bit_[i / 32] |= code << (62 - 2 * (i % 32));
+            }
+        }
+
+        // If the query lies in an encoded text (see addEncodedQuery), shift
+        // its words, and clip them at the first base that isn't A, C, G or
+        // T, into query2bit_ (just as encodeQuery_ would have filled it)
+        template <typename IteratorT>
+        bool copyEncodedQuery_(IteratorT qb, IteratorT qe, bool complementBases) {
+            int64_t m = std::distance(qb, qe);
+            if (complementBases or numEncoded_ == 0 or m == 0) { return false; }
+            const char* b = &*qb;
+            for (size_t t = 0; t < numEncoded_; ++t) {
+                const EncodedText_& et = encoded_[t];
+                if (b < et.begin or b + m > et.begin + et.len) { continue; }
+                size_t off = b - et.begin;
+                size_t numWords = m / 32 + 2;
+                query2bit_.resize(numWords);
+                for (size_t w = 0; w < numWords; ++w) {
+                    size_t p = off + 32 * w;
+                    if (p >= et.len) { query2bit_[w] = 0; continue; }
+                    uint32_t sh = 2 * (p & 31);
+                    uint64_t win = et.packed[p >> 5] << sh;
+                    if (sh > 0) { win |= et.packed[(p >> 5) + 1] >> (64 - sh); }
+                    query2bit_[w] = win;
+                }
+                // The first invalid base at or after off (or the end)
+                size_t numMaskWords = (et.len + 63) / 64;
+                size_t mw = off >> 6;
+                uint64_t bits = et.invalid[mw] & (~uint64_t(0) << (off & 63));
+                while (bits == 0 and ++mw < numMaskWords) { bits = et.invalid[mw]; }
+                size_t firstInvalid = (bits == 0) ? et.len : (mw << 6) + __builtin_ctzll(bits);
+                queryValidLen_ = std::min<int64_t>(m, firstInvalid - off);
+                // Nothing from the first invalid base on is encoded
+                size_t v = queryValidLen_;
+                uint32_t keep = 2 * (v % 32);
+                query2bit_[v / 32] &= (keep == 0) ? 0 : (~uint64_t(0) << (64 - keep));
+                std::fill(query2bit_.begin() + v / 32 + 1, query2bit_.end(), 0);
+                return true;
+            }
+            return false;
+        }
+
+        // Point queryBytes_ at the query, or, if it is to be complemented,
+        // at a copy of it as it will be compared (upper-cased and
+        // complemented) in queryCopy_.  A query with lower-case bases is
+        // still compared correctly, but mismatch_ stops at each of them.
+        template <typename IteratorT>
+        void setQueryBytes_(IteratorT qb, IteratorT qe, bool complementBases) {
+            if (!complementBases) {
+                queryBytes_ = (qb == qe) ? nullptr : &*qb;
+                return;
+            }
+            queryCopy_.clear();
+            for (auto it = qb; it != qe; ++it) {
+                char c = ::toupper(*it);
+                queryCopy_.push_back(rapmap::utils::my_mer::complement(c));
+            }
+            queryBytes_ = queryCopy_.data();
+        }
+
+        static inline int64_t k_() {
+            return rapmap::utils::FixedKmer<K>::len(rapmap::utils::my_mer::k());
+        }
+
+        inline uint64_t queryWindow_(int64_t i) const {
+            size_t w = i / 32;
+            uint32_t off = 2 * (i % 32);
+            uint64_t win = query2bit_[w] << off;
+            if (off > 0) { win |= query2bit_[w + 1] >> (64 - off); }
+            return win;
+        }
+
+        // The number of positions, starting at query position qi (and text
+        // position textPos), for which the query matches the text, without
+        // going past query position limit, a '$', or the end of the text.
+        inline int64_t matchRun_(uint64_t textPos, int64_t qi, int64_t limit) const {
+            int64_t run{0};
+            int64_t end = std::min(limit, queryValidLen_);
+            while (qi + run < end and textPos + run < static_cast<uint64_t>(textLen_)) {
+                uint64_t diff = packed_->window(textPos + run) ^ queryWindow_(qi + run);
+                int64_t same = (diff == 0) ? 32 : (__builtin_clzll(diff) >> 1);
+                same = std::min<int64_t>(same, packed_->distToBoundary(textPos + run));
+                same = std::min<int64_t>(same, end - (qi + run));
+                same = std::min<int64_t>(same, static_cast<int64_t>(textLen_ - (textPos + run)));
+                run += same;
+                if (same < 32) { break; }
+            }
+            return run;
+        }
+
         RapMapIndexT* rmi_;
-        std::string* seq_;
-        std::vector<OffsetT>* sa_;
+        const rapmap::utils::IndexArray<char>* seq_;
+        const typename RapMapIndexT::SAType* sa_;
+        const rapmap::utils::PackedText* packed_;
         OffsetT textLen_;
+        // The LCP-LR arrays (or nullptr if the index has none), and the
+        // k-mer length of the intervals for which they were built
+        const rapmap::utils::IndexArray<uint16_t>* llcp_;
+        const rapmap::utils::IndexArray<uint16_t>* rlcp_;
+        // The LCP range-minimum structure (or nullptr if there is none)
+        const rapmap::utils::LCPRangeMin* rmq_;
+        // The child table (or nullptr if there is none)
+        const rapmap::utils::IndexArray<OffsetT>* cld_;
+        // The fingerprints of the suffixes (or nullptr if there are none)
+        const rapmap::utils::IndexArray<uint64_t>* fp_;
+        // The samples of the large k-mer intervals (or nullptr)
+        const rapmap::utils::SampledSearchTree* samples_;
+        // The byte-comparison kernel for this CPU (see MatchKernels.hpp)
+        rapmap::utils::MismatchFn mismatch_;
+        // The 2-bit query (only used with a packed text or fingerprints)
+        std::vector<uint64_t> query2bit_;
+        int64_t queryValidLen_{0};
+        // The query as it is compared (only used with a byte text), and
+        // the copy of a query that is complemented
+        const char* queryBytes_{nullptr};
+        std::vector<char> queryCopy_;
+        // The encoded texts queries may be taken from (see addEncodedQuery)
+        struct EncodedText_ {
+            const char* begin;
+            size_t len;
+            const uint64_t* packed;
+            const uint64_t* invalid;
+        };
+        EncodedText_ encoded_[2];
+        size_t numEncoded_{0};
 };
 
 
@@ -0,0 +1,174 @@
+//
+// RapMap - Rapid and accurate mapping of short reads to transcriptomes using
+// quasi-mapping.
+// Copyright (C) 2015, 2016, 2017 Rob Patro, Avi Srivastava, Hirak Sarkar
+//
+// This file is part of RapMap.
+//
+// RapMap is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RapMap is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RapMap.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RAPMAP_SAMPLED_SEARCH_TREE_HPP__
+#define __RAPMAP_SAMPLED_SEARCH_TREE_HPP__
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "IndexArray.hpp"
+#include "SuffixFingerprints.hpp"
+
+namespace rapmap {
+namespace utils {
+
+/**
+ * A top-level search structure for the large k-mer intervals of the
+ * suffix array.  Every kStride-th row of each interval of at least
+ * minRows rows is sampled, and the fingerprints of the sampled suffixes
+ * (see SuffixFingerprints.hpp) are laid out in Eytzinger (BFS) order, so
+ * that the first levels of a search over them share a few cache lines
+ * and the rest are prefetched.  SASearcher uses the samples to narrow a
+ * k-mer interval to (about) kStride rows before it probes the suffix
+ * array itself.
+ */
+class SampledSearchTree {
+public:
+  static constexpr uint64_t kStride = 16;
+
+  // The samples of one interval
+  struct Interval {
+    const uint64_t* keys;  // fingerprints, in Eytzinger order
+    const uint32_t* ranks; // the sample (in row order) of each key
+    uint64_t size;
+    uint64_t firstRow;
+  };
+
+  // Sample the intervals [lb, ub) of at least minRows rows
+  template <typename IndexT>
+  void build(const std::string& text, const std::vector<IndexT>& SA, uint32_t k,
+             std::vector<std::pair<uint64_t, uint64_t>> intervals, uint64_t minRows) {
+    minRows = std::max(minRows, 2 * kStride);
+    std::sort(intervals.begin(), intervals.end());
+    std::vector<uint64_t> lbs, ubs, offsets{0}, keys;
+    std::vector<uint32_t> ranks;
+    std::vector<uint64_t> sorted;
+    for (auto& iv : intervals) {
+      if (iv.second - iv.first < minRows) { continue; }
+      sorted.clear();
+      for (uint64_t row = iv.first; row < iv.second; row += kStride) {
+        sorted.push_back(SuffixFingerprints::of(text, static_cast<int64_t>(SA[row]), k));
+      }
+      uint64_t off = keys.size();
+      keys.resize(off + sorted.size());
+      ranks.resize(off + sorted.size());
+      layout_(sorted, keys.data() + off, ranks.data() + off, 1, 0);
+      lbs.push_back(iv.first);
+      ubs.push_back(iv.second);
+      offsets.push_back(keys.size());
+    }
+    numRows_ = SA.size();
+    lbs_.assign(std::move(lbs));
+    ubs_.assign(std::move(ubs));
+    offsets_.assign(std::move(offsets));
+    keys_.assign(std::move(keys));
+    ranks_.assign(std::move(ranks));
+  }
+
+  inline bool empty() const { return lbs_.empty(); }
+  // The number of rows of the suffix array it was built over
+  inline uint64_t numRows() const { return numRows_; }
+  inline uint64_t bytes() const {
+    return (lbs_.size() + ubs_.size() + offsets_.size() + keys_.size()) * sizeof(uint64_t) +
+           ranks_.size() * sizeof(uint32_t);
+  }
+
+  // Find the samples of the interval [lb, ub); false if it wasn't sampled
+  inline bool find(uint64_t lb, uint64_t ub, Interval& iv) const {
+    auto it = std::lower_bound(lbs_.begin(), lbs_.end(), lb);
+    if (it == lbs_.end() or *it != lb) { return false; }
+    size_t i = it - lbs_.begin();
+    if (ubs_[i] != ub) { return false; }
+    iv.keys = keys_.data() + offsets_[i];
+    iv.ranks = ranks_.data() + offsets_[i];
+    iv.size = offsets_[i + 1] - offsets_[i];
+    iv.firstRow = lb;
+    return true;
+  }
+
+  // The rank of the first sample of iv (in row order) for which pred is
+  // false (iv.size if there is none), where pred holds for a prefix of
+  // the samples.  The keys of the samples on either side of that point
+  // are returned in before and after (nullptr if there is none).
+  template <typename PredT>
+  static inline uint64_t partitionPoint(const Interval& iv, PredT pred,
+                                        const uint64_t*& before,
+                                        const uint64_t*& after) {
+    before = nullptr;
+    uint64_t i{1};
+    while (i <= iv.size) {
+      // (the keys 3 levels down share a cache line)
+      __builtin_prefetch(iv.keys + 8 * i - 1);
+      if (pred(iv.keys[i - 1])) {
+        // the last node at which the search goes right is the
+        // predecessor of the partition point
+        before = iv.keys + (i - 1);
+        i = 2 * i + 1;
+      } else {
+        i = 2 * i;
+      }
+    }
+    // and the last at which it goes left, its successor
+    i >>= __builtin_ffsll(~i);
+    after = (i == 0) ? nullptr : iv.keys + (i - 1);
+    return (i == 0) ? iv.size : iv.ranks[i - 1];
+  }
+
+  static inline uint64_t row(const Interval& iv, uint64_t rank) {
+    return iv.firstRow + rank * kStride;
+  }
+
+  template <typename Archive> void save(Archive& ar) const {
+    ar(numRows_, lbs_, ubs_, offsets_, keys_, ranks_);
+  }
+
+  template <typename Archive> void load(Archive& ar) {
+    ar(numRows_, lbs_, ubs_, offsets_, keys_, ranks_);
+  }
+
+private:
+  // Place the sorted keys in the subtree rooted at Eytzinger node i
+  // (1-based), starting from sorted[j]; returns the next j
+  static uint64_t layout_(const std::vector<uint64_t>& sorted, uint64_t* keys,
+                          uint32_t* ranks, uint64_t i, uint64_t j) {
+    if (i > sorted.size()) { return j; }
+    j = layout_(sorted, keys, ranks, 2 * i, j);
+    keys[i - 1] = sorted[j];
+    ranks[i - 1] = static_cast<uint32_t>(j);
+    return layout_(sorted, keys, ranks, 2 * i + 1, j + 1);
+  }
+
+  uint64_t numRows_{0};
+  IndexArray<uint64_t> lbs_;
+  IndexArray<uint64_t> ubs_;
+  IndexArray<uint64_t> offsets_;
+  IndexArray<uint64_t> keys_;
+  IndexArray<uint32_t> ranks_;
+};
+
+} // namespace utils
+} // namespace rapmap
+
+#endif // __RAPMAP_SAMPLED_SEARCH_TREE_HPP__
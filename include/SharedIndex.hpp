@@ -0,0 +1,132 @@
+//
+// RapMap - Rapid and accurate mapping of short reads to transcriptomes using
+// quasi-mapping.
+// Copyright (C) 2015, 2016, 2017 Rob Patro, Avi Srivastava, Hirak Sarkar
+//
+// This file is part of RapMap.
+//
+// RapMap is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RapMap is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RapMap.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RAPMAP_SHARED_INDEX_HPP__
+#define __RAPMAP_SHARED_INDEX_HPP__
+
+#include <cstdint>
+#include <cstddef>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+/**
+ * A quasi-index published into a named POSIX shared-memory segment by
+ * `rapmap quasiload`.  The segment holds a one-page preamble, followed
+ * by a flat index image (see FlatIndex.hpp) and the raw bytes of the
+ * k-mer hash files, each starting on a page boundary.  The segment is
+ * keyed to a particular index by the sequence and name hashes recorded
+ * in the index header, so that `quasimap -y` will refuse to attach to a
+ * segment holding a different transcriptome.
+ */
+namespace rapmap {
+namespace shm {
+
+constexpr char kShmMagic[8] = {'R', 'M', 'S', 'H', 'M', '\0', '\0', '\0'};
+// Bump this whenever the segment layout changes
+constexpr uint32_t kShmLayoutVersion = 1;
+constexpr uint32_t kMaxHashParts = 4;
+constexpr size_t kDigestLen = 80;
+
+struct SharedPart {
+  uint64_t offset;
+  uint64_t bytes;
+};
+
+struct SharedIndexPreamble {
+  // written last, so that a partially-published segment is never used
+  char magic[8];
+  uint32_t version;
+  uint32_t indexWidth;
+  uint32_t kmerLen;
+  uint32_t perfectHash;
+  char seqHash[kDigestLen];
+  char nameHash[kDigestLen];
+  uint64_t totalBytes;
+  SharedPart flat;
+  uint32_t numHashParts;
+  uint32_t reserved;
+  SharedPart hashParts[kMaxHashParts];
+};
+
+// The full POSIX name ("/name") for a user-provided segment name
+std::string segmentName(const std::string& name);
+
+/**
+ * A mapping of a named shared-memory segment.  The mapping is
+ * released when this object is destroyed; the segment itself persists
+ * until it is removed.
+ */
+class SharedIndexSegment {
+public:
+  SharedIndexSegment();
+  ~SharedIndexSegment();
+  SharedIndexSegment(const SharedIndexSegment&) = delete;
+  SharedIndexSegment& operator=(const SharedIndexSegment&) = delete;
+
+  // Create a new, writable segment of the given size.  Fails if a
+  // segment of this name already exists.
+  bool create(const std::string& name, uint64_t bytes, std::string& err);
+  // Map an existing segment read-only and check its preamble.
+  bool open(const std::string& name, std::string& err);
+  // Remove the named segment (processes that have it mapped keep it)
+  static bool remove(const std::string& name, std::string& err);
+
+  char* data() { return base_; }
+  const char* data() const { return base_; }
+  uint64_t size() const { return len_; }
+  const SharedIndexPreamble* preamble() const {
+    return reinterpret_cast<const SharedIndexPreamble*>(base_);
+  }
+
+private:
+  char* base_;
+  uint64_t len_;
+};
+
+// Compute the location of the flat image and each hash part within a
+// segment and fill in the corresponding preamble fields.
+void layoutSegment(SharedIndexPreamble& p, uint64_t flatBytes,
+                   const std::vector<uint64_t>& hashPartBytes);
+
+// The size of fname in bytes; returns false if it can't be stat'ed
+bool fileBytes(const std::string& fname, uint64_t& bytes);
+// Read the first `bytes` bytes of fname into dst
+bool readFileInto(const std::string& fname, char* dst, uint64_t bytes);
+
+/**
+ * A read-only std::streambuf over a region of memory, so that the
+ * stream-based deserializers can read directly from the segment.
+ */
+class MemoryStreamBuf : public std::streambuf {
+public:
+  MemoryStreamBuf(const char* buf, size_t len) {
+    char* b = const_cast<char*>(buf);
+    setg(b, b, b + len);
+  }
+  // The number of bytes read so far
+  size_t consumed() const { return static_cast<size_t>(gptr() - eback()); }
+};
+
+} // namespace shm
+} // namespace rapmap
+
+#endif // __RAPMAP_SHARED_INDEX_HPP__
@@ -0,0 +1,93 @@
+//
+// RapMap - Rapid and accurate mapping of short reads to transcriptomes using
+// quasi-mapping.
+// Copyright (C) 2015, 2016, 2017 Rob Patro, Avi Srivastava, Hirak Sarkar
+//
+// This file is part of RapMap.
+//
+// RapMap is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RapMap is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RapMap.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RAPMAP_SUFFIX_FINGERPRINTS_HPP__
+#define __RAPMAP_SUFFIX_FINGERPRINTS_HPP__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace rapmap {
+namespace utils {
+
+/**
+ * The fingerprint of a row of the suffix array holds the kBases bases
+ * that follow the first k characters of its suffix (which the k-mer
+ * hash has already matched), 2 bits each in the high 56 bits, the first
+ * base highest.  The low 8 bits hold the number of those bases that are
+ * valid; if that is less than kBases, the suffix has a '$' right after
+ * them.  Stored in an array parallel to the suffix array, they let a
+ * binary search decide most comparisons without reading the suffix array
+ * or the text at all.
+ */
+struct SuffixFingerprints {
+  static constexpr int64_t kBases = 28;
+
+  static inline int64_t validBases(uint64_t f) {
+    return static_cast<int64_t>(f & 0xFF);
+  }
+  // The code of base off (< validBases(f))
+  static inline uint64_t base(uint64_t f, int64_t off) {
+    return (f >> (62 - 2 * off)) & 0x3;
+  }
+  // The bases from off on, the first in the high bits (zero-filled)
+  static inline uint64_t window(uint64_t f, int64_t off) {
+    return (f & ~uint64_t(0xFF)) << (2 * off);
+  }
+
+  // The fingerprint of the suffix starting at position saPos of text
+  // (which is made up of A, C, G, T and '$')
+  static uint64_t of(const std::string& text, int64_t saPos, uint32_t k) {
+    const int64_t n = static_cast<int64_t>(text.length());
+    int64_t pos = saPos + k;
+    uint64_t f{0};
+    int64_t valid{0};
+    for (; valid < kBases and pos + valid < n; ++valid) {
+      uint64_t code{0};
+      switch (text[pos + valid]) {
+        case 'A': code = 0; break;
+        case 'C': code = 1; break;
+        case 'G': code = 2; break;
+        case 'T': code = 3; break;
+        default: code = 4; break;
+      }
+      if (code > 3) { break; }
+      f |= code << (62 - 2 * valid);
+    }
+    return f | static_cast<uint64_t>(valid);
+  }
+
+  // Fill fp with the fingerprints of the rows of SA
+  template <typename IndexT>
+  static void build(const std::string& text, const std::vector<IndexT>& SA,
+                    uint32_t k, std::vector<uint64_t>& fp) {
+    fp.assign(SA.size(), 0);
+    for (size_t r = 0; r < SA.size(); ++r) {
+      fp[r] = of(text, static_cast<int64_t>(SA[r]), k);
+    }
+  }
+};
+
+} // namespace utils
+} // namespace rapmap
+
+#endif // __RAPMAP_SUFFIX_FINGERPRINTS_HPP__
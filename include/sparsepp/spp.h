@@ -3253,6 +3253,20 @@ public:
         }
     }
 
+    // Prefetch the group holding the first bucket that find(key) probes,
+    // so that a later find of key doesn't stall on it (a no-op where the
+    // compiler has no prefetch builtin).
+    // ------------------------------------------------------------------
+    void prefetch(const key_type& key) const
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        const size_type bucket_count_minus_one = bucket_count() - 1;
+        __builtin_prefetch(&table.which_group(hash(key) & bucket_count_minus_one));
+#else
+        (void)key;
+#endif
+    }
+
     // This is a tr1 method: the bucket a given key is in, or what bucket
     // it would be put in, if it were to be inserted.  Shrug.
     // ------------------------------------------------------------------
@@ -3927,6 +3941,7 @@ public:
     // ------
     iterator find(const key_type& key)                 { return rep.find(key); }
     const_iterator find(const key_type& key) const     { return rep.find(key); }
+    void prefetch(const key_type& key) const           { rep.prefetch(key); }
 
     mapped_type& operator[](const key_type& key)
     {
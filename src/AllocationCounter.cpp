@@ -0,0 +1,96 @@
+//
+// RapMap - Rapid and accurate mapping of short reads to transcriptomes using
+// quasi-mapping.
+// Copyright (C) 2015, 2016, 2017 Rob Patro, Avi Srivastava, Hirak Sarkar
+//
+// This file is part of RapMap.
+//
+// RapMap is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RapMap is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RapMap.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+// Only built into the test executable rapmap_count_allocs (see
+// src/CMakeLists.txt); the rapmap binary keeps the allocator it
+// is linked with.  That executable is linked with
+// -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc, so that the C code
+// (bit_array, the kseq buffers of the parser, ...) and the statically
+// linked libraries go through the counting wrappers below as well as
+// operator new does.
+
+#include "AllocationCounter.hpp"
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+thread_local uint64_t numAllocations{0};
+} // namespace
+
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t num, size_t size);
+void* __real_realloc(void* p, size_t size);
+
+void* __wrap_malloc(size_t size) {
+  ++numAllocations;
+  return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t num, size_t size) {
+  ++numAllocations;
+  return __real_calloc(num, size);
+}
+
+void* __wrap_realloc(void* p, size_t size) {
+  ++numAllocations;
+  return __real_realloc(p, size);
+}
+} // extern "C"
+
+namespace rapmap {
+namespace utils {
+uint64_t threadAllocations() { return numAllocations; }
+} // namespace utils
+} // namespace rapmap
+
+// The replaceable global allocation functions of C++11, which allocate
+// (and so are counted) through the wrapped malloc
+void* operator new(std::size_t size) {
+  // malloc(0) may return nullptr; operator new must not
+  void* p = std::malloc(size > 0 ? size : 1);
+  if (p == nullptr) { throw std::bad_alloc(); }
+  return p;
+}
+
+void* operator new[](std::size_t size) {
+  void* p = std::malloc(size > 0 ? size : 1);
+  if (p == nullptr) { throw std::bad_alloc(); }
+  return p;
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  return std::malloc(size > 0 ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  return std::malloc(size > 0 ? size : 1);
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+
+void operator delete[](void* p) noexcept { std::free(p); }
+
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
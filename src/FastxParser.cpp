@@ -91,10 +91,44 @@ template <typename T> FastxParser<T>::~FastxParser() {
   }
 }
 
-inline void copyRecord(kseq_t* seq, ReadSeq* s) {
+void EncodedSeq::encode(const char* seq, size_t len) {
+  // one extra word so that 32-base windows never read past the end
+  fwd.assign(len / 32 + 2, 0);
+  rc.assign(len / 32 + 2, 0);
+  nMask.assign((len + 63) / 64, 0);
+  rcNMask.assign((len + 63) / 64, 0);
+  rcSeq.resize(len);
+  for (size_t i = 0; i < len; ++i) {
+    size_t j = len - 1 - i;
+    uint64_t code{0};
+    char rcBase{'N'};
+    switch (seq[i]) {
+    case 'A': case 'a': code = 0; rcBase = 'T'; break;
+    case 'C': case 'c': code = 1; rcBase = 'G'; break;
+    case 'G': case 'g': code = 2; rcBase = 'C'; break;
+    case 'T': case 't': code = 3; rcBase = 'A'; break;
+    // U is complemented (as by rapmap::utils::reverseRead), but isn't
+    // a base of the read itself
+    case 'U': case 'u': code = 4; rcBase = 'A'; break;
+    default: code = 5; break;
+    }
+    if (code < 4) {
+      fwd[i >> 5] |= code << (62 - 2 * (i & 31));
+      rc[j >> 5] |= (3 - code) << (62 - 2 * (j & 31));
+    } else {
+      nMask[i >> 6] |= uint64_t(1) << (i & 63);
+      if (code == 5) { rcNMask[j >> 6] |= uint64_t(1) << (j & 63); }
+    }
+    rcSeq[j] = rcBase;
+  }
+  valid = true;
+}
+
+inline void copyRecord(kseq_t* seq, ReadSeq* s, bool encode) {
   // Copy over the sequence and read name
   s->seq.assign(seq->seq.s, seq->seq.l);
   s->name.assign(seq->name.s, seq->name.l);
+  if (encode) { s->enc.encode(seq->seq.s, seq->seq.l); }
 }
 
 template <typename T>
@@ -104,7 +138,8 @@ void parseReads(
     moodycamel::ConcurrentQueue<uint32_t>& workQueue,
     moodycamel::ConcurrentQueue<std::unique_ptr<ReadChunk<T>>>&
         seqContainerQueue_,
-    moodycamel::ConcurrentQueue<std::unique_ptr<ReadChunk<T>>>& readQueue_) {
+    moodycamel::ConcurrentQueue<std::unique_ptr<ReadChunk<T>>>& readQueue_,
+    bool encode) {
   kseq_t* seq;
   T* s;
   uint32_t fn{0};
@@ -127,7 +162,7 @@ void parseReads(
     while (ksv >= 0) {
       s = &((*local)[numWaiting++]);
 
-      copyRecord(seq, s);
+      copyRecord(seq, s, encode);
 
       // If we've filled the local vector, then dump to the concurrent queue
       if (numWaiting == numObtained) {
@@ -167,7 +202,8 @@ void parseReadPair(
     moodycamel::ConcurrentQueue<uint32_t>& workQueue,
     moodycamel::ConcurrentQueue<std::unique_ptr<ReadChunk<T>>>&
         seqContainerQueue_,
-    moodycamel::ConcurrentQueue<std::unique_ptr<ReadChunk<T>>>& readQueue_) {
+    moodycamel::ConcurrentQueue<std::unique_ptr<ReadChunk<T>>>& readQueue_,
+    bool encode) {
 
   kseq_t* seq;
   kseq_t* seq2;
@@ -199,8 +235,8 @@ void parseReadPair(
     while (ksv >= 0 and ksv2 >= 0) {
 
       s = &((*local)[numWaiting++]);
-      copyRecord(seq, &s->first);
-      copyRecord(seq2, &s->second);
+      copyRecord(seq, &s->first, encode);
+      copyRecord(seq2, &s->second, encode);
 
       // If we've filled the local vector, then dump to the concurrent queue
       if (numWaiting == numObtained) {
@@ -243,7 +279,8 @@ template <> bool FastxParser<ReadSeq>::start() {
         parseReads(this->inputStreams_, this->numParsing_,
                    this->consumeContainers_[i].get(),
                    this->produceReads_[i].get(), this->workQueue_,
-                   this->seqContainerQueue_, this->readQueue_);
+                   this->seqContainerQueue_, this->readQueue_,
+                   this->encodeReads_);
       }));
     }
     return true;
@@ -274,7 +311,8 @@ template <> bool FastxParser<ReadPair>::start() {
         parseReadPair(this->inputStreams_, this->inputStreams2_,
                       this->numParsing_, this->consumeContainers_[i].get(),
                       this->produceReads_[i].get(), this->workQueue_,
-                      this->seqContainerQueue_, this->readQueue_);
+                      this->seqContainerQueue_, this->readQueue_,
+                   this->encodeReads_);
       }));
     }
     return true;
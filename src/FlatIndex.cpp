@@ -0,0 +1,234 @@
+//
+// RapMap - Rapid and accurate mapping of short reads to transcriptomes using
+// quasi-mapping.
+// Copyright (C) 2015, 2016, 2017 Rob Patro, Avi Srivastava, Hirak Sarkar
+//
+// This file is part of RapMap.
+//
+// RapMap is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RapMap is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RapMap.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "FlatIndex.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace rapmap {
+namespace flat {
+
+inline uint64_t alignUp(uint64_t x, uint64_t a) { return ((x + a - 1) / a) * a; }
+
+FlatIndexWriter::FlatIndexWriter(uint32_t indexWidth) : indexWidth_(indexWidth) {}
+
+void FlatIndexWriter::addSection(FlatSectionID id, const void* data,
+                                 size_t elemSize, size_t count) {
+  FlatSection s;
+  s.id = static_cast<uint32_t>(id);
+  s.elemSize = static_cast<uint32_t>(elemSize);
+  s.count = count;
+  s.offset = 0;
+  s.bytes = static_cast<uint64_t>(elemSize) * count;
+  sections_.push_back(s);
+  data_.push_back(data);
+}
+
+FlatPreamble FlatIndexWriter::layout_() const {
+  FlatPreamble p;
+  std::memset(&p, 0, sizeof(p));
+  std::memcpy(p.magic, kFlatMagic, sizeof(kFlatMagic));
+  p.version = kFlatLayoutVersion;
+  p.indexWidth = indexWidth_;
+  p.pageSize = kFlatPageSize;
+  p.numSections = static_cast<uint32_t>(sections_.size());
+  // The preamble occupies the first page
+  uint64_t offset = kFlatPageSize;
+  for (size_t i = 0; i < sections_.size(); ++i) {
+    p.sections[i] = sections_[i];
+    p.sections[i].offset = offset;
+    offset = alignUp(offset + sections_[i].bytes, kFlatPageSize);
+  }
+  return p;
+}
+
+uint64_t FlatIndexWriter::totalBytes() const {
+  auto p = layout_();
+  uint64_t total = kFlatPageSize;
+  for (uint32_t i = 0; i < p.numSections; ++i) {
+    total = std::max(total, alignUp(p.sections[i].offset + p.sections[i].bytes,
+                                    kFlatPageSize));
+  }
+  return total;
+}
+
+bool FlatIndexWriter::write(const std::string& fname) const {
+  if (sections_.size() > kMaxFlatSections) {
+    return false;
+  }
+  std::ofstream ofile(fname, std::ios::binary);
+  if (!ofile.is_open()) {
+    return false;
+  }
+  auto p = layout_();
+  std::vector<char> zeros(kFlatPageSize, 0);
+  ofile.write(reinterpret_cast<const char*>(&p), sizeof(p));
+  uint64_t written = sizeof(p);
+  for (uint32_t i = 0; i < p.numSections; ++i) {
+    auto& s = p.sections[i];
+    // pad up to the start of this section
+    ofile.write(zeros.data(), s.offset - written);
+    ofile.write(reinterpret_cast<const char*>(data_[i]), s.bytes);
+    written = s.offset + s.bytes;
+  }
+  // pad the file out to a whole number of pages
+  ofile.write(zeros.data(), alignUp(written, kFlatPageSize) - written);
+  ofile.close();
+  return !ofile.fail();
+}
+
+void FlatIndexWriter::writeTo(char* dst) const {
+  auto p = layout_();
+  std::memset(dst, 0, kFlatPageSize);
+  std::memcpy(dst, &p, sizeof(p));
+  for (uint32_t i = 0; i < p.numSections; ++i) {
+    auto& s = p.sections[i];
+    if (s.bytes > 0) {
+      std::memcpy(dst + s.offset, data_[i], s.bytes);
+    }
+  }
+}
+
+FlatIndexView::FlatIndexView() : base_(nullptr), len_(0), mapped_(false) {}
+
+FlatIndexView::~FlatIndexView() {
+  if (mapped_ and base_ != nullptr) {
+    munmap(const_cast<char*>(base_), len_);
+  }
+}
+
+bool FlatIndexView::open(const std::string& fname, uint32_t indexWidth,
+                         std::string& err) {
+  int fd = ::open(fname.c_str(), O_RDONLY);
+  if (fd < 0) {
+    err = "could not open " + fname;
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 or st.st_size < static_cast<off_t>(kFlatPageSize)) {
+    ::close(fd);
+    err = fname + " is too small to be a flat index";
+    return false;
+  }
+  len_ = static_cast<uint64_t>(st.st_size);
+  void* addr = mmap(nullptr, len_, PROT_READ, MAP_SHARED, fd, 0);
+  // The mapping keeps the file alive; we no longer need the descriptor
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    err = "could not mmap " + fname;
+    return false;
+  }
+  base_ = static_cast<const char*>(addr);
+  mapped_ = true;
+  // Suffix array and text accesses are essentially random
+  madvise(addr, len_, MADV_RANDOM);
+  return validate_(indexWidth, err);
+}
+
+bool FlatIndexView::attach(const char* base, uint64_t len, uint32_t indexWidth,
+                           std::string& err) {
+  if (len < kFlatPageSize) {
+    err = "the flat index image is too small";
+    return false;
+  }
+  base_ = base;
+  len_ = len;
+  mapped_ = false;
+  return validate_(indexWidth, err);
+}
+
+bool FlatIndexView::validate_(uint32_t indexWidth, std::string& err) {
+  auto p = reinterpret_cast<const FlatPreamble*>(base_);
+  if (std::memcmp(p->magic, kFlatMagic, sizeof(kFlatMagic)) != 0) {
+    err = "bad magic number; this is not a flat RapMap index";
+    return false;
+  }
+  if (p->version != kFlatLayoutVersion) {
+    err = "flat layout version " + std::to_string(p->version) +
+          " is not supported (expected " + std::to_string(kFlatLayoutVersion) +
+          "); please re-build the index";
+    return false;
+  }
+  if (p->indexWidth != indexWidth) {
+    err = "flat index was written with " + std::to_string(8 * p->indexWidth) +
+          "-bit offsets, but " + std::to_string(8 * indexWidth) +
+          "-bit offsets were requested";
+    return false;
+  }
+  if (p->numSections > kMaxFlatSections) {
+    err = "corrupt section table";
+    return false;
+  }
+  for (uint32_t i = 0; i < p->numSections; ++i) {
+    auto& s = p->sections[i];
+    if (s.offset % kFlatPageSize != 0 or s.offset + s.bytes > len_) {
+      err = "section " + std::to_string(s.id) + " lies outside of the index";
+      return false;
+    }
+  }
+  return true;
+}
+
+const FlatSection* FlatIndexView::find_(FlatSectionID id) const {
+  auto p = reinterpret_cast<const FlatPreamble*>(base_);
+  for (uint32_t i = 0; i < p->numSections; ++i) {
+    if (p->sections[i].id == static_cast<uint32_t>(id)) {
+      return &p->sections[i];
+    }
+  }
+  return nullptr;
+}
+
+std::vector<char> packNames(const std::vector<std::string>& names) {
+  size_t tot{0};
+  for (auto& n : names) {
+    tot += n.length() + 1;
+  }
+  std::vector<char> buf;
+  buf.reserve(tot);
+  for (auto& n : names) {
+    buf.insert(buf.end(), n.begin(), n.end());
+    buf.push_back('\0');
+  }
+  return buf;
+}
+
+void unpackNames(const char* buf, size_t len, size_t numNames,
+                 std::vector<std::string>& names) {
+  names.clear();
+  names.reserve(numNames);
+  const char* it = buf;
+  const char* end = buf + len;
+  while (it < end and names.size() < numNames) {
+    names.emplace_back(it);
+    it += names.back().length() + 1;
+  }
+}
+
+} // namespace flat
+} // namespace rapmap
@@ -56,39 +56,28 @@ namespace rapmap {
         }
 
 
-        // Return hits from processedHits where position constraints
-        // match maxDist
-        bool collectHitsSimpleSA(SAHitMap& processedHits,
+        // Return the hits of the transcripts left active in ws (see
+        // intersectSAHits)
+        bool collectHitsSimpleSA(SAHitWorkspace& ws,
                         uint32_t readLen,
                         uint32_t maxDist,
                         std::vector<QuasiAlignment>& hits,
                         MateStatus mateStatus){
-                //bool foundHit{false};
-                // One processed hit per transcript
-	            //auto startOffset = hits.size();
-                for (auto& ph : processedHits) {
-                        // If this is an *active* position list
-                        if (ph.second.active) {
-                                auto tid = ph.first;
-				auto minPosIt = std::min_element(ph.second.tqvec.begin(),
-						ph.second.tqvec.end(),
-						[](const SATxpQueryPos& a, const SATxpQueryPos& b) -> bool {
-						    return a.pos < b.pos;
-						});
-                                bool hitRC = minPosIt->queryRC;
-                                int32_t hitPos = minPosIt->pos - minPosIt->queryPos;
-                                bool isFwd = !hitRC;
-                                hits.emplace_back(tid, hitPos, isFwd, readLen);
-                                hits.back().mateStatus = mateStatus;
-                        }
-                }
-                // if SAHitMap is sorted, no need to sort here
-                /*
-                std::sort(hits.begin() + startOffset, hits.end(),
-                                [](const QuasiAlignment& a, const QuasiAlignment& b) -> bool {
-                                return a.tid < b.tid;
+                // One processed hit per transcript, in order of id
+                for (size_t t = 0; t < ws.size(); ++t) {
+                        if (!ws.active[t]) { continue; }
+                        auto first = ws.positions.begin() + ws.offsets[t];
+                        auto last = ws.positions.begin() + ws.offsets[t + 1];
+                        auto minPosIt = std::min_element(first, last,
+                                [](const SATxpQueryPos& a, const SATxpQueryPos& b) -> bool {
+                                    return a.pos < b.pos;
                                 });
-                                */
+                        bool hitRC = minPosIt->queryRC;
+                        int32_t hitPos = minPosIt->pos - minPosIt->queryPos;
+                        bool isFwd = !hitRC;
+                        hits.emplace_back(ws.txps[t], hitPos, isFwd, readLen);
+                        hits.back().mateStatus = mateStatus;
+                }
                 return true;
         }
 
@@ -366,38 +355,6 @@ namespace rapmap {
 
 
 
-        template <typename RapMapIndexT>
-        void intersectSAIntervalWithOutput(SAIntervalHit<typename RapMapIndexT::IndexType>& h,
-                                           RapMapIndexT& rmi,
-                                           uint32_t intervalCounter,
-                                           SAHitMap& outHits) {
-            using OffsetT = typename RapMapIndexT::IndexType;
-            // Convenient bindings for variables we'll use
-            auto& SA = rmi.SA;
-            //auto& txpIDs = rmi.positionIDs;
-            auto& txpStarts = rmi.txpOffsets;
-
-            // Walk through every hit in the new interval 'h'
-            for (OffsetT i = h.begin; i != h.end; ++i) {
-              //auto txpID = txpIDs[SA[i]];
-              // auto txpID = rankDict.Rank(SA[i], 1);
-              auto txpID = rmi.transcriptAtPosition(SA[i]);
-              auto txpListIt = outHits.find(txpID);
-              // If we found this transcript
-              // Add this position to the list
-              if (txpListIt != outHits.end()) {
-                txpListIt->second.numActive += (txpListIt->second.numActive == intervalCounter - 1) ? 1 : 0;
-                if (txpListIt->second.numActive == intervalCounter) {
-                  auto globalPos = SA[i];
-                  auto localPos = globalPos - txpStarts[txpID];
-                  txpListIt->second.tqvec.emplace_back(localPos, h.queryPos, h.queryRC);
-                }
-              }
-            }
-          }
-
-
-
         std::vector<ProcessedHit> intersectHits(
                 std::vector<HitInfo>& inHits,
                 RapMapIndex& rmi
@@ -596,33 +553,21 @@ namespace rapmap {
         }
 
         template <typename RapMapIndexT>
-        SAHitMap intersectSAHits(
+        void intersectSAHits(
                 std::vector<SAIntervalHit<typename RapMapIndexT::IndexType>>& inHits,
                 RapMapIndexT& rmi,
                 size_t readLen,
-                bool strictFilter 
-                ) {
+                bool strictFilter,
+                SAHitWorkspace& ws) {
             using OffsetT = typename RapMapIndexT::IndexType;
-            // Each inHit is a SAIntervalHit structure that contains
-            // an SA interval with all hits for a particuar query location
-            // on the read.
-            //
-            // We want to find the transcripts that appear in *every*
-            // interavl.  Further, for each transcript, we want to
-            // know the positions within this txp.
-
-            // Check this --- we should never call this function
-            // with less than 2 hits.
-            SAHitMap outHits;
+            ws.clear();
             if (inHits.size() < 2) {
                 std::cerr << "intersectHitsSA() called with < 2 hits "
                     " hits; this shouldn't happen\n";
-                return outHits;
+                return;
             }
 
-            auto& SA = rmi.SA;
             auto& txpStarts = rmi.txpOffsets;
-            //auto& txpIDs = rmi.positionIDs;
 
             // Start with the smallest interval
             // i.e. interval with the fewest hits.
@@ -633,38 +578,67 @@ namespace rapmap {
                 }
             }
 
-            //outHits.reserve(minHit->span());
-            // =========
-            { // Add the info from minHit to outHits
-                for (OffsetT i = minHit->begin; i < minHit->end; ++i) {
-                    auto globalPos = SA[i];
-                    //auto tid = txpIDs[globalPos];
-                    auto tid = rmi.transcriptAtPosition(globalPos);
-                    auto txpPos = globalPos - txpStarts[tid];
-                    outHits[tid].tqvec.emplace_back(txpPos, minHit->queryPos, minHit->queryRC);
-                }
+            // The transcripts hit by minHit, and its positions in each
+            // (labeled, for now, by transcript id)
+            for (OffsetT i = minHit->begin; i < minHit->end; ++i) {
+                auto globalPos = rmi.hitPosition(i, minHit->len);
+                uint32_t tid = rmi.transcriptAtPosition(globalPos);
+                auto txpPos = globalPos - txpStarts[tid];
+                ws.txps.push_back(tid);
+                ws.pending.push_back({tid, SATxpQueryPos(txpPos, minHit->queryPos, minHit->queryRC)});
             }
-            // =========
+            std::sort(ws.txps.begin(), ws.txps.end());
+            ws.txps.erase(std::unique(ws.txps.begin(), ws.txps.end()), ws.txps.end());
+            for (auto& p : ws.pending) {
+                p.txp = std::lower_bound(ws.txps.begin(), ws.txps.end(), p.txp) - ws.txps.begin();
+            }
+            size_t numTxps = ws.txps.size();
+            ws.numActive.assign(numTxps, 1);
 
             // Now intersect everything in inHits (apart from minHits)
             // to get the final set of mapping info.
             size_t intervalCounter{2};
             for (auto& h : inHits) {
-                if (&h != minHit) { // don't intersect minHit with itself
-                    intersectSAIntervalWithOutput(h, rmi, intervalCounter, outHits);
-                    ++intervalCounter;
+                if (&h == minHit) { continue; } // don't intersect minHit with itself
+                for (OffsetT i = h.begin; i != h.end; ++i) {
+                    auto globalPos = rmi.hitPosition(i, h.len);
+                    uint32_t tid = rmi.transcriptAtPosition(globalPos);
+                    auto txpIt = std::lower_bound(ws.txps.begin(), ws.txps.end(), tid);
+                    // If we found this transcript
+                    // Add this position to the list
+                    if (txpIt != ws.txps.end() and *txpIt == tid) {
+                        uint32_t t = txpIt - ws.txps.begin();
+                        auto& numActive = ws.numActive[t];
+                        numActive += (numActive == intervalCounter - 1) ? 1 : 0;
+                        if (numActive == intervalCounter) {
+                            auto localPos = globalPos - txpStarts[tid];
+                            ws.pending.push_back({t, SATxpQueryPos(localPos, h.queryPos, h.queryRC)});
+                        }
+                    }
                 }
+                ++intervalCounter;
             }
 
+            // Gather the positions of each transcript (counting sort by
+            // transcript, which keeps them in the order they were found)
+            ws.offsets.assign(numTxps + 2, 0);
+            for (auto& p : ws.pending) { ++ws.offsets[p.txp + 2]; }
+            for (size_t t = 2; t < numTxps + 2; ++t) { ws.offsets[t] += ws.offsets[t - 1]; }
+            ws.positions.resize(ws.pending.size(), SATxpQueryPos(0, 0, false));
+            for (auto& p : ws.pending) { ws.positions[ws.offsets[p.txp + 1]++] = p.pos; }
+
             size_t requiredNumHits = inHits.size();
             // Mark as active any transcripts with the required number of hits.
-            for (auto it = outHits.begin(); it != outHits.end(); ++it) {
-                bool enoughHits = (it->second.numActive >= requiredNumHits);
-                it->second.active = (strictFilter) ? 
-                    (enoughHits and it->second.checkConsistent(readLen, requiredNumHits)) :
+            ws.active.resize(numTxps);
+            for (size_t t = 0; t < numTxps; ++t) {
+                bool enoughHits = (ws.numActive[t] >= requiredNumHits);
+                ws.active[t] = (strictFilter) ?
+                    (enoughHits and rapmap::utils::checkConsistentHits(
+                            ws.positions.begin() + ws.offsets[t],
+                            ws.positions.begin() + ws.offsets[t + 1],
+                            readLen, requiredNumHits)) :
                     (enoughHits);
             }
-            return outHits;
         }
 
 
@@ -677,45 +651,62 @@ namespace rapmap {
 									     rapmap::utils::KmerKeyHasher>>;
       using SAIndex32BitPerfect = RapMapSAIndex<int32_t, PerfectHashT<uint64_t, rapmap::utils::SAInterval<int32_t>>>;
       using SAIndex64BitPerfect = RapMapSAIndex<int64_t, PerfectHashT<uint64_t, rapmap::utils::SAInterval<int64_t>>>;
+      using SAIndexPackedDense = RapMapSAIndex<int64_t, RegHashT<uint64_t, rapmap::utils::SAInterval<int64_t>,
+									     rapmap::utils::KmerKeyHasher>,
+                                               rapmap::utils::PackedSA<int64_t>>;
+      using SAIndexPackedPerfect = RapMapSAIndex<int64_t, PerfectHashT<uint64_t, rapmap::utils::SAInterval<int64_t>>,
+                                                 rapmap::utils::PackedSA<int64_t>>;
+      using FMIndex32BitDense = RapMapFMIndex<int32_t, RegHashT<uint64_t, rapmap::utils::SAInterval<int32_t>,
+									     rapmap::utils::KmerKeyHasher>>;
+      using FMIndex64BitDense = RapMapFMIndex<int64_t, RegHashT<uint64_t, rapmap::utils::SAInterval<int64_t>,
+									     rapmap::utils::KmerKeyHasher>>;
 
         template
-        void intersectSAIntervalWithOutput<SAIndex32BitDense>(SAIntervalHit<int32_t>& h,
-                                                              SAIndex32BitDense& rmi, 
-                                                              uint32_t intervalCounter, 
-                                                              SAHitMap& outHits);
+        void intersectSAHits<SAIndex32BitDense>(std::vector<SAIntervalHit<int32_t>>& inHits,
+                                 SAIndex32BitDense& rmi,
+                                 size_t readLen, bool strictFilter,
+                                 SAHitWorkspace& ws);
 
         template
-        void intersectSAIntervalWithOutput<SAIndex64BitDense>(SAIntervalHit<int64_t>& h,
-                                                              SAIndex64BitDense& rmi, 
-                                                              uint32_t intervalCounter, 
-                                                              SAHitMap& outHits); 
+        void intersectSAHits<SAIndex64BitDense>(std::vector<SAIntervalHit<int64_t>>& inHits,
+                                 SAIndex64BitDense& rmi,
+                                 size_t readLen, bool strictFilter,
+                                 SAHitWorkspace& ws);
 
         template
-        SAHitMap intersectSAHits<SAIndex32BitDense>(std::vector<SAIntervalHit<int32_t>>& inHits,
-                                                    SAIndex32BitDense& rmi, size_t readLen, bool strictFilter);
+        void intersectSAHits<SAIndex32BitPerfect>(std::vector<SAIntervalHit<int32_t>>& inHits,
+                                 SAIndex32BitPerfect& rmi,
+                                 size_t readLen, bool strictFilter,
+                                 SAHitWorkspace& ws);
 
         template
-        SAHitMap intersectSAHits<SAIndex64BitDense>(std::vector<SAIntervalHit<int64_t>>& inHits,
-                                                    SAIndex64BitDense& rmi, size_t readLen, bool strictFilter);
+        void intersectSAHits<SAIndex64BitPerfect>(std::vector<SAIntervalHit<int64_t>>& inHits,
+                                 SAIndex64BitPerfect& rmi,
+                                 size_t readLen, bool strictFilter,
+                                 SAHitWorkspace& ws);
 
         template
-        void intersectSAIntervalWithOutput<SAIndex32BitPerfect>(SAIntervalHit<int32_t>& h,
-                                                                SAIndex32BitPerfect& rmi, 
-                                                                uint32_t intervalCounter, 
-                                                                SAHitMap& outHits);
+        void intersectSAHits<SAIndexPackedDense>(std::vector<SAIntervalHit<int64_t>>& inHits,
+                                 SAIndexPackedDense& rmi,
+                                 size_t readLen, bool strictFilter,
+                                 SAHitWorkspace& ws);
 
         template
-        void intersectSAIntervalWithOutput<SAIndex64BitPerfect>(SAIntervalHit<int64_t>& h,
-                                                                SAIndex64BitPerfect& rmi, 
-                                                                uint32_t intervalCounter, 
-                                                                SAHitMap& outHits);
+        void intersectSAHits<SAIndexPackedPerfect>(std::vector<SAIntervalHit<int64_t>>& inHits,
+                                 SAIndexPackedPerfect& rmi,
+                                 size_t readLen, bool strictFilter,
+                                 SAHitWorkspace& ws);
 
         template
-        SAHitMap intersectSAHits<SAIndex32BitPerfect>(std::vector<SAIntervalHit<int32_t>>& inHits,
-                                                      SAIndex32BitPerfect& rmi, size_t readLen, bool strictFilter);
+        void intersectSAHits<FMIndex32BitDense>(std::vector<SAIntervalHit<int32_t>>& inHits,
+                                 FMIndex32BitDense& rmi,
+                                 size_t readLen, bool strictFilter,
+                                 SAHitWorkspace& ws);
 
         template
-        SAHitMap intersectSAHits<SAIndex64BitPerfect>(std::vector<SAIntervalHit<int64_t>>& inHits,
-                                                      SAIndex64BitPerfect& rmi, size_t readLen, bool strictFilter);
+        void intersectSAHits<FMIndex64BitDense>(std::vector<SAIntervalHit<int64_t>>& inHits,
+                                 FMIndex64BitDense& rmi,
+                                 size_t readLen, bool strictFilter,
+                                 SAHitWorkspace& ws);
     }
 }
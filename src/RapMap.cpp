@@ -32,6 +32,7 @@ int rapMapIndex(int argc, char* argv[]);
 int rapMapSAIndex(int argc, char* argv[]);
 int rapMapMap(int argc, char* argv[]);
 int rapMapSAMap(int argc, char* argv[]);
+int rapMapSALoad(int argc, char* argv[]);
 
 void printUsage() {
     std::string versionString = rapmap::version;
@@ -40,11 +41,12 @@ void printUsage() {
     std::cerr << "=====================================\n";
     auto usage =
         R"(
-There are currently 4 RapMap subcommands
+There are currently 5 RapMap subcommands
     pseudoindex   --- builds a k-mer-based index
     pseudomap     --- map reads using a k-mer-based index
     quasiindex --- builds a suffix array-based (SA) index
     quasimap   --- map reads using the SA-based index
+    quasiload  --- publish an SA-based index in shared memory
 
 Run a corresponding command "rapmap <cmd> -h" for
 more information on each of the possible RapMap
@@ -86,6 +88,8 @@ int main(int argc, char* argv[]) {
         return rapMapMap(argc - 1, args.data());
     } else if (std::string(argv[1]) == "quasimap") {
         return rapMapSAMap(argc - 1, args.data());
+    } else if (std::string(argv[1]) == "quasiload") {
+        return rapMapSALoad(argc - 1, args.data());
     } else {
         std::cerr << "the command " << argv[1]
                   << " is not yet implemented\n";
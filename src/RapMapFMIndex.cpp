@@ -0,0 +1,148 @@
+//
+// RapMap - Rapid and accurate mapping of short reads to transcriptomes using
+// quasi-mapping.
+// Copyright (C) 2015, 2016, 2017 Rob Patro, Avi Srivastava, Hirak Sarkar
+//
+// This file is part of RapMap.
+//
+// RapMap is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RapMap is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RapMap.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "RapMapFMIndex.hpp"
+#include "IndexHeader.hpp"
+#include "RapMapFileSystem.hpp"
+#include <cereal/types/vector.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/archives/binary.hpp>
+#include <cereal/archives/json.hpp>
+
+#include "spdlog/spdlog.h"
+
+#include <fstream>
+#include <future>
+
+template <typename IndexT, typename HashT>
+RapMapFMIndex<IndexT, HashT>::RapMapFMIndex() {}
+
+// Given a position, p, in the concatenated text,
+// return the corresponding transcript
+template <typename IndexT, typename HashT>
+IndexT RapMapFMIndex<IndexT, HashT>::transcriptAtPosition(IndexT p) {
+    return rankDict->rank(p);
+}
+
+template <typename IndexT, typename HashT>
+bool RapMapFMIndex<IndexT, HashT>::load(const std::string& indDir, uint32_t numThreads) {
+    auto logger = spdlog::get("stderrLog");
+
+    IndexHeader h;
+    std::ifstream indexStream(indDir + "header.json");
+    {
+      cereal::JSONInputArchive ar(indexStream);
+      ar(h);
+    }
+    indexStream.close();
+    uint32_t idxK = h.kmerLen();
+    rapmap::utils::my_mer::k(idxK);
+
+    // This part takes the longest, so do it in it's own asynchronous task
+    std::future<bool> loadingHash = std::async(std::launch::async, [this, logger, indDir]() -> bool {
+        std::ifstream hashStream(indDir + "hash.bin", std::ios::binary);
+        if (!hashStream.is_open()) {
+            logger->error("Couldn't open {}hash.bin", indDir);
+            return false;
+        }
+        khash.unserialize(typename spp_utils::pod_hash_serializer<uint64_t, rapmap::utils::SAInterval<IndexT>>(),
+                          &hashStream);
+        return true;
+    });
+
+    std::future<bool> loadingRank = std::async(std::launch::async, [this, logger, indDir]() -> bool {
+        std::string rsFileName = indDir + "rsd.bin";
+        logger->info("Loading Rank-Select Bit Array");
+        FILE* rsFile = fopen(rsFileName.c_str(), "r");
+        if (rsFile == nullptr) {
+            logger->error("Couldn't open {}!", rsFileName);
+            return false;
+        }
+        bitArray.reset(bit_array_create(0));
+        bool loaded = bit_array_load(bitArray.get(), rsFile);
+        fclose(rsFile);
+        if (!loaded) {
+            logger->error("Couldn't load bit array from {}!", rsFileName);
+            return false;
+        }
+        rankDict.reset(new rank9b(bitArray->words, bitArray->num_of_bits));
+        return true;
+    });
+
+    // The transcript info holds an empty text; the FM-index takes its place
+    {
+        logger->info("Loading Transcript Info ");
+        std::ifstream seqStream(indDir + "txpInfo.bin", std::ios::binary);
+        cereal::BinaryInputArchive seqArchive(seqStream);
+        std::string emptyText;
+        seqArchive(txpNames);
+        seqArchive(txpOffsets);
+        seqArchive(emptyText);
+        seqArchive(txpCompleteLens);
+    }
+    {
+        logger->info("Loading FM-index ");
+        std::ifstream fmStream(indDir + "fm.bin", std::ios::binary);
+        if (!fmStream.is_open()) {
+            logger->error("Couldn't open {}fm.bin", indDir);
+            std::exit(1);
+        }
+        cereal::BinaryInputArchive fmArchive(fmStream);
+        fmArchive(fm);
+        logger->info("FM-index holds {} rows in {} bytes (SA sample rate {})",
+                     fm.length(), fm.bytes(), fm.sampleRate());
+    }
+
+    std::vector<IndexT> lens(txpOffsets.size());
+    if (txpOffsets.size() > 1) {
+        for(size_t i = 0; i < txpOffsets.size() - 1; ++i) {
+            auto nextOffset = txpOffsets[i+1];
+            auto currentOffset = txpOffsets[i];
+            lens[i] = (nextOffset - 1) - currentOffset;
+        }
+    }
+    // The last length is just the length of the text - the last offset
+    lens[txpOffsets.size()-1] = (textLength() - 1) - txpOffsets[txpOffsets.size() - 1];
+    txpLens.assign(std::move(lens));
+
+    logger->info("Waiting to finish loading hash");
+    if (!loadingRank.get() or !loadingHash.get()) {
+        logger->error("Failed to load the index from {}", indDir);
+        std::exit(1);
+    }
+    logger->info("Done loading index");
+    return true;
+}
+
+template <typename IndexT, typename HashT>
+bool RapMapFMIndex<IndexT, HashT>::attach(const std::string& memName, const IndexHeader& h) {
+    auto logger = spdlog::get("stderrLog");
+    logger->error("FM-indices can't be used from shared memory; "
+                  "please map without -y");
+    return false;
+}
+
+template class RapMapFMIndex<int32_t,  RegHashT<uint64_t,
+                      rapmap::utils::SAInterval<int32_t>,
+                      rapmap::utils::KmerKeyHasher>>;
+template class RapMapFMIndex<int64_t,  RegHashT<uint64_t,
+                      rapmap::utils::SAInterval<int64_t>,
+                      rapmap::utils::KmerKeyHasher>>;
@@ -20,7 +20,14 @@
 //
 
 #include "RapMapFileSystem.hpp"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 
 namespace rapmap {
@@ -54,5 +61,55 @@ namespace rapmap {
             mkdir(path, ACCESSPERMS);
         }
 
+        uint64_t FileSize(const char* path) {
+            struct stat fileStat;
+            if ( stat(path, &fileStat) ) {
+                return 0;
+            }
+            return static_cast<uint64_t>(fileStat.st_size);
+        }
+
+        bool ParallelRead(const char* path, uint64_t offset, char* dst,
+                          uint64_t bytes, uint32_t numThreads) {
+            int fd = open(path, O_RDONLY);
+            if (fd < 0) {
+                return false;
+            }
+#if defined(POSIX_FADV_SEQUENTIAL)
+            posix_fadvise(fd, offset, bytes, POSIX_FADV_SEQUENTIAL);
+#endif
+            // Don't bother splitting up small reads
+            const uint64_t minSlice = (uint64_t(1) << 24);
+            numThreads = std::max(uint32_t(1), numThreads);
+            uint64_t numSlices = std::min(static_cast<uint64_t>(numThreads),
+                                          std::max(uint64_t(1), bytes / minSlice));
+            uint64_t sliceLen = (bytes + numSlices - 1) / numSlices;
+
+            std::atomic<bool> ok{true};
+            auto readSlice = [&](uint64_t sliceStart, uint64_t sliceEnd) -> void {
+                uint64_t pos = sliceStart;
+                while (pos < sliceEnd and ok) {
+                    ssize_t n = pread(fd, dst + pos, sliceEnd - pos, offset + pos);
+                    if (n <= 0) {
+                        ok = false;
+                        return;
+                    }
+                    pos += static_cast<uint64_t>(n);
+                }
+            };
+
+            std::vector<std::thread> readers;
+            for (uint64_t i = 1; i < numSlices; ++i) {
+                uint64_t sliceStart = i * sliceLen;
+                uint64_t sliceEnd = std::min(bytes, sliceStart + sliceLen);
+                readers.emplace_back(readSlice, sliceStart, sliceEnd);
+            }
+            // the calling thread reads the first slice
+            readSlice(0, std::min(bytes, sliceLen));
+            for (auto& t : readers) { t.join(); }
+            close(fd);
+            return ok;
+        }
+
     }
 }
@@ -67,6 +67,7 @@
 #include "PairSequenceParser.hpp"
 #include "RapMapUtils.hpp"
 #include "RapMapIndex.hpp"
+#include "RollingKmerEncoder.hpp"
 #include "RapMapFileSystem.hpp"
 #include "RapMapConfig.hpp"
 #include "ScopedTimer.hpp"
@@ -282,27 +283,24 @@ bool collectHitsWithPositionConstraint(uint32_t tid,
 
 class SkippingKmerSearcher{
     private:
-	std::string* qstr;
-	const char* qCharArray;
+	// The k-mers of the query (encoded once, by reset)
+	rapmap::utils::RollingKmerEncoder<>* kmers;
 	uint32_t qlen;
 	uint32_t k;
-	uint32_t klen;
 	uint32_t startPos;
-	uint32_t nextBaseIndex;
-	rapmap::utils::my_mer mer;
-	rapmap::utils::my_mer rcmer;
+	// Where next() starts looking
+	uint32_t nextPos;
 	rapmap::utils::my_mer tempMer;
 	static constexpr uint32_t invalidIndex = std::numeric_limits<uint32_t>::max();
 
     public:
-	SkippingKmerSearcher(std::string& queryStr) :
-		qstr(&queryStr),
-		qCharArray(queryStr.c_str()),
+	SkippingKmerSearcher(std::string& queryStr, rapmap::utils::RollingKmerEncoder<>& kmersIn) :
+		kmers(&kmersIn),
 		qlen(queryStr.length()),
 		k(rapmap::utils::my_mer::k()),
-		klen(0),
 		startPos(0),
-		nextBaseIndex(0) {
+		nextPos(0) {
+		    kmers->reset(queryStr, k);
 		    next();
 	}
 
@@ -311,8 +309,11 @@ class SkippingKmerSearcher{
 	uint32_t queryIndex() { return startPos; }
 
 	rapmap::utils::my_mer getMer(bool& isRC) {
-	    tempMer = mer.get_canonical();
-	    isRC = (mer != tempMer);
+	    auto fw = kmers->word(startPos);
+	    auto rc = kmers->rcWord(startPos);
+	    isRC = (rc < fw);
+	    tempMer.polyA();
+	    tempMer.set_bits(0, 2 * k, isRC ? rc : fw);
 	    return tempMer;
 	}
 
@@ -332,10 +333,10 @@ class SkippingKmerSearcher{
 
 
 	    // otherwise start a new k-mer at the jump position
-	    while (!tempMer.from_chars(&qCharArray[searchPos])) {
+	    while (!kmers->isValid(searchPos)) {
 		// If it wasn't a valid k-mer, find the offending base
 		// and try to start k bases before it
-		uint32_t invalidLoc = qstr->find_last_not_of("aAcCgGtT", searchPos + k);
+		uint32_t invalidLoc = kmers->lastInvalid(searchPos + k);
 		// Make sure we don't fall off the end
 		if (invalidLoc < k + 1) {
 		    return false;
@@ -344,10 +345,8 @@ class SkippingKmerSearcher{
 	    }
 
 	    // we found a hit, so make it the current k-mer
-	    klen = k;
 	    startPos = searchPos;
-	    nextBaseIndex = searchPos + k + 1;
-	    mer = tempMer;
+	    nextPos = searchPos + 1;
 	    return true;
 	}
 
@@ -365,10 +364,8 @@ class SkippingKmerSearcher{
 	// return true and the k-mer position. Otherwise, return
 	// false.
 	std::tuple<bool, uint32_t> skipForward(uint32_t skipVal) {
-	   tempMer = mer;
-	   uint32_t tempKLen = klen;
-      	   uint32_t tempStartPos = startPos;
-	   uint32_t tempNextBaseIndex = nextBaseIndex;
+	   uint32_t tempStartPos = startPos;
+	   uint32_t tempNextPos = nextPos;
 
 	   uint32_t jumpPos = startPos + skipVal;
 	   // Would we jump past the end of the read?
@@ -388,10 +385,10 @@ class SkippingKmerSearcher{
 	       }
 	   } else {
 	      // otherwise start a new k-mer at the jump position
-	      while (! (reachedGoal = mer.from_chars(&qCharArray[jumpPos])) ) {
+	      while (! (reachedGoal = kmers->isValid(jumpPos)) ) {
 		  // If it wasn't a valid k-mer, find the offending base
 		  // and try to start after it
-		  jumpPos = qstr->find_first_not_of("aAcCgGtT", jumpPos) + 1;
+		  jumpPos = kmers->nextInvalid(jumpPos) + 1;
 		  // Make sure we don't fall off the end
 		  if (jumpPos > qlen - k) {
 		      startPos = invalidIndex;
@@ -402,18 +399,15 @@ class SkippingKmerSearcher{
 	      // If the search was successful
 	      if (reachedGoal) {
 		  // set startPos to the position we ended up jumping to
-		  klen = k;
 		  startPos = jumpPos;
-		  nextBaseIndex = startPos + k + 1;
+		  nextPos = startPos + 1;
 	      }
 	   }
 	   // If the search was un-successful, return the searcher to it's previous state
 	   // and report the failure and the position where the backward search should begin.
 	   if (!reachedGoal) {
-	       mer = tempMer;
-	       klen = tempKLen;
 	       startPos = tempStartPos;
-	       nextBaseIndex = tempNextBaseIndex;
+	       nextPos = tempNextPos;
 	       return std::make_pair(false, initJumpPos);
 	   }
 	   return std::make_pair(true, startPos);
@@ -422,33 +416,24 @@ class SkippingKmerSearcher{
 	// Move to the next *valid* k-mer.  If we found a k-mer, return true,
 	// If we can't move forward anymore, then return false.
 	bool next() {
-	    bool valid{false};
-	    while (!valid and nextBaseIndex < qlen) {
-		int c = jellyfish::mer_dna::code(qCharArray[nextBaseIndex]);
-		// If the next base isn't a valid nucleotide
-		if (jellyfish::mer_dna::not_dna(c)) {
-		    // reset the k-mer
-		    klen = 0;
-		    ++nextBaseIndex;
-		    if (qlen - nextBaseIndex < k) {
-			startPos = invalidIndex;
-			return false;
-		    } else {
-			continue;
-		    }
+	    uint32_t p = nextPos;
+	    while (p + k <= qlen) {
+		// If the k-mer has a base that isn't a valid nucleotide,
+		// skip past it
+		size_t invalidLoc = kmers->nextInvalid(p);
+		if (invalidLoc < p + k) {
+		    p = invalidLoc + 1;
+		    continue;
 		}
-		mer.shift_left(c);
-		//rcmer.shift_right(jellyfish::mer_dna::complement(c));
-		++klen;
-	        ++nextBaseIndex;
-            // EDIT
-		if (klen >= k and !mer.is_homopolymer()) {
-		    startPos = nextBaseIndex - k;
-		    valid = true;
+		if (!kmers->isHomopolymer(p)) {
+		    startPos = p;
+		    nextPos = p + 1;
+		    return true;
 		}
+		++p;
 	    }
-	    if (!valid) { startPos = invalidIndex; }
-	    return valid;
+	    startPos = invalidIndex;
+	    return false;
 	}
 
 	bool isValid() { return startPos != invalidIndex; }
@@ -460,9 +445,11 @@ struct JumpStats {
 };
 
 
+// Each mapping thread needs its own SkippingCollector (for readKmers_)
 class SkippingCollector {
     private:
 	RapMapIndex* rmi_;
+	rapmap::utils::RollingKmerEncoder<> readKmers_;
     public:
 	SkippingCollector(RapMapIndex* rmiIn) : rmi_(rmiIn) {}
 
@@ -496,7 +483,7 @@ class SkippingCollector {
 	    uint32_t searchPos{0};
 	    uint32_t jumpLen{0};
 	    bool isRC;
-	    SkippingKmerSearcher ksearch(readStr);
+	    SkippingKmerSearcher ksearch(readStr, readKmers_);
 
 	    while (ksearch.isValid()) {
 		auto searchMer = ksearch.getMer(isRC);
@@ -1096,12 +1083,12 @@ int rapMapMap(int argc, char* argv[]) {
 				noout.getValue());
 		    }
 		} else {
-		    SkippingCollector skippingCollector(&rmi);
+		    std::vector<SkippingCollector> skippingCollectors(nthread, SkippingCollector(&rmi));
 		    for (size_t i = 0; i < nthread; ++i) {
 			threads.emplace_back(processReadsPair<SkippingCollector, SpinLockT>,
 				pairParserPtr.get(),
 				std::ref(rmi),
-				std::ref(skippingCollector),
+				std::ref(skippingCollectors[i]),
 				&iomutex,
 				outLog,
 				std::ref(hctrs),
@@ -1134,12 +1121,12 @@ int rapMapMap(int argc, char* argv[]) {
 				noout.getValue());
 		    }
 		} else {
-		    SkippingCollector skippingCollector(&rmi);
+		    std::vector<SkippingCollector> skippingCollectors(nthread, SkippingCollector(&rmi));
 		    for (size_t i = 0; i < nthread; ++i) {
 			threads.emplace_back(processReadsSingle<SkippingCollector, SpinLockT>,
 				singleParserPtr.get(),
 				std::ref(rmi),
-				std::ref(skippingCollector),
+				std::ref(skippingCollectors[i]),
 				&iomutex,
 				outLog,
 				std::ref(hctrs),
@@ -23,6 +23,7 @@
 #include "FrugalBooMap.hpp"
 #include "RapMapSAIndex.hpp"
 #include "IndexHeader.hpp"
+#include "RapMapFileSystem.hpp"
 #include <cereal/types/unordered_map.hpp>
 #include <cereal/types/vector.hpp>
 #include <cereal/types/string.hpp>
@@ -30,7 +31,11 @@
 #include <cereal/archives/json.hpp>
 
 
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <future>
+#include <mutex>
 #include <thread>
 
 /*
@@ -47,19 +52,109 @@ void set_empty_key(spp::sparse_hash_map<uint64_t,
 }
 */
 
-    // Set the SA and text pointer if this is a perfect hash
+// Point the perfect hash at the suffix array, however it is stored
+template <typename IndexT>
+void setHashSA(PerfectHashT<uint64_t, rapmap::utils::SAInterval<IndexT>>& khash,
+               const rapmap::utils::IndexArray<IndexT>& SA) {
+    khash.setSAPtr(SA.data());
+}
+
 template <typename IndexT>
+void setHashSA(PerfectHashT<uint64_t, rapmap::utils::SAInterval<IndexT>>& khash,
+               const rapmap::utils::PackedSA<IndexT>& SA) {
+    khash.setPackedSA(&SA);
+}
+
+    // Set the SA and text pointer if this is a perfect hash
+template <typename IndexT, typename SAT>
 void setPerfectHashPointers(RegHashT<uint64_t,
                             rapmap::utils::SAInterval<IndexT>,
-                            rapmap::utils::KmerKeyHasher>& khash, std::vector<IndexT>& SA, std::string& seq) {
+                            rapmap::utils::KmerKeyHasher>& khash,
+                            SAT& SA,
+                            rapmap::utils::IndexArray<char>& seq,
+                            const rapmap::utils::PackedText* packedSeq) {
     // do nothing
 }
 
-template <typename IndexT>
+template <typename IndexT, typename SAT>
 void setPerfectHashPointers(PerfectHashT<uint64_t,
-                            rapmap::utils::SAInterval<IndexT>>& khash, std::vector<IndexT>& SA, std::string& seq) {
-    khash.setSAPtr(&SA);
-    khash.setTextPtr(seq.c_str(), seq.length());
+                            rapmap::utils::SAInterval<IndexT>>& khash,
+                            SAT& SA,
+                            rapmap::utils::IndexArray<char>& seq,
+                            const rapmap::utils::PackedText* packedSeq) {
+    setHashSA(khash, SA);
+    if (packedSeq != nullptr) {
+        khash.setPackedText(packedSeq);
+    } else {
+        khash.setTextPtr(seq.data(), seq.length());
+    }
+}
+
+// Read a cereal-serialized vector, which is simply its length followed
+// by its elements, directly into arr.
+template <typename T>
+bool readSerializedArray(const std::string& fname, rapmap::utils::IndexArray<T>& arr,
+                         uint32_t numThreads, uint64_t& bytes) {
+    uint64_t len{0};
+    {
+        std::ifstream ifile(fname, std::ios::binary);
+        if (!ifile.read(reinterpret_cast<char*>(&len), sizeof(len))) {
+            return false;
+        }
+    }
+    T* ptr = arr.allocate(len);
+    bytes = len * sizeof(T);
+    return rapmap::fs::ParallelRead(fname.c_str(), sizeof(len),
+                                    reinterpret_cast<char*>(ptr), bytes, numThreads);
+}
+
+// These are **free** functions that read, borrow and write the suffix
+// array according to how it is stored.
+template <typename IndexT>
+bool readSuffixArray(const std::string& indexDir, rapmap::utils::IndexArray<IndexT>& SA,
+                     uint32_t numThreads, uint64_t& bytes) {
+    return readSerializedArray(indexDir + "sa.bin", SA, numThreads, bytes);
+}
+
+// The packed suffix array is stored as its image
+template <typename IndexT>
+bool readSuffixArray(const std::string& indexDir, rapmap::utils::PackedSA<IndexT>& SA,
+                     uint32_t numThreads, uint64_t& bytes) {
+    return readSerializedArray(indexDir + "saPacked.bin", SA.image(), numThreads, bytes) and
+           SA.init();
+}
+
+template <typename IndexT>
+bool borrowSuffixArray(const rapmap::flat::FlatIndexView& view,
+                       rapmap::utils::IndexArray<IndexT>& SA) {
+    const IndexT* saPtr{nullptr};
+    size_t saLen{0};
+    if (!view.get(rapmap::flat::FlatSectionID::SA, saPtr, saLen)) { return false; }
+    SA.borrow(saPtr, saLen);
+    return true;
+}
+
+template <typename IndexT>
+bool borrowSuffixArray(const rapmap::flat::FlatIndexView& view,
+                       rapmap::utils::PackedSA<IndexT>& SA) {
+    const uint64_t* imagePtr{nullptr};
+    size_t imageLen{0};
+    if (!view.get(rapmap::flat::FlatSectionID::PACKED_SA, imagePtr, imageLen)) { return false; }
+    SA.image().borrow(imagePtr, imageLen);
+    return SA.init();
+}
+
+template <typename IndexT>
+void addSuffixArraySection(rapmap::flat::FlatIndexWriter& writer,
+                           const rapmap::utils::IndexArray<IndexT>& SA) {
+    writer.addSection(rapmap::flat::FlatSectionID::SA, SA.data(), sizeof(IndexT), SA.size());
+}
+
+template <typename IndexT>
+void addSuffixArraySection(rapmap::flat::FlatIndexWriter& writer,
+                           const rapmap::utils::PackedSA<IndexT>& SA) {
+    writer.addSection(rapmap::flat::FlatSectionID::PACKED_SA, SA.image().data(),
+                      sizeof(uint64_t), SA.image().size());
 }
 
 // These are **free** functions that are used for loading the
@@ -83,21 +178,109 @@ bool loadHashFromIndex(const std::string& indexDir,
     return true;
 }
 
-template <typename IndexT, typename HashT>
-RapMapSAIndex<IndexT, HashT>::RapMapSAIndex() {}
+// The files holding the hash, in the order expected by loadHashFromMemory
+template <typename IndexT>
+std::vector<std::string> hashFilesForIndex(const std::string& indexDir,
+                                           RegHashT<uint64_t,
+                                           rapmap::utils::SAInterval<IndexT>,
+                                           rapmap::utils::KmerKeyHasher>& khash) {
+    return {indexDir + "hash.bin"};
+}
+
+template <typename IndexT>
+std::vector<std::string> hashFilesForIndex(const std::string& indexDir,
+                                           PerfectHashT<uint64_t, rapmap::utils::SAInterval<IndexT>>& h) {
+    return {indexDir + "hash_info.bph", indexDir + "hash_info.val"};
+}
+
+// Load the hash from the copies of its files held in a shared memory
+// segment.  A sparsepp table is made of pointers, so it can't be used
+// where it lies: it is unserialized into this process's own memory, and
+// only the perfect hash (-p) is used in place, shared by every process.
+template <typename IndexT>
+bool loadHashFromMemory(const rapmap::shm::SharedIndexSegment& seg,
+                        RegHashT<uint64_t,
+                        rapmap::utils::SAInterval<IndexT>,
+                        rapmap::utils::KmerKeyHasher>& khash) {
+    auto p = seg.preamble();
+    if (p->numHashParts != 1) { return false; }
+    auto& part = p->hashParts[0];
+    rapmap::shm::MemoryStreamBuf sb(seg.data() + part.offset, part.bytes);
+    std::istream hashStream(&sb);
+    khash.unserialize(typename spp_utils::pod_hash_serializer<uint64_t, rapmap::utils::SAInterval<IndexT>>(),
+                      &hashStream);
+    return true;
+}
+
+template <typename IndexT>
+bool loadHashFromMemory(const rapmap::shm::SharedIndexSegment& seg,
+                        PerfectHashT<uint64_t, rapmap::utils::SAInterval<IndexT>>& h) {
+    auto p = seg.preamble();
+    if (p->numHashParts != 2) { return false; }
+    auto& phf = p->hashParts[0];
+    auto& vals = p->hashParts[1];
+    return h.loadFromMemory(seg.data() + phf.offset, phf.bytes,
+                            seg.data() + vals.offset, vals.bytes);
+}
+
+// Records how long each component of the index took to load (and how
+// much was read for it), so that slow loads can be diagnosed.
+class IndexLoadReport {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    void add(const std::string& component, uint64_t bytes, Clock::time_point start) {
+        std::chrono::duration<double> elapsed = Clock::now() - start;
+        std::lock_guard<std::mutex> lock(mut_);
+        entries_.push_back({component, bytes, elapsed.count()});
+    }
+
+    void log(const std::shared_ptr<spdlog::logger>& logger, Clock::time_point start) {
+        std::chrono::duration<double> wall = Clock::now() - start;
+        std::lock_guard<std::mutex> lock(mut_);
+        uint64_t totBytes{0};
+        fmt::MemoryWriter w;
+        w.write("Index load summary:");
+        for (auto& e : entries_) {
+            totBytes += e.bytes;
+            w.write("\n  {:<22} {:>14} bytes {:>9.3f}s", e.component, e.bytes, e.seconds);
+            if (e.bytes > 0 and e.seconds > 0.0) {
+                w.write(" ({:.1f} MB/s)", (e.bytes / 1000000.0) / e.seconds);
+            }
+        }
+        w.write("\n  {:<22} {:>14} bytes {:>9.3f}s", "total (wall clock)", totBytes, wall.count());
+        if (wall.count() > 0.0) {
+            w.write(" ({:.1f} MB/s)", (totBytes / 1000000.0) / wall.count());
+        }
+        logger->info(w.str());
+    }
+
+private:
+    struct Entry {
+        std::string component;
+        uint64_t bytes;
+        double seconds;
+    };
+    std::mutex mut_;
+    std::vector<Entry> entries_;
+};
+
+template <typename IndexT, typename HashT, typename SAT>
+RapMapSAIndex<IndexT, HashT, SAT>::RapMapSAIndex() {}
 
 // Given a position, p, in the concatenated text,
 // return the corresponding transcript
-template <typename IndexT, typename HashT>
-IndexT RapMapSAIndex<IndexT, HashT>::transcriptAtPosition(IndexT p) {
+template <typename IndexT, typename HashT, typename SAT>
+IndexT RapMapSAIndex<IndexT, HashT, SAT>::transcriptAtPosition(IndexT p) {
     return rankDict->rank(p);
 }
 
-template <typename IndexT, typename HashT>
-bool RapMapSAIndex<IndexT, HashT>::load(const std::string& indDir) {
-
+template <typename IndexT, typename HashT, typename SAT>
+bool RapMapSAIndex<IndexT, HashT, SAT>::load(const std::string& indDir, uint32_t numThreads) {
+    using Clock = IndexLoadReport::Clock;
     auto logger = spdlog::get("stderrLog");
-    size_t n{0};
+    auto loadStart = Clock::now();
+    IndexLoadReport report;
 
     IndexHeader h;
     std::ifstream indexStream(indDir + "header.json");
@@ -108,68 +291,32 @@ bool RapMapSAIndex<IndexT, HashT>::load(const std::string& indDir) {
     indexStream.close();
     uint32_t idxK = h.kmerLen();
     rapmap::utils::my_mer::k(idxK);
+    packedText = h.packedText();
+    canonicalHash = h.canonicalHash();
 
     // This part takes the longest, so do it in it's own asynchronous task
-    std::future<bool> loadingHash = std::async(std::launch::async, [this, logger, indDir]() -> bool {
-	return loadHashFromIndex(indDir, khash);
+    std::future<bool> loadingHash = std::async(std::launch::async, [this, logger, indDir, &report]() -> bool {
+        auto start = Clock::now();
+        bool loaded = loadHashFromIndex(indDir, khash);
+        uint64_t hashBytes{0};
+        for (auto& fn : hashFilesForIndex(indDir, khash)) {
+            hashBytes += rapmap::fs::FileSize(fn.c_str());
+        }
+        report.add("hash", hashBytes, start);
+        return loaded;
     });
 
-    std::ifstream saStream(indDir + "sa.bin");
-    {
-        logger->info("Loading Suffix Array ");
-        cereal::BinaryInputArchive saArchive(saStream);
-        saArchive(SA);
-        //saArchive(LCP);
+    bool loadedArrays = h.flatLayout() ? loadFlat_(indDir, report) :
+                                         loadSerialized_(indDir, numThreads, report);
+    if (!loadedArrays) {
+        logger->error("Failed to load the index from {}", indDir);
+        std::exit(1);
     }
-    saStream.close();
 
-    std::ifstream seqStream(indDir + "txpInfo.bin");
-    {
-        logger->info("Loading Transcript Info ");
-        cereal::BinaryInputArchive seqArchive(seqStream);
-        seqArchive(txpNames);
-        seqArchive(txpOffsets);
-        //seqArchive(positionIDs);
-        seqArchive(seq);
-        seqArchive(txpCompleteLens);
-    }
-    seqStream.close();
-
-    /*
-       std::ifstream rsStream(indDir + "rsdSafe.bin", std::ios::binary);
-       {
-       logger->info("Loading Rank-Select Data");
-       rankDictSafe.Load(rsStream);
-       }
-       rsStream.close();
-       */
-    std::string rsFileName = indDir + "rsd.bin";
-    FILE* rsFile = fopen(rsFileName.c_str(), "r");
-    {
-        logger->info("Loading Rank-Select Bit Array");
-        bitArray.reset(bit_array_create(0));
-        if (!bit_array_load(bitArray.get(), rsFile)) {
-            logger->error("Couldn't load bit array from {}!", rsFileName);
-            std::exit(1);
-        }
-        logger->info("There were {} set bits in the bit array", bit_array_num_bits_set(bitArray.get()));
-        rankDict.reset(new rank9b(bitArray->words, bitArray->num_of_bits));
+    if (!loadSearchTables_(indDir, h, report)) {
+        logger->error("Failed to load the search tables from {}", indDir);
+        std::exit(1);
     }
-    fclose(rsFile);
-
-    {
-        logger->info("Computing transcript lengths");
-        txpLens.resize(txpOffsets.size());
-        if (txpOffsets.size() > 1) {
-            for(size_t i = 0; i < txpOffsets.size() - 1; ++i) {
-                auto nextOffset = txpOffsets[i+1];
-                auto currentOffset = txpOffsets[i];
-                txpLens[i] = (nextOffset - 1) - currentOffset;
-            }
-        }
-        // The last length is just the length of the suffix array - the last offset
-        txpLens[txpOffsets.size()-1] = (SA.size() - 1) - txpOffsets[txpOffsets.size() - 1];
-    } 
 
     logger->info("Waiting to finish loading hash");
     loadingHash.wait();
@@ -179,11 +326,488 @@ bool RapMapSAIndex<IndexT, HashT>::load(const std::string& indDir) {
         std::exit(1);
     }
     // Set the SA and text pointer if this is a perfect hash
-    setPerfectHashPointers(khash, SA, seq); 
+    setPerfectHashPointers(khash, SA, seq, packedText ? &packedSeq : nullptr); 
+    report.log(logger, loadStart);
     logger->info("Done loading index");
     return true;
 }
 
+// The suffix array, the text and the bit vector are loaded concurrently
+// (and the suffix array and text are themselves read in parallel slices).
+// Since a cereal-serialized vector (or string) is simply its length
+// followed by its elements, these can be read directly into place.
+template <typename IndexT, typename HashT, typename SAT>
+bool RapMapSAIndex<IndexT, HashT, SAT>::loadSerialized_(const std::string& indDir,
+                                                        uint32_t numThreads,
+                                                        IndexLoadReport& report) {
+    using Clock = IndexLoadReport::Clock;
+    auto logger = spdlog::get("stderrLog");
+
+    std::future<bool> loadingSA = std::async(std::launch::async,
+                                             [this, logger, indDir, numThreads, &report]() -> bool {
+        auto start = Clock::now();
+        logger->info("Loading Suffix Array ");
+        uint64_t saBytes{0};
+        if (!readSuffixArray(indDir, SA, numThreads, saBytes)) {
+            logger->error("Couldn't read the suffix array from {}", indDir);
+            return false;
+        }
+        report.add("suffix array", saBytes, start);
+        return true;
+    });
+
+    std::future<bool> loadingRank = std::async(std::launch::async,
+                                               [this, logger, indDir, &report]() -> bool {
+        auto start = Clock::now();
+        std::string rsFileName = indDir + "rsd.bin";
+        logger->info("Loading Rank-Select Bit Array");
+        FILE* rsFile = fopen(rsFileName.c_str(), "r");
+        if (rsFile == nullptr) {
+            logger->error("Couldn't open {}!", rsFileName);
+            return false;
+        }
+        bitArray.reset(bit_array_create(0));
+        bool loaded = bit_array_load(bitArray.get(), rsFile);
+        fclose(rsFile);
+        if (!loaded) {
+            logger->error("Couldn't load bit array from {}!", rsFileName);
+            return false;
+        }
+        report.add("boundary bits", rapmap::fs::FileSize(rsFileName.c_str()), start);
+
+        start = Clock::now();
+        rankDict.reset(new rank9b(bitArray->words, bitArray->num_of_bits));
+        boundaryBits.borrow(bitArray->words, bitArray->num_of_words);
+        report.add("rank directory", 0, start);
+        return true;
+    });
+
+    // The transcript info is read on this thread
+    bool loadedTxpInfo{true};
+    {
+        auto start = Clock::now();
+        std::string txpInfoFileName = indDir + "txpInfo.bin";
+        uint64_t textLen{0};
+        uint64_t textOffset{0};
+        {
+            logger->info("Loading Transcript Info ");
+            std::ifstream seqStream(txpInfoFileName, std::ios::binary);
+            cereal::BinaryInputArchive seqArchive(seqStream);
+            seqArchive(txpNames);
+            seqArchive(txpOffsets);
+            //seqArchive(positionIDs);
+            // Skip over the text for now; it is read in parallel below.
+            seqStream.read(reinterpret_cast<char*>(&textLen), sizeof(textLen));
+            textOffset = static_cast<uint64_t>(seqStream.tellg());
+            seqStream.seekg(textLen, std::ios::cur);
+            seqArchive(txpCompleteLens);
+            if (!seqStream) {
+                logger->error("Couldn't read the transcript info from {}", txpInfoFileName);
+                loadedTxpInfo = false;
+            }
+        }
+
+        if (loadedTxpInfo) {
+            report.add("transcript info",
+                       rapmap::fs::FileSize(txpInfoFileName.c_str()) - textLen, start);
+        }
+
+        if (loadedTxpInfo and !packedText) {
+            start = Clock::now();
+            char* textPtr = seq.allocate(textLen);
+            if (!rapmap::fs::ParallelRead(txpInfoFileName.c_str(), textOffset, textPtr, textLen, numThreads)) {
+                logger->error("Couldn't read the text from {}", txpInfoFileName);
+                loadedTxpInfo = false;
+            } else {
+                report.add("text", textLen, start);
+            }
+        }
+
+        // The packed text is its length, followed by a (cereal-serialized)
+        // vector of words.
+        if (loadedTxpInfo and packedText) {
+            start = Clock::now();
+            std::string packedFileName = indDir + "text2bit.bin";
+            uint64_t header[2] = {0, 0};
+            {
+                std::ifstream packedStream(packedFileName, std::ios::binary);
+                if (!packedStream.read(reinterpret_cast<char*>(header), sizeof(header))) {
+                    logger->error("Couldn't read the packed text from {}", packedFileName);
+                    loadedTxpInfo = false;
+                }
+            }
+            if (loadedTxpInfo) {
+                packedSeq.setLength(header[0]);
+                uint64_t packedBytes = header[1] * sizeof(uint64_t);
+                uint64_t* wordPtr = packedSeq.words().allocate(header[1]);
+                if (!rapmap::fs::ParallelRead(packedFileName.c_str(), sizeof(header),
+                                              reinterpret_cast<char*>(wordPtr), packedBytes, numThreads)) {
+                    logger->error("Couldn't read the packed text from {}", packedFileName);
+                    loadedTxpInfo = false;
+                } else {
+                    report.add("packed text", packedBytes, start);
+                }
+            }
+        }
+
+        if (loadedTxpInfo) {
+            start = Clock::now();
+            std::vector<IndexT> lens(txpOffsets.size());
+            if (txpOffsets.size() > 1) {
+                for(size_t i = 0; i < txpOffsets.size() - 1; ++i) {
+                    auto nextOffset = txpOffsets[i+1];
+                    auto currentOffset = txpOffsets[i];
+                    lens[i] = (nextOffset - 1) - currentOffset;
+                }
+            }
+            // The last length is just the length of the text - the last offset
+            lens[txpOffsets.size()-1] = (textLength() - 1) - txpOffsets[txpOffsets.size() - 1];
+            txpLens.assign(std::move(lens));
+            report.add("transcript lengths", 0, start);
+        }
+    }
+
+    bool loadedSA = loadingSA.get();
+    bool loadedRank = loadingRank.get();
+    if (loadedRank and packedText) {
+        packedSeq.setBoundaries(boundaryBits.data(), boundaryBits.size());
+    }
+    return loadedTxpInfo and loadedSA and loadedRank;
+}
+
+// Load whichever of the LCP-LR arrays, the LCP range-minimum structure,
+// the child table, the suffix fingerprints and the interval samples the
+// index was built with
+template <typename IndexT, typename HashT, typename SAT>
+bool RapMapSAIndex<IndexT, HashT, SAT>::loadSearchTables_(const std::string& indDir,
+                                                          const IndexHeader& h,
+                                                          IndexLoadReport& report) {
+    auto logger = spdlog::get("stderrLog");
+    if (h.lcp()) {
+        auto start = IndexLoadReport::Clock::now();
+        std::string lcpLRFileName = indDir + "lcplr.bin";
+        logger->info("Loading LCP-LR arrays");
+        std::ifstream lcpLRStream(lcpLRFileName, std::ios::binary);
+        if (!lcpLRStream.is_open()) {
+            logger->error("Couldn't open {}!", lcpLRFileName);
+            return false;
+        }
+        {
+            cereal::BinaryInputArchive lcpLRArchive(lcpLRStream);
+            lcpLRArchive(leftLCP, rightLCP);
+        }
+        if (leftLCP.size() != SA.size() or rightLCP.size() != SA.size()) {
+            logger->error("The LCP-LR arrays in {} don't match the suffix array", lcpLRFileName);
+            return false;
+        }
+        report.add("LCP-LR arrays", rapmap::fs::FileSize(lcpLRFileName.c_str()), start);
+    }
+    if (h.lcpRMQ()) {
+        auto start = IndexLoadReport::Clock::now();
+        std::string rmqFileName = indDir + "lcprmq.bin";
+        logger->info("Loading LCP range-minimum structure");
+        std::ifstream rmqStream(rmqFileName, std::ios::binary);
+        if (!rmqStream.is_open()) {
+            logger->error("Couldn't open {}!", rmqFileName);
+            return false;
+        }
+        {
+            cereal::BinaryInputArchive rmqArchive(rmqStream);
+            rmqArchive(lcpRMQ);
+        }
+        if (lcpRMQ.size() != SA.size()) {
+            logger->error("The LCP array in {} doesn't match the suffix array", rmqFileName);
+            return false;
+        }
+        report.add("LCP range-minimum", lcpRMQ.bytes(), start);
+    }
+    if (h.childTable()) {
+        auto start = IndexLoadReport::Clock::now();
+        std::string cldFileName = indDir + "cld.bin";
+        logger->info("Loading child table");
+        std::ifstream cldStream(cldFileName, std::ios::binary);
+        if (!cldStream.is_open()) {
+            logger->error("Couldn't open {}!", cldFileName);
+            return false;
+        }
+        {
+            cereal::BinaryInputArchive cldArchive(cldStream);
+            cldArchive(childTable);
+        }
+        if (childTable.size() != SA.size()) {
+            logger->error("The child table in {} doesn't match the suffix array", cldFileName);
+            return false;
+        }
+        report.add("child table", rapmap::fs::FileSize(cldFileName.c_str()), start);
+    }
+    if (h.fingerprints()) {
+        auto start = IndexLoadReport::Clock::now();
+        std::string fpFileName = indDir + "fp.bin";
+        logger->info("Loading suffix fingerprints");
+        std::ifstream fpStream(fpFileName, std::ios::binary);
+        if (!fpStream.is_open()) {
+            logger->error("Couldn't open {}!", fpFileName);
+            return false;
+        }
+        {
+            cereal::BinaryInputArchive fpArchive(fpStream);
+            fpArchive(fingerprints);
+        }
+        if (fingerprints.size() != SA.size()) {
+            logger->error("The fingerprints in {} don't match the suffix array", fpFileName);
+            return false;
+        }
+        report.add("suffix fingerprints", rapmap::fs::FileSize(fpFileName.c_str()), start);
+    }
+    if (h.sampledSearch()) {
+        auto start = IndexLoadReport::Clock::now();
+        std::string sampleFileName = indDir + "sampled.bin";
+        logger->info("Loading interval samples");
+        std::ifstream sampleStream(sampleFileName, std::ios::binary);
+        if (!sampleStream.is_open()) {
+            logger->error("Couldn't open {}!", sampleFileName);
+            return false;
+        }
+        {
+            cereal::BinaryInputArchive sampleArchive(sampleStream);
+            sampleArchive(sampledSearch);
+        }
+        if (sampledSearch.numRows() != SA.size()) {
+            logger->error("The samples in {} don't match the suffix array", sampleFileName);
+            return false;
+        }
+        report.add("interval samples", sampledSearch.bytes(), start);
+    }
+    if (h.kmerFilter()) {
+        auto start = IndexLoadReport::Clock::now();
+        std::string filterFileName = indDir + "filter.bin";
+        logger->info("Loading k-mer filter");
+        std::ifstream filterStream(filterFileName, std::ios::binary);
+        if (!filterStream.is_open()) {
+            logger->error("Couldn't open {}!", filterFileName);
+            return false;
+        }
+        {
+            cereal::BinaryInputArchive filterArchive(filterStream);
+            filterArchive(kmerFilter);
+        }
+        report.add("k-mer filter", kmerFilter.bytes(), start);
+    }
+    return true;
+}
+
+template <typename IndexT, typename HashT, typename SAT>
+bool RapMapSAIndex<IndexT, HashT, SAT>::loadFlat_(const std::string& indDir, IndexLoadReport& report) {
+    auto logger = spdlog::get("stderrLog");
+    auto start = IndexLoadReport::Clock::now();
+
+    std::string flatFileName = indDir + rapmap::flat::kFlatFileName;
+    logger->info("Mapping flat index {}", flatFileName);
+    flatIndex.reset(new rapmap::flat::FlatIndexView);
+    std::string err;
+    if (!flatIndex->open(flatFileName, sizeof(IndexT), err)) {
+        logger->error("Couldn't map the flat index: {}", err);
+        return false;
+    }
+    bool borrowed = borrowFlatSections_();
+    report.add("flat index (mapped)", flatIndex->mappedBytes(), start);
+    return borrowed;
+}
+
+// Point SA, seq, etc. at the sections of flatIndex
+template <typename IndexT, typename HashT, typename SAT>
+bool RapMapSAIndex<IndexT, HashT, SAT>::borrowFlatSections_() {
+    using rapmap::flat::FlatSectionID;
+    auto logger = spdlog::get("stderrLog");
+
+    const char* textPtr{nullptr};
+    const uint64_t* packedPtr{nullptr};
+    const IndexT* offsetPtr{nullptr};
+    const IndexT* lenPtr{nullptr};
+    const uint32_t* completeLenPtr{nullptr};
+    const uint64_t* boundaryPtr{nullptr};
+    const char* namePtr{nullptr};
+    size_t textLen{0}, numPackedWords{0}, numOffsets{0}, numLens{0},
+           numCompleteLens{0}, numBoundaryWords{0}, nameBytes{0};
+
+    bool ok = borrowSuffixArray(*flatIndex, SA) and
+        (packedText ? flatIndex->get(FlatSectionID::PACKED_TEXT, packedPtr, numPackedWords) :
+                      flatIndex->get(FlatSectionID::TEXT, textPtr, textLen)) and
+        flatIndex->get(FlatSectionID::TXP_OFFSETS, offsetPtr, numOffsets) and
+        flatIndex->get(FlatSectionID::TXP_LENS, lenPtr, numLens) and
+        flatIndex->get(FlatSectionID::TXP_COMPLETE_LENS, completeLenPtr, numCompleteLens) and
+        flatIndex->get(FlatSectionID::BOUNDARY_BITS, boundaryPtr, numBoundaryWords) and
+        flatIndex->get(FlatSectionID::TXP_NAMES, namePtr, nameBytes);
+    if (!ok) {
+        logger->error("The flat index is missing required sections");
+        return false;
+    }
+    if (numOffsets != numLens or numOffsets != numCompleteLens) {
+        logger->error("Inconsistent transcript information in the flat index");
+        return false;
+    }
+
+    // The text ends with the '$' that follows the last transcript (the
+    // suffix array may hold fewer entries than there are text positions)
+    if (packedText) {
+        textLen = (numOffsets > 0) ? offsetPtr[numOffsets - 1] + lenPtr[numLens - 1] + 1 : 0;
+        if (numPackedWords != rapmap::utils::PackedText::numWords(textLen)) {
+            logger->error("The packed text in the flat index has the wrong length");
+            return false;
+        }
+    }
+
+    // The large arrays are used in place
+    if (packedText) {
+        packedSeq.words().borrow(packedPtr, numPackedWords);
+        packedSeq.setLength(textLen);
+        packedSeq.setBoundaries(boundaryPtr, numBoundaryWords);
+    } else {
+        seq.borrow(textPtr, textLen);
+    }
+    txpOffsets.borrow(offsetPtr, numOffsets);
+    txpLens.borrow(lenPtr, numLens);
+    txpCompleteLens.borrow(completeLenPtr, numCompleteLens);
+
+    // The bit vector has one bit per text position; only the (small)
+    // rank directory is built here.
+    rankDict.reset(new rank9b(boundaryPtr, textLen));
+    boundaryBits.borrow(boundaryPtr, numBoundaryWords);
+
+    rapmap::flat::unpackNames(namePtr, nameBytes, numOffsets, txpNames);
+    logger->info("Mapped {} bytes; {} transcripts in index",
+                 flatIndex->mappedBytes(), txpNames.size());
+    return true;
+}
+
+template <typename IndexT, typename HashT, typename SAT>
+bool RapMapSAIndex<IndexT, HashT, SAT>::attach(const std::string& memName, const IndexHeader& h) {
+    auto logger = spdlog::get("stderrLog");
+    auto shmName = rapmap::shm::segmentName(memName);
+    logger->info("Attaching to shared memory segment {}", shmName);
+
+    std::string err;
+    sharedSegment.reset(new rapmap::shm::SharedIndexSegment);
+    if (!sharedSegment->open(memName, err)) {
+        logger->error("{}", err);
+        return false;
+    }
+    auto p = sharedSegment->preamble();
+    if (p->indexWidth != sizeof(IndexT) or
+        (p->perfectHash != 0) != h.perfectHash() or
+        p->kmerLen != h.kmerLen()) {
+        logger->error("Shared memory segment {} holds a different type of index "
+                      "than the one described by the provided header", shmName);
+        return false;
+    }
+    if (h.seqHash() != std::string(p->seqHash) or
+        h.nameHash() != std::string(p->nameHash)) {
+        logger->error("Shared memory segment {} was published from a different index "
+                      "(the sequence / name hashes do not match)", shmName);
+        return false;
+    }
+    rapmap::utils::my_mer::k(h.kmerLen());
+    packedText = h.packedText();
+    canonicalHash = h.canonicalHash();
+
+    flatIndex.reset(new rapmap::flat::FlatIndexView);
+    if (!flatIndex->attach(sharedSegment->data() + p->flat.offset, p->flat.bytes,
+                           sizeof(IndexT), err)) {
+        logger->error("Couldn't use the index in {}: {}", shmName, err);
+        return false;
+    }
+    if (!borrowFlatSections_()) {
+        return false;
+    }
+    if (!loadHashFromMemory(*sharedSegment, khash)) {
+        logger->error("Couldn't load the hash from {}", shmName);
+        return false;
+    }
+    setPerfectHashPointers(khash, SA, seq, packedText ? &packedSeq : nullptr);
+    logger->info("Attached to {} bytes of shared memory", sharedSegment->size());
+    if (!h.perfectHash()) {
+        logger->warn("The k-mer hash ({} bytes in {}) was copied into this process; "
+                     "only the rest of the index is shared.  Build the index with -p "
+                     "to share the hash as well", p->hashParts[0].bytes, shmName);
+    }
+    return true;
+}
+
+template <typename IndexT, typename HashT, typename SAT>
+bool RapMapSAIndex<IndexT, HashT, SAT>::publish(const std::string& memName,
+                                                const std::string& indDir,
+                                                const IndexHeader& h) {
+    using rapmap::flat::FlatSectionID;
+    auto logger = spdlog::get("stderrLog");
+    auto shmName = rapmap::shm::segmentName(memName);
+
+    // The arrays are laid out exactly as in a flat index
+    auto names = rapmap::flat::packNames(txpNames);
+    rapmap::flat::FlatIndexWriter writer(sizeof(IndexT));
+    addSuffixArraySection(writer, SA);
+    if (packedText) {
+        writer.addSection(FlatSectionID::PACKED_TEXT, packedSeq.words().data(), sizeof(uint64_t),
+                          packedSeq.words().size());
+    } else {
+        writer.addSection(FlatSectionID::TEXT, seq.data(), sizeof(char), seq.length());
+    }
+    writer.addSection(FlatSectionID::TXP_OFFSETS, txpOffsets.data(), sizeof(IndexT), txpOffsets.size());
+    writer.addSection(FlatSectionID::TXP_LENS, txpLens.data(), sizeof(IndexT), txpLens.size());
+    writer.addSection(FlatSectionID::TXP_COMPLETE_LENS, txpCompleteLens.data(), sizeof(uint32_t),
+                      txpCompleteLens.size());
+    writer.addSection(FlatSectionID::BOUNDARY_BITS, boundaryBits.data(), sizeof(uint64_t),
+                      boundaryBits.size());
+    writer.addSection(FlatSectionID::TXP_NAMES, names.data(), sizeof(char), names.size());
+
+    // and the hash is copied verbatim from its files
+    auto hashFiles = hashFilesForIndex(indDir, khash);
+    std::vector<uint64_t> hashPartBytes(hashFiles.size(), 0);
+    for (size_t i = 0; i < hashFiles.size(); ++i) {
+        if (!rapmap::shm::fileBytes(hashFiles[i], hashPartBytes[i])) {
+            logger->error("Couldn't find hash file {}", hashFiles[i]);
+            return false;
+        }
+    }
+
+    rapmap::shm::SharedIndexPreamble p;
+    std::memset(&p, 0, sizeof(p));
+    p.version = rapmap::shm::kShmLayoutVersion;
+    p.indexWidth = sizeof(IndexT);
+    p.kmerLen = h.kmerLen();
+    p.perfectHash = h.perfectHash() ? 1 : 0;
+    std::strncpy(p.seqHash, h.seqHash().c_str(), rapmap::shm::kDigestLen - 1);
+    std::strncpy(p.nameHash, h.nameHash().c_str(), rapmap::shm::kDigestLen - 1);
+    rapmap::shm::layoutSegment(p, writer.totalBytes(), hashPartBytes);
+
+    std::string err;
+    rapmap::shm::SharedIndexSegment segment;
+    if (!segment.create(memName, p.totalBytes, err)) {
+        logger->error("{}", err);
+        return false;
+    }
+    logger->info("Copying {} bytes into shared memory segment {}", p.totalBytes, shmName);
+    writer.writeTo(segment.data() + p.flat.offset);
+    for (size_t i = 0; i < hashFiles.size(); ++i) {
+        if (!rapmap::shm::readFileInto(hashFiles[i], segment.data() + p.hashParts[i].offset,
+                                       hashPartBytes[i])) {
+            logger->error("Couldn't read hash file {}", hashFiles[i]);
+            rapmap::shm::SharedIndexSegment::remove(memName, err);
+            return false;
+        }
+    }
+    // The magic number is written last; until it is present, the
+    // segment will not be used.
+    std::memcpy(segment.data(), &p, sizeof(p));
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(segment.data(), rapmap::shm::kShmMagic, sizeof(rapmap::shm::kShmMagic));
+    logger->info("Published index {} as {}", indDir, shmName);
+    if (!h.perfectHash()) {
+        logger->warn("This index has the regular k-mer hash (it was built without -p), "
+                     "which each process that attaches copies into its own memory");
+    }
+    return true;
+}
+
 template class RapMapSAIndex<int32_t,  RegHashT<uint64_t,
                       rapmap::utils::SAInterval<int32_t>,
                       rapmap::utils::KmerKeyHasher>>;
@@ -192,3 +816,9 @@ template class RapMapSAIndex<int64_t,  RegHashT<uint64_t,
                       rapmap::utils::KmerKeyHasher>>;
 template class RapMapSAIndex<int32_t, PerfectHashT<uint64_t, rapmap::utils::SAInterval<int32_t>>>;
 template class RapMapSAIndex<int64_t, PerfectHashT<uint64_t, rapmap::utils::SAInterval<int64_t>>>;
+template class RapMapSAIndex<int64_t,  RegHashT<uint64_t,
+                      rapmap::utils::SAInterval<int64_t>,
+                      rapmap::utils::KmerKeyHasher>,
+                      rapmap::utils::PackedSA<int64_t>>;
+template class RapMapSAIndex<int64_t, PerfectHashT<uint64_t, rapmap::utils::SAInterval<int64_t>>,
+                      rapmap::utils::PackedSA<int64_t>>;
@@ -20,18 +20,25 @@
 //
 
 #include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <cstdio>
+#include <cstring>
+#include <functional>
 #include <fstream>
 #include <iostream>
 #include <iterator>
 #include <memory>
 #include <mutex>
 #include <random>
+#include <thread>
 #include <type_traits>
 #include <unordered_map>
 #include <vector>
 
+#include <sys/resource.h>
+#include <unistd.h>
+
 #include "tclap/CmdLine.h"
 
 #include <cereal/archives/binary.hpp>
@@ -69,6 +76,15 @@
 #include "rank9b.h"
 
 #include "IndexHeader.hpp"
+#include "FlatIndex.hpp"
+#include "PackedText.hpp"
+#include "PackedSA.hpp"
+#include "FMIndex.hpp"
+#include "ParallelSuffixSort.hpp"
+#include "LCPArray.hpp"
+#include "SuffixFingerprints.hpp"
+#include "SampledSearchTree.hpp"
+#include "KmerFilter.hpp"
 
 // sha functionality
 #include "picosha2.h"
@@ -81,28 +97,119 @@ using TranscriptIDVector = std::vector<TranscriptID>;
 using KmerIDMap = std::vector<TranscriptIDVector>;
 using MerMapT = jellyfish::cooperative::hash_counter<rapmap::utils::my_mer>;
 
-bool buildSA(const std::string& outputDir, std::string& concatText, size_t tlen,
-             std::vector<int64_t>& SA) {
-  // IndexT is the signed index type
-  // UIndexT is the unsigned index type
-  using IndexT = int64_t;
-  using UIndexT = uint64_t;
+// Options controlling how the quasi index is built
+struct IndexOpts {
+  bool noClipPolyA{false};
+  bool usePerfectHash{false};
+  uint32_t numHashThreads{4};
+  // Sort the suffix array with numHashThreads threads rather than with
+  // (single-threaded) divsufsort
+  bool parallelSA{false};
+  std::string sepStr{" \t"};
+  // Write the SA, text and transcript info as a single mmap-able file
+  bool flatLayout{false};
+  // Store the text 2-bit packed rather than one byte per base
+  bool packedText{false};
+  // Store the SA with ceil(log2 n) bits per entry
+  bool packedSA{false};
+  // Build an FM-index (with a sampled SA) instead of the SA and text
+  bool fmIndex{false};
+  uint32_t fmSampleRate{16};
+  // Leave the suffixes that can't begin a k-mer out of the SA
+  bool pruneSA{false};
+  // If non-zero, build the SA and hash bucket by bucket, in memory,
+  // keeping the resident memory of the process under this many megabytes
+  uint64_t bucketMemoryMB{0};
+  // Also build the LCP array and the searcher's LCP-LR arrays
+  bool lcp{false};
+  // Also build the child table (implies lcp)
+  bool childTable{false};
+  // Also write the fingerprint of each suffix
+  bool fingerprints{false};
+  // If > 0, also sample the k-mer intervals of at least this many rows
+  uint32_t sampledSearchRows{0};
+  // Key the hash on canonical k-mers
+  bool canonicalHash{false};
+  // If > 0, also write a filter over the keys of the hash with this many
+  // bits per key
+  uint32_t filterBits{0};
+};
+
+// Remove, in place, the suffixes of SA that start on a '$' or whose first
+// k bases cross the end of a transcript.  No k-mer interval includes
+// these suffixes, so the SA that remains is all that mapping needs (and
+// it is still sorted).
+template <typename IndexT>
+void pruneSuffixArray(const std::string& concatText, uint32_t k,
+                      std::vector<IndexT>& SA) {
+  ScopedTimer timer;
+  std::cerr << "Removing suffixes that can't begin a k-mer . . . ";
+  size_t tlen = concatText.length();
+  // keep[p] is true if T[p, p + k) contains no '$'
+  std::vector<bool> keep(tlen, false);
+  size_t run{0};
+  for (size_t p = tlen; p > 0; --p) {
+    run = (concatText[p - 1] == '$') ? 0 : run + 1;
+    keep[p - 1] = (run >= k);
+  }
+  size_t numKept{0};
+  for (size_t i = 0; i < SA.size(); ++i) {
+    if (keep[SA[i]]) { SA[numKept++] = SA[i]; }
+  }
+  std::cerr << "kept " << numKept << " of " << SA.size() << " suffixes\n";
+  SA.resize(numKept);
+  SA.shrink_to_fit();
+}
+
+// Sort the suffixes of text into SA (sized to the text) with divsufsort,
+// whose entry points differ with the width of the entries
+inline int divSufSort(const std::string& text, std::vector<int32_t>& SA) {
+  return divsufsort(
+      reinterpret_cast<unsigned char*>(const_cast<char*>(text.data())),
+      SA.data(), text.length());
+}
+
+inline int divSufSort(const std::string& text, std::vector<int64_t>& SA) {
+  return divsufsort64(
+      reinterpret_cast<unsigned char*>(const_cast<char*>(text.data())),
+      SA.data(), text.length());
+}
+
+// IndexT is the (signed) type of the suffix array entries: int32_t for
+// "small" suffix arrays, int64_t for "large" ones
+template <typename IndexT>
+bool buildSA(const std::string& outputDir, std::string& concatText,
+             std::vector<IndexT>& SA, bool saveToDisk = true,
+             uint32_t pruneK = 0, uint32_t numSortThreads = 1) {
   bool success{false};
 
-  std::ofstream saStream(outputDir + "sa.bin", std::ios::binary);
+  std::ofstream saStream;
+  if (saveToDisk) {
+    saStream.open(outputDir + "sa.bin", std::ios::binary);
+  }
   {
     ScopedTimer timer;
-    SA.resize(tlen, 0);
-    IndexT textLen = static_cast<IndexT>(tlen);
-    std::cerr << "Building suffix array . . . ";
-    auto ret = divsufsort64(
-        reinterpret_cast<unsigned char*>(const_cast<char*>(concatText.data())),
-        SA.data(), tlen);
+    SA.resize(concatText.length(), 0);
+    // divsufsort is single-threaded; with --parallelSA (numSortThreads >
+    // 1), sort in parallel instead (which yields the same suffix array,
+    // but needs more memory and can be slower on very repetitive text)
+    numSortThreads = std::min(numSortThreads, std::max(std::thread::hardware_concurrency(), 1u));
+    int ret{0};
+    if (numSortThreads > 1) {
+      std::cerr << "Building suffix array with " << numSortThreads << " threads . . . ";
+      rapmap::utils::parallelSuffixSort(concatText, SA, numSortThreads);
+    } else {
+      std::cerr << "Building suffix array . . . ";
+      ret = divSufSort(concatText, SA);
+    }
 
     success = (ret == 0);
     if (success) {
       std::cerr << "success\n";
-      {
+      if (pruneK > 0) {
+        pruneSuffixArray(concatText, pruneK, SA);
+      }
+      if (saveToDisk) {
         ScopedTimer timer2;
         std::cerr << "saving to disk . . . ";
         cereal::BinaryOutputArchive saArchive(saStream);
@@ -110,7 +217,7 @@ bool buildSA(const std::string& outputDir, std::string& concatText, size_t tlen,
         std::cerr << "done\n";
       }
     } else {
-      std::cerr << "FAILURE: return code from libdivsufsort64() was " << ret
+      std::cerr << "FAILURE: return code from divsufsort was " << ret
                 << "\n";
       saStream.close();
       std::exit(1);
@@ -121,85 +228,258 @@ bool buildSA(const std::string& outputDir, std::string& concatText, size_t tlen,
   return success;
 }
 
+// The 2-bit (my_mer) encoding of the k-mer at position p of the text,
+// computed in place; returns false if the k-mer contains a '$' or runs
+// off the end of the text.  If reverse is true, the k-mer is read from
+// right to left (see buildHash).
+inline bool encodeKmerAt(const std::string& text, uint64_t p, uint32_t k,
+                         bool reverse, uint64_t& word) {
+  if (p + k > text.length()) {
+    return false;
+  }
+  const char* kmer = text.data() + p;
+  uint64_t w{0};
+  for (uint32_t j = 0; j < k; ++j) {
+    uint64_t c;
+    switch (reverse ? kmer[k - 1 - j] : kmer[j]) {
+    case 'A': c = 0; break;
+    case 'C': c = 1; break;
+    case 'G': c = 2; break;
+    case 'T': c = 3; break;
+    default: return false;
+    }
+    w = (w << 2) | c;
+  }
+  word = w;
+  return true;
+}
+
+template <typename IndexT>
+using KmerIntervals =
+    std::vector<std::pair<uint64_t, rapmap::utils::SAInterval<IndexT>>>;
+
+// Find the interval of SA rows that starts with each k-mer of the text.
+// The SA is split into one range per thread, with each boundary moved
+// forward to the first row of a k-mer, so that no interval spans two
+// ranges; the intervals found by each thread are returned separately.
+// SA may be a slice (of saLen rows) of a larger suffix array, whose first
+// row is rowOffset, as long as no k-mer straddles the ends of the slice.
+template <typename IndexT>
+std::vector<KmerIntervals<IndexT>>
+collectKmerIntervals(const std::string& concatText, uint32_t k,
+                     const IndexT* SA, int64_t saLen, int64_t rowOffset,
+                     uint32_t numThreads, bool reverseKeys) {
+  numThreads = std::max(numThreads, 1u);
+  auto kmerAt = [&](int64_t row, uint64_t& word) -> bool {
+    return encodeKmerAt(concatText, SA[row], k, reverseKeys, word);
+  };
+
+  std::vector<int64_t> bounds(numThreads + 1, saLen);
+  bounds[0] = 0;
+  for (uint32_t t = 1; t < numThreads; ++t) {
+    int64_t b = std::max(bounds[t - 1], (saLen * t) / numThreads);
+    uint64_t prev{0}, cur{0};
+    while (b > 0 and b < saLen and kmerAt(b - 1, prev) and kmerAt(b, cur) and
+           prev == cur) {
+      ++b;
+    }
+    bounds[t] = b;
+  }
+
+  std::vector<KmerIntervals<IndexT>> intervals(numThreads);
+  auto collect = [&](uint32_t t) {
+    auto& out = intervals[t];
+    int64_t lo = bounds[t], hi = bounds[t + 1];
+    int64_t start = lo;
+    bool curValid{false};
+    uint64_t cur{0}, word{0};
+    for (int64_t row = lo; row < hi; ++row) {
+      bool valid = kmerAt(row, word);
+      if (!(valid and curValid and word == cur)) {
+        if (curValid) {
+          out.push_back({cur, {static_cast<IndexT>(rowOffset + start),
+                               static_cast<IndexT>(rowOffset + row)}});
+        }
+        start = row;
+        cur = word;
+        curValid = valid;
+      }
+    }
+    if (curValid) {
+      out.push_back({cur, {static_cast<IndexT>(rowOffset + start),
+                           static_cast<IndexT>(rowOffset + hi)}});
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (uint32_t t = 1; t < numThreads; ++t) {
+    threads.emplace_back(collect, t);
+  }
+  collect(0);
+  for (auto& t : threads) {
+    t.join();
+  }
+  return intervals;
+}
+
+template <typename IndexT>
+std::vector<KmerIntervals<IndexT>>
+collectKmerIntervals(const std::string& concatText, uint32_t k,
+                     const std::vector<IndexT>& SA, uint32_t numThreads,
+                     bool reverseKeys) {
+  return collectKmerIntervals(concatText, k, SA.data(),
+                              static_cast<int64_t>(SA.size()), 0, numThreads,
+                              reverseKeys);
+}
+
+template <typename IndexT>
+using KmerHashT = RegHashT<rapmap::utils::my_mer::base_type,
+                           rapmap::utils::SAInterval<IndexT>,
+                           rapmap::utils::KmerKeyHasher>;
+
+// Move the intervals collected by each thread into khash
+template <typename IndexT>
+void addKmerIntervals(std::vector<KmerIntervals<IndexT>>& kmerIntervals,
+                      KmerHashT<IndexT>& khash) {
+  for (auto& ivs : kmerIntervals) {
+    for (auto& iv : ivs) {
+      // Each k-mer occupies a single run of the SA
+      if (!khash.insert(iv).second) {
+        std::cerr << "\nERROR: trying to add the same k-mer (" << iv.first
+                  << ") multiple times!\n";
+      }
+    }
+    KmerIntervals<IndexT>().swap(ivs);
+  }
+}
+
+// Re-key khash on canonical k-mers (see rapmap::utils::CanonicalKmer).
+// The entry of a k-mer that is its pair's key stays put (flagged if its
+// reverse complement occurs too); that of a k-mer whose reverse complement
+// doesn't occur moves to its key, flagged as the reverse complement's.
+template <typename IndexT>
+void canonicalizeKmerHash(KmerHashT<IndexT>& khash, uint32_t k) {
+  using Canon = rapmap::utils::CanonicalKmer;
+  using WordT = rapmap::utils::my_mer::base_type;
+  ScopedTimer timer;
+  std::cerr << "keying the hash on canonical k-mers . . . ";
+  std::vector<std::pair<WordT, rapmap::utils::SAInterval<IndexT>>> moved;
+  size_t numBoth{0};
+  rapmap::utils::my_mer mer;
+  for (auto& kv : khash) {
+    mer.set_bits(0, 2 * k, kv.first);
+    WordT rcWord = mer.get_reverse_complement().word(0);
+    // (k is odd, so no k-mer is its own reverse complement)
+    bool hasRC = (khash.find(rcWord) != khash.end());
+    if (kv.first < rcWord) {
+      if (hasRC) {
+        Canon::setFlags(kv.second, false, true);
+        ++numBoth;
+      }
+    } else if (!hasRC) {
+      moved.emplace_back(kv.first, kv.second);
+    }
+  }
+  for (auto& kv : moved) {
+    khash.erase(kv.first);
+    mer.set_bits(0, 2 * k, kv.first);
+    Canon::setFlags(kv.second, true, false);
+    khash.insert({mer.get_reverse_complement().word(0), kv.second});
+  }
+  std::cerr << "done (" << numBoth << " k-mers also occur reverse complemented "
+            << "and keep a second entry)\n";
+}
+
+// Write khash to hash.bin
+template <typename IndexT>
+bool saveKmerHash(const std::string& outputDir, KmerHashT<IndexT>& khash) {
+  using WordT = rapmap::utils::my_mer::base_type;
+  std::cerr << "\nkhash had " << khash.size() << " keys\n";
+  std::ofstream hashStream(outputDir + "hash.bin", std::ios::binary);
+  {
+    ScopedTimer timer;
+    std::cerr << "saving hash to disk . . . ";
+    khash.serialize(typename spp_utils::pod_hash_serializer<WordT, rapmap::utils::SAInterval<IndexT>>(),
+                    &hashStream);
+    std::cerr << "done\n";
+  }
+  bool success = static_cast<bool>(hashStream);
+  hashStream.close();
+  return success;
+}
+
+// Write filter to filter.bin, along with how many random k-mers get past
+// it (almost all of which are absent from the index)
+bool saveKmerFilter(const std::string& outputDir,
+                    const rapmap::utils::KmerFilter& filter, uint32_t k) {
+  const uint64_t merMask = (k >= 32) ? ~uint64_t(0) : ((uint64_t(1) << (2 * k)) - 1);
+  const size_t numProbes{1000000};
+  std::mt19937_64 gen(271828);
+  size_t numPassed{0};
+  for (size_t i = 0; i < numProbes; ++i) {
+    numPassed += filter.contains(gen() & merMask) ? 1 : 0;
+  }
+  std::cerr << "k-mer filter uses " << filter.bytes() << " bytes; "
+            << numPassed << " of " << numProbes << " random k-mers pass it\n";
+  std::ofstream filterStream(outputDir + "filter.bin", std::ios::binary);
+  {
+    cereal::BinaryOutputArchive filterArchive(filterStream);
+    filterArchive(filter);
+  }
+  bool success = static_cast<bool>(filterStream);
+  filterStream.close();
+  return success;
+}
+
+// Write a filter with bitsPerKey bits per key over the keys of khash
+template <typename IndexT>
+bool writeKmerFilter(const std::string& outputDir, const KmerHashT<IndexT>& khash,
+                     uint32_t k, uint32_t bitsPerKey) {
+  ScopedTimer timer;
+  rapmap::utils::KmerFilter filter;
+  filter.init(khash.size(), bitsPerKey);
+  for (auto& kv : khash) {
+    filter.add(kv.first);
+  }
+  return saveKmerFilter(outputDir, filter, k);
+}
+
 // IndexT is the index type.
 // int32_t for "small" suffix arrays
 // int64_t for "large" ones
 template <typename IndexT>
 bool buildPerfectHash(const std::string& outputDir, std::string& concatText,
                       size_t tlen, uint32_t k, std::vector<IndexT>& SA,
-                      uint32_t numHashThreads) {
+                      uint32_t numHashThreads, uint32_t filterBits = 0) {
   //BooMap<uint64_t, rapmap::utils::SAInterval<IndexT>> intervals;
   PerfectHashT<uint64_t, rapmap::utils::SAInterval<IndexT>> intervals;
-  intervals.setSAPtr(&SA);
+  intervals.setSAPtr(SA.data());
   intervals.setTextPtr(concatText.data(), concatText.length());
+  rapmap::utils::KmerFilter filter;
 
-  // The start and stop of the current interval
-  IndexT start = 0, stop = 0;
-  // An iterator to the beginning of the text
-  auto textB = concatText.begin();
-  auto textE = concatText.end();
-  // The current k-mer as a string
-  rapmap::utils::my_mer mer;
-  bool currentValid{false};
-  std::string currentKmer;
-  std::string nextKmer;
-  while (stop < tlen) {
-    // Check if the string starting at the
-    // current position is valid (i.e. doesn't contain $)
-    // and is <= k bases from the end of the string
-    nextKmer = concatText.substr(SA[stop], k);
-    if (nextKmer.length() == k and
-        nextKmer.find_first_of('$') == std::string::npos) {
-      // If this is a new k-mer, then hash the current k-mer
-      if (nextKmer != currentKmer) {
-        if (currentKmer.length() == k and
-            currentKmer.find_first_of('$') == std::string::npos) {
-          mer = rapmap::utils::my_mer(currentKmer);
-          auto bits = mer.get_bits(0, 2 * k);
-          intervals.add(std::move(bits), {start, stop});
-          // push_back(std::make_pair<uint64_t,
-          // rapmap::utils::SAInterval<IndexT>>(std::move(bits), {start,
-          // stop}));
-        }
-        currentKmer = nextKmer;
-        start = stop;
-      }
-    } else {
-      // If this isn't a valid suffix (contains a $)
-      // If the previous interval was valid, put it
-      // in the hash.
-      if (currentKmer.length() == k and
-          currentKmer.find_first_of('$') == std::string::npos) {
-        mer = rapmap::utils::my_mer(currentKmer);
-        auto bits = mer.get_bits(0, 2 * k);
-        // intervals.push_back(std::make_pair<uint64_t,
-        // rapmap::utils::SAInterval<IndexT>>(std::move(bits), {start, stop}));
-        intervals.add(std::move(bits), {start, stop});
-      }
-      // The current interval is invalid and empty
-      currentKmer = nextKmer;
-      start = stop;
+  {
+    ScopedTimer timer;
+    std::cerr << "collecting k-mer intervals . . . ";
+    auto kmerIntervals =
+        collectKmerIntervals(concatText, k, SA, numHashThreads, false);
+    size_t numIntervals{0};
+    for (auto& ivs : kmerIntervals) {
+      numIntervals += ivs.size();
     }
-    if (stop % 1000000 == 0) {
-      std::cerr << "\r\rprocessed " << stop << " positions";
+    if (filterBits > 0) { filter.init(numIntervals, filterBits); }
+    for (auto& ivs : kmerIntervals) {
+      for (auto& iv : ivs) {
+        if (filterBits > 0) { filter.add(iv.first); }
+        intervals.add(std::move(iv.first), std::move(iv.second));
+      }
+      KmerIntervals<IndexT>().swap(ivs);
     }
-    // We always update the end position
-    ++stop;
+    std::cerr << "found " << numIntervals << " intervals\n";
   }
-  if (start < tlen) {
-    if (currentKmer.length() == k and
-        currentKmer.find_first_of('$') != std::string::npos) {
-      mer = rapmap::utils::my_mer(currentKmer);
-      auto bits = mer.get_bits(0, 2 * k);
-      // intervals.push_back(std::make_pair<uint64_t,
-      // rapmap::utils::SAInterval<IndexT>>(std::move(bits), {start, stop}));
-      intervals.add(std::move(bits), {start, stop});
-    }
+  if (filterBits > 0 and !saveKmerFilter(outputDir, filter, k)) {
+    return false;
   }
 
-  // std::cerr << "\nthere are " << intervals.size() << " intervals of the
-  // selected depth\n";
-
   std::cout << "building perfect hash function\n";
   intervals.build(numHashThreads);
   std::cout << "\ndone.\n";
@@ -211,242 +491,538 @@ bool buildPerfectHash(const std::string& outputDir, std::string& concatText,
   return true;
 }
 
-bool buildSA(const std::string& outputDir, std::string& concatText, size_t tlen,
-             std::vector<int32_t>& SA) {
-  // IndexT is the signed index type
-  // UIndexT is the unsigned index type
-  using IndexT = int32_t;
-  using UIndexT = uint32_t;
-  bool success{false};
-
-  std::ofstream saStream(outputDir + "sa.bin", std::ios::binary);
+// IndexT is the index type.
+// int32_t for "small" suffix arrays
+// int64_t for "large" ones
+// If reverseKeys is true, concatText is the reversed text (as for the
+// FM-index) and each interval is keyed by its k-mer in the forward text.
+template <typename IndexT>
+bool buildHash(const std::string& outputDir, std::string& concatText,
+               size_t tlen, uint32_t k, std::vector<IndexT>& SA,
+               uint32_t numThreads, bool reverseKeys = false,
+               bool canonical = false, uint32_t filterBits = 0) {
+  // Now, build the k-mer lookup table
+  KmerHashT<IndexT> khash;
   {
     ScopedTimer timer;
-    SA.resize(tlen, 0);
-    IndexT textLen = static_cast<IndexT>(tlen);
-    std::cerr << "Building suffix array . . . ";
-    auto ret = divsufsort(
-        reinterpret_cast<unsigned char*>(const_cast<char*>(concatText.data())),
-        SA.data(), tlen);
-
-    success = (ret == 0);
-    if (success) {
-      std::cerr << "success\n";
-      {
-        ScopedTimer timer2;
-        std::cerr << "saving to disk . . . ";
-        cereal::BinaryOutputArchive saArchive(saStream);
-        saArchive(SA);
-        std::cerr << "done\n";
-      }
-    } else {
-      std::cerr << "FAILURE: return code from libdivsufsort() was " << ret
-                << "\n";
-      saStream.close();
-      std::exit(1);
+    std::cerr << "collecting k-mer intervals . . . ";
+    auto kmerIntervals =
+        collectKmerIntervals(concatText, k, SA, numThreads, reverseKeys);
+    size_t numIntervals{0};
+    for (auto& ivs : kmerIntervals) {
+      numIntervals += ivs.size();
     }
+    khash.reserve(numIntervals);
+    addKmerIntervals(kmerIntervals, khash);
     std::cerr << "done\n";
   }
-  saStream.close();
-  return success;
+  if (canonical) { canonicalizeKmerHash(khash, k); }
+  if (filterBits > 0 and !writeKmerFilter(outputDir, khash, k, filterBits)) {
+    return false;
+  }
+  return saveKmerHash(outputDir, khash);
 }
 
-// IndexT is the index type.
-// int32_t for "small" suffix arrays
-// int64_t for "large" ones
+// The resident memory of this process, in bytes, at its highest since
+// the last resetPeakResident() (or, where that can't be reset, ever)
+uint64_t peakResidentBytes() {
+#if defined(__linux__)
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 6, "VmHWM:") == 0) {
+      return std::stoull(line.substr(6)) * 1024;
+    }
+  }
+#endif
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+  return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+  return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+}
+
+// Start measuring the peak resident memory afresh (only on Linux)
+void resetPeakResident() {
+#if defined(__linux__)
+  std::ofstream clearRefs("/proc/self/clear_refs");
+  clearRefs << "5";
+#endif
+}
+
+// The resident memory of this process, in bytes, now (or, where that
+// can't be read, at its highest so far, which is at least as much)
+uint64_t residentBytes() {
+#if defined(__linux__)
+  std::ifstream statm("/proc/self/statm");
+  uint64_t numPages{0}, numResidentPages{0};
+  if (statm >> numPages >> numResidentPages) {
+    return numResidentPages * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+  }
+#endif
+  return peakResidentBytes();
+}
+
+// About how many bytes khash (a sparsepp table, at most half full) takes
+// once it holds numEntries entries, counting half a byte of group and
+// bitmap overhead per bucket, and the table it replaces if it has to
+// grow (both are held while the entries are moved), plus filterBits bits
+// per entry for the k-mer filter built from it
 template <typename IndexT>
-bool buildHash(const std::string& outputDir, std::string& concatText,
-               size_t tlen, uint32_t k, std::vector<IndexT>& SA) {
-  // Now, build the k-mer lookup table
-    // The base type should always be uint64_t
-    using WordT = rapmap::utils::my_mer::base_type;
-    RegHashT<WordT, rapmap::utils::SAInterval<IndexT>,
-                         rapmap::utils::KmerKeyHasher> khash;
-    //RegHashT<uint64_t, IndexT, rapmap::utils::KmerKeyHasher> overflowhash;
-    //std::cerr << "sizeof(SAInterval<IndexT>) = " << sizeof(rapmap::utils::SAInterval<IndexT>) << '\n';
-    //khash.set_empty_key(std::numeric_limits<uint64_t>::max());
-  // The start and stop of the current interval
-  IndexT start = 0, stop = 0;
-  // An iterator to the beginning of the text
-  auto textB = concatText.begin();
-  auto textE = concatText.end();
-  // The current k-mer as a string
-  rapmap::utils::my_mer mer;
-  bool currentValid{false};
-  std::string currentKmer;
-  std::string nextKmer;
-  while (stop < tlen) {
-    // Check if the string starting at the
-    // current position is valid (i.e. doesn't contain $)
-    // and is <= k bases from the end of the string
-    nextKmer = concatText.substr(SA[stop], k);
-    if (nextKmer.length() == k and
-        nextKmer.find_first_of('$') == std::string::npos) {
-      // If this is a new k-mer, then hash the current k-mer
-      if (nextKmer != currentKmer) {
-        if (currentKmer.length() == k and
-            currentKmer.find_first_of('$') == std::string::npos) {
-          mer = currentKmer;
-          auto bits = mer.word(0);
-          auto hashIt = khash.find(bits);
-          if (hashIt == khash.end()) {
-            if (start > 1) {
-              if (concatText.substr(SA[start - 1], k) ==
-                  concatText.substr(SA[start], k)) {
-                std::cerr << "T[SA[" << start - 1 << "]:" << k
-                          << "] = " << concatText.substr(SA[start - 1], k)
-                          << " = T[SA[" << start << "]:" << k << "]\n";
-                std::cerr << "start = " << start << ", stop = " << stop << "\n";
-                std::cerr << "[fatal (1)] THIS SHOULD NOT HAPPEN\n";
-                std::exit(1);
-              }
-            }
-            if (start == stop) {
-              std::cerr << "[fatal (2)] Interval is empty! (start = " << start
-                        << ") = (stop =  " << stop << ")\n";
-            }
-            if (start == stop) {
-              std::cerr << "[fatal (3)] Interval is empty! (start = " << start
-                        << ") = (stop =  " << stop << ")\n";
-            }
+uint64_t estimateKmerHashBytes(const KmerHashT<IndexT>& khash,
+                               uint64_t numEntries, uint32_t filterBits) {
+  const uint64_t entryBytes = sizeof(typename KmerHashT<IndexT>::value_type);
+  uint64_t numBuckets = std::max(uint64_t(khash.bucket_count()), uint64_t(1));
+  uint64_t newNumBuckets = numBuckets;
+  while (newNumBuckets < 2 * numEntries) { newNumBuckets *= 2; }
+  uint64_t bytes = numEntries * entryBytes + newNumBuckets / 2 +
+                   (numEntries * filterBits) / 8;
+  if (newNumBuckets > numBuckets) {
+    bytes += khash.size() * entryBytes + numBuckets / 2;
+  }
+  return bytes;
+}
 
-            khash[bits] = {start, stop};
-            /*
-            IndexT len = stop - start;
-            bool overflow = (len >= std::numeric_limits<uint8_t>::max());
-            uint8_t blen = overflow ? std::numeric_limits<uint8_t>::max() :
-                static_cast<uint8_t>(len);
-            khash[bits] = {start, blen};
-            if (overflow) {
-                overflowhash[bits] = len;
-            }
-            */
-          } else {
-            std::cerr << "\nERROR (1): trying to add same suffix "
-                      << currentKmer << " (len = " << currentKmer.length()
-                      << ") multiple times!\n";
-            auto prevInt = hashIt->second;
-            std::cerr << "existing interval is [" << prevInt.begin() << ", "
-                      << prevInt.end() << ")\n";
-            for (auto x = prevInt.begin(); x < prevInt.end(); ++x) {
-              auto suff = concatText.substr(SA[x], k);
-              for (auto c : suff) {
-                std::cerr << "*" << c << "*";
-              }
-              std::cerr << " (len = " << suff.length() << ")\n";
-            }
-            std::cerr << "new interval is [" << start << ", " << stop << ")\n";
-            for (auto x = start; x < stop; ++x) {
-              auto suff = concatText.substr(SA[x], k);
-              for (auto c : suff) {
-                std::cerr << "*" << c << "*";
-              }
-              std::cerr << "\n";
+// Build sa.bin and hash.bin bucket by bucket, keeping the resident memory
+// of the process under memoryCapBytes.  This is an in-memory build: the
+// text and the whole k-mer hash stay in memory, and only the suffix array
+// is never held whole.  The suffixes are bucketed by their first few (at
+// most k) characters, and consecutive buckets are grouped into chunks.
+// Whatever of the cap the process already uses (the text included) and
+// the bucket counts leave is split evenly between a chunk (its suffixes
+// and, at worst, one k-mer interval per suffix) and the hash; the bucket
+// prefixes are made short enough for the counts to take at most a
+// sixteenth of it.  Each chunk is gathered with a scan of the text, sorted (its
+// buckets are independent, so they are sorted in parallel), appended to
+// sa.bin and mined for k-mer intervals.  No k-mer interval spans two
+// buckets, so the intervals of each chunk are final when they are found.
+// Nothing is spilled to disk: rather than exceed its share, the build
+// fails if a single bucket doesn't fit in a chunk or if the intervals
+// found so far would take the hash past its share.
+//
+// Each bucket is sorted with std::sort, comparing suffixes with memcmp, so
+// a comparison costs as much as the two suffixes share; the suffixes of a
+// long sequence that occurs in many transcripts (e.g. a shared exon) share
+// most of it, and sorting them costs roughly the square of its length
+// (divsufsort, used without --bucketMemory, has no such case).
+template <typename IndexT>
+bool buildSAAndHashByBuckets(const std::string& outputDir,
+                             const std::string& concatText, uint32_t k,
+                             bool prune, uint64_t memoryCapBytes,
+                             uint32_t numThreads, bool canonical,
+                             uint32_t filterBits) {
+  const int64_t n = static_cast<int64_t>(concatText.length());
+  const unsigned char* text =
+      reinterpret_cast<const unsigned char*>(concatText.data());
+  numThreads = std::max(numThreads, 1u);
+
+  resetPeakResident();
+  const uint64_t residentAtStart = residentBytes();
+  std::cerr << "[info] resident memory before the bucketed build: "
+            << (residentAtStart >> 10) << " kB\n";
+  if (memoryCapBytes <= residentAtStart) {
+    std::cerr << "[fatal] --bucketMemory must be more than the "
+              << ((residentAtStart >> 20) + 1)
+              << " MB the indexer already uses (the text included)\n";
+    return false;
+  }
+
+  // The bucket of a suffix is given by its first prefixLen characters,
+  // coded so that the order of buckets is the order of their suffixes
+  // (0 is "past the end").  Besides the count of each bucket, a chunk
+  // keeps the start of each of its buckets and the next free row in each.
+  uint32_t code[256] = {0};
+  for (int64_t i = 0; i < n; ++i) { code[text[i]] = 1; }
+  uint32_t sigma{0};
+  for (uint32_t c = 0; c < 256; ++c) {
+    if (code[c]) { code[c] = ++sigma; }
+  }
+  uint32_t bits{1};
+  while ((1u << bits) < sigma + 1) { ++bits; }
+  const uint64_t bytesPerBucket = 3 * sizeof(uint64_t);
+  uint32_t prefixLen = std::max(1u, std::min(k, 21 / bits));
+  while (prefixLen > 1 and
+         (uint64_t(1) << (bits * prefixLen)) * bytesPerBucket >
+             (memoryCapBytes - residentAtStart) / 16) {
+    --prefixLen;
+  }
+  const uint64_t numBuckets = uint64_t(1) << (bits * prefixLen);
+
+  // Call fn(i, bucket) for every suffix i that is kept in the SA
+  auto forEachSuffix = [&](std::function<void(int64_t, uint64_t)> fn) {
+    int64_t nextSep{-1};
+    rapmap::utils::detail::forEachKey(
+        text, n, code, bits, prefixLen, 0, n, [&](int64_t i, uint64_t key) {
+          if (prune) {
+            // Skip the suffixes whose first k bases cross a '$'
+            if (nextSep < i) {
+              auto sep = std::memchr(text + i, '$', n - i);
+              nextSep = sep ? static_cast<const unsigned char*>(sep) - text : n;
             }
+            if (nextSep - i < static_cast<int64_t>(k)) { return; }
           }
+          fn(i, key);
+        });
+  };
+
+  // Leave half of whatever the process and the bucket counts don't use to
+  // the hash
+  uint64_t fixedBytes = residentAtStart + numBuckets * bytesPerBucket;
+  if (memoryCapBytes <= fixedBytes) {
+    std::cerr << "[fatal] --bucketMemory must be more than the "
+              << ((fixedBytes >> 20) + 1)
+              << " MB the indexer and the bucket counts would use\n";
+    return false;
+  }
+  std::vector<uint64_t> bucketCounts(numBuckets, 0);
+  forEachSuffix([&](int64_t, uint64_t key) { ++bucketCounts[key]; });
+  uint64_t numSuffixes{0};
+  for (auto c : bucketCounts) { numSuffixes += c; }
+
+  uint64_t hashBytes = (memoryCapBytes - fixedBytes) / 2;
+  uint64_t chunkBytes = (memoryCapBytes - fixedBytes) - hashBytes;
+  uint64_t chunkSuffixes = std::max(
+      uint64_t(1),
+      chunkBytes / (sizeof(IndexT) + sizeof(typename KmerIntervals<IndexT>::value_type)));
+
+  std::ofstream saStream(outputDir + "sa.bin", std::ios::binary);
+  // The SA is written as cereal writes a vector: its length, then its
+  // elements
+  uint64_t saSize = numSuffixes;
+  saStream.write(reinterpret_cast<const char*>(&saSize), sizeof(saSize));
+
+  KmerHashT<IndexT> khash;
+  std::vector<IndexT> chunk;
+  std::vector<uint64_t> bucketStart;
+  uint64_t rowOffset{0};
+  uint64_t firstBucket{0};
+  uint32_t numChunks{0};
+  ScopedTimer timer;
+  while (firstBucket < numBuckets) {
+    // Group as many buckets as fit in the chunk
+    uint64_t lastBucket = firstBucket;
+    uint64_t chunkSize{0};
+    while (lastBucket < numBuckets and
+           (chunkSize == 0 or chunkSize + bucketCounts[lastBucket] <= chunkSuffixes)) {
+      chunkSize += bucketCounts[lastBucket];
+      ++lastBucket;
+    }
+    if (chunkSize > chunkSuffixes) {
+      std::cerr << "\n[fatal] a single bucket of " << chunkSize
+                << " suffixes doesn't fit in the " << (chunkBytes >> 20)
+                << " MB that --bucketMemory leaves to each chunk\n";
+      return false;
+    }
+    ++numChunks;
+    std::cerr << "\r\rsorting chunk " << numChunks << " (rows " << rowOffset
+              << " to " << rowOffset + chunkSize << " of " << numSuffixes << ")";
+
+    // Gather the suffixes of the chunk, in bucket order
+    chunk.assign(chunkSize, 0);
+    bucketStart.assign(lastBucket - firstBucket + 1, 0);
+    for (uint64_t b = firstBucket; b < lastBucket; ++b) {
+      bucketStart[b - firstBucket + 1] = bucketStart[b - firstBucket] + bucketCounts[b];
+    }
+    {
+      std::vector<uint64_t> next(bucketStart.begin(), bucketStart.end() - 1);
+      forEachSuffix([&](int64_t i, uint64_t key) {
+        if (key >= firstBucket and key < lastBucket) {
+          chunk[next[key - firstBucket]++] = static_cast<IndexT>(i);
         }
-        currentKmer = nextKmer;
-        start = stop;
-      }
-    } else {
-      // If this isn't a valid suffix (contains a $)
-
-      // If the previous interval was valid, put it
-      // in the hash.
-      if (currentKmer.length() == k and
-          currentKmer.find_first_of('$') == std::string::npos) {
-        mer = currentKmer.c_str();
-        auto bits = mer.word(0);
-        auto hashIt = khash.find(bits);
-        if (hashIt == khash.end()) {
-          if (start > 2) {
-            if (concatText.substr(SA[start - 1], k) ==
-                concatText.substr(SA[start], k)) {
-              std::cerr << "T[SA[" << start - 1 << "]:" << k
-                        << "] = " << concatText.substr(SA[start - 1], k)
-                        << " = T[SA[" << start << "]:" << k << "]\n";
-              std::cerr << "start = " << start << ", stop = " << stop << "\n";
-              std::cerr << "[fatal (4)] THIS SHOULD NOT HAPPEN\n";
-              std::exit(1);
-            }
-          }
-          khash[bits] = {start, stop};
-          /*
-          IndexT len = stop - start;
-          bool overflow = (len >= std::numeric_limits<uint8_t>::max());
-          uint8_t blen = overflow ? std::numeric_limits<uint8_t>::max() :
-              static_cast<uint8_t>(len);
-          khash[bits] = {start, blen};
-          if (overflow) {
-              overflowhash[bits] = len;
-          }
-          */
-        } else {
-          std::cerr << "\nERROR (2): trying to add same suffix " << currentKmer
-                    << "multiple times!\n";
-          auto prevInt = hashIt->second;
-          std::cerr << "existing interval is [" << prevInt.begin() << ", "
-                    << prevInt.end() << ")\n";
-          for (auto x = prevInt.begin(); x < prevInt.end(); ++x) {
-            std::cerr << concatText.substr(SA[x], k) << "\n";
-          }
-          std::cerr << "new interval is [" << start << ", " << stop << ")\n";
-          for (auto x = start; x < stop; ++x) {
-            std::cerr << concatText.substr(SA[x], k) << "\n";
-          }
+      });
+    }
+
+    // Sort each bucket by the rest of its suffixes
+    auto suffixLess = [text, n, prefixLen](IndexT a, IndexT b) -> bool {
+      int64_t i = std::min(static_cast<int64_t>(a) + prefixLen, n);
+      int64_t j = std::min(static_cast<int64_t>(b) + prefixLen, n);
+      int64_t len = std::min(n - i, n - j);
+      int c = std::memcmp(text + i, text + j, len);
+      return (c != 0) ? (c < 0) : (n - i < n - j);
+    };
+    std::atomic<uint64_t> nextBucket{0};
+    auto sortBuckets = [&]() {
+      uint64_t b;
+      while ((b = nextBucket++) < lastBucket - firstBucket) {
+        if (bucketStart[b + 1] - bucketStart[b] > 1) {
+          std::sort(chunk.begin() + bucketStart[b],
+                    chunk.begin() + bucketStart[b + 1], suffixLess);
         }
       }
-      // The current interval is invalid and empty
-      currentKmer = nextKmer;
-      start = stop;
-    }
-    if (stop % 1000000 == 0) {
-      std::cerr << "\r\rprocessed " << stop << " positions";
-    }
-    // We always update the end position
-    ++stop;
-  }
-  if (start < tlen) {
-    if (currentKmer.length() == k and
-        currentKmer.find_first_of('$') != std::string::npos) {
-      mer = currentKmer.c_str();
-      khash[mer.word(0)] = {start, stop};
-      /*
-      IndexT len = stop - start;
-      bool overflow = (len >= std::numeric_limits<uint8_t>::max());
-      uint8_t blen = overflow ? std::numeric_limits<uint8_t>::max() :
-          static_cast<uint8_t>(len);
-      khash[mer.get_bits(0, 2 * k)] = {start, blen};
-      if (overflow) {
-          overflowhash[mer.get_bits(0, 2 * k)] = len;
-      }
-      */
+    };
+    std::vector<std::thread> sorters;
+    for (uint32_t t = 1; t < numThreads; ++t) { sorters.emplace_back(sortBuckets); }
+    sortBuckets();
+    for (auto& t : sorters) { t.join(); }
+
+    saStream.write(reinterpret_cast<const char*>(chunk.data()),
+                   chunk.size() * sizeof(IndexT));
+    auto kmerIntervals = collectKmerIntervals(
+        concatText, k, chunk.data(), static_cast<int64_t>(chunk.size()),
+        static_cast<int64_t>(rowOffset), numThreads, false);
+    uint64_t numEntries = khash.size();
+    for (auto& ivs : kmerIntervals) { numEntries += ivs.size(); }
+    uint64_t estHashBytes = estimateKmerHashBytes(khash, numEntries, filterBits);
+    if (estHashBytes > hashBytes) {
+      std::cerr << "\n[fatal] after " << rowOffset + chunkSize << " of "
+                << numSuffixes << " rows, the k-mer hash would take about "
+                << (estHashBytes >> 20) << " MB, more than the "
+                << (hashBytes >> 20) << " MB that --bucketMemory leaves to it\n";
+      return false;
     }
+    addKmerIntervals(kmerIntervals, khash);
+
+    rowOffset += chunkSize;
+    firstBucket = lastBucket;
   }
-  std::cerr << "\nkhash had " << khash.size() << " keys\n";
-  std::ofstream hashStream(outputDir + "hash.bin", std::ios::binary);
-  {
-    ScopedTimer timer;
-    std::cerr << "saving hash to disk . . . ";
-    khash.serialize(typename spp_utils::pod_hash_serializer<WordT, rapmap::utils::SAInterval<IndexT>>(),
-                    &hashStream);
-    std::cerr << "done\n";
+  std::cerr << "\nwrote the suffix array (" << numSuffixes << " rows) in "
+            << numChunks << " chunks\n";
+  bool success = static_cast<bool>(saStream);
+  saStream.close();
+  std::vector<IndexT>().swap(chunk);
+  if (!success) {
+    std::cerr << "[fatal] Could not write sa.bin\n";
+    return false;
   }
-  hashStream.close();
+  if (canonical) { canonicalizeKmerHash(khash, k); }
+  if (filterBits > 0 and !writeKmerFilter(outputDir, khash, k, filterBits)) {
+    return false;
+  }
+  if (!saveKmerHash(outputDir, khash)) { return false; }
+  std::cerr << "[info] peak resident memory while building: "
+            << (peakResidentBytes() >> 10) << " kB (the cap is "
+            << (memoryCapBytes >> 10) << " kB)\n";
   return true;
 }
 
+// Build the FM-index of the reversed text (fm.bin) and the hash of its
+// k-mer intervals (keyed by the k-mers of the forward text)
+template <typename IndexT>
+bool buildFMIndex(const std::string& outputDir, std::string& concatText,
+                  size_t tlen, uint32_t k, uint32_t sampleRate,
+                  uint32_t numThreads, uint32_t numSortThreads) {
+  std::string rtext(concatText.rbegin(), concatText.rend());
+  std::vector<IndexT> SA;
+  if (!buildSA(outputDir, rtext, SA, false, 0, numSortThreads)) {
+    return false;
+  }
+  if (!buildHash<IndexT>(outputDir, rtext, tlen, k, SA, numThreads, true)) {
+    return false;
+  }
+
+  ScopedTimer timer;
+  std::cerr << "Building FM-index (SA sample rate " << sampleRate
+            << ") and saving to disk . . . ";
+  rapmap::utils::FMIndex<IndexT> fm;
+  fm.build(rtext, SA, sampleRate);
+  std::ofstream fmStream(outputDir + "fm.bin", std::ios::binary);
+  {
+    cereal::BinaryOutputArchive fmArchive(fmStream);
+    fmArchive(fm);
+  }
+  bool success = static_cast<bool>(fmStream);
+  fmStream.close();
+  std::cerr << "done (" << fm.bytes() << " bytes)\n";
+  return success;
+}
+
+// Build the LCP array of SA and write it to lcp.bin, and write the LCP-LR
+// arrays and the range-minimum structure over the LCP array that the
+// searcher uses to lcplr.bin and lcprmq.bin (and, if childTable is true,
+// the child table to cld.bin)
+template <typename IndexT>
+bool buildLCP(const std::string& outputDir, const std::string& concatText,
+              const std::vector<IndexT>& SA, uint32_t k, bool childTable) {
+  ScopedTimer timer;
+  std::cerr << "Building LCP array and saving to disk . . . ";
+  std::vector<IndexT> lcp;
+  rapmap::utils::buildLCPArray(concatText, SA, lcp);
+  std::vector<uint16_t> llcp, rlcp;
+  rapmap::utils::buildLCPLR(lcp, k, llcp, rlcp);
+
+  std::ofstream lcpStream(outputDir + "lcp.bin", std::ios::binary);
+  {
+    cereal::BinaryOutputArchive lcpArchive(lcpStream);
+    lcpArchive(lcp);
+  }
+  bool success = static_cast<bool>(lcpStream);
+  lcpStream.close();
+
+  std::ofstream lcpLRStream(outputDir + "lcplr.bin", std::ios::binary);
+  {
+    cereal::BinaryOutputArchive lcpLRArchive(lcpLRStream);
+    lcpLRArchive(llcp, rlcp);
+  }
+  success = success and static_cast<bool>(lcpLRStream);
+  lcpLRStream.close();
+
+  rapmap::utils::LCPRangeMin lcpRMQ;
+  lcpRMQ.build(lcp);
+  std::ofstream rmqStream(outputDir + "lcprmq.bin", std::ios::binary);
+  {
+    cereal::BinaryOutputArchive rmqArchive(rmqStream);
+    rmqArchive(lcpRMQ);
+  }
+  success = success and static_cast<bool>(rmqStream);
+  rmqStream.close();
+
+  if (childTable) {
+    std::vector<IndexT> cld;
+    rapmap::utils::buildChildTable(lcp, cld);
+    std::ofstream cldStream(outputDir + "cld.bin", std::ios::binary);
+    {
+      cereal::BinaryOutputArchive cldArchive(cldStream);
+      cldArchive(cld);
+    }
+    success = success and static_cast<bool>(cldStream);
+    cldStream.close();
+  }
+  std::cerr << "done\n";
+  return success;
+}
+
+// Write the fingerprint of each row of SA (see SuffixFingerprints.hpp) to
+// fp.bin
+template <typename IndexT>
+bool writeFingerprints(const std::string& outputDir, const std::string& concatText,
+                       const std::vector<IndexT>& SA, uint32_t k) {
+  ScopedTimer timer;
+  std::cerr << "Building suffix fingerprints and saving to disk . . . ";
+  std::vector<uint64_t> fp;
+  rapmap::utils::SuffixFingerprints::build(concatText, SA, k, fp);
+  std::ofstream fpStream(outputDir + "fp.bin", std::ios::binary);
+  {
+    cereal::BinaryOutputArchive fpArchive(fpStream);
+    fpArchive(fp);
+  }
+  bool success = static_cast<bool>(fpStream);
+  fpStream.close();
+  std::cerr << "done\n";
+  return success;
+}
+
+// Sample the k-mer intervals of SA of at least minRows rows (see
+// SampledSearchTree.hpp) and write the samples to sampled.bin
+template <typename IndexT>
+bool writeSampledSearch(const std::string& outputDir, const std::string& concatText,
+                        const std::vector<IndexT>& SA, uint32_t k,
+                        uint64_t minRows, uint32_t numThreads) {
+  ScopedTimer timer;
+  std::cerr << "Sampling large k-mer intervals and saving to disk . . . ";
+  std::vector<std::pair<uint64_t, uint64_t>> intervals;
+  for (auto& ivs : collectKmerIntervals(concatText, k, SA, numThreads, false)) {
+    for (auto& iv : ivs) {
+      intervals.emplace_back(iv.second.begin(), iv.second.end());
+    }
+  }
+  rapmap::utils::SampledSearchTree tree;
+  tree.build(concatText, SA, k, std::move(intervals), minRows);
+  std::ofstream sampleStream(outputDir + "sampled.bin", std::ios::binary);
+  {
+    cereal::BinaryOutputArchive sampleArchive(sampleStream);
+    sampleArchive(tree);
+  }
+  bool success = static_cast<bool>(sampleStream);
+  sampleStream.close();
+  std::cerr << "done (" << tree.bytes() << " bytes)\n";
+  return success;
+}
+
+// Write the image of the bit-packed suffix array (a cereal-serialized
+// vector of words) to saPacked.bin
+template <typename IndexT>
+bool writePackedSA(const std::string& outputDir, std::vector<IndexT>& SA) {
+  ScopedTimer timer;
+  std::cerr << "Packing suffix array and saving to disk . . . ";
+  auto image = rapmap::utils::PackedSA<IndexT>::pack(SA);
+  std::ofstream saStream(outputDir + "saPacked.bin", std::ios::binary);
+  {
+    cereal::BinaryOutputArchive saArchive(saStream);
+    saArchive(image);
+  }
+  bool success = static_cast<bool>(saStream);
+  saStream.close();
+  std::cerr << "done (" << image[1] << " bits per entry)\n";
+  return success;
+}
+
+// Write the SA, text, transcript information and boundary bit vector
+// as a single, page-aligned flat file that can be mapped in place.
+template <typename IndexT>
+bool writeFlatIndex(const std::string& outputDir, std::vector<IndexT>& SA,
+                    std::string& concatText,
+                    std::vector<int64_t>& transcriptStarts,
+                    std::vector<uint32_t>& completeLengths,
+                    std::vector<std::string>& transcriptNames,
+                    BIT_ARRAY* bitArray, bool packedText, bool packedSA) {
+  using rapmap::flat::FlatSectionID;
+  ScopedTimer timer;
+  std::cerr << "Writing flat index to disk . . . ";
+
+  size_t numTxps = transcriptStarts.size();
+  int64_t tlen = static_cast<int64_t>(concatText.length());
+  std::vector<IndexT> txpStarts(numTxps, 0);
+  std::vector<IndexT> txpLens(numTxps, 0);
+  for (size_t i = 0; i < numTxps; ++i) {
+    int64_t nextStart = (i + 1 < numTxps) ? transcriptStarts[i + 1] : tlen;
+    txpStarts[i] = static_cast<IndexT>(transcriptStarts[i]);
+    // don't count the '$' separator
+    txpLens[i] = static_cast<IndexT>((nextStart - 1) - transcriptStarts[i]);
+  }
+  std::vector<char> names = rapmap::flat::packNames(transcriptNames);
+  std::vector<uint64_t> packedWords;
+  std::vector<uint64_t> packedSAImage;
+
+  rapmap::flat::FlatIndexWriter writer(sizeof(IndexT));
+  if (packedSA) {
+    packedSAImage = rapmap::utils::PackedSA<IndexT>::pack(SA);
+    writer.addSection(FlatSectionID::PACKED_SA, packedSAImage.data(),
+                      sizeof(uint64_t), packedSAImage.size());
+  } else {
+    writer.addSection(FlatSectionID::SA, SA.data(), sizeof(IndexT), SA.size());
+  }
+  if (packedText) {
+    packedWords = rapmap::utils::PackedText::pack(concatText);
+    writer.addSection(FlatSectionID::PACKED_TEXT, packedWords.data(),
+                      sizeof(uint64_t), packedWords.size());
+  } else {
+    writer.addSection(FlatSectionID::TEXT, concatText.data(), sizeof(char),
+                      concatText.length());
+  }
+  writer.addSection(FlatSectionID::TXP_OFFSETS, txpStarts.data(),
+                    sizeof(IndexT), txpStarts.size());
+  writer.addSection(FlatSectionID::TXP_LENS, txpLens.data(), sizeof(IndexT),
+                    txpLens.size());
+  writer.addSection(FlatSectionID::TXP_COMPLETE_LENS, completeLengths.data(),
+                    sizeof(uint32_t), completeLengths.size());
+  writer.addSection(FlatSectionID::BOUNDARY_BITS, bitArray->words,
+                    sizeof(uint64_t), bitArray->num_of_words);
+  writer.addSection(FlatSectionID::TXP_NAMES, names.data(), sizeof(char),
+                    names.size());
+
+  bool success = writer.write(outputDir + rapmap::flat::kFlatFileName);
+  std::cerr << (success ? "done\n" : "FAILED\n");
+  return success;
+}
+
 // To use the parser in the following, we get "jobs" until none is
 // available. A job behaves like a pointer to the type
 // jellyfish::sequence_list (see whole_sequence_parser.hpp).
 template <typename ParserT> //, typename CoverageCalculator>
 void indexTranscriptsSA(ParserT* parser,
                         std::string& outputDir,
-                        bool noClipPolyA, bool usePerfectHash,
-                        uint32_t numHashThreads,
-                        std::string& sepStr,
+                        IndexOpts& opts,
                         std::mutex& iomutex,
                         std::shared_ptr<spdlog::logger> log) {
+  bool noClipPolyA = opts.noClipPolyA;
+  bool usePerfectHash = opts.usePerfectHash;
+  uint32_t numHashThreads = opts.numHashThreads;
+  // divsufsort builds the suffix array unless --parallelSA is given
+  uint32_t numSortThreads = opts.parallelSA ? numHashThreads : 1;
+  std::string& sepStr = opts.sepStr;
+
   // Create a random uniform distribution
   std::default_random_engine eng(271828);
 
@@ -488,8 +1064,9 @@ void indexTranscriptsSA(ParserT* parser,
       onePos; // Positions in the bit array where we should write a '1'
   // remember the initial lengths (e.g., before clipping etc., of all transcripts)
   std::vector<uint32_t> completeLengths;
-  // the stream of transcript sequence
-  fmt::MemoryWriter txpSeqStream;
+  // the concatenated transcript sequence (built in place, rather than
+  // copied out of a stream, so it is only ever held once)
+  std::string concatText;
   {
     ScopedTimer timer;
     // Get the read group by which this thread will
@@ -570,8 +1147,8 @@ void indexTranscriptsSA(ParserT* parser,
           // The un-molested length of this transcript
           completeLengths.push_back(completeLen);
 
-          txpSeqStream << readStr;
-          txpSeqStream << '$';
+          concatText += readStr;
+          concatText += '$';
           currIndex += readLen + 1;
           onePos.push_back(currIndex - 1);
         } else {
@@ -592,15 +1169,12 @@ void indexTranscriptsSA(ParserT* parser,
   std::cerr << "Clipped poly-A tails from " << numPolyAsClipped
             << " transcripts\n";
 
-  // Put the concatenated text in a string
-  std::string concatText = txpSeqStream.str();
-  // And clear the stream
-  txpSeqStream.clear();
 
   // Build the suffix array
   size_t tlen = concatText.length();
   size_t maxInt = std::numeric_limits<int32_t>::max();
-  bool largeIndex = (tlen + 1 > maxInt);
+  // A packed suffix array is always addressed with 64-bit offsets
+  bool largeIndex = (tlen + 1 > maxInt) or opts.packedSA;
 
   // Make our dense bit arrray
   BIT_ARRAY* bitArray = bit_array_create(concatText.length());
@@ -611,81 +1185,172 @@ void indexTranscriptsSA(ParserT* parser,
   onePos.clear();
   onePos.shrink_to_fit();
 
-  std::string rsFileName = outputDir + "rsd.bin";
-  FILE* rsFile = fopen(rsFileName.c_str(), "w");
-  {
-    ScopedTimer timer;
-    std::cerr << "Building rank-select dictionary and saving to disk ";
-    bit_array_save(bitArray, rsFile);
-    std::cerr << "done\n";
-  }
-  fclose(rsFile);
-  bit_array_free(bitArray);
+  // In the flat layout, everything is written together once the
+  // suffix array has been built.
+  if (!opts.flatLayout) {
+    std::string rsFileName = outputDir + "rsd.bin";
+    FILE* rsFile = fopen(rsFileName.c_str(), "w");
+    {
+      ScopedTimer timer;
+      std::cerr << "Building rank-select dictionary and saving to disk ";
+      bit_array_save(bitArray, rsFile);
+      std::cerr << "done\n";
+    }
+    fclose(rsFile);
+    bit_array_free(bitArray);
+    bitArray = nullptr;
+
+    std::ofstream seqStream(outputDir + "txpInfo.bin", std::ios::binary);
+    {
+      ScopedTimer timer;
+      std::cerr << "Writing sequence data to file . . . ";
+      cereal::BinaryOutputArchive seqArchive(seqStream);
+      seqArchive(transcriptNames);
+      if (largeIndex) {
+        seqArchive(transcriptStarts);
+      } else {
+        std::vector<int32_t> txpStarts(transcriptStarts.size(), 0);
+        size_t numTranscriptStarts = transcriptStarts.size();
+        for (size_t i = 0; i < numTranscriptStarts; ++i) {
+          txpStarts[i] = static_cast<int32_t>(transcriptStarts[i]);
+        }
+        transcriptStarts.clear();
+        transcriptStarts.shrink_to_fit();
+        { seqArchive(txpStarts); }
+      }
+      // seqArchive(positionIDs);
+      // A packed text is written separately (below), and an FM-index
+      // replaces the text, in which case the text stored here is empty.
+      if (opts.packedText or opts.fmIndex) {
+        seqArchive(std::string());
+      } else {
+        seqArchive(concatText);
+      }
+      seqArchive(completeLengths);
+      std::cerr << "done\n";
+    }
+    seqStream.close();
 
-  std::ofstream seqStream(outputDir + "txpInfo.bin", std::ios::binary);
-  {
-    ScopedTimer timer;
-    std::cerr << "Writing sequence data to file . . . ";
-    cereal::BinaryOutputArchive seqArchive(seqStream);
-    seqArchive(transcriptNames);
-    if (largeIndex) {
-      seqArchive(transcriptStarts);
-    } else {
-      std::vector<int32_t> txpStarts(transcriptStarts.size(), 0);
-      size_t numTranscriptStarts = transcriptStarts.size();
-      for (size_t i = 0; i < numTranscriptStarts; ++i) {
-        txpStarts[i] = static_cast<int32_t>(transcriptStarts[i]);
+    if (opts.packedText) {
+      ScopedTimer timer;
+      std::cerr << "Writing packed text to file . . . ";
+      std::ofstream packedStream(outputDir + "text2bit.bin", std::ios::binary);
+      {
+        cereal::BinaryOutputArchive packedArchive(packedStream);
+        uint64_t textLen = concatText.length();
+        packedArchive(textLen);
+        packedArchive(rapmap::utils::PackedText::pack(concatText));
       }
-      transcriptStarts.clear();
-      transcriptStarts.shrink_to_fit();
-      { seqArchive(txpStarts); }
+      packedStream.close();
+      std::cerr << "done\n";
     }
-    // seqArchive(positionIDs);
-    seqArchive(concatText);
-    seqArchive(completeLengths);
-    std::cerr << "done\n";
-  }
-  seqStream.close();
 
-  // clear stuff we no longer need
-  // positionIDs.clear();
-  // positionIDs.shrink_to_fit();
-  transcriptStarts.clear();
-  transcriptStarts.shrink_to_fit();
-  transcriptNames.clear();
-  transcriptNames.shrink_to_fit();
-  // done clearing
+    // clear stuff we no longer need
+    // positionIDs.clear();
+    // positionIDs.shrink_to_fit();
+    transcriptStarts.clear();
+    transcriptStarts.shrink_to_fit();
+    transcriptNames.clear();
+    transcriptNames.shrink_to_fit();
+    // done clearing
+  }
 
-  if (largeIndex) {
+  if (opts.fmIndex) {
+    std::cerr << "[info] Building " << (largeIndex ? 64 : 32)
+              << "-bit FM-index (length of generalized text is " << tlen
+              << ")\n";
+    bool success = largeIndex
+        ? buildFMIndex<int64_t>(outputDir, concatText, tlen, k, opts.fmSampleRate,
+                                numHashThreads, numSortThreads)
+        : buildFMIndex<int32_t>(outputDir, concatText, tlen, k, opts.fmSampleRate,
+                                numHashThreads, numSortThreads);
+    if (!success) {
+      std::cerr << "[fatal] Could not build the FM-index!\n";
+      std::exit(1);
+    }
+  } else if (opts.bucketMemoryMB > 0) {
+    std::cerr << "[info] Building " << (largeIndex ? 64 : 32)
+              << "-bit suffix array bucket by bucket in at most "
+              << opts.bucketMemoryMB << " MB (length of generalized text is "
+              << tlen << ")\n";
+    uint64_t memoryCapBytes = opts.bucketMemoryMB << 20;
+    bool success = largeIndex
+        ? buildSAAndHashByBuckets<int64_t>(outputDir, concatText, k, opts.pruneSA,
+                                           memoryCapBytes, numHashThreads,
+                                           opts.canonicalHash, opts.filterBits)
+        : buildSAAndHashByBuckets<int32_t>(outputDir, concatText, k, opts.pruneSA,
+                                           memoryCapBytes, numHashThreads,
+                                           opts.canonicalHash, opts.filterBits);
+    if (!success) {
+      std::cerr << "[fatal] Could not build the suffix array and hash!\n";
+      std::exit(1);
+    }
+  } else if (largeIndex) {
     largeIndex = true;
     std::cerr << "[info] Building 64-bit suffix array "
                  "(length of generalized text is "
               << tlen << " )\n";
     using IndexT = int64_t;
     std::vector<IndexT> SA;
-    bool success = buildSA(outputDir, concatText, tlen, SA);
+    bool success = buildSA(outputDir, concatText, SA,
+                           !opts.flatLayout and !opts.packedSA,
+                           opts.pruneSA ? k : 0, numSortThreads);
     if (!success) {
       std::cerr << "[fatal] Could not build the suffix array!\n";
       std::exit(1);
     }
+    if (opts.packedSA and !opts.flatLayout) {
+      success = writePackedSA(outputDir, SA);
+      if (!success) {
+        std::cerr << "[fatal] Could not write the packed suffix array!\n";
+        std::exit(1);
+      }
+    }
 
     if (usePerfectHash) {
       success = buildPerfectHash<IndexT>(outputDir, concatText, tlen, k, SA,
-                                         numHashThreads);
+                                         numHashThreads, opts.filterBits);
     } else {
-      success = buildHash<IndexT>(outputDir, concatText, tlen, k, SA);
+      success = buildHash<IndexT>(outputDir, concatText, tlen, k, SA,
+                                  numHashThreads, false, opts.canonicalHash,
+                                  opts.filterBits);
     }
     if (!success) {
       std::cerr << "[fatal] Could not build the suffix interval hash!\n";
       std::exit(1);
     }
+    if (opts.lcp and !buildLCP<IndexT>(outputDir, concatText, SA, k, opts.childTable)) {
+      std::cerr << "[fatal] Could not write the LCP array!\n";
+      std::exit(1);
+    }
+    if (opts.fingerprints and !writeFingerprints<IndexT>(outputDir, concatText, SA, k)) {
+      std::cerr << "[fatal] Could not write the suffix fingerprints!\n";
+      std::exit(1);
+    }
+    if (opts.sampledSearchRows > 0 and
+        !writeSampledSearch<IndexT>(outputDir, concatText, SA, k,
+                                    opts.sampledSearchRows, numHashThreads)) {
+      std::cerr << "[fatal] Could not write the interval samples!\n";
+      std::exit(1);
+    }
+    if (opts.flatLayout) {
+      success = writeFlatIndex<IndexT>(outputDir, SA, concatText,
+                                       transcriptStarts, completeLengths,
+                                       transcriptNames, bitArray,
+                                       opts.packedText, opts.packedSA);
+      if (!success) {
+        std::cerr << "[fatal] Could not write the flat index!\n";
+        std::exit(1);
+      }
+    }
   } else {
     std::cerr << "[info] Building 32-bit suffix array "
                  "(length of generalized text is "
               << tlen << ")\n";
     using IndexT = int32_t;
     std::vector<IndexT> SA;
-    bool success = buildSA(outputDir, concatText, tlen, SA);
+    bool success = buildSA(outputDir, concatText, SA, !opts.flatLayout,
+                           opts.pruneSA ? k : 0, numSortThreads);
     if (!success) {
       std::cerr << "[fatal] Could not build the suffix array!\n";
       std::exit(1);
@@ -693,14 +1358,45 @@ void indexTranscriptsSA(ParserT* parser,
 
     if (usePerfectHash) {
       success = buildPerfectHash<IndexT>(outputDir, concatText, tlen, k, SA,
-                                         numHashThreads);
+                                         numHashThreads, opts.filterBits);
     } else {
-      success = buildHash<IndexT>(outputDir, concatText, tlen, k, SA);
+      success = buildHash<IndexT>(outputDir, concatText, tlen, k, SA,
+                                  numHashThreads, false, opts.canonicalHash,
+                                  opts.filterBits);
     }
     if (!success) {
       std::cerr << "[fatal] Could not build the suffix interval hash!\n";
       std::exit(1);
     }
+    if (opts.lcp and !buildLCP<IndexT>(outputDir, concatText, SA, k, opts.childTable)) {
+      std::cerr << "[fatal] Could not write the LCP array!\n";
+      std::exit(1);
+    }
+    if (opts.fingerprints and !writeFingerprints<IndexT>(outputDir, concatText, SA, k)) {
+      std::cerr << "[fatal] Could not write the suffix fingerprints!\n";
+      std::exit(1);
+    }
+    if (opts.sampledSearchRows > 0 and
+        !writeSampledSearch<IndexT>(outputDir, concatText, SA, k,
+                                    opts.sampledSearchRows, numHashThreads)) {
+      std::cerr << "[fatal] Could not write the interval samples!\n";
+      std::exit(1);
+    }
+    if (opts.flatLayout) {
+      success = writeFlatIndex<IndexT>(outputDir, SA, concatText,
+                                       transcriptStarts, completeLengths,
+                                       transcriptNames, bitArray,
+                                       opts.packedText, opts.packedSA);
+      if (!success) {
+        std::cerr << "[fatal] Could not write the flat index!\n";
+        std::exit(1);
+      }
+    }
+  }
+
+  if (bitArray != nullptr) {
+    bit_array_free(bitArray);
+    bitArray = nullptr;
   }
 
   seqHasher.finish();
@@ -711,6 +1407,18 @@ void indexTranscriptsSA(ParserT* parser,
                      indexVersion,
                      true, k, largeIndex,
                      usePerfectHash);
+  header.setFlatLayout(opts.flatLayout, rapmap::flat::kFlatLayoutVersion);
+  header.setPackedText(opts.packedText);
+  header.setPackedSA(opts.packedSA);
+  header.setFMIndex(opts.fmIndex);
+  header.setPrunedSA(opts.pruneSA);
+  header.setLCP(opts.lcp);
+  header.setLCPRMQ(opts.lcp);
+  header.setChildTable(opts.childTable);
+  header.setFingerprints(opts.fingerprints);
+  header.setSampledSearch(opts.sampledSearchRows > 0);
+  header.setCanonicalHash(opts.canonicalHash);
+  header.setKmerFilter(opts.filterBits > 0);
   // Set the hash info
   std::string seqHash;
   std::string nameHash;
@@ -763,8 +1471,20 @@ int rapMapSAIndex(int argc, char* argv[]) {
   */
   TCLAP::ValueArg<uint32_t> numHashThreads(
       "x", "numThreads",
-      "Use this many threads to build the perfect hash function", false, 4,
+      "Use this many threads to build the perfect hash function (and the "
+      "suffix array, with --parallelSA)", false, 4,
       "positive integer <= # cores");
+  TCLAP::SwitchArg parallelSA(
+      "", "parallelSA", "Sort the suffix array with a parallel prefix-doubling "
+                        "sort on the -x threads rather than with divsufsort "
+                        "(faster on several cores, but needs more memory, "
+                        "and can be slower on very repetitive transcriptomes)",
+      false);
+  TCLAP::SwitchArg flatLayout(
+      "", "flat", "Store the suffix array, text and transcript information in a "
+                  "single, page-aligned file (flat.bin) that the mapper can mmap "
+                  "and share between processes",
+      false);
   cmd.add(transcripts);
   cmd.add(index);
   cmd.add(kval);
@@ -772,6 +1492,94 @@ int rapMapSAIndex(int argc, char* argv[]) {
   cmd.add(perfectHash);
   cmd.add(customSeps);
   cmd.add(numHashThreads);
+  cmd.add(parallelSA);
+  TCLAP::SwitchArg packedText(
+      "", "packedText", "Store the reference text 2-bit packed (using 4x less "
+                        "memory for the text)",
+      false);
+  TCLAP::SwitchArg packedSA(
+      "", "packedSA", "Store each suffix array entry with only as many bits as "
+                      "are needed to address the text (implies 64-bit offsets)",
+      false);
+  TCLAP::SwitchArg fmIndex(
+      "", "fm", "Build an FM-index with a sampled suffix array in place of the "
+                "suffix array and text (a much smaller index that is somewhat "
+                "slower to map against); requires the regular hash (no -p)",
+      false);
+  TCLAP::ValueArg<uint32_t> fmSampleRate(
+      "", "fmSampleRate", "Sample one in this many suffix array entries in the "
+                          "FM-index (larger is smaller, but slower)",
+      false, 16, "positive integer");
+  cmd.add(flatLayout);
+  cmd.add(packedText);
+  cmd.add(packedSA);
+  TCLAP::SwitchArg pruneSA(
+      "", "pruneSA", "Leave the suffixes that start on a transcript boundary, "
+                     "or whose first k bases cross one, out of the suffix array "
+                     "(they are never used in mapping)",
+      false);
+  TCLAP::ValueArg<uint64_t> bucketMemory(
+      "", "bucketMemory", "Build the suffix array in memory, a group of "
+                          "buckets (suffixes with the same first few bases) "
+                          "at a time, so that the whole array is never held, "
+                          "and keep the indexer under this many megabytes of "
+                          "resident memory while building it and the k-mer "
+                          "hash.  The text and the whole hash are still held, "
+                          "and nothing is spilled to disk: indexing fails if "
+                          "a bucket or the (estimated) hash doesn't fit.  "
+                          "Sorting is slower than without it on long repeats.  "
+                          "Only for the regular hash and the default layout",
+      false, 0, "megabytes");
+  cmd.add(fmIndex);
+  cmd.add(fmSampleRate);
+  cmd.add(pruneSA);
+  TCLAP::SwitchArg lcp(
+      "", "lcp", "Also build the LCP array (lcp.bin), the LCP-LR arrays "
+                 "(lcplr.bin) with which the mapper extends matches without "
+                 "re-comparing bases, and a range-minimum structure over the "
+                 "LCP array (lcprmq.bin) that answers its LCE queries in "
+                 "constant time (together, about 6 more bytes per suffix "
+                 "when mapping)",
+      false);
+  TCLAP::SwitchArg childTable(
+      "", "childTable", "Also build the child table of the enhanced suffix "
+                        "array (cld.bin), with which the mapper narrows a "
+                        "k-mer's interval in time proportional to the length "
+                        "of the match, rather than to the log of the interval "
+                        "size (implies --lcp)",
+      false);
+  TCLAP::SwitchArg fingerprints(
+      "", "fingerprints", "Also write, for every suffix, the 28 bases that "
+                          "follow its first k (fp.bin, 8 more bytes per "
+                          "suffix), so that most comparisons made while "
+                          "mapping read neither the suffix array nor the text",
+      false);
+  cmd.add(bucketMemory);
+  cmd.add(lcp);
+  cmd.add(childTable);
+  TCLAP::ValueArg<uint32_t> sampledSearch(
+      "", "sampledSearch", "Also sample every 16th suffix of each k-mer "
+                           "interval of at least this many rows (sampled.bin), "
+                           "so that the mapper narrows such intervals from a "
+                           "small, cache-resident search tree before it probes "
+                           "the suffix array (0 disables)",
+      false, 0, "rows");
+  cmd.add(fingerprints);
+  cmd.add(sampledSearch);
+  TCLAP::SwitchArg canonical(
+      "", "canonical", "Key the hash on canonical k-mers, so that the mapper "
+                       "finds a k-mer and its reverse complement with a "
+                       "single lookup; requires the regular hash (no -p)",
+      false);
+  cmd.add(canonical);
+  TCLAP::ValueArg<uint32_t> filterBits(
+      "", "filterBits", "Also write a Bloom filter over the k-mers of the hash "
+                        "(filter.bin) with this many bits per k-mer, which the "
+                        "mapper asks before the hash so that most absent "
+                        "k-mers cost a single cache miss; 16 lets fewer than "
+                        "1 in 500 absent k-mers through (0 disables)",
+      false, 0, "bits");
+  cmd.add(filterBits);
 	cmd.add(sharedMem);
   cmd.parse(argc, argv);
 
@@ -795,6 +1603,51 @@ int rapMapSAIndex(int argc, char* argv[]) {
   }
   rapmap::utils::my_mer::k(k);
 
+  if (fmIndex.getValue()) {
+    if (perfectHash.getValue() or flatLayout.getValue() or
+        packedText.getValue() or packedSA.getValue() or pruneSA.getValue()) {
+      std::cerr << "Error: --fm can't be combined with -p, --flat, "
+                   "--packedText, --packedSA or --pruneSA\n";
+      std::exit(1);
+    }
+    if (fmSampleRate.getValue() == 0) {
+      std::cerr << "Error: --fmSampleRate must be positive\n";
+      std::exit(1);
+    }
+  }
+
+  if (bucketMemory.getValue() > 0 and
+      (perfectHash.getValue() or flatLayout.getValue() or
+       packedSA.getValue() or fmIndex.getValue())) {
+    std::cerr << "Error: --bucketMemory can't be combined with -p, --flat, "
+                 "--packedSA or --fm\n";
+    std::exit(1);
+  }
+
+  if ((lcp.getValue() or childTable.getValue()) and
+      (fmIndex.getValue() or bucketMemory.getValue() > 0)) {
+    std::cerr << "Error: --lcp and --childTable can't be combined with --fm "
+                 "or --bucketMemory\n";
+    std::exit(1);
+  }
+
+  if ((fingerprints.getValue() or sampledSearch.getValue() > 0) and
+      (fmIndex.getValue() or bucketMemory.getValue() > 0)) {
+    std::cerr << "Error: --fingerprints and --sampledSearch can't be combined "
+                 "with --fm or --bucketMemory\n";
+    std::exit(1);
+  }
+
+  if (canonical.getValue() and (perfectHash.getValue() or fmIndex.getValue())) {
+    std::cerr << "Error: --canonical can't be combined with -p or --fm\n";
+    std::exit(1);
+  }
+
+  if (filterBits.getValue() > 0 and fmIndex.getValue()) {
+    std::cerr << "Error: --filterBits can't be combined with --fm\n";
+    std::exit(1);
+  }
+
   std::string indexDir = index.getValue();
   if (indexDir.back() != '/') {
     indexDir += '/';
@@ -824,12 +1677,27 @@ int rapMapSAIndex(int argc, char* argv[]) {
   transcriptParserPtr.reset(
 			    new single_parser(transcriptFiles, numThreads, numProd));
   transcriptParserPtr->start();
-  bool noClipPolyA = noClip.getValue();
-  bool usePerfectHash = perfectHash.getValue();
-  uint32_t numPerfectHashThreads = numHashThreads.getValue();
+  IndexOpts opts;
+  opts.noClipPolyA = noClip.getValue();
+  opts.usePerfectHash = perfectHash.getValue();
+  opts.numHashThreads = numHashThreads.getValue();
+  opts.parallelSA = parallelSA.getValue();
+  opts.sepStr = sepStr;
+  opts.flatLayout = flatLayout.getValue();
+  opts.packedText = packedText.getValue();
+  opts.packedSA = packedSA.getValue();
+  opts.fmIndex = fmIndex.getValue();
+  opts.fmSampleRate = fmSampleRate.getValue();
+  opts.pruneSA = pruneSA.getValue();
+  opts.bucketMemoryMB = bucketMemory.getValue();
+  opts.lcp = lcp.getValue() or childTable.getValue();
+  opts.childTable = childTable.getValue();
+  opts.fingerprints = fingerprints.getValue();
+  opts.sampledSearchRows = sampledSearch.getValue();
+  opts.canonicalHash = canonical.getValue();
+  opts.filterBits = filterBits.getValue();
   std::mutex iomutex;
-  indexTranscriptsSA(transcriptParserPtr.get(), indexDir, noClipPolyA,
-                     usePerfectHash, numPerfectHashThreads, sepStr, iomutex, jointLog);
+  indexTranscriptsSA(transcriptParserPtr.get(), indexDir, opts, iomutex, jointLog);
 
   // Output info about the reference
   std::ofstream refInfoStream(indexDir + "refInfo.json");
@@ -0,0 +1,164 @@
+//
+// RapMap - Rapid and accurate mapping of short reads to transcriptomes using
+// quasi-mapping.
+// Copyright (C) 2015, 2016, 2017 Rob Patro, Avi Srivastava, Hirak Sarkar
+//
+// This file is part of RapMap.
+//
+// RapMap is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RapMap is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RapMap.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include <cereal/archives/json.hpp>
+
+#include "spdlog/spdlog.h"
+
+#include "tclap/CmdLine.h"
+
+#include "BooMap.hpp"
+#include "FrugalBooMap.hpp"
+#include "IndexHeader.hpp"
+#include "RapMapConfig.hpp"
+#include "RapMapFileSystem.hpp"
+#include "RapMapSAIndex.hpp"
+#include "RapMapUtils.hpp"
+#include "SharedIndex.hpp"
+
+// Load the index in indexPrefix and publish it as memName
+template <typename RapMapIndexT>
+bool publishIndex(const std::string& indexPrefix, const std::string& memName,
+                  const IndexHeader& h) {
+  RapMapIndexT rmi;
+  rmi.load(indexPrefix);
+  return rmi.publish(memName, indexPrefix, h);
+}
+
+int rapMapSALoad(int argc, char* argv[]) {
+  std::string versionString = rapmap::version;
+  TCLAP::CmdLine cmd("RapMap Index Loader", ' ', versionString);
+  cmd.getProgramName() = "rapmap";
+
+  TCLAP::ValueArg<std::string> index("i", "index", "The location of the quasiindex to publish", false, "", "path");
+  TCLAP::ValueArg<std::string> sharedMem("y", "sharedMemory", "Name of the shared memory segment to create (or remove)", true, "", "name string");
+  TCLAP::SwitchArg remove("", "remove", "Remove the named shared memory segment rather than creating it", false);
+  cmd.add(index);
+  cmd.add(sharedMem);
+  cmd.add(remove);
+
+  auto rawConsoleSink = std::make_shared<spdlog::sinks::stderr_sink_mt>();
+  auto consoleSink =
+      std::make_shared<spdlog::sinks::ansicolor_sink>(rawConsoleSink);
+  auto consoleLog = spdlog::create("stderrLog", {consoleSink});
+
+  try {
+    cmd.parse(argc, argv);
+
+    std::string memName = sharedMem.getValue();
+    std::string err;
+    if (remove.getValue()) {
+      if (!rapmap::shm::SharedIndexSegment::remove(memName, err)) {
+        consoleLog->error("{}", err);
+        return 1;
+      }
+      consoleLog->info("Removed shared memory segment {}",
+                       rapmap::shm::segmentName(memName));
+      return 0;
+    }
+
+    if (!index.isSet()) {
+      consoleLog->error("You must provide the index (-i) to publish");
+      std::exit(1);
+    }
+
+    std::string indexPrefix(index.getValue());
+    if (indexPrefix.back() != '/') {
+      indexPrefix += "/";
+    }
+
+    if (!rapmap::fs::DirExists(indexPrefix.c_str())) {
+      consoleLog->error("It looks like the index you provided [{}] "
+                        "doesn't exist", indexPrefix);
+      std::exit(1);
+    }
+
+    IndexHeader h;
+    std::ifstream indexStream(indexPrefix + "header.json");
+    {
+      cereal::JSONInputArchive ar(indexStream);
+      ar(h);
+    }
+    indexStream.close();
+
+    if (h.indexType() != IndexType::QUASI) {
+      consoleLog->error("The index {} does not appear to be of the "
+                        "appropriate type (quasi)", indexPrefix);
+      std::exit(1);
+    }
+
+    if (h.fmIndex()) {
+      consoleLog->error("The index {} is an FM-index, which can't (yet) be "
+                        "published in shared memory", indexPrefix);
+      std::exit(1);
+    }
+
+    bool success{false};
+    if (h.packedSA()) {
+      if (h.perfectHash()) {
+        success = publishIndex<RapMapSAIndex<int64_t, PerfectHashT<uint64_t, rapmap::utils::SAInterval<int64_t>>,
+                                             rapmap::utils::PackedSA<int64_t>>>(
+            indexPrefix, memName, h);
+      } else {
+        success = publishIndex<RapMapSAIndex<int64_t,
+                                             RegHashT<uint64_t, rapmap::utils::SAInterval<int64_t>,
+                                                      rapmap::utils::KmerKeyHasher>,
+                                             rapmap::utils::PackedSA<int64_t>>>(
+            indexPrefix, memName, h);
+      }
+    } else if (h.bigSA()) {
+      if (h.perfectHash()) {
+        success = publishIndex<RapMapSAIndex<int64_t, PerfectHashT<uint64_t, rapmap::utils::SAInterval<int64_t>>>>(
+            indexPrefix, memName, h);
+      } else {
+        success = publishIndex<RapMapSAIndex<int64_t,
+                                             RegHashT<uint64_t, rapmap::utils::SAInterval<int64_t>,
+                                                      rapmap::utils::KmerKeyHasher>>>(
+            indexPrefix, memName, h);
+      }
+    } else {
+      if (h.perfectHash()) {
+        success = publishIndex<RapMapSAIndex<int32_t, PerfectHashT<uint64_t, rapmap::utils::SAInterval<int32_t>>>>(
+            indexPrefix, memName, h);
+      } else {
+        success = publishIndex<RapMapSAIndex<int32_t,
+                                             RegHashT<uint64_t, rapmap::utils::SAInterval<int32_t>,
+                                                      rapmap::utils::KmerKeyHasher>>>(
+            indexPrefix, memName, h);
+      }
+    }
+
+    if (success) {
+      consoleLog->info("Run \"rapmap quasimap -i {} -y {} ...\" to map using the "
+                       "shared index, and \"rapmap quasiload -y {} --remove\" to "
+                       "release it", indexPrefix, memName, memName);
+    }
+    return success ? 0 : 1;
+  } catch (TCLAP::ArgException& e) {
+    consoleLog->error("Exception [{}] when parsing argument {}", e.error(), e.argId());
+    return 1;
+  }
+}
@@ -75,13 +75,17 @@
 #include "SingleAlignmentFormatter.hpp"
 #include "RapMapUtils.hpp"
 #include "RapMapSAIndex.hpp"
+#include "RapMapFMIndex.hpp"
 #include "RapMapFileSystem.hpp"
 #include "RapMapConfig.hpp"
 #include "ScopedTimer.hpp"
 #include "SpinLock.hpp"
 #include "IndexHeader.hpp"
 #include "SASearcher.hpp"
+#include "FMSearcher.hpp"
 #include "SACollector.hpp"
+#include "MappingWorkspace.hpp"
+#include "AllocationCounter.hpp"
 
 //#define __TRACK_CORRECT__
 
@@ -128,9 +132,16 @@ struct MappingOpts {
     bool fuzzy{false};
     bool consistentHits{false};
     bool quiet{false};
+    // Map with the k only known at run time, even if the mapping loops are
+    // specialized for the k of the index (see mapReadsWithK)
+    bool runtimeK{false};
+    // If non-negative, count the heap allocations made while mapping the
+    // reads of each thread after its first allocWarmup reads (only in
+    // rapmap_count_allocs, see AllocationCounter.hpp)
+    int64_t allocWarmup{-1};
 };
 
-template <typename RapMapIndexT, typename MutexT>
+template <uint32_t K, typename RapMapIndexT, typename MutexT>
 void processReadsSingleSA(single_parser * parser,
                           RapMapIndexT& rmi,
                           MutexT* iomutex,
@@ -139,7 +150,10 @@ void processReadsSingleSA(single_parser * parser,
                           MappingOpts* mopts) {
     using OffsetT = typename RapMapIndexT::IndexType;
 
-    SACollector<RapMapIndexT> hitCollector(&rmi);
+    // The per-thread collector, searcher and per-read scratch
+    MappingWorkspace<RapMapIndexT, K> ws(&rmi);
+    auto& hitCollector = ws.collector;
+    auto& saSearcher = ws.searcher;
     if (mopts->sensitive) {
         hitCollector.disableNIP();
     }
@@ -156,7 +170,7 @@ void processReadsSingleSA(single_parser * parser,
 
     fmt::MemoryWriter sstream;
     size_t batchSize{2500};
-    std::vector<QuasiAlignment> hits;
+    auto& hits = ws.hits;
 
     size_t readLen{0};
 	bool tooManyHits{false};
@@ -164,9 +178,18 @@ void processReadsSingleSA(single_parser * parser,
 
     SingleAlignmentFormatter<RapMapIndexT*> formatter(&rmi);
 
-    SASearcher<RapMapIndexT> saSearcher(&rmi);
-
     uint32_t orphanStatus{0};
+    // The reads of the current chunk, and the first hit of each (whose
+    // lookups are batched across the chunk)
+    auto& readSeqs = ws.readSeqs;
+    auto& firstHits = ws.firstHits;
+    // With --countAllocs, the number of reads this thread has seen, and
+    // whether the heap allocations made while mapping (not writing out)
+    // the current chunk are counted
+    uint64_t readsSeen{0};
+    bool countAllocs{false};
+    uint64_t allocsBefore{0};
+
     // Get the read group by which this thread will
     // communicate with the parser (*once per-thread*)
     auto rg = parser->getReadGroup();
@@ -176,11 +199,19 @@ void processReadsSingleSA(single_parser * parser,
       //  typename single_parser::job j(*parser); // Get a job from the parser: a bunch of reads (at most max_read_group)
       //  if(j.is_empty()) break;                 // If we got nothing, then quit.
       //  for(size_t i = 0; i < j->nb_filled; ++i) { // For each sequence
-      for (auto& read : rg) {
+      countAllocs = (mopts->allocWarmup >= 0 and
+                     readsSeen >= static_cast<uint64_t>(mopts->allocWarmup));
+      if (countAllocs) { allocsBefore = rapmap::utils::threadAllocations(); }
+      readSeqs.clear();
+      for (auto& read : rg) { readSeqs.push_back(&read); }
+      hitCollector.findFirstHits(readSeqs, firstHits);
+      for (size_t readIdx = 0; readIdx < rg.size(); ++readIdx) {
+            auto& read = rg[readIdx];
 	    readLen = read.seq.length();//j->data[i].seq.length();
             ++hctr.numReads;
             hits.clear();
-            hitCollector(read.seq, hits, saSearcher, MateStatus::SINGLE_END, mopts->consistentHits);
+            hitCollector(read, firstHits[readIdx], hits, saSearcher,
+                         MateStatus::SINGLE_END, mopts->consistentHits);
             auto numHits = hits.size();
             hctr.totHits += numHits;
 
@@ -217,6 +248,10 @@ void processReadsSingleSA(single_parser * parser,
                 }
             }
         } // for all reads in this job
+        if (countAllocs) {
+            hctr.numAllocs += rapmap::utils::threadAllocations() - allocsBefore;
+        }
+        readsSeen += rg.size();
 
         // DUMP OUTPUT
         if (!mopts->noOutput) {
@@ -243,7 +278,7 @@ void processReadsSingleSA(single_parser * parser,
 /**
  *  Map reads from a collection of paired-end files.
  */
-template <typename RapMapIndexT, typename MutexT>
+template <uint32_t K, typename RapMapIndexT, typename MutexT>
 void processReadsPairSA(paired_parser* parser,
                         RapMapIndexT& rmi,
                         MutexT* iomutex,
@@ -252,7 +287,10 @@ void processReadsPairSA(paired_parser* parser,
                         MappingOpts* mopts) {
     using OffsetT = typename RapMapIndexT::IndexType;
 
-    SACollector<RapMapIndexT> hitCollector(&rmi);
+    // The per-thread collector, searcher and per-read scratch
+    MappingWorkspace<RapMapIndexT, K> ws(&rmi);
+    auto& hitCollector = ws.collector;
+    auto& saSearcher = ws.searcher;
     if (mopts->sensitive) {
         hitCollector.disableNIP();
     }
@@ -269,9 +307,9 @@ void processReadsPairSA(paired_parser* parser,
 
     fmt::MemoryWriter sstream;
     size_t batchSize{1000};
-    std::vector<QuasiAlignment> leftHits;
-    std::vector<QuasiAlignment> rightHits;
-    std::vector<QuasiAlignment> jointHits;
+    auto& leftHits = ws.leftHits;
+    auto& rightHits = ws.rightHits;
+    auto& jointHits = ws.jointHits;
 
     size_t readLen{0};
 	bool tooManyHits{false};
@@ -280,9 +318,19 @@ void processReadsPairSA(paired_parser* parser,
     // Create a formatter for alignments
     PairAlignmentFormatter<RapMapIndexT*> formatter(&rmi);
 
-    SASearcher<RapMapIndexT> saSearcher(&rmi);
-
     uint32_t orphanStatus{0};
+    // The mates of the current chunk (left, then right, for each pair),
+    // and the first hit of each (whose lookups are batched across the
+    // chunk)
+    auto& readSeqs = ws.readSeqs;
+    auto& firstHits = ws.firstHits;
+
+    // With --countAllocs, the number of reads this thread has seen, and
+    // whether the heap allocations made while mapping (not writing out)
+    // the current chunk are counted
+    uint64_t readsSeen{0};
+    bool countAllocs{false};
+    uint64_t allocsBefore{0};
 
     // Get the read group by which this thread will
     // communicate with the parser (*once per-thread*)
@@ -293,7 +341,17 @@ void processReadsPairSA(paired_parser* parser,
       //typename paired_parser::job j(*parser); // Get a job from the parser: a bunch of reads (at most max_read_group)
       //if(j.is_empty()) break;                 // If we got nothing, quit
       //  for(size_t i = 0; i < j->nb_filled; ++i) { // For each sequence
+      countAllocs = (mopts->allocWarmup >= 0 and
+                     readsSeen >= static_cast<uint64_t>(mopts->allocWarmup));
+      if (countAllocs) { allocsBefore = rapmap::utils::threadAllocations(); }
+      readSeqs.clear();
       for (auto& rpair : rg) {
+        readSeqs.push_back(&rpair.first);
+        readSeqs.push_back(&rpair.second);
+      }
+      hitCollector.findFirstHits(readSeqs, firstHits);
+      for (size_t pairIdx = 0; pairIdx < rg.size(); ++pairIdx) {
+        auto& rpair = rg[pairIdx];
 	tooManyHits = false;
 	    readLen = rpair.first.seq.length();
             ++hctr.numReads;
@@ -301,12 +359,12 @@ void processReadsPairSA(paired_parser* parser,
             leftHits.clear();
             rightHits.clear();
 
-            bool lh = hitCollector(rpair.first.seq,
+            bool lh = hitCollector(rpair.first, firstHits[2 * pairIdx],
                                    leftHits, saSearcher,
                                    MateStatus::PAIRED_END_LEFT,
                                    mopts->consistentHits);
 
-            bool rh = hitCollector(rpair.second.seq,
+            bool rh = hitCollector(rpair.second, firstHits[2 * pairIdx + 1],
                                    rightHits, saSearcher,
                                    MateStatus::PAIRED_END_RIGHT,
                                    mopts->consistentHits);
@@ -348,6 +406,10 @@ void processReadsPairSA(paired_parser* parser,
                 }
             }
         } // for all reads in this job
+        if (countAllocs) {
+            hctr.numAllocs += rapmap::utils::threadAllocations() - allocsBefore;
+        }
+        readsSeen += rg.size();
 
         // DUMP OUTPUT
         if (!mopts->noOutput) {
@@ -370,7 +432,7 @@ void processReadsPairSA(paired_parser* parser,
 
 }
 
-template <typename RapMapIndexT, typename MutexT>
+template <uint32_t K, typename RapMapIndexT, typename MutexT>
 bool spawnProcessReadsThreads(
                               uint32_t nthread,
                               paired_parser* parser,
@@ -383,7 +445,7 @@ bool spawnProcessReadsThreads(
             std::vector<std::thread> threads;
 
             for (size_t i = 0; i < nthread; ++i) {
-                threads.emplace_back(processReadsPairSA<RapMapIndexT, MutexT>,
+                threads.emplace_back(processReadsPairSA<K, RapMapIndexT, MutexT>,
                                      parser,
                                      std::ref(rmi),
                                      &iomutex,
@@ -396,7 +458,7 @@ bool spawnProcessReadsThreads(
             return true;
         }
 
-template <typename RapMapIndexT, typename MutexT>
+template <uint32_t K, typename RapMapIndexT, typename MutexT>
 bool spawnProcessReadsThreads(
                               uint32_t nthread,
                               single_parser* parser,
@@ -407,7 +469,7 @@ bool spawnProcessReadsThreads(
                               MappingOpts* mopts) {
             std::vector<std::thread> threads;
             for (size_t i = 0; i < nthread; ++i) {
-                threads.emplace_back(processReadsSingleSA<RapMapIndexT, MutexT>,
+                threads.emplace_back(processReadsSingleSA<K, RapMapIndexT, MutexT>,
                                      parser,
                                      std::ref(rmi),
                                      &iomutex,
@@ -419,7 +481,7 @@ bool spawnProcessReadsThreads(
             return true;
         }
 
-template <typename RapMapIndexT>
+template <uint32_t K, typename RapMapIndexT>
 bool mapReads(RapMapIndexT& rmi,
 	      std::shared_ptr<spdlog::logger> consoleLog,
           MappingOpts* mopts) {
@@ -476,8 +538,10 @@ bool mapReads(RapMapIndexT& rmi,
 
 	    uint32_t nprod = (read1Vec.size() > 1) ? 2 : 1; 
 	    pairParserPtr.reset(new paired_parser(read1Vec, read2Vec, nthread, nprod, chunkSize));
+	    // the reads are 2-bit encoded by the parsing threads
+	    pairParserPtr->encodeReads(true);
 	    pairParserPtr->start();
-            spawnProcessReadsThreads(nthread, pairParserPtr.get(), rmi, iomutex,
+            spawnProcessReadsThreads<K>(nthread, pairParserPtr.get(), rmi, iomutex,
                                      outLog, hctrs, mopts);
         } else {
             std::vector<std::string> unmatedReadVec = rapmap::utils::tokenize(mopts->unmatedReads, ',');
@@ -485,9 +549,11 @@ bool mapReads(RapMapIndexT& rmi,
 
 	    uint32_t nprod = (unmatedReadVec.size() > 1) ? 2 : 1; 
 	    singleParserPtr.reset(new single_parser(unmatedReadVec, nthread, nprod, chunkSize));
+	    // the reads are 2-bit encoded by the parsing threads
+	    singleParserPtr->encodeReads(true);
 	    singleParserPtr->start();
             /** Create the threads depending on the collector type **/
-            spawnProcessReadsThreads(nthread, singleParserPtr.get(), rmi, iomutex,
+            spawnProcessReadsThreads<K>(nthread, singleParserPtr.get(), rmi, iomutex,
                                       outLog, hctrs, mopts);
         }
 	if (!mopts->quiet) { std::cerr << "\n\n"; }
@@ -496,6 +562,10 @@ bool mapReads(RapMapIndexT& rmi,
     consoleLog->info("Done mapping reads.");
     consoleLog->info("In total saw {} reads.", hctrs.numReads);
     consoleLog->info("Final # hits per read = {}", hctrs.totHits / static_cast<float>(hctrs.numReads));
+    if (mopts->allocWarmup >= 0) {
+        consoleLog->info("heap allocations while mapping reads (after the first {} reads of each thread): {}",
+                         mopts->allocWarmup, hctrs.numAllocs);
+    }
 	consoleLog->info("flushing output queue.");
 	outLog->flush();
 	/*
@@ -511,6 +581,28 @@ bool mapReads(RapMapIndexT& rmi,
 	return true;
 }
 
+/**
+ * Map the reads with the collector and searcher specialized for the k of
+ * the index (set by loadIndex) if it is one of the common ones, so that
+ * the k-mer masks and shifts in the inner loops are constants, and with
+ * the k only known at run time otherwise (or if --runtimeK is given).
+ */
+template <typename RapMapIndexT>
+bool mapReadsWithK(RapMapIndexT& rmi,
+                   std::shared_ptr<spdlog::logger> consoleLog,
+                   MappingOpts* mopts) {
+    if (mopts->runtimeK) {
+        return mapReads<0>(rmi, consoleLog, mopts);
+    }
+    switch (rapmap::utils::my_mer::k()) {
+        case 19: return mapReads<19>(rmi, consoleLog, mopts);
+        case 23: return mapReads<23>(rmi, consoleLog, mopts);
+        case 25: return mapReads<25>(rmi, consoleLog, mopts);
+        case 31: return mapReads<31>(rmi, consoleLog, mopts);
+        default: return mapReads<0>(rmi, consoleLog, mopts);
+    }
+}
+
 void displayOpts(MappingOpts& mopts, spdlog::logger* log) {
         fmt::MemoryWriter optWriter;
         optWriter.write("\ncommand line options\n"
@@ -536,6 +628,22 @@ void displayOpts(MappingOpts& mopts, spdlog::logger* log) {
 }
 
 
+// Load the index from disk, or attach to the shared memory segment
+// memName if one was given.
+template <typename RapMapIndexT>
+void loadIndex(RapMapIndexT& rmi, const std::string& indexPrefix,
+               const std::string& memName, const IndexHeader& h,
+               uint32_t numThreads) {
+    if (memName.empty()) {
+        // Loading is I/O bound, so use at least a few threads
+        rmi.load(indexPrefix, std::max(numThreads, 4u));
+    } else if (!rmi.attach(memName, h)) {
+        auto logger = spdlog::get("stderrLog");
+        logger->error("Couldn't attach to the shared index {}", memName);
+        std::exit(1);
+    }
+}
+
 int rapMapSAMap(int argc, char* argv[]) {
   std::string versionString = rapmap::version;
   TCLAP::CmdLine cmd(
@@ -552,13 +660,17 @@ int rapMapSAMap(int argc, char* argv[]) {
   TCLAP::ValueArg<uint32_t> maxNumHits("m", "maxNumHits", "Reads mapping to more than this many loci are discarded", false, 200, "positive integer");
   TCLAP::ValueArg<std::string> outname("o", "output", "The output file (default: stdout)", false, "", "path");
   TCLAP::ValueArg<double> quasiCov("z", "quasiCoverage", "Require that this fraction of a read is covered by MMPs before it is considered mappable.", false, 0.0, "double in [0,1]");
-	TCLAP::ValueArg<std::string> sharedMem("y", "sharedMemory", "Name of shared memory location", false, "", "name string");
+  TCLAP::ValueArg<std::string> sharedMem("y", "sharedMemory", "Attach to the index published in this shared memory segment (by \"rapmap quasiload\") rather than loading it from disk", false, "", "name string");
   TCLAP::SwitchArg noout("n", "noOutput", "Don't write out any alignments (for speed testing purposes)", false);
   TCLAP::SwitchArg sensitive("e", "sensitive", "Perform a more sensitive quasi-mapping by disabling NIP skipping", false);
   TCLAP::SwitchArg noStrict("", "noStrictCheck", "Don't perform extra checks to try and assure that only equally \"best\" mappings for a read are reported", false);
   TCLAP::SwitchArg fuzzy("f", "fuzzyIntersection", "Find paired-end mapping locations using fuzzy intersection", false);
   TCLAP::SwitchArg consistent("c", "consistentHits", "Ensure that the hits collected are consistent (co-linear)", false);
   TCLAP::SwitchArg quiet("q", "quiet", "Disable all console output apart from warnings and errors", false);
+  TCLAP::SwitchArg runtimeK("", "runtimeK", "Use the mapping code that takes the k-mer length at run time, even if there is a version specialized for the k of the index (the mappings are the same; for testing purposes)", false);
+#ifdef RAPMAP_COUNT_ALLOCS
+  TCLAP::ValueArg<int64_t> countAllocs("", "countAllocs", "Count (and report) the heap allocations made while mapping the reads, skipping the first this many reads (or pairs) of each thread (for testing purposes)", false, -1, "non-negative integer");
+#endif // RAPMAP_COUNT_ALLOCS
   cmd.add(index);
   cmd.add(noout);
 
@@ -574,7 +686,11 @@ int rapMapSAMap(int argc, char* argv[]) {
   cmd.add(fuzzy);
   cmd.add(consistent);
   cmd.add(quiet);
-	cmd.add(sharedMem);
+  cmd.add(runtimeK);
+  cmd.add(sharedMem);
+#ifdef RAPMAP_COUNT_ALLOCS
+  cmd.add(countAllocs);
+#endif // RAPMAP_COUNT_ALLOCS
   
   auto rawConsoleSink = std::make_shared<spdlog::sinks::stderr_sink_mt>();
   auto consoleSink =
@@ -585,9 +701,7 @@ int rapMapSAMap(int argc, char* argv[]) {
 
     cmd.parse(argc, argv);
 
-	//test shared mem command
-	std::string memName=sharedMem.getValue();
-	//std::cerr<<"The shared memory location name is "<<memName<<'\n';
+    std::string memName = sharedMem.getValue();
 
     // If we're supposed to be quiet, only print out warnings and above
     if (quiet.getValue()) {
@@ -643,6 +757,10 @@ int rapMapSAMap(int argc, char* argv[]) {
     mopts.consistentHits = consistent.getValue();
     mopts.fuzzy = fuzzy.getValue();
     mopts.quiet = quiet.getValue();
+    mopts.runtimeK = runtimeK.getValue();
+#ifdef RAPMAP_COUNT_ALLOCS
+    mopts.allocWarmup = countAllocs.getValue();
+#endif // RAPMAP_COUNT_ALLOCS
 
     if (quasiCov.isSet() and !sensitive.isSet()) {
         consoleLog->info("The --quasiCoverage option is set to {}, but the --sensitive flag was not set. The former implies the later. Enabling sensitive mode.", quasiCov.getValue());
@@ -669,20 +787,50 @@ int rapMapSAMap(int argc, char* argv[]) {
     //std::unique_ptr<RapMapSAIndex<int64_t>> BigSAIdxPtr{nullptr};
 
     bool success{false};
-    if (h.bigSA()) {
+    if (h.fmIndex()) {
+      // An FM-index is only built with the regular hash
+      if (h.bigSA()) {
+          RapMapFMIndex<int64_t,
+                        RegHashT<uint64_t, rapmap::utils::SAInterval<int64_t>,
+                                               rapmap::utils::KmerKeyHasher>> rmi;
+          loadIndex(rmi, indexPrefix, memName, h, mopts.numThreads);
+          success = mapReadsWithK(rmi, consoleLog, &mopts);
+      } else {
+          RapMapFMIndex<int32_t,
+                        RegHashT<uint64_t, rapmap::utils::SAInterval<int32_t>,
+                                               rapmap::utils::KmerKeyHasher>> rmi;
+          loadIndex(rmi, indexPrefix, memName, h, mopts.numThreads);
+          success = mapReadsWithK(rmi, consoleLog, &mopts);
+      }
+    } else if (h.packedSA()) {
+      // A bit-packed suffix array always presents 64-bit offsets
+      if (h.perfectHash()) {
+          RapMapSAIndex<int64_t, PerfectHashT<uint64_t, rapmap::utils::SAInterval<int64_t>>,
+                        rapmap::utils::PackedSA<int64_t>> rmi;
+          loadIndex(rmi, indexPrefix, memName, h, mopts.numThreads);
+          success = mapReadsWithK(rmi, consoleLog, &mopts);
+      } else {
+          RapMapSAIndex<int64_t,
+                        RegHashT<uint64_t, rapmap::utils::SAInterval<int64_t>,
+                                               rapmap::utils::KmerKeyHasher>,
+                        rapmap::utils::PackedSA<int64_t>> rmi;
+          loadIndex(rmi, indexPrefix, memName, h, mopts.numThreads);
+          success = mapReadsWithK(rmi, consoleLog, &mopts);
+      }
+    } else if (h.bigSA()) {
         //std::cerr << "Loading 64-bit suffix array index: \n";
       //BigSAIdxPtr.reset(new RapMapSAIndex<int64_t>);
       //BigSAIdxPtr->load(indexPrefix, h.kmerLen());
       if (h.perfectHash()) {
           RapMapSAIndex<int64_t, PerfectHashT<uint64_t, rapmap::utils::SAInterval<int64_t>>> rmi;
-          rmi.load(indexPrefix);
-          success = mapReads(rmi, consoleLog, &mopts);
+          loadIndex(rmi, indexPrefix, memName, h, mopts.numThreads);
+          success = mapReadsWithK(rmi, consoleLog, &mopts);
       } else {
           RapMapSAIndex<int64_t,
                         RegHashT<uint64_t, rapmap::utils::SAInterval<int64_t>,
                                                rapmap::utils::KmerKeyHasher>> rmi;
-          rmi.load(indexPrefix);
-          success = mapReads(rmi, consoleLog, &mopts);
+          loadIndex(rmi, indexPrefix, memName, h, mopts.numThreads);
+          success = mapReadsWithK(rmi, consoleLog, &mopts);
       }
     } else {
         //std::cerr << "Loading 32-bit suffix array index: \n";
@@ -690,14 +838,14 @@ int rapMapSAMap(int argc, char* argv[]) {
       //SAIdxPtr->load(indexPrefix, h.kmerLen());
         if (h.perfectHash()) {
             RapMapSAIndex<int32_t, PerfectHashT<uint64_t, rapmap::utils::SAInterval<int32_t>>> rmi;
-            rmi.load(indexPrefix);
-            success = mapReads(rmi, consoleLog, &mopts);
+            loadIndex(rmi, indexPrefix, memName, h, mopts.numThreads);
+            success = mapReadsWithK(rmi, consoleLog, &mopts);
         } else {
             RapMapSAIndex<int32_t,
                           RegHashT<uint64_t, rapmap::utils::SAInterval<int32_t>,
                                                  rapmap::utils::KmerKeyHasher>> rmi;
-            rmi.load(indexPrefix);
-            success = mapReads(rmi, consoleLog, &mopts);
+            loadIndex(rmi, indexPrefix, memName, h, mopts.numThreads);
+            success = mapReadsWithK(rmi, consoleLog, &mopts);
         }
     }
 
@@ -25,6 +25,7 @@
 
 #include "RapMapUtils.hpp"
 #include "RapMapSAIndex.hpp"
+#include "RapMapFMIndex.hpp"
 #include "RapMapIndex.hpp"
 #include "PairAlignmentFormatter.hpp"
 #include "SingleAlignmentFormatter.hpp"
@@ -35,6 +36,19 @@
 
 namespace rapmap {
     namespace utils {
+        // The NH tag of every record of a read (or pair) with numHits
+        // alignments.  It's streamed into the output along with each
+        // record, rather than formatted into a string of its own for
+        // each read, so that writing the records allocates nothing.
+        struct NumHitsTag {
+            size_t numHits;
+        };
+
+        inline fmt::Writer& operator<<(fmt::Writer& w, const NumHitsTag& tag) {
+            w << "NH:i:" << tag.numHits;
+            return w;
+        }
+
         std::vector<std::string> tokenize(const std::string &s, char delim) {
             std::stringstream ss(s);
             std::string item;
@@ -165,7 +179,7 @@ namespace rapmap {
                 }
 
 
-                std::string numHitFlag = fmt::format("NH:i:{}", hits.size());
+                NumHitsTag numHits{hits.size()};
                 uint32_t alnCtr{0};
                 bool haveRev{false};
                 for (auto& qa : hits) {
@@ -201,7 +215,7 @@ namespace rapmap {
                         << qa.fragLen << '\t' // TLEN
                         << *readSeq << '\t' // SEQ
                         << "*\t" // QSTR
-                        << numHitFlag << '\n';
+                        << numHits << '\n';
                     ++alnCtr;
                     // === SAM
 #if defined(__DEBUG__) || defined(__TRACK_CORRECT__)
@@ -275,7 +289,7 @@ namespace rapmap {
                 }
                 */
 
-                std::string numHitFlag = fmt::format("NH:i:{}", jointHits.size());
+                NumHitsTag numHits{jointHits.size()};
                 uint32_t alnCtr{0};
 				uint32_t trueHitCtr{0};
 				QuasiAlignment* firstTrueHit{nullptr};
@@ -344,7 +358,7 @@ namespace rapmap {
                                 << ((read1First) ? fragLen : -fragLen) << '\t' // TLEN
                                 << *readSeq1 << '\t' // SEQ
                                 << "*\t" // QUAL
-                                << numHitFlag << '\n';
+                                << numHits << '\n';
 
                         sstream << mateName.c_str() << '\t' // QNAME
                                 << flags2 << '\t' // FLAGS
@@ -357,7 +371,7 @@ namespace rapmap {
                                 << ((read1First) ? -fragLen : fragLen) << '\t' // TLEN
                                 << *readSeq2 << '\t' // SEQ
                                 << "*\t" // QUAL
-                                << numHitFlag << '\n';
+                                << numHits << '\n';
                     } else {
                         rapmap::utils::getSamFlags(qa, true, flags1, flags2);
                         if (alnCtr != 0) {
@@ -455,7 +469,7 @@ namespace rapmap {
                                 << 0 << '\t' // TLEN (spec says 0, not read len)
                                 << *readSeq << '\t' // SEQ
                                 << "*\t" // QUAL
-                                << numHitFlag << '\n';
+                                << numHits << '\n';
 
 
                         // Output the info for the unaligned mate.
@@ -470,7 +484,7 @@ namespace rapmap {
                             << 0 << '\t' // TLEN (spec says 0, not read len)
                             << *unalignedSeq << '\t' // SEQ
                             << "*\t" // QUAL
-                            << numHitFlag << '\n';
+                            << numHits << '\n';
                     }
                     ++alnCtr;
                     // == SAM
@@ -529,6 +543,15 @@ using SAIndex64BitDense = RapMapSAIndex<int64_t, RegHashT<uint64_t, rapmap::util
 								       rapmap::utils::KmerKeyHasher>>;
 using SAIndex32BitPerfect = RapMapSAIndex<int32_t, PerfectHashT<uint64_t, rapmap::utils::SAInterval<int32_t>>>;
 using SAIndex64BitPerfect = RapMapSAIndex<int64_t, PerfectHashT<uint64_t, rapmap::utils::SAInterval<int64_t>>>;
+using SAIndexPackedDense = RapMapSAIndex<int64_t, RegHashT<uint64_t, rapmap::utils::SAInterval<int64_t>,
+								       rapmap::utils::KmerKeyHasher>,
+                                         rapmap::utils::PackedSA<int64_t>>;
+using SAIndexPackedPerfect = RapMapSAIndex<int64_t, PerfectHashT<uint64_t, rapmap::utils::SAInterval<int64_t>>,
+                                           rapmap::utils::PackedSA<int64_t>>;
+using FMIndex32BitDense = RapMapFMIndex<int32_t, RegHashT<uint64_t, rapmap::utils::SAInterval<int32_t>,
+								       rapmap::utils::KmerKeyHasher>>;
+using FMIndex64BitDense = RapMapFMIndex<int64_t, RegHashT<uint64_t, rapmap::utils::SAInterval<int64_t>,
+								       rapmap::utils::KmerKeyHasher>>;
 
 // Explicit instantiations
 // pair parser, 32-bit, dense hash
@@ -596,6 +619,70 @@ template uint32_t rapmap::utils::writeAlignmentsToStream<fastx_parser::ReadSeq,
                 std::vector<rapmap::utils::QuasiAlignment>& jointHits,
                 fmt::MemoryWriter& sstream);
 
+// pair parser, packed SA, dense hash
+template uint32_t rapmap::utils::writeAlignmentsToStream<fastx_parser::ReadPair, SAIndexPackedDense*>(
+                fastx_parser::ReadPair& r,
+                PairAlignmentFormatter<SAIndexPackedDense*>& formatter,
+                rapmap::utils::HitCounters& hctr,
+                std::vector<rapmap::utils::QuasiAlignment>& jointHits,
+                fmt::MemoryWriter& sstream);
+
+// pair parser, packed SA, perfect hash
+template uint32_t rapmap::utils::writeAlignmentsToStream<fastx_parser::ReadPair, SAIndexPackedPerfect*>(
+                fastx_parser::ReadPair& r,
+                PairAlignmentFormatter<SAIndexPackedPerfect*>& formatter,
+                rapmap::utils::HitCounters& hctr,
+                std::vector<rapmap::utils::QuasiAlignment>& jointHits,
+                fmt::MemoryWriter& sstream);
+
+// single parser, packed SA, dense hash
+template uint32_t rapmap::utils::writeAlignmentsToStream<fastx_parser::ReadSeq, SAIndexPackedDense*>(
+                fastx_parser::ReadSeq& r,
+                SingleAlignmentFormatter<SAIndexPackedDense*>& formatter,
+                rapmap::utils::HitCounters& hctr,
+                std::vector<rapmap::utils::QuasiAlignment>& jointHits,
+                fmt::MemoryWriter& sstream);
+
+// single parser, packed SA, perfect hash
+template uint32_t rapmap::utils::writeAlignmentsToStream<fastx_parser::ReadSeq, SAIndexPackedPerfect*>(
+                fastx_parser::ReadSeq& r,
+                SingleAlignmentFormatter<SAIndexPackedPerfect*>& formatter,
+                rapmap::utils::HitCounters& hctr,
+                std::vector<rapmap::utils::QuasiAlignment>& jointHits,
+                fmt::MemoryWriter& sstream);
+
+// pair parser, 32-bit FM-index, dense hash
+template uint32_t rapmap::utils::writeAlignmentsToStream<fastx_parser::ReadPair, FMIndex32BitDense*>(
+                fastx_parser::ReadPair& r,
+                PairAlignmentFormatter<FMIndex32BitDense*>& formatter,
+                rapmap::utils::HitCounters& hctr,
+                std::vector<rapmap::utils::QuasiAlignment>& jointHits,
+                fmt::MemoryWriter& sstream);
+
+// pair parser, 64-bit FM-index, dense hash
+template uint32_t rapmap::utils::writeAlignmentsToStream<fastx_parser::ReadPair, FMIndex64BitDense*>(
+                fastx_parser::ReadPair& r,
+                PairAlignmentFormatter<FMIndex64BitDense*>& formatter,
+                rapmap::utils::HitCounters& hctr,
+                std::vector<rapmap::utils::QuasiAlignment>& jointHits,
+                fmt::MemoryWriter& sstream);
+
+// single parser, 32-bit FM-index, dense hash
+template uint32_t rapmap::utils::writeAlignmentsToStream<fastx_parser::ReadSeq, FMIndex32BitDense*>(
+                fastx_parser::ReadSeq& r,
+                SingleAlignmentFormatter<FMIndex32BitDense*>& formatter,
+                rapmap::utils::HitCounters& hctr,
+                std::vector<rapmap::utils::QuasiAlignment>& jointHits,
+                fmt::MemoryWriter& sstream);
+
+// single parser, 64-bit FM-index, dense hash
+template uint32_t rapmap::utils::writeAlignmentsToStream<fastx_parser::ReadSeq, FMIndex64BitDense*>(
+                fastx_parser::ReadSeq& r,
+                SingleAlignmentFormatter<FMIndex64BitDense*>& formatter,
+                rapmap::utils::HitCounters& hctr,
+                std::vector<rapmap::utils::QuasiAlignment>& jointHits,
+                fmt::MemoryWriter& sstream);
+
 
 template uint32_t rapmap::utils::writeAlignmentsToStream<fastx_parser::ReadPair, RapMapIndex*>(
                 fastx_parser::ReadPair& r,
@@ -0,0 +1,177 @@
+//
+// RapMap - Rapid and accurate mapping of short reads to transcriptomes using
+// quasi-mapping.
+// Copyright (C) 2015, 2016, 2017 Rob Patro, Avi Srivastava, Hirak Sarkar
+//
+// This file is part of RapMap.
+//
+// RapMap is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RapMap is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RapMap.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "SharedIndex.hpp"
+#include "FlatIndex.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace rapmap {
+namespace shm {
+
+inline uint64_t alignUp(uint64_t x, uint64_t a) { return ((x + a - 1) / a) * a; }
+
+std::string segmentName(const std::string& name) {
+  return (!name.empty() and name.front() == '/') ? name : "/" + name;
+}
+
+SharedIndexSegment::SharedIndexSegment() : base_(nullptr), len_(0) {}
+
+SharedIndexSegment::~SharedIndexSegment() {
+  if (base_ != nullptr) {
+    munmap(base_, len_);
+  }
+}
+
+bool SharedIndexSegment::create(const std::string& name, uint64_t bytes,
+                                std::string& err) {
+  auto shmName = segmentName(name);
+  int fd = shm_open(shmName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (fd < 0) {
+    err = (errno == EEXIST)
+              ? "shared memory segment " + shmName +
+                    " already exists; remove it first"
+              : "could not create shared memory segment " + shmName + " (" +
+                    std::strerror(errno) + ")";
+    return false;
+  }
+  if (ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+    err = "could not resize shared memory segment " + shmName + " to " +
+          std::to_string(bytes) + " bytes (" + std::strerror(errno) + ")";
+    ::close(fd);
+    shm_unlink(shmName.c_str());
+    return false;
+  }
+  void* addr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    err = "could not map shared memory segment " + shmName;
+    shm_unlink(shmName.c_str());
+    return false;
+  }
+  base_ = static_cast<char*>(addr);
+  len_ = bytes;
+  return true;
+}
+
+bool SharedIndexSegment::open(const std::string& name, std::string& err) {
+  auto shmName = segmentName(name);
+  int fd = shm_open(shmName.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    err = "could not open shared memory segment " + shmName +
+          "; was it published with \"rapmap quasiload\"?";
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 or
+      st.st_size < static_cast<off_t>(sizeof(SharedIndexPreamble))) {
+    ::close(fd);
+    err = "shared memory segment " + shmName + " is too small";
+    return false;
+  }
+  len_ = static_cast<uint64_t>(st.st_size);
+  void* addr = mmap(nullptr, len_, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    err = "could not map shared memory segment " + shmName;
+    return false;
+  }
+  base_ = static_cast<char*>(addr);
+
+  auto p = preamble();
+  if (std::memcmp(p->magic, kShmMagic, sizeof(kShmMagic)) != 0) {
+    err = "shared memory segment " + shmName +
+          " does not hold a (completely published) RapMap index";
+    return false;
+  }
+  if (p->version != kShmLayoutVersion) {
+    err = "shared memory segment " + shmName + " has layout version " +
+          std::to_string(p->version) + " (expected " +
+          std::to_string(kShmLayoutVersion) + "); please re-publish it";
+    return false;
+  }
+  if (p->totalBytes != len_ or p->flat.offset + p->flat.bytes > len_ or
+      p->numHashParts > kMaxHashParts) {
+    err = "shared memory segment " + shmName + " is corrupt";
+    return false;
+  }
+  for (uint32_t i = 0; i < p->numHashParts; ++i) {
+    if (p->hashParts[i].offset + p->hashParts[i].bytes > len_) {
+      err = "shared memory segment " + shmName + " is corrupt";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SharedIndexSegment::remove(const std::string& name, std::string& err) {
+  auto shmName = segmentName(name);
+  if (shm_unlink(shmName.c_str()) != 0) {
+    err = "could not remove shared memory segment " + shmName + " (" +
+          std::strerror(errno) + ")";
+    return false;
+  }
+  return true;
+}
+
+void layoutSegment(SharedIndexPreamble& p, uint64_t flatBytes,
+                   const std::vector<uint64_t>& hashPartBytes) {
+  const uint64_t pageSize = rapmap::flat::kFlatPageSize;
+  uint64_t offset = alignUp(sizeof(SharedIndexPreamble), pageSize);
+  p.flat.offset = offset;
+  p.flat.bytes = flatBytes;
+  offset = alignUp(offset + flatBytes, pageSize);
+  p.numHashParts = static_cast<uint32_t>(hashPartBytes.size());
+  for (size_t i = 0; i < hashPartBytes.size(); ++i) {
+    p.hashParts[i].offset = offset;
+    p.hashParts[i].bytes = hashPartBytes[i];
+    offset = alignUp(offset + hashPartBytes[i], pageSize);
+  }
+  p.totalBytes = offset;
+}
+
+bool fileBytes(const std::string& fname, uint64_t& bytes) {
+  struct stat st;
+  if (stat(fname.c_str(), &st) != 0) {
+    return false;
+  }
+  bytes = static_cast<uint64_t>(st.st_size);
+  return true;
+}
+
+bool readFileInto(const std::string& fname, char* dst, uint64_t bytes) {
+  std::ifstream ifile(fname, std::ios::binary);
+  if (!ifile.is_open()) {
+    return false;
+  }
+  ifile.read(dst, bytes);
+  return !ifile.fail();
+}
+
+} // namespace shm
+} // namespace rapmap